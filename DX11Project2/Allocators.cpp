@@ -0,0 +1,137 @@
+//***************************************************************************************
+// Allocators.cpp
+//***************************************************************************************
+
+#include "Allocators.h"
+#include <atomic>
+#include <cstdlib>
+
+#pragma region AllocationCounter
+namespace
+{
+    std::atomic<UINT64> g_AllocationCount(0);
+    std::atomic<UINT64> g_AllocationBytes(0);
+}
+
+UINT64 AllocationCounter::GetCount()
+{
+    return g_AllocationCount;
+}
+
+UINT64 AllocationCounter::GetBytes()
+{
+    return g_AllocationBytes;
+}
+
+#if defined(DEBUG) | defined(_DEBUG)
+// The replaced global operators count and forward to malloc.  Release builds
+// keep the CRT's.
+void* operator new(size_t size)
+{
+    ++g_AllocationCount;
+    g_AllocationBytes += size;
+
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+    ++g_AllocationCount;
+    g_AllocationBytes += size;
+    return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) throw()
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* p) throw()
+{
+    free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw()
+{
+    free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+    free(p);
+}
+#endif
+#pragma endregion
+
+#pragma region FrameArena
+FrameArena::FrameArena(UINT capacity)
+:   m_Block(new BYTE[capacity]),
+    m_Capacity(capacity),
+    m_Offset(0),
+    m_HighWater(0),
+    m_OverflowBytes(0)
+{
+}
+
+FrameArena::~FrameArena()
+{
+    for (BYTE* overflow : m_Overflow)
+        delete[] overflow;
+    delete[] m_Block;
+}
+
+void* FrameArena::Allocate(UINT bytes, UINT alignment)
+{
+    UINT_PTR base = (UINT_PTR)m_Block;
+    UINT_PTR aligned = (base + m_Offset + alignment - 1) & ~(UINT_PTR)(alignment - 1);
+    UINT end = (UINT)(aligned - base) + bytes;
+
+    if (end <= m_Capacity)
+    {
+        m_Offset = end;
+        if (GetUsed() > m_HighWater)
+            m_HighWater = GetUsed();
+        return (void*)aligned;
+    }
+
+    // Out of room: borrow from the heap until the next Reset grows the block.
+    BYTE* overflow = new BYTE[bytes + alignment];
+    m_Overflow.push_back(overflow);
+    m_OverflowBytes += bytes;
+    if (GetUsed() > m_HighWater)
+        m_HighWater = GetUsed();
+
+    return (void*)(((UINT_PTR)overflow + alignment - 1) & ~(UINT_PTR)(alignment - 1));
+}
+
+void FrameArena::Reset()
+{
+    if (!m_Overflow.empty())
+    {
+        for (BYTE* overflow : m_Overflow)
+            delete[] overflow;
+        m_Overflow.clear();
+
+        // Room for the largest frame so far and then some.
+        delete[] m_Block;
+        m_Capacity = m_HighWater + m_HighWater / 2;
+        m_Block = new BYTE[m_Capacity];
+    }
+
+    m_Offset = 0;
+    m_OverflowBytes = 0;
+}
+#pragma endregion
@@ -0,0 +1,197 @@
+//***************************************************************************************
+// Allocators.h
+//
+// Memory that does not come from the general heap once the scene is running.
+//
+// AllocationCounter counts every call of the global operator new, which
+// Allocators.cpp replaces in debug builds, so the main loop can check that a
+// steady-state frame does not touch the heap.  Release builds keep the CRT's
+// operators and count nothing.
+//
+// FrameArena hands out memory for data that lives one frame: allocation bumps
+// an offset, Reset at the start of the next frame takes everything back.  A
+// frame that outgrows the block borrows from the heap and the block is resized
+// to fit at the following Reset.  ArenaAllocator puts standard containers on it.
+// The arena belongs to the main thread.
+//
+// ObjectPool keeps objects of one type in chunks with a free list; Clear
+// destroys whatever is still alive and frees the chunks at once.
+//***************************************************************************************
+
+#ifndef ALLOCATORS_H
+#define ALLOCATORS_H
+
+#include <windows.h>
+#include <cassert>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace AllocationCounter
+{
+    // Calls of the global operator new, and the bytes they asked for, since startup.
+    UINT64  GetCount();
+    UINT64  GetBytes();
+}
+
+class FrameArena
+{
+public:
+    static FrameArena* getInstance()
+    {
+        static FrameArena frameArena(1 << 20);
+        return &frameArena;
+    }
+
+    explicit FrameArena(UINT capacity);
+    ~FrameArena();
+
+    // 'alignment' is a power of two.
+    void*   Allocate(UINT bytes, UINT alignment = 16);
+
+    template <typename T>
+    T*      AllocateArray(UINT count)   { return static_cast<T*>(Allocate(sizeof(T) * count, __alignof(T))); }
+
+    // Everything allocated since the last Reset is gone.
+    void    Reset();
+
+    UINT    GetCapacity() const         { return m_Capacity; }
+    UINT    GetUsed() const             { return m_Offset + m_OverflowBytes; }
+    UINT    GetHighWater() const        { return m_HighWater; }
+
+public:
+    FrameArena(const FrameArena& rhs)               = delete;
+    FrameArena& operator=(const FrameArena& rhs)    = delete;
+
+private:
+    BYTE*               m_Block;
+    UINT                m_Capacity;
+    UINT                m_Offset;
+    UINT                m_HighWater;
+
+    std::vector<BYTE*>  m_Overflow;             // heap blocks borrowed this frame
+    UINT                m_OverflowBytes;
+};
+
+// Standard allocator on the frame arena; deallocate is a no-op.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind { typedef ArenaAllocator<U> other; };
+
+    explicit ArenaAllocator(FrameArena* arena = FrameArena::getInstance()) : m_Arena(arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& rhs) : m_Arena(rhs.GetArena()) {}
+
+    T*          allocate(size_t count)          { return m_Arena->AllocateArray<T>((UINT)count); }
+    void        deallocate(T*, size_t)          {}
+
+    FrameArena* GetArena() const                { return m_Arena; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& rhs) const { return m_Arena == rhs.GetArena(); }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& rhs) const { return m_Arena != rhs.GetArena(); }
+
+private:
+    FrameArena* m_Arena;
+};
+
+template <typename T>
+class ObjectPool
+{
+public:
+    explicit ObjectPool(UINT chunkSize = 64)
+    :   m_ChunkSize(chunkSize), m_FreeList(nullptr), m_LiveCount(0)
+    {
+    }
+
+    ~ObjectPool()
+    {
+        Clear();
+    }
+
+    T* Create()
+    {
+        if (!m_FreeList)
+            AddChunk();
+
+        Slot* slot = m_FreeList;
+        m_FreeList = slot->Next;
+        slot->Live = true;
+        ++m_LiveCount;
+        return new (&slot->Storage) T();
+    }
+
+    void Destroy(T* object)
+    {
+        if (!object)
+            return;
+
+        // The object sits at the start of its slot.
+        Slot* slot = reinterpret_cast<Slot*>(object);
+        assert(slot->Live);
+        object->~T();
+        slot->Live = false;
+        slot->Next = m_FreeList;
+        m_FreeList = slot;
+        --m_LiveCount;
+    }
+
+    // Destroys the live objects and frees every chunk.
+    void Clear()
+    {
+        for (Slot* chunk : m_Chunks)
+        {
+            for (UINT i = 0; i < m_ChunkSize; ++i)
+            {
+                if (chunk[i].Live)
+                    reinterpret_cast<T*>(&chunk[i].Storage)->~T();
+            }
+            delete[] chunk;
+        }
+        m_Chunks.clear();
+        m_FreeList = nullptr;
+        m_LiveCount = 0;
+    }
+
+    UINT    GetLiveCount() const    { return m_LiveCount; }
+    UINT    GetCapacity() const     { return (UINT)m_Chunks.size() * m_ChunkSize; }
+
+public:
+    ObjectPool(const ObjectPool& rhs)               = delete;
+    ObjectPool& operator=(const ObjectPool& rhs)    = delete;
+
+private:
+    struct Slot
+    {
+        typename std::aligned_storage<sizeof(T), __alignof(T)>::type Storage;
+        Slot*   Next;
+        bool    Live;
+    };
+
+    void AddChunk()
+    {
+        Slot* chunk = new Slot[m_ChunkSize];
+        for (UINT i = 0; i < m_ChunkSize; ++i)
+        {
+            chunk[i].Next = i + 1 < m_ChunkSize ? &chunk[i + 1] : m_FreeList;
+            chunk[i].Live = false;
+        }
+        m_FreeList = chunk;
+        m_Chunks.push_back(chunk);
+    }
+
+private:
+    UINT                m_ChunkSize;
+    std::vector<Slot*>  m_Chunks;
+    Slot*               m_FreeList;
+    UINT                m_LiveCount;
+};
+
+#endif // ALLOCATORS_H
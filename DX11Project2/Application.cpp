@@ -1,11 +1,30 @@
 #include "Application.h"
 #include "InputManager.h"
 #include "D3DManager.h"
+#include "ConstantBuffers.h"
+#include "FrameConstants.h"
+#include "ClusteredLighting.h"
+#include "CascadedShadows.h"
+#include "OcclusionCulling.h"
+#include "MeshAsset.h"
+#include "Allocators.h"
+#include "CollisionWorld.h"
+#include "Terrain.h"
+#include "TextureCompressor.h"
+#include "AssetArchive.h"
+#include "Random.h"
 #include <WindowsX.h>
+#include <shellapi.h>
+#include <mmsystem.h>
+
+#pragma comment( lib, "winmm.lib" )
 
 namespace
 {
     Application* g_App = nullptr;
+
+    // Mounted at startup when it exists; -pack writes it.
+    const wchar_t* AssetPack = L"Assets.pak";
 }
 
 LRESULT CALLBACK MainWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
@@ -22,7 +41,10 @@ Application::Application(HINSTANCE hInstance)
     m_AppPaused(false),
     m_Minimized(false),
     m_Maximized(false),
-    m_Resizing(false)
+    m_Resizing(false),
+    m_CheckAllocations(false),
+    m_SteadyFrames(0),
+    m_StatsAllocations(0)
 {
     g_App = this;
 }
@@ -34,6 +56,12 @@ Application::~Application()
 
 bool Application::Init()
 {
+    if (!ParseCommandLine())
+        return false;
+
+    // Whatever the pack lacks or is older than, or everything without one, is read loose.
+    AssetArchive::getInstance()->Mount(AssetPack);
+
     if (!InitMainWindow())
         return false;
 
@@ -43,6 +71,13 @@ bool Application::Init()
         d3d->CleanupDevice();
         return false;
     }
+
+    auto& ioStats = AssetArchive::getInstance()->GetStats();
+    std::wostringstream outs;
+    outs.precision(3);
+    outs << L"Startup I/O: " << ioStats.Opens << L" opens, " << ioStats.Reads << L" reads, "
+        << ioStats.PackHits << L" files from the pack, " << ioStats.Bytes / 1024 << L" KB in " << ioStats.Ms << L" ms\n";
+    OutputDebugStringW(outs.str().c_str());
     return true;
 }
 
@@ -51,7 +86,11 @@ int Application::Run()
     auto input = InputManager::getInstance();
     auto d3d = D3DManager::getInstance();
     MSG msg = { 0 };
+
+    // 1 ms sleeps let the pacer spin less.
+    timeBeginPeriod(1);
     m_Timer.Reset();
+    m_Pacer.Reset();
     while (msg.message != WM_QUIT)
     {
         if (PeekMessage(&msg, 0, 0, 0, PM_REMOVE))
@@ -62,19 +101,54 @@ int Application::Run()
         else
         {
             m_Timer.Tick();
-            if (!m_AppPaused)
+
+            // A replay keeps running without focus; it does not read live input.
+            bool replaying = m_Recorder.GetMode() == InputRecorder::Replaying;
+            if (!m_AppPaused || replaying)
             {
+                float dt = m_Timer.DeltaTime();
+                if (replaying && !m_Recorder.ReplayFrame(*input, dt))
+                {
+                    m_Recorder.WriteProfile(m_Recorder.GetFilename() + L".csv");
+                    m_Recorder.EndReplay();
+                    DestroyWindow(m_MainWnd);
+                    continue;
+                }
+
+                input->ProcessEvents();
+                if (m_Recorder.GetMode() == InputRecorder::Recording)
+                    m_Recorder.RecordFrame(dt, input->GetFrameEvents());
+
+                FrameArena::getInstance()->Reset();
+#if defined(DEBUG) | defined(_DEBUG)
+                UINT64 allocations = AllocationCounter::GetCount();
+#endif
+
+                double start = GameTimer::NowMs();
                 CalculateFrameStats();
-                input->SetKeyState();
-                d3d->Update(m_Timer.DeltaTime());
+                d3d->Update(dt);
                 d3d->Render();
+                if (replaying)
+                    m_Recorder.AddFrameTime(GameTimer::NowMs() - start);
+
+#if defined(DEBUG) | defined(_DEBUG)
+                // Recording and replaying append to their logs every frame.
+                const UINT warmUpFrames = 120;
+                if (m_CheckAllocations && m_Recorder.GetMode() == InputRecorder::Off && ++m_SteadyFrames > warmUpFrames)
+                    assert(AllocationCounter::GetCount() == allocations);
+#endif
+
+                m_Pacer.WaitForNextFrame();
             }
             else
             {
                 Sleep(100);
+                m_Pacer.Reset();
             }
         }
     }
+    timeEndPeriod(1);
+    m_Recorder.EndRecording();
     d3d->CleanupDevice();
     return (int)msg.wParam;
 }
@@ -96,6 +170,9 @@ LRESULT Application::MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
     case WM_ACTIVATE:
         if (LOWORD(wParam) == WA_INACTIVE)
         {
+            // Keys released while another window has focus never reach us.
+            if (m_Recorder.GetMode() != InputRecorder::Replaying)
+                input->ReleaseAll(m_Timer.TotalTime());
             m_AppPaused = true;
             m_Timer.Stop();
         }
@@ -167,25 +244,46 @@ LRESULT Application::MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
         ((MINMAXINFO*)lParam)->ptMinTrackSize.y = 200;
         return 0;
 
+    case WM_KEYDOWN:
+        PushInputEvent(InputEvent::KeyDown, (UINT)wParam, 0);
+        return 0;
+    case WM_KEYUP:
+        PushInputEvent(InputEvent::KeyUp, (UINT)wParam, 0);
+        return 0;
+    case WM_SYSKEYDOWN:
+        // Still handled by DefWindowProc so Alt+F4 and friends keep working.
+        PushInputEvent(InputEvent::KeyDown, (UINT)wParam, 0);
+        break;
+    case WM_SYSKEYUP:
+        PushInputEvent(InputEvent::KeyUp, (UINT)wParam, 0);
+        break;
+
     case WM_LBUTTONDOWN:
+        PushInputEvent(InputEvent::MouseDown, MK_LBUTTON, lParam);
+        SetCapture(hwnd);
+        return 0;
     case WM_MBUTTONDOWN:
+        PushInputEvent(InputEvent::MouseDown, MK_MBUTTON, lParam);
+        SetCapture(hwnd);
+        return 0;
     case WM_RBUTTONDOWN:
-        input->SetMousePos(GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
-        if (wParam & MK_LBUTTON) input->SetMouseState(MK_LBUTTON, true);
-        if (wParam & MK_MBUTTON) input->SetMouseState(MK_MBUTTON, true);
-        if (wParam & MK_RBUTTON) input->SetMouseState(MK_RBUTTON, true);
+        PushInputEvent(InputEvent::MouseDown, MK_RBUTTON, lParam);
         SetCapture(hwnd);
         return 0;
     case WM_LBUTTONUP:
+        PushInputEvent(InputEvent::MouseUp, MK_LBUTTON, lParam);
+        ReleaseCapture();
+        return 0;
     case WM_MBUTTONUP:
+        PushInputEvent(InputEvent::MouseUp, MK_MBUTTON, lParam);
+        ReleaseCapture();
+        return 0;
     case WM_RBUTTONUP:
-        if (!(wParam & MK_LBUTTON)) input->SetMouseState(MK_LBUTTON, false);
-        if (!(wParam & MK_MBUTTON)) input->SetMouseState(MK_MBUTTON, false);
-        if (!(wParam & MK_RBUTTON)) input->SetMouseState(MK_RBUTTON, false);
+        PushInputEvent(InputEvent::MouseUp, MK_RBUTTON, lParam);
         ReleaseCapture();
         return 0;
     case WM_MOUSEMOVE:
-        input->SetMousePos(GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+        PushInputEvent(InputEvent::MouseMove, 0, lParam);
         return 0;
 
     case WM_DESTROY:
@@ -197,6 +295,153 @@ LRESULT Application::MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 }
 
 
+bool Application::ParseCommandLine()
+{
+    // -record <file> saves the session on exit, -replay <file> plays one back
+    // and writes the frame times to <file>.csv; "Tests -replay <file>" plays it
+    // back without a window or drawing, for benchmarks.  -tickrate <hz> sets the
+    // simulation rate and -simthread runs the simulation on its own thread.
+    // -fps <n> sets the frame rate the loop is paced to, 0 leaves it unpaced.
+    // The benchmarks run from the Tests console, "Tests -bench <name>".
+    // -compress <bc1|bc3|bc4|bc5|bc7> <source> <dest.dds> compresses an image and its
+    // mips offline and exits.
+    // -pack <dest> packs the compiled effects and the textures into an asset pack and exits.
+    // -seed <n> seeds the random numbers, so scattered lights and the like repeat.
+    // -allocfree asserts that frames stop allocating from the heap once warmed up,
+    // in debug builds.
+    // -land adds the chunked heightmap Land beside the terrain and shows the chunks
+    // and triangles it draws.
+    float tickRate = 60.0f;
+    float frameRate = 60.0f;
+    bool threaded = false;
+
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (!argv)
+        return true;
+
+    bool result = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::wstring option = argv[i];
+        if (option == L"-simthread")
+        {
+            threaded = true;
+        }
+        else if (option == L"-allocfree")
+        {
+            m_CheckAllocations = true;
+        }
+        else if (option == L"-land")
+        {
+            D3DManager::getInstance()->SetLandEnabled(true);
+        }
+        else if (i + 1 == argc)
+        {
+            break;
+        }
+        else if (option == L"-fps")
+        {
+            frameRate = (float)_wtof(argv[++i]);
+        }
+        else if (option == L"-seed")
+        {
+            Random::SetGlobalSeed(_wcstoui64(argv[++i], nullptr, 10));
+        }
+        else if (option == L"-tickrate")
+        {
+            tickRate = (float)_wtof(argv[++i]);
+            if (tickRate <= 0.0f)
+                tickRate = 60.0f;
+        }
+        else if (option == L"-record")
+        {
+            m_Recorder.BeginRecording(argv[++i]);
+        }
+        else if (option == L"-replay")
+        {
+            if (!m_Recorder.BeginReplay(argv[++i]))
+            {
+                MessageBox(0, L"Replay file could not be loaded.", 0, 0);
+                result = false;
+            }
+        }
+        else if (option == L"-pack")
+        {
+            // The cached effect variants go too, for builds shipped without the sources.
+            const wchar_t* patterns[] = { L"FX/*.cso", L"FX/Cache/*.cso", L"Textures/*" };
+            std::vector<std::wstring> filenames;
+            for (auto pattern : patterns)
+                AssetArchive::ListFiles(pattern, filenames);
+
+            double start = GameTimer::NowMs();
+            bool written = AssetArchive::Pack(filenames, argv[i + 1], true);
+
+            std::wostringstream outs;
+            outs.precision(3);
+            if (written)
+                outs << argv[i + 1] << L" written with " << filenames.size() << L" files in " << GameTimer::NowMs() - start << L" ms";
+            else
+                outs << argv[i + 1] << L" could not be written.";
+            MessageBox(0, outs.str().c_str(), L"Asset Pack", 0);
+            result = false;
+            break;
+        }
+        else if (option == L"-compress")
+        {
+            // Runs before the window exists, so it makes a device of its own.
+            TextureCompressor::Format format;
+            ID3D11Device* device = 0;
+            ID3D11DeviceContext* context = 0;
+            if (i + 3 >= argc || !TextureCompressor::ParseFormat(argv[i + 1], format))
+            {
+                MessageBox(0, L"Usage: -compress <bc1|bc3|bc4|bc5|bc7> <source> <dest.dds>", 0, 0);
+            }
+            else if (FAILED(D3D11CreateDevice(0, D3D_DRIVER_TYPE_HARDWARE, 0, 0, 0, 0, D3D11_SDK_VERSION, &device, 0, &context)))
+            {
+                MessageBox(0, L"D3D11CreateDevice Failed.", 0, 0);
+            }
+            else
+            {
+                double start = GameTimer::NowMs();
+                bool written = TextureCompressor::CompressFile(device, context, argv[i + 2], argv[i + 3], format);
+
+                std::wostringstream outs;
+                outs.precision(3);
+                if (written)
+                    outs << argv[i + 3] << L" written in " << GameTimer::NowMs() - start << L" ms";
+                else
+                    outs << argv[i + 3] << L" could not be written.";
+                MessageBox(0, outs.str().c_str(), L"Block Compression", 0);
+            }
+            ReleaseCOM(context);
+            ReleaseCOM(device);
+            result = false;
+            break;
+        }
+    }
+
+    LocalFree(argv);
+
+    m_Pacer.SetTargetFrameTime(frameRate > 0.0f ? 1.0 / frameRate : 0.0);
+
+    // A threaded simulation is paced by the wall clock, which a replay cannot reproduce.
+    if (m_Recorder.GetMode() == InputRecorder::Replaying)
+        threaded = false;
+    D3DManager::getInstance()->SetSimulation(tickRate, 5, threaded);
+
+    return result;
+}
+
+void Application::PushInputEvent(UINT type, UINT code, LPARAM lParam)
+{
+    // Live input is ignored while a recording drives the frames.
+    if (m_Recorder.GetMode() == InputRecorder::Replaying)
+        return;
+
+    InputManager::getInstance()->PushEvent(m_Timer.TotalTime(), type, code, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+}
+
 bool Application::InitMainWindow()
 {
     WNDCLASS wc;
@@ -249,12 +494,53 @@ void Application::CalculateFrameStats()
         float fps = (float)frameCnt; // fps = frameCnt / 1
         float mspf = 1000.0f / fps;
 
-        std::wostringstream outs;
-        outs.precision(6);
-        outs << m_MainWndCaption << L"    "
-            << L"FPS: " << fps << L"    "
-            << L"Frame Time: " << mspf << L" (ms)";
-        SetWindowText(m_MainWnd, outs.str().c_str());
+        auto& cbStats = ConstantBuffers::PerDraw->GetLastFrameStats();
+        auto& fxStats = FrameConstants::GetLastFrameStats();
+        auto& lightStats = D3DManager::getInstance()->GetClusteredLighting()->GetStats();
+        auto& shadowStats = D3DManager::getInstance()->GetCascadedShadows()->GetStats();
+        auto& occlusionStats = D3DManager::getInstance()->GetOcclusionCulling()->GetStats();
+        auto& pacerStats = m_Pacer.GetStats();
+        auto& collisionStats = D3DManager::getInstance()->GetCollisionWorld().GetStats();
+        auto meshStats = MeshAsset::GetStats();
+        auto pageStats = D3DManager::getInstance()->GetTerrain()->GetVirtualTextureStats();
+        auto& drawStats = D3DManager::getInstance()->GetDrawStats();
+
+        // Formatted on the frame arena; a string stream would allocate every second.
+        const UINT captionLength = 1024;
+        wchar_t* caption = FrameArena::getInstance()->AllocateArray<wchar_t>(captionLength);
+        swprintf_s(caption, captionLength,
+            L"%s    FPS: %g    Frame Time: %g (ms)    CB Upload: %u B / %u maps    FX Upload: %u B    "
+            L"Light Bin: %g ms    Shadow Casters: %u drawn / %u culled    Occluded: %u / %u    "
+            L"Meshes: %u KB / %u KB unshared    Contacts: %u    Pages: %u hit / %u miss / %u evicted    "
+            L"Object Draws: %u for %u objects    Pacing Error: %g / %g ms",
+            m_MainWndCaption.c_str(), fps, mspf,
+            cbStats.UploadBytes, cbStats.MapCount, fxStats.UploadBytes,
+            lightStats.BinMs, shadowStats.Drawn, shadowStats.Culled,
+            occlusionStats.Occluded, occlusionStats.Tested,
+            (meshStats.GpuBytes + meshStats.CpuBytes) / 1024, meshStats.UnsharedBytes / 1024, collisionStats.Touching,
+            pageStats.Hits, pageStats.Misses, pageStats.Evictions,
+            drawStats.Draws, drawStats.Objects,
+            pacerStats.MeanErrorMs, pacerStats.MaxErrorMs);
+
+        if (auto land = D3DManager::getInstance()->GetLand())
+        {
+            auto& landStats = land->GetStats();
+            size_t length = wcslen(caption);
+            swprintf_s(caption + length, captionLength - length, L"    Land: %u / %u chunks, %u / %u triangles",
+                landStats.DrawnChunks, landStats.Chunks, landStats.Triangles, landStats.FullTriangles);
+        }
+
+#if defined(DEBUG) | defined(_DEBUG)
+        // Only debug builds count allocations.
+        UINT64 allocationCount = AllocationCounter::GetCount();
+        float allocationsPerFrame = (float)(allocationCount - m_StatsAllocations) / frameCnt;
+        m_StatsAllocations = allocationCount;
+
+        size_t length = wcslen(caption);
+        swprintf_s(caption + length, captionLength - length, L"    Heap Allocs: %g / frame", allocationsPerFrame);
+#endif
+        SetWindowText(m_MainWnd, caption);
+        m_Pacer.ResetStats();
 
         frameCnt = 0;
         timeElapsed += 1.0f;
@@ -2,6 +2,8 @@
 #include <windows.h>
 #include <string>
 #include "GameTimer.h"
+#include "InputRecorder.h"
+#include "FramePacer.h"
 
 class Application
 {
@@ -16,6 +18,8 @@ public:
 
 private:
     bool    InitMainWindow();
+    bool    ParseCommandLine();
+    void    PushInputEvent(UINT type, UINT code, LPARAM lParam);
     void    CalculateFrameStats();
 
 private:
@@ -24,6 +28,8 @@ private:
     std::wstring    m_MainWndCaption;
 
     GameTimer       m_Timer;
+    InputRecorder   m_Recorder;
+    FramePacer      m_Pacer;
 
     int             m_ClientWidth;
     int             m_ClientHeight;
@@ -32,5 +38,9 @@ private:
     bool            m_Minimized;
     bool            m_Maximized;
     bool            m_Resizing;
+
+    bool            m_CheckAllocations;     // assert allocation free frames after the warm up
+    UINT            m_SteadyFrames;
+    UINT64          m_StatsAllocations;     // allocation count at the last frame stats
 };
 
@@ -0,0 +1,671 @@
+//***************************************************************************************
+// AssetArchive.cpp
+//***************************************************************************************
+
+#include "AssetArchive.h"
+#include "GameTimer.h"
+#include <map>
+
+namespace
+{
+    // The compressed stream is a run of sequences: a token with the literal
+    // count in the high and the match length less MinMatch in the low nibble,
+    // more length bytes when a nibble is 15, the literals, then the 16 bit
+    // offset of the match and more match length bytes.  The last sequence
+    // stops after its literals.
+    const UINT MinMatch     = 4;
+    const UINT MaxOffset    = 0xffff;
+    const UINT HashBits     = 14;
+    const UINT NoPosition   = 0xffffffff;
+
+    UINT HashSequence(const BYTE* p)
+    {
+        UINT v = p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT)p[3] << 24);
+        return (v * 2654435761u) >> (32 - HashBits);
+    }
+
+    void PutLength(std::vector<BYTE>& dst, UINT length)
+    {
+        for (; length >= 255; length -= 255)
+            dst.push_back(255);
+        dst.push_back((BYTE)length);
+    }
+
+    void PutSequence(std::vector<BYTE>& dst, const BYTE* literals, UINT literalCount, UINT offset, UINT matchLength)
+    {
+        UINT matchCode = matchLength ? matchLength - MinMatch : 0;
+        dst.push_back((BYTE)((MathHelper::Min(literalCount, 15u) << 4) | MathHelper::Min(matchCode, 15u)));
+        if (literalCount >= 15)
+            PutLength(dst, literalCount - 15);
+        dst.insert(dst.end(), literals, literals + literalCount);
+
+        if (matchLength)
+        {
+            dst.push_back((BYTE)offset);
+            dst.push_back((BYTE)(offset >> 8));
+            if (matchCode >= 15)
+                PutLength(dst, matchCode - 15);
+        }
+    }
+
+    bool GetLength(const BYTE*& in, const BYTE* inEnd, UINT& length)
+    {
+        BYTE b;
+        do
+        {
+            if (in == inEnd)
+                return false;
+            b = *in++;
+            length += b;
+        } while (b == 255);
+        return true;
+    }
+
+    struct TestRandom
+    {
+        explicit TestRandom(UINT seed) : State(seed) {}
+
+        UINT Next(UINT n)
+        {
+            State = State * 1664525u + 1013904223u;
+            return (State >> 8) % n;
+        }
+
+        UINT State;
+    };
+
+    // Literal runs, repeats near and far, and long matches, in 'size' bytes.
+    void GenerateData(TestRandom& random, UINT size, std::vector<BYTE>& data)
+    {
+        data.resize(size);
+        for (UINT i = 0; i < size; )
+        {
+            UINT run = MathHelper::Min(1 + random.Next(600), size - i);
+            UINT kind = random.Next(3);
+            UINT offset = 1 + random.Next(kind == 2 ? 70000 : 64);
+            for (UINT j = 0; j < run; ++j, ++i)
+            {
+                if (kind == 0 || offset > i)
+                    data[i] = (BYTE)random.Next(256);
+                else
+                    data[i] = data[i - offset];
+            }
+        }
+    }
+}
+
+const UINT AssetArchive::Magic;
+const UINT AssetArchive::Version;
+const UINT AssetArchive::BlobAlignment;
+
+AssetArchive::AssetArchive()
+:   m_File(INVALID_HANDLE_VALUE),
+    m_Mapping(nullptr),
+    m_View(nullptr),
+    m_PackTime(),
+    m_Data(nullptr),
+    m_Size(0),
+    m_Entries(nullptr),
+    m_EntryCount(0),
+    m_Names(nullptr)
+{
+    ResetStats();
+}
+
+#pragma region Mount
+bool AssetArchive::Mount(const std::wstring& packFile)
+{
+    Unmount();
+    double start = GameTimer::NowMs();
+
+    m_File = CreateFileW(packFile.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (m_File == INVALID_HANDLE_VALUE)
+        return false;
+    ++m_Stats.Opens;
+
+    LARGE_INTEGER size;
+    bool mounted = GetFileSizeEx(m_File, &size) && size.QuadPart > 0 && GetFileTime(m_File, 0, 0, &m_PackTime);
+    if (mounted)
+    {
+        m_Mapping = CreateFileMappingW(m_File, 0, PAGE_READONLY, 0, 0, 0);
+        if (m_Mapping)
+            m_View = static_cast<const BYTE*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+        mounted = m_View && Attach(m_View, (UINT64)size.QuadPart);
+    }
+
+    if (!mounted)
+        Unmount();
+    m_Stats.Ms += GameTimer::NowMs() - start;
+    return mounted;
+}
+
+void AssetArchive::Unmount()
+{
+    if (m_View)
+        UnmapViewOfFile(m_View);
+    if (m_Mapping)
+        CloseHandle(m_Mapping);
+    if (m_File != INVALID_HANDLE_VALUE)
+        CloseHandle(m_File);
+
+    m_File = INVALID_HANDLE_VALUE;
+    m_Mapping = nullptr;
+    m_View = nullptr;
+    m_Data = nullptr;
+    m_Size = 0;
+    m_Entries = nullptr;
+    m_EntryCount = 0;
+    m_Names = nullptr;
+}
+
+bool AssetArchive::Attach(const BYTE* data, UINT64 size)
+{
+    if (size < sizeof(Header))
+        return false;
+
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    UINT64 namesStart = sizeof(Header) + (UINT64)header.EntryCount * sizeof(Entry);
+    UINT64 namesEnd = namesStart + (UINT64)header.NameChars * sizeof(USHORT);
+    if (header.Magic != Magic || header.Version != Version || namesEnd > size)
+        return false;
+
+    const Entry* entries = reinterpret_cast<const Entry*>(data + sizeof(Header));
+    for (UINT i = 0; i < header.EntryCount; ++i)
+    {
+        const Entry& entry = entries[i];
+        if (entry.Offset > size || entry.StoredSize > size - entry.Offset ||
+            (UINT64)entry.NameOffset + entry.NameLength > header.NameChars)
+            return false;
+        if (!(entry.Flags & Compressed) && entry.StoredSize != entry.Size)
+            return false;
+        if (i > 0 && entries[i - 1].NameHash > entry.NameHash)
+            return false;
+    }
+
+    m_Data = data;
+    m_Size = size;
+    m_Entries = entries;
+    m_EntryCount = header.EntryCount;
+    m_Names = reinterpret_cast<const USHORT*>(data + namesStart);
+    return true;
+}
+#pragma endregion
+
+#pragma region Load
+bool AssetArchive::Load(const std::wstring& filename, Asset& asset)
+{
+    const Entry* entry = Find(filename);
+    if (!entry)
+        return LoadLoose(filename, asset);
+    if (IsLooseNewer(filename))
+    {
+        ++m_Stats.StaleHits;
+        return LoadLoose(filename, asset);
+    }
+
+    double start = GameTimer::NowMs();
+    const BYTE* blob = m_Data + entry->Offset;
+    asset.Size = entry->Size;
+    if (entry->Flags & Compressed)
+    {
+        asset.Storage.resize(entry->Size);
+        BYTE* dst = asset.Storage.empty() ? nullptr : &asset.Storage[0];
+        if (!Decompress(blob, entry->StoredSize, dst, entry->Size))
+        {
+            asset.Data = nullptr;
+            asset.Size = 0;
+            return false;
+        }
+        asset.Data = dst;
+    }
+    else
+    {
+        asset.Storage.clear();
+        asset.Data = blob;
+    }
+    assert(Hash(asset.Data, asset.Size) == entry->ContentHash);
+
+    ++m_Stats.PackHits;
+    m_Stats.Bytes += asset.Size;
+    m_Stats.Ms += GameTimer::NowMs() - start;
+    return true;
+}
+
+bool AssetArchive::Contains(const std::wstring& filename) const
+{
+    return Find(filename) != nullptr;
+}
+
+void AssetArchive::ResetStats()
+{
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+const AssetArchive::Entry* AssetArchive::Find(const std::wstring& filename) const
+{
+    if (!m_Entries)
+        return nullptr;
+
+    std::wstring name = NormalizeName(filename);
+    std::vector<USHORT> chars(name.begin(), name.end());
+    UINT64 hash = Hash(chars.empty() ? nullptr : &chars[0], chars.size() * sizeof(USHORT));
+
+    const Entry* end = m_Entries + m_EntryCount;
+    const Entry* entry = std::lower_bound(m_Entries, end, hash,
+        [](const Entry& e, UINT64 h) { return e.NameHash < h; });
+    for (; entry != end && entry->NameHash == hash; ++entry)
+    {
+        if (entry->NameLength == chars.size() &&
+            std::equal(chars.begin(), chars.end(), m_Names + entry->NameOffset))
+            return entry;
+    }
+    return nullptr;
+}
+
+bool AssetArchive::LoadLoose(const std::wstring& filename, Asset& asset)
+{
+    double start = GameTimer::NowMs();
+    asset.Data = nullptr;
+    asset.Size = 0;
+
+    HANDLE file = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    ++m_Stats.Opens;
+
+    LARGE_INTEGER size;
+    bool loaded = GetFileSizeEx(file, &size) && size.QuadPart < 0x7fffffff;
+    if (loaded)
+    {
+        asset.Storage.resize((size_t)size.QuadPart);
+        DWORD read = 0;
+        if (!asset.Storage.empty())
+        {
+            loaded = ReadFile(file, &asset.Storage[0], (DWORD)asset.Storage.size(), &read, 0) &&
+                read == asset.Storage.size();
+            ++m_Stats.Reads;
+        }
+    }
+    CloseHandle(file);
+
+    if (loaded)
+    {
+        asset.Data = asset.Storage.empty() ? nullptr : &asset.Storage[0];
+        asset.Size = (UINT)asset.Storage.size();
+        m_Stats.Bytes += asset.Size;
+    }
+    m_Stats.Ms += GameTimer::NowMs() - start;
+    return loaded;
+}
+
+bool AssetArchive::IsLooseNewer(const std::wstring& filename) const
+{
+    // A pack attached to memory has no date to go by.
+    if (!m_View)
+        return false;
+
+    // Reads the directory entry; the file is not opened.
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExW(filename.c_str(), GetFileExInfoStandard, &attributes))
+        return false;
+    return CompareFileTime(&attributes.ftLastWriteTime, &m_PackTime) > 0;
+}
+
+std::wstring AssetArchive::GetName(const Entry& entry) const
+{
+    const USHORT* name = m_Names + entry.NameOffset;
+    return std::wstring(name, name + entry.NameLength);
+}
+
+std::wstring AssetArchive::NormalizeName(const std::wstring& filename)
+{
+    std::wstring name = filename;
+    for (auto& c : name)
+        c = (c == L'\\') ? L'/' : towlower(c);
+    while (name.compare(0, 2, L"./") == 0)
+        name.erase(0, 2);
+    return name;
+}
+#pragma endregion
+
+#pragma region Pack
+void AssetArchive::ListFiles(const std::wstring& pattern, std::vector<std::wstring>& filenames)
+{
+    size_t slash = pattern.find_last_of(L"/\\");
+    std::wstring dir = (slash == std::wstring::npos) ? std::wstring() : pattern.substr(0, slash + 1);
+
+    WIN32_FIND_DATAW fd;
+    HANDLE find = FindFirstFileW(pattern.c_str(), &fd);
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+    do
+    {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            filenames.push_back(dir + fd.cFileName);
+    } while (FindNextFileW(find, &fd));
+    FindClose(find);
+}
+
+bool AssetArchive::Pack(const std::vector<std::wstring>& filenames, const std::wstring& packFile, bool compress)
+{
+    AssetArchive loose;
+    std::vector<std::vector<BYTE> > contents(filenames.size());
+    for (UINT i = 0; i < filenames.size(); ++i)
+    {
+        Asset asset;
+        if (!loose.LoadLoose(filenames[i], asset))
+            return false;
+        contents[i].swap(asset.Storage);
+    }
+
+    std::vector<BYTE> pack;
+    BuildPack(filenames, contents, compress, pack);
+
+    std::ofstream fout(packFile.c_str(), std::ios::binary);
+    fout.write((const char*)&pack[0], pack.size());
+    return !fout.fail();
+}
+
+void AssetArchive::BuildPack(const std::vector<std::wstring>& names, const std::vector<std::vector<BYTE> >& contents,
+                             bool compress, std::vector<BYTE>& pack)
+{
+    assert(names.size() == contents.size());
+
+    // Entries go in hash order; the blobs stay in the order they were given.
+    std::vector<Entry> entries(names.size());
+    std::vector<USHORT> nameChars;
+    for (UINT i = 0; i < names.size(); ++i)
+    {
+        std::wstring name = NormalizeName(names[i]);
+        Entry& entry = entries[i];
+        entry.NameOffset = (UINT)nameChars.size();
+        entry.NameLength = (USHORT)name.size();
+        nameChars.insert(nameChars.end(), name.begin(), name.end());
+        entry.NameHash = Hash(name.empty() ? nullptr : &nameChars[entry.NameOffset], name.size() * sizeof(USHORT));
+    }
+
+    UINT64 blobStart = sizeof(Header) + entries.size() * sizeof(Entry) + nameChars.size() * sizeof(USHORT);
+    pack.assign((size_t)blobStart, 0);
+
+    // Equal contents are stored once.
+    std::map<std::pair<UINT64, UINT>, UINT> blobs;
+    std::vector<BYTE> compressed;
+    for (UINT i = 0; i < contents.size(); ++i)
+    {
+        const std::vector<BYTE>& content = contents[i];
+        Entry& entry = entries[i];
+        entry.Size = (UINT)content.size();
+        entry.ContentHash = Hash(content.empty() ? nullptr : &content[0], content.size());
+
+        auto key = std::make_pair(entry.ContentHash, entry.Size);
+        auto shared = blobs.find(key);
+        if (shared != blobs.end())
+        {
+            const Entry& first = entries[shared->second];
+            entry.Offset = first.Offset;
+            entry.StoredSize = first.StoredSize;
+            entry.Flags = first.Flags;
+            continue;
+        }
+        blobs[key] = i;
+
+        const BYTE* stored = content.empty() ? nullptr : &content[0];
+        entry.StoredSize = entry.Size;
+        entry.Flags = 0;
+        if (compress && !content.empty())
+        {
+            Compress(&content[0], entry.Size, compressed);
+            if (compressed.size() < entry.Size - entry.Size / 8)
+            {
+                stored = &compressed[0];
+                entry.StoredSize = (UINT)compressed.size();
+                entry.Flags = Compressed;
+            }
+        }
+
+        pack.resize((pack.size() + BlobAlignment - 1) / BlobAlignment * BlobAlignment, 0);
+        entry.Offset = pack.size();
+        pack.insert(pack.end(), stored, stored + entry.StoredSize);
+    }
+
+    // Names with the same hash are told apart by Find, so their order does not matter.
+    std::stable_sort(entries.begin(), entries.end(),
+        [](const Entry& a, const Entry& b) { return a.NameHash < b.NameHash; });
+
+    Header header;
+    header.Magic = Magic;
+    header.Version = Version;
+    header.EntryCount = (UINT)entries.size();
+    header.NameChars = (UINT)nameChars.size();
+    memcpy(&pack[0], &header, sizeof(header));
+    if (!entries.empty())
+        memcpy(&pack[sizeof(Header)], &entries[0], entries.size() * sizeof(Entry));
+    if (!nameChars.empty())
+        memcpy(&pack[sizeof(Header) + entries.size() * sizeof(Entry)], &nameChars[0], nameChars.size() * sizeof(USHORT));
+}
+#pragma endregion
+
+#pragma region Compression
+void AssetArchive::Compress(const BYTE* src, UINT size, std::vector<BYTE>& dst)
+{
+    dst.clear();
+    dst.reserve(size + size / 255 + 16);
+
+    // The last position each hashed 4 byte sequence was seen at.
+    std::vector<UINT> table(1 << HashBits, NoPosition);
+    UINT anchor = 0;
+    UINT pos = 0;
+    while (pos + MinMatch <= size)
+    {
+        UINT h = HashSequence(src + pos);
+        UINT candidate = table[h];
+        table[h] = pos;
+        if (candidate == NoPosition || pos - candidate > MaxOffset || memcmp(src + candidate, src + pos, MinMatch) != 0)
+        {
+            ++pos;
+            continue;
+        }
+
+        UINT length = MinMatch;
+        while (pos + length < size && src[candidate + length] == src[pos + length])
+            ++length;
+
+        PutSequence(dst, src + anchor, pos - anchor, pos - candidate, length);
+        pos += length;
+        anchor = pos;
+
+        // Lets a match start right after this one.
+        if (pos + MinMatch <= size && pos >= 2)
+            table[HashSequence(src + pos - 2)] = pos - 2;
+    }
+    PutSequence(dst, src + anchor, size - anchor, 0, 0);
+}
+
+bool AssetArchive::Decompress(const BYTE* src, UINT storedSize, BYTE* dst, UINT size)
+{
+    const BYTE* in = src;
+    const BYTE* inEnd = src + storedSize;
+    BYTE* out = dst;
+    BYTE* outEnd = dst + size;
+
+    for (;;)
+    {
+        if (in == inEnd)
+            return false;
+        BYTE token = *in++;
+
+        UINT literalCount = token >> 4;
+        if (literalCount == 15 && !GetLength(in, inEnd, literalCount))
+            return false;
+        if (literalCount > (UINT)(inEnd - in) || literalCount > (UINT)(outEnd - out))
+            return false;
+        memcpy(out, in, literalCount);
+        in += literalCount;
+        out += literalCount;
+
+        // Only the last sequence ends without a match.
+        if (in == inEnd)
+            return out == outEnd;
+
+        if (inEnd - in < 2)
+            return false;
+        UINT offset = in[0] | (in[1] << 8);
+        in += 2;
+        UINT matchLength = token & 15;
+        if (matchLength == 15 && !GetLength(in, inEnd, matchLength))
+            return false;
+        matchLength += MinMatch;
+        if (offset == 0 || offset > (UINT)(out - dst) || matchLength > (UINT)(outEnd - out))
+            return false;
+
+        // Byte by byte, as the match may overlap what it writes.
+        const BYTE* match = out - offset;
+        for (UINT i = 0; i < matchLength; ++i)
+            *out++ = match[i];
+    }
+}
+
+UINT64 AssetArchive::Hash(const void* data, size_t bytes)
+{
+    // FNV-1a, 64 bit.
+    const BYTE* p = static_cast<const BYTE*>(data);
+    UINT64 hash = 14695981039346656037ull;
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+#pragma endregion
+
+#pragma region Tests
+UINT AssetArchive::SelfTest()
+{
+    UINT failures = 0;
+    TestRandom random(47);
+
+    // Round trips, with sizes around the length nibble and byte boundaries.
+    const UINT sizes[] = { 0, 1, 3, 4, 15, 16, 19, 270, 271, 1000, 70000, 200000 };
+    std::vector<BYTE> data, stream, back;
+    for (UINT size : sizes)
+    {
+        GenerateData(random, size, data);
+        Compress(data.empty() ? nullptr : &data[0], size, stream);
+        back.assign(size + 1, 0xcd);
+        if (!Decompress(&stream[0], (UINT)stream.size(), back.empty() ? nullptr : &back[0], size) ||
+            !std::equal(data.begin(), data.end(), back.begin()) || back[size] != 0xcd)
+            ++failures;
+
+        // Truncated streams and wrong sizes are refused.
+        if (stream.size() > 1 && Decompress(&stream[0], (UINT)stream.size() - 1, &back[0], size))
+            ++failures;
+        if (Decompress(&stream[0], (UINT)stream.size(), &back[0], size + 1))
+            ++failures;
+    }
+
+    // A long run compresses to almost nothing, and offsets reaching before the
+    // start are refused.
+    data.assign(100000, 7);
+    Compress(&data[0], (UINT)data.size(), stream);
+    if (stream.size() > 500)
+        ++failures;
+    const BYTE farMatch[] = { 0x10, 'a', 0x02, 0x00, 0x00 };
+    back.assign(16, 0);
+    if (Decompress(farMatch, sizeof(farMatch), &back[8], 5))
+        ++failures;
+
+    // A pack of random files, some repeated and some under names differing in
+    // case and slashes only.
+    std::vector<std::wstring> names;
+    std::vector<std::vector<BYTE> > contents;
+    for (UINT i = 0; i < 40; ++i)
+    {
+        std::wostringstream outs;
+        outs << (i % 2 ? L"Textures\\" : L"FX/") << L"File" << i << (i % 3 ? L".dds" : L".cso");
+        names.push_back(outs.str());
+        contents.push_back(std::vector<BYTE>());
+        if (i % 7 == 6)
+            contents.back() = contents[i - 3];
+        else
+            GenerateData(random, random.Next(5000), contents.back());
+    }
+
+    std::vector<BYTE> pack;
+    BuildPack(names, contents, true, pack);
+
+    AssetArchive archive;
+    if (!archive.Attach(&pack[0], pack.size()))
+        return failures + 1;
+
+    UINT compressedCount = 0;
+    for (UINT i = 0; i < names.size(); ++i)
+    {
+        const Entry* entry = archive.Find(names[i]);
+        std::wstring other = names[i];
+        for (auto& c : other)
+            c = (c == L'\\') ? L'/' : towupper(c);
+        if (!entry || archive.Find(L"./" + other) != entry || entry->Offset % BlobAlignment != 0)
+        {
+            ++failures;
+            continue;
+        }
+        compressedCount += (entry->Flags & Compressed) ? 1 : 0;
+
+        Asset asset;
+        if (!archive.Load(names[i], asset) || asset.Size != contents[i].size() ||
+            !std::equal(contents[i].begin(), contents[i].end(), asset.Data) ||
+            Hash(asset.Data, asset.Size) != entry->ContentHash)
+            ++failures;
+    }
+    const Entry* copy = archive.Find(names[6]);
+    if (compressedCount == 0 || archive.Find(L"FX/Missing.cso") || !copy || copy->Offset != archive.Find(names[3])->Offset)
+        ++failures;
+
+    // Damaged packs are refused.
+    std::vector<BYTE> damaged = pack;
+    damaged[0] ^= 1;
+    if (archive.Attach(&damaged[0], damaged.size()))
+        ++failures;
+    if (archive.Attach(&pack[0], pack.size() - 1))
+        ++failures;
+
+    return failures;
+}
+
+AssetArchive::BenchmarkResult AssetArchive::Benchmark(const std::wstring& packFile)
+{
+    BenchmarkResult result;
+    ZeroMemory(&result, sizeof(result));
+
+    std::vector<std::wstring> names;
+    {
+        AssetArchive packed;
+        if (!packed.Mount(packFile))
+            return result;
+        for (UINT i = 0; i < packed.m_EntryCount; ++i)
+            names.push_back(packed.GetName(packed.m_Entries[i]));
+        result.PackBytes = packed.m_Size;
+    }
+    result.Files = (UINT)names.size();
+
+    Asset asset;
+    AssetArchive loose;
+    for (auto& name : names)
+    {
+        loose.LoadLoose(name, asset);
+        result.Bytes += asset.Size;
+    }
+    result.Loose = loose.m_Stats;
+
+    AssetArchive packed;
+    packed.Mount(packFile);
+    for (auto& name : names)
+        packed.Load(name, asset);
+    result.Packed = packed.m_Stats;
+
+    return result;
+}
+#pragma endregion
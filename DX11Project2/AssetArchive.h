@@ -0,0 +1,173 @@
+//***************************************************************************************
+// AssetArchive.h
+//
+// Reads the files the engine loads at startup (compiled effects, textures and
+// the heightmap) from one pack file instead of opening each of them.  The pack
+// is mounted with a single file mapping; an entry stored as is comes straight
+// out of the mapped view, a compressed one is decompressed into the caller's
+// storage.  Files the pack does not have, and loose files written after the
+// pack, are read from the disk, so an edited shader or texture shows without
+// packing again.
+//
+// Layout: a Header, the table of contents sorted by name hash, the names and
+// then the blobs, each starting on a BlobAlignment boundary.  Names are stored
+// lower case with forward slashes, so "Textures\Grass.dds" and
+// "textures/grass.dds" are the same entry.  Every entry keeps an FNV-1a hash
+// of its contents, checked on load in debug builds; files with equal contents
+// share one blob.  Compression is a byte oriented LZ77 in the style of LZ4,
+// kept only where it saves an eighth of the file.
+//
+// Loads are meant for the main thread at startup; the stats are not guarded.
+//***************************************************************************************
+
+#ifndef ASSETARCHIVE_H
+#define ASSETARCHIVE_H
+
+#include "d3dUtil.h"
+
+class AssetArchive
+{
+public:
+    static const UINT Magic         = 0x314b4150;   // "PAK1"
+    static const UINT Version       = 1;
+    static const UINT BlobAlignment = 16;
+
+    enum EntryFlags
+    {
+        Compressed = 1,
+    };
+
+    struct Header
+    {
+        UINT    Magic;
+        UINT    Version;
+        UINT    EntryCount;
+        UINT    NameChars;      // of the name table after the entries
+    };
+
+    struct Entry
+    {
+        UINT64  NameHash;
+        UINT64  ContentHash;    // of the uncompressed contents
+        UINT64  Offset;         // of the blob, from the start of the pack
+        UINT    StoredSize;
+        UINT    Size;
+        UINT    NameOffset;     // in chars
+        USHORT  NameLength;
+        USHORT  Flags;          // EntryFlags
+    };
+
+    // A loaded file.  Data points into the mapped pack, valid until Unmount,
+    // or into Storage, so an Asset is not copied.
+    struct Asset
+    {
+        Asset() : Data(nullptr), Size(0) {}
+        Asset(const Asset& rhs)             = delete;
+        Asset& operator=(const Asset& rhs)  = delete;
+
+        const BYTE*         Data;
+        UINT                Size;
+        std::vector<BYTE>   Storage;
+    };
+
+    struct Stats
+    {
+        UINT    Opens;          // files opened, the pack included
+        UINT    Reads;          // ReadFile calls
+        UINT    PackHits;       // loads served by the pack
+        UINT    StaleHits;      // loads the pack has but a newer loose file served
+        UINT64  Bytes;          // loaded, after decompression
+        double  Ms;             // in Mount and Load
+    };
+
+    struct BenchmarkResult
+    {
+        UINT    Files;
+        UINT64  Bytes;
+        UINT64  PackBytes;
+        Stats   Loose;          // every file of the pack read from the disk
+        Stats   Packed;         // the same files through a freshly mounted pack
+    };
+
+public:
+    static AssetArchive* getInstance()
+    {
+        static AssetArchive assetArchive;
+        return &assetArchive;
+    }
+
+    // Maps 'packFile'; returns false and stays on the loose files when it is
+    // missing or damaged.
+    bool    Mount(const std::wstring& packFile);
+    void    Unmount();
+    bool    IsMounted() const               { return m_Entries != nullptr; }
+
+    // Loads 'filename' from the pack, unless the loose file is newer than the
+    // pack, or else from the disk.
+    bool    Load(const std::wstring& filename, Asset& asset);
+    bool    Contains(const std::wstring& filename) const;
+
+    const Stats&    GetStats() const        { return m_Stats; }
+    void            ResetStats();
+
+    // The files matching 'pattern', e.g. L"Textures/*.dds", with the directory
+    // of the pattern in front.
+    static void     ListFiles(const std::wstring& pattern, std::vector<std::wstring>& filenames);
+
+    // The packing tool: reads 'filenames' from the disk and writes them to
+    // 'packFile', compressing where it pays when 'compress' is set.
+    static bool     Pack(const std::vector<std::wstring>& filenames, const std::wstring& packFile, bool compress);
+
+    // The pack image of 'contents' under 'names'.
+    static void     BuildPack(const std::vector<std::wstring>& names, const std::vector<std::vector<BYTE> >& contents,
+                              bool compress, std::vector<BYTE>& pack);
+
+    static void     Compress(const BYTE* src, UINT size, std::vector<BYTE>& dst);
+    // Fails instead of reading or writing out of bounds on a damaged stream.
+    static bool     Decompress(const BYTE* src, UINT storedSize, BYTE* dst, UINT size);
+
+    static UINT64   Hash(const void* data, size_t bytes);
+
+    // Round trips generated data through the compressor and through a pack
+    // built in memory, and checks that damaged packs and streams are refused.
+    // Returns the number of failures.
+    static UINT             SelfTest();
+
+    // Loads every file of 'packFile' loose and through the pack.  Both come
+    // out of the file cache once the files have been read before.
+    static BenchmarkResult  Benchmark(const std::wstring& packFile);
+
+public:
+    AssetArchive(const AssetArchive& rhs)               = delete;
+    AssetArchive& operator=(const AssetArchive& rhs)    = delete;
+
+private:
+    AssetArchive();
+    ~AssetArchive() { Unmount(); }
+
+    // Points the archive at a pack image after checking that everything in it
+    // is in bounds.
+    bool            Attach(const BYTE* data, UINT64 size);
+    const Entry*    Find(const std::wstring& filename) const;
+    bool            LoadLoose(const std::wstring& filename, Asset& asset);
+    bool            IsLooseNewer(const std::wstring& filename) const;
+    std::wstring    GetName(const Entry& entry) const;
+
+    static std::wstring NormalizeName(const std::wstring& filename);
+
+private:
+    HANDLE          m_File;
+    HANDLE          m_Mapping;
+    const BYTE*     m_View;         // of the mapping; null when attached to memory
+    FILETIME        m_PackTime;     // last write of the mapped pack
+
+    const BYTE*     m_Data;
+    UINT64          m_Size;
+    const Entry*    m_Entries;
+    UINT            m_EntryCount;
+    const USHORT*   m_Names;
+
+    Stats           m_Stats;
+};
+
+#endif // ASSETARCHIVE_H
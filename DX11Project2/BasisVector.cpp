@@ -30,12 +30,8 @@ void BasisVector::Update(float dt)
 
 void BasisVector::Render(ID3D11DeviceContext* context, CXMMATRIX viewProj)
 {
-    UINT stride = sizeof(Vertex::Color);
-    UINT offset = 0;
-    context->IASetVertexBuffers(0, 1, &m_VertexBuffer, &stride, &offset);
-    context->IASetIndexBuffer(m_IndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+    m_Mesh->Bind(context);
     context->IASetInputLayout(InputLayouts::Color);
-    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
 
     Object::Render(context, viewProj);
 }
@@ -43,42 +39,30 @@ void BasisVector::Render(ID3D11DeviceContext* context, CXMMATRIX viewProj)
 
 void BasisVector::CreateBuffer(ID3D11Device* device)
 {
-    Vertex::Color vertices[] =
+    m_Mesh = MeshAsset::Find(L"BasisVector");
+    if (!m_Mesh)
     {
-        { XMFLOAT3(0.0f,    0.0f,   0.0f),      XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f) },
-        { XMFLOAT3(1000.0f, 0.0f,   0.0f),      XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f) },
-        { XMFLOAT3(0.0f,    0.0f,   0.0f),      XMFLOAT4(0.0f, 1.0f, 0.0f, 1.0f) },
-        { XMFLOAT3(0.0f,    1000.0f,0.0f),      XMFLOAT4(0.0f, 1.0f, 0.0f, 1.0f) },
-        { XMFLOAT3(0.0f,    0.0f,   0.0f),      XMFLOAT4(0.0f, 0.0f, 1.0f, 1.0f) },
-        { XMFLOAT3(0.0f,    0.0f,   1000.0f),   XMFLOAT4(0.0f, 0.0f, 1.0f, 1.0f) },
-    };
-    D3D11_BUFFER_DESC bd;
-    ZeroMemory(&bd, sizeof(bd));
-    bd.Usage = D3D11_USAGE_DEFAULT;             //   
-    bd.ByteWidth = sizeof(vertices);            //  ũ
-    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;    // ο Ǵ  
-    bd.CPUAccessFlags = 0;                      // CPU flag, Ϲ GPU ϱ  0 .
+        Vertex::Color vertices[] =
+        {
+            { XMFLOAT3(0.0f,    0.0f,   0.0f),      XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f) },
+            { XMFLOAT3(1000.0f, 0.0f,   0.0f),      XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f) },
+            { XMFLOAT3(0.0f,    0.0f,   0.0f),      XMFLOAT4(0.0f, 1.0f, 0.0f, 1.0f) },
+            { XMFLOAT3(0.0f,    1000.0f,0.0f),      XMFLOAT4(0.0f, 1.0f, 0.0f, 1.0f) },
+            { XMFLOAT3(0.0f,    0.0f,   0.0f),      XMFLOAT4(0.0f, 0.0f, 1.0f, 1.0f) },
+            { XMFLOAT3(0.0f,    0.0f,   1000.0f),   XMFLOAT4(0.0f, 0.0f, 1.0f, 1.0f) },
+        };
+        UINT indices[] =
+        {
+            0, 1,
+            2, 3,
+            4, 5,
+        };
 
-    D3D11_SUBRESOURCE_DATA InitData;
-    ZeroMemory(&InitData, sizeof(InitData));
-    InitData.pSysMem = vertices;
-    HR(device->CreateBuffer(&bd, &InitData, &m_VertexBuffer));
+        m_Mesh = MeshAsset::Create(device, L"BasisVector",
+            std::vector<Vertex::Color>(vertices, vertices + ARRAYSIZE(vertices)),
+            std::vector<UINT>(indices, indices + ARRAYSIZE(indices)),
+            D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+    }
 
-
-    WORD indices[] =
-    {
-        0, 1,
-        2, 3,
-        4, 5,
-    };
-    m_VertexOffset = 0;
-    m_IndexOffset = 0;
-    m_IndexCount = ARRAYSIZE(indices);
-
-    bd.Usage = D3D11_USAGE_DEFAULT;     // CPU  Ұ,   Ұ, GPU  
-    bd.ByteWidth = sizeof(indices);
-    bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    bd.CPUAccessFlags = 0;
-    InitData.pSysMem = indices;
-    HR(device->CreateBuffer(&bd, &InitData, &m_IndexBuffer));
+    SetMeshBox(m_Mesh->GetBounds());
 }
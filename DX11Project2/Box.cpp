@@ -2,11 +2,18 @@
 #include "Effects.h"
 #include "GeometryGenerator.h"
 #include "RenderStates.h"
+#include "TextureArrays.h"
 
 
 Box::Box()
+:   m_Time(0.0f),
+    m_Center(0.0f, 20.0f, 20.0f),
+    m_DiffuseMapFile(L"Textures/WoodCrate01.dds")
 {
-    m_Mat.Diffuse = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.5f);
+    Material mat = GetMaterial();
+    mat.Diffuse = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.5f);
+    SetMaterial(mat);
+    SetCastsShadow(true);
 }
 
 
@@ -14,12 +21,18 @@ Box::~Box()
 {
 }
 
+void Box::Place(const XMFLOAT3& center, const std::wstring& diffuseMap)
+{
+    m_Center = center;
+    m_DiffuseMapFile = diffuseMap;
+}
+
 void Box::Init(ID3D11Device* device)
 {
     CreateBuffer(device);
     m_Effect = Effects::BasicFX;
-    m_Tech = Effects::BasicFX->m_Light1TexTech;
-    HR(D3DX11CreateShaderResourceViewFromFile(device, L"Textures/WoodCrate01.dds", 0, 0, &m_DiffuseMapSRV, 0));
+    m_Tech = Effects::BasicFX->m_DefaultTech;
+    SetDiffuseMap(m_DiffuseMapFile);
 }
 
 void Box::Release()
@@ -29,95 +42,58 @@ void Box::Release()
 
 void Box::Update(float dt)
 {
-    static float t = 0.0f;
-    t += dt;
+    m_Time += dt;
+    float t = m_Time;
     float scaleValue = 2.0f;
     float moveValue = cosf(t)*10.0f;
-    XMMATRIX scale = XMMatrixScaling(scaleValue, scaleValue, scaleValue);
     XMMATRIX rotate = XMMatrixRotationX(t) * XMMatrixRotationY(-t) * XMMatrixRotationZ(t);
-    XMMATRIX position = XMMatrixTranslation(moveValue, 20.0f, 20.0f);
-    XMMATRIX world = scale * rotate * position;
-    XMStoreFloat4x4(&m_World, world);
+    SetTransform(
+        XMVectorReplicate(scaleValue),
+        XMQuaternionRotationMatrix(rotate),
+        XMVectorSet(m_Center.x + moveValue, m_Center.y, m_Center.z, 0.0f));
 
     Object::Update(dt);
 }
 
 void Box::Render(ID3D11DeviceContext* context, CXMMATRIX viewProj)
 {
-    UINT stride = sizeof(Vertex::Basic32);
-    UINT offset = 0;
-    context->IASetVertexBuffers(0, 1, &m_VertexBuffer, &stride, &offset);
-    context->IASetIndexBuffer(m_IndexBuffer, DXGI_FORMAT_R32_UINT, 0);
+    m_Mesh->Bind(context);
     context->IASetInputLayout(InputLayouts::Basic32);
-    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-    switch (RenderStates::m_RenderOptions)
-    {
-    case RenderOptions::Lighting:
-        m_Tech = Effects::BasicFX->m_Light3Tech;
-        break;
-    case RenderOptions::Textures:
-        m_Tech = Effects::BasicFX->m_Light3TexTech;
-        break;
-    case RenderOptions::TexturesAndFog:
-        m_Tech = Effects::BasicFX->m_Light3TexFogTech;
-        break;
-    }
+    m_Tech = Effects::BasicFX->SelectTech(BasicEffect::FeaturesFor(RenderStates::m_RenderOptions));
     Object::Render(context, viewProj);
 }
 
-
-void Box::CreateBuffer(ID3D11Device* device)
+Object::BatchKey Box::GetBatchKey() const
 {
-    GeometryGenerator::MeshData box;
-    GeometryGenerator geoGen;
-    geoGen.CreateBox(1.0f, 1.0f, 1.0f, box);
+    BatchKey key = { m_Mesh, BasicEffect::FeaturesFor(RenderStates::m_RenderOptions), TextureArrays::getInstance()->GetSlice(m_DiffuseMap).Array };
+    return key;
+}
 
-    m_VertexOffset = 0;
-    m_IndexOffset = 0;
-    m_IndexCount = box.Indices.size();
 
-    UINT totalVertexCount = box.Vertices.size();
-    UINT totalIndexCount = m_IndexCount;
+void Box::RenderShadow(ID3D11DeviceContext* context, CXMMATRIX lightViewProj)
+{
+    m_Mesh->Bind(context);
+    context->IASetInputLayout(InputLayouts::Basic32);
+
+    m_Tech = Effects::BasicFX->SelectTech(BasicShadowCaster);
+    Object::RenderDepth(context, lightViewProj);
+}
 
-    XMFLOAT3 vMinf3(+MathHelper::Infinity, +MathHelper::Infinity, +MathHelper::Infinity);
-    XMFLOAT3 vMaxf3(-MathHelper::Infinity, -MathHelper::Infinity, -MathHelper::Infinity);
-    XMVECTOR vMin = XMLoadFloat3(&vMinf3);
-    XMVECTOR vMax = XMLoadFloat3(&vMaxf3);
 
-    m_MeshVertices.resize(totalVertexCount);
-    UINT k = 0;
-    for (size_t i = 0; i < box.Vertices.size(); ++i, ++k)
+void Box::CreateBuffer(ID3D11Device* device)
+{
+    // Every box shares one mesh.
+    m_Mesh = MeshAsset::Find(L"Box");
+    if (!m_Mesh)
     {
-        m_MeshVertices[k].Pos = box.Vertices[i].Position;
-        m_MeshVertices[k].Normal = box.Vertices[i].Normal;
-        m_MeshVertices[k].Tex = box.Vertices[i].TexC;
+        GeometryGenerator::Counts counts = GeometryGenerator::BoxCounts();
+        std::vector<Vertex::Basic32> vertices(counts.Vertices);
+        std::vector<UINT> indices(counts.Indices);
+        GeometryGenerator::CreateBox(1.0f, 1.0f, 1.0f, &vertices[0], &indices[0]);
 
-        XMVECTOR P = XMLoadFloat3(&m_MeshVertices[i].Pos);
-        vMin = XMVectorMin(vMin, P);
-        vMax = XMVectorMax(vMax, P);
+        m_Mesh = MeshAsset::Create(device, L"Box", vertices, indices);
     }
-    XMStoreFloat3(&m_MeshBox.Center, 0.5f*(vMin + vMax));
-    XMStoreFloat3(&m_MeshBox.Extents, 0.5f*(vMax - vMin));
-
-    D3D11_BUFFER_DESC vbd;
-    vbd.Usage = D3D11_USAGE_IMMUTABLE;
-    vbd.ByteWidth = sizeof(Vertex::Basic32) * totalVertexCount;
-    vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    vbd.CPUAccessFlags = 0;
-    vbd.MiscFlags = 0;
-    D3D11_SUBRESOURCE_DATA vinitData;
-    vinitData.pSysMem = &m_MeshVertices[0];
-    HR(device->CreateBuffer(&vbd, &vinitData, &m_VertexBuffer));
-
-    m_MeshIndices.insert(m_MeshIndices.end(), box.Indices.begin(), box.Indices.end());
-    D3D11_BUFFER_DESC ibd;
-    ibd.Usage = D3D11_USAGE_IMMUTABLE;
-    ibd.ByteWidth = sizeof(UINT)* totalIndexCount;
-    ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    ibd.CPUAccessFlags = 0;
-    ibd.MiscFlags = 0;
-    D3D11_SUBRESOURCE_DATA iinitData;
-    iinitData.pSysMem = &m_MeshIndices[0];
-    HR(device->CreateBuffer(&ibd, &iinitData, &m_IndexBuffer));
+
+    SetMeshBox(m_Mesh->GetBounds());
 }
@@ -6,10 +6,20 @@ public:
     Box();
     virtual ~Box();
 
+    // Where the box swings and the texture it wears; call before Init.
+    void Place(const XMFLOAT3& center, const std::wstring& diffuseMap);
+
     virtual void Init(ID3D11Device* device);
     virtual void Release();
     virtual void Update(float dt);
     virtual void Render(ID3D11DeviceContext* context, CXMMATRIX viewProj);
+    virtual void RenderShadow(ID3D11DeviceContext* context, CXMMATRIX lightViewProj);
     virtual void CreateBuffer(ID3D11Device* device);
+    virtual BatchKey GetBatchKey() const;
+
+private:
+    float           m_Time;
+    XMFLOAT3        m_Center;
+    std::wstring    m_DiffuseMapFile;
 };
 
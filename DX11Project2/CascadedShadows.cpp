@@ -0,0 +1,415 @@
+//***************************************************************************************
+// CascadedShadows.cpp
+//***************************************************************************************
+
+#include "CascadedShadows.h"
+#include "Camera.h"
+#include "Random.h"
+#include "GameTimer.h"
+
+namespace
+{
+    // Weight of the logarithmic splits against the uniform ones.
+    const float SplitLambda = 0.75f;
+}
+
+CascadedShadows::CascadedShadows(ID3D11Device* device, UINT mapSize, float shadowDistance)
+:   m_MapSize(mapSize),
+    m_ShadowDistance(shadowDistance),
+    m_ShadowMap(nullptr),
+    m_SRV(nullptr)
+{
+    ZeroMemory(m_DSV, sizeof(m_DSV));
+    ZeroMemory(m_Splits, sizeof(m_Splits));
+    ZeroMemory(m_TexelSize, sizeof(m_TexelSize));
+    ZeroMemory(&m_Constants, sizeof(m_Constants));
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+    m_Viewport.TopLeftX = 0.0f;
+    m_Viewport.TopLeftY = 0.0f;
+    m_Viewport.Width = (float)m_MapSize;
+    m_Viewport.Height = (float)m_MapSize;
+    m_Viewport.MinDepth = 0.0f;
+    m_Viewport.MaxDepth = 1.0f;
+
+    if (!device)
+        return;
+
+    // One array slice per cascade, written as depth and read back as a texture.
+    D3D11_TEXTURE2D_DESC texDesc;
+    texDesc.Width = m_MapSize;
+    texDesc.Height = m_MapSize;
+    texDesc.MipLevels = 1;
+    texDesc.ArraySize = CascadeCount;
+    texDesc.Format = DXGI_FORMAT_R24G8_TYPELESS;
+    texDesc.SampleDesc.Count = 1;
+    texDesc.SampleDesc.Quality = 0;
+    texDesc.Usage = D3D11_USAGE_DEFAULT;
+    texDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+    texDesc.CPUAccessFlags = 0;
+    texDesc.MiscFlags = 0;
+    HR(device->CreateTexture2D(&texDesc, 0, &m_ShadowMap));
+
+    for (UINT i = 0; i < CascadeCount; ++i)
+    {
+        D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc;
+        dsvDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+        dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+        dsvDesc.Flags = 0;
+        dsvDesc.Texture2DArray.MipSlice = 0;
+        dsvDesc.Texture2DArray.FirstArraySlice = i;
+        dsvDesc.Texture2DArray.ArraySize = 1;
+        HR(device->CreateDepthStencilView(m_ShadowMap, &dsvDesc, &m_DSV[i]));
+    }
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+    srvDesc.Format = DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+    srvDesc.Texture2DArray.MostDetailedMip = 0;
+    srvDesc.Texture2DArray.MipLevels = 1;
+    srvDesc.Texture2DArray.FirstArraySlice = 0;
+    srvDesc.Texture2DArray.ArraySize = CascadeCount;
+    HR(device->CreateShaderResourceView(m_ShadowMap, &srvDesc, &m_SRV));
+}
+
+CascadedShadows::~CascadedShadows()
+{
+    ReleaseCOM(m_SRV);
+    for (UINT i = 0; i < CascadeCount; ++i)
+    {
+        ReleaseCOM(m_DSV[i]);
+    }
+    ReleaseCOM(m_ShadowMap);
+}
+
+void CascadedShadows::BeginCascade(ID3D11DeviceContext* dc, UINT cascade)
+{
+    // Depth only; a null render target disables color writes.
+    ID3D11RenderTargetView* renderTargets[1] = { 0 };
+    dc->OMSetRenderTargets(1, renderTargets, m_DSV[cascade]);
+    dc->RSSetViewports(1, &m_Viewport);
+    dc->ClearDepthStencilView(m_DSV[cascade], D3D11_CLEAR_DEPTH, 1.0f, 0);
+}
+
+#pragma region Fitting
+void CascadedShadows::Update(const Camera& cam, const XMFLOAT3& lightDir, const std::vector<XNA::AxisAlignedBox>& casters)
+{
+    double start = GameTimer::NowMs();
+
+    ComputeSplits(cam.GetNearZ());
+
+    // The light view has no translation, so light space does not follow the
+    // camera and texel snapping in it stays put from frame to frame.
+    XMVECTOR dir = XMVector3Normalize(XMLoadFloat3(&lightDir));
+    XMVECTOR up = (fabsf(XMVectorGetY(dir)) > 0.99f) ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+    XMMATRIX lightView = XMMatrixLookToLH(XMVectorZero(), dir, up);
+
+    // Light space depth of the caster closest to the light.
+    float minCasterZ = +MathHelper::Infinity;
+    XMVECTOR absDir = XMVectorAbs(dir);
+    for (auto& box : casters)
+    {
+        float z = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&box.Center), dir));
+        float r = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&box.Extents), absDir));
+        minCasterZ = MathHelper::Min(minCasterZ, z - r);
+    }
+
+    for (UINT i = 0; i < CascadeCount; ++i)
+    {
+        FitCascade(i, cam, lightView, minCasterZ);
+    }
+
+    m_Constants.CascadeSplits = XMFLOAT4(m_Splits[1], m_Splits[2], m_Splits[3], m_Splits[4]);
+    m_Constants.Params = XMFLOAT4(1.0f / m_MapSize, 0.0f, 0.0f, 0.0f);
+
+    m_Stats.Casters = casters.size();
+    m_Stats.Drawn = 0;
+    m_Stats.Culled = 0;
+    m_Stats.FitMs = GameTimer::NowMs() - start;
+}
+
+void CascadedShadows::ComputeSplits(float zn)
+{
+    // Practical split scheme: logarithmic splits keep the texel density even
+    // near the camera, the uniform share keeps far cascades from getting huge.
+    float zf = m_ShadowDistance;
+    for (UINT i = 0; i <= CascadeCount; ++i)
+    {
+        float s = (float)i / CascadeCount;
+        float logSplit = zn * powf(zf / zn, s);
+        float uniformSplit = zn + (zf - zn) * s;
+        m_Splits[i] = MathHelper::Lerp(uniformSplit, logSplit, SplitLambda);
+    }
+}
+
+void CascadedShadows::GetSliceCorners(const Camera& cam, float zn, float zf, XMVECTOR corners[8]) const
+{
+    float tanHalfX = 0.5f*cam.GetNearWindowWidth() / cam.GetNearZ();
+    float tanHalfY = 0.5f*cam.GetNearWindowHeight() / cam.GetNearZ();
+
+    XMVECTOR pos = cam.GetPositionXM();
+    XMVECTOR right = cam.GetRightXM();
+    XMVECTOR up = cam.GetUpXM();
+    XMVECTOR look = cam.GetLookXM();
+
+    for (UINT i = 0; i < 8; ++i)
+    {
+        float z = (i & 1) ? zf : zn;
+        float x = ((i & 2) ? 1.0f : -1.0f) * tanHalfX * z;
+        float y = ((i & 4) ? 1.0f : -1.0f) * tanHalfY * z;
+        corners[i] = pos + x*right + y*up + z*look;
+    }
+}
+
+void CascadedShadows::FitCascade(UINT cascade, const Camera& cam, CXMMATRIX lightView, float minCasterZ)
+{
+    float zn = m_Splits[cascade];
+    float zf = m_Splits[cascade + 1];
+
+    // Bounding sphere of the slice, centred on the view axis where it touches
+    // the near and far corners alike.  It only depends on the lens and the
+    // splits, so rotating the camera never changes the cascade size.
+    float tanHalfX = 0.5f*cam.GetNearWindowWidth() / cam.GetNearZ();
+    float tanHalfY = 0.5f*cam.GetNearWindowHeight() / cam.GetNearZ();
+    float k2 = tanHalfX*tanHalfX + tanHalfY*tanHalfY;
+    float centerZ = MathHelper::Min(0.5f*(zn + zf)*(1.0f + k2), zf);
+    float radius = MathHelper::Max(
+        sqrtf((zf - centerZ)*(zf - centerZ) + k2*zf*zf),
+        sqrtf((centerZ - zn)*(centerZ - zn) + k2*zn*zn));
+
+    XMVECTOR centerW = cam.GetPositionXM() + centerZ*cam.GetLookXM();
+    XMFLOAT3 center;
+    XMStoreFloat3(&center, XMVector3TransformCoord(centerW, lightView));
+
+    // Widen by two texels so the square still covers the sphere after its
+    // origin is snapped down to a whole texel.
+    float halfWidth = radius * m_MapSize / (m_MapSize - 2.0f);
+    float texel = 2.0f*halfWidth / m_MapSize;
+    float left = floorf((center.x - halfWidth) / texel) * texel;
+    float bottom = floorf((center.y - halfWidth) / texel) * texel;
+
+    // Pull the near plane back to the closest caster so that everything between
+    // the light and the slice casts into it.
+    float nearZ = MathHelper::Min(center.z - radius, minCasterZ) - 1.0f;
+    float farZ = center.z + radius;
+
+    XMMATRIX proj = XMMatrixOrthographicOffCenterLH(left, left + 2.0f*halfWidth, bottom, bottom + 2.0f*halfWidth, nearZ, farZ);
+    XMMATRIX viewProj = XMMatrixMultiply(lightView, proj);
+
+    // Transform NDC space [-1,+1]^2 to texture space [0,1]^2.
+    XMMATRIX toTexture(
+        0.5f, 0.0f, 0.0f, 0.0f,
+        0.0f, -0.5f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.5f, 0.5f, 0.0f, 1.0f);
+
+    XMStoreFloat4x4(&m_ViewProj[cascade], viewProj);
+    XMStoreFloat4x4(&m_Constants.ShadowTransforms[cascade], XMMatrixTranspose(XMMatrixMultiply(viewProj, toTexture)));
+    ExtractFrustumPlanes(m_Planes[cascade], viewProj);
+
+    m_TexelSize[cascade] = texel;
+    m_Origin[cascade] = XMFLOAT2(left, bottom);
+}
+#pragma endregion
+
+#pragma region Culling
+bool CascadedShadows::AabbBehindPlane(const XNA::AxisAlignedBox& box, FXMVECTOR plane)
+{
+    XMVECTOR center = XMLoadFloat3(&box.Center);
+    XMVECTOR extents = XMLoadFloat3(&box.Extents);
+
+    // Same test as AabbBehindPlaneTest in Terrain.fx.
+    float r = XMVectorGetX(XMVector3Dot(extents, XMVectorAbs(plane)));
+    float s = XMVectorGetX(XMPlaneDotCoord(plane, center));
+    return (s + r) < 0.0f;
+}
+
+void CascadedShadows::Cull(UINT cascade, const std::vector<XNA::AxisAlignedBox>& casters, std::vector<UINT>& visible)
+{
+    XMVECTOR planes[6];
+    for (UINT p = 0; p < 6; ++p)
+    {
+        planes[p] = XMLoadFloat4(&m_Planes[cascade][p]);
+    }
+
+    UINT drawn = 0;
+    for (UINT i = 0; i < casters.size(); ++i)
+    {
+        bool outside = false;
+        for (UINT p = 0; p < 6 && !outside; ++p)
+        {
+            outside = AabbBehindPlane(casters[i], planes[p]);
+        }
+
+        if (!outside)
+        {
+            visible.push_back(i);
+            ++drawn;
+        }
+    }
+
+    m_Stats.Drawn += drawn;
+    m_Stats.Culled += casters.size() - drawn;
+}
+
+void CascadedShadows::CullReference(UINT cascade, const std::vector<XNA::AxisAlignedBox>& casters, std::vector<UINT>& visible) const
+{
+    // The cascade volume is a box in light space, so a caster intersects it
+    // exactly when the light space bounds of its corners overlap the unit volume.
+    XMMATRIX viewProj = GetViewProj(cascade);
+    XMVECTOR volumeMin = XMVectorSet(-1.0f, -1.0f, 0.0f, 0.0f);
+    XMVECTOR volumeMax = XMVectorSet(+1.0f, +1.0f, 1.0f, 0.0f);
+
+    for (UINT i = 0; i < casters.size(); ++i)
+    {
+        XMVECTOR center = XMLoadFloat3(&casters[i].Center);
+        XMVECTOR extents = XMLoadFloat3(&casters[i].Extents);
+
+        XMVECTOR vMin = XMVectorReplicate(+MathHelper::Infinity);
+        XMVECTOR vMax = XMVectorReplicate(-MathHelper::Infinity);
+        for (UINT k = 0; k < 8; ++k)
+        {
+            XMVECTOR sign = XMVectorSet((k & 1) ? 1.0f : -1.0f, (k & 2) ? 1.0f : -1.0f, (k & 4) ? 1.0f : -1.0f, 0.0f);
+            XMVECTOR p = XMVector3TransformCoord(center + sign*extents, viewProj);
+            vMin = XMVectorMin(vMin, p);
+            vMax = XMVectorMax(vMax, p);
+        }
+
+        if (XMVector3GreaterOrEqual(vMax, volumeMin) && XMVector3LessOrEqual(vMin, volumeMax))
+            visible.push_back(i);
+    }
+}
+#pragma endregion
+
+#pragma region Validation
+UINT CascadedShadows::Validate(const Camera& cam, const XMFLOAT3& lightDir, const std::vector<XNA::AxisAlignedBox>& casters)
+{
+    Update(cam, lightDir, casters);
+
+    const float epsilon = 1e-3f;
+    UINT failures = 0;
+
+    if (fabsf(m_Splits[0] - cam.GetNearZ()) > epsilon || fabsf(m_Splits[CascadeCount] - m_ShadowDistance) > epsilon)
+        ++failures;
+
+    for (UINT c = 0; c < CascadeCount; ++c)
+    {
+        if (!(m_Splits[c] < m_Splits[c + 1]))
+            ++failures;
+
+        // Every corner of the camera slice has to land inside the cascade.
+        XMVECTOR corners[8];
+        GetSliceCorners(cam, m_Splits[c], m_Splits[c + 1], corners);
+        XMMATRIX viewProj = GetViewProj(c);
+        for (UINT k = 0; k < 8; ++k)
+        {
+            XMFLOAT3 p;
+            XMStoreFloat3(&p, XMVector3TransformCoord(corners[k], viewProj));
+            if (fabsf(p.x) > 1.0f + epsilon || fabsf(p.y) > 1.0f + epsilon || p.z < -epsilon || p.z > 1.0f + epsilon)
+                ++failures;
+        }
+
+        std::vector<UINT> visible, reference;
+        Cull(c, casters, visible);
+        CullReference(c, casters, reference);
+        if (visible != reference)
+            ++failures;
+    }
+
+    // Nudge the camera by less than the smallest texel.  Every cascade has to
+    // keep its size and either stay put or move by whole texels, so a fixed
+    // world point keeps its place inside its shadow map texel and the shadow
+    // edges do not shimmer.
+    float texelSize[CascadeCount];
+    XMFLOAT2 origin[CascadeCount];
+    XMFLOAT2 texelPos[CascadeCount];
+    XMVECTOR probe = cam.GetPositionXM() + 0.5f*(m_Splits[0] + m_Splits[1])*cam.GetLookXM() + 0.37f*cam.GetRightXM();
+    for (UINT c = 0; c < CascadeCount; ++c)
+    {
+        texelSize[c] = m_TexelSize[c];
+        origin[c] = m_Origin[c];
+        texelPos[c] = GetTexelPosition(c, probe);
+    }
+
+    Camera moved = cam;
+    float nudge = 0.4f*m_TexelSize[0];
+    XMFLOAT3 pos = cam.GetPosition();
+    moved.SetPosition(pos.x + nudge, pos.y - 0.5f*nudge, pos.z + 0.8f*nudge);
+    moved.UpdateViewMatrix();
+    Update(moved, lightDir, casters);
+
+    for (UINT c = 0; c < CascadeCount; ++c)
+    {
+        if (fabsf(m_TexelSize[c] - texelSize[c]) > 1e-5f*texelSize[c])
+            ++failures;
+
+        float dx = (m_Origin[c].x - origin[c].x) / texelSize[c];
+        float dy = (m_Origin[c].y - origin[c].y) / texelSize[c];
+        if (fabsf(dx - floorf(dx + 0.5f)) > 1e-2f || fabsf(dy - floorf(dy + 0.5f)) > 1e-2f)
+            ++failures;
+
+        XMFLOAT2 p = GetTexelPosition(c, probe);
+        float fx = p.x - texelPos[c].x;
+        float fy = p.y - texelPos[c].y;
+        if (fabsf(fx - floorf(fx + 0.5f)) > 1e-2f || fabsf(fy - floorf(fy + 0.5f)) > 1e-2f)
+            ++failures;
+    }
+
+    m_Stats.Drawn = 0;
+    m_Stats.Culled = 0;
+    return failures;
+}
+
+XMFLOAT2 CascadedShadows::GetTexelPosition(UINT cascade, FXMVECTOR posW) const
+{
+    XMFLOAT3 ndc;
+    XMStoreFloat3(&ndc, XMVector3TransformCoord(posW, GetViewProj(cascade)));
+    return XMFLOAT2((0.5f*ndc.x + 0.5f) * m_MapSize, (0.5f - 0.5f*ndc.y) * m_MapSize);
+}
+#pragma endregion
+
+#pragma region Testing
+UINT CascadedShadows::SelfTest()
+{
+    // Boxes strewn over the terrain like D3DManager's casters, plus one tall
+    // tower the near planes have to be pulled back to.
+    Random random(30);
+    std::vector<XNA::AxisAlignedBox> casters(200);
+    for (auto& box : casters)
+    {
+        box.Center = XMFLOAT3(random.NextFloat(-64.0f, 64.0f), random.NextFloat(0.0f, 30.0f), random.NextFloat(-64.0f, 64.0f));
+        box.Extents = XMFLOAT3(random.NextFloat(0.5f, 4.0f), random.NextFloat(0.5f, 4.0f), random.NextFloat(0.5f, 4.0f));
+    }
+    casters[0].Center = XMFLOAT3(20.0f, 100.0f, -10.0f);
+    casters[0].Extents = XMFLOAT3(2.0f, 100.0f, 2.0f);
+
+    Camera cam;
+    cam.SetLens(0.25f*MathHelper::Pi, 1280.0f / 720.0f, 1.0f, 1000.0f);
+    CascadedShadows shadows(nullptr, 2048, 200.0f);
+
+    // Across the field, straight down, and along the light from both sides.
+    const XMFLOAT3 eyes[][2] =
+    {
+        { XMFLOAT3(0.0f, 8.0f, -40.0f),     XMFLOAT3(0.0f, 5.0f, 0.0f) },
+        { XMFLOAT3(10.0f, 80.0f, 10.0f),    XMFLOAT3(10.5f, 0.0f, 10.0f) },
+        { XMFLOAT3(-30.0f, 30.0f, -30.0f),  XMFLOAT3(30.0f, -30.0f, 30.0f) },
+        { XMFLOAT3(30.0f, 5.0f, 30.0f),     XMFLOAT3(-30.0f, 20.0f, -30.0f) },
+    };
+    const XMFLOAT3 lightDirs[] =
+    {
+        XMFLOAT3(0.57735f, -0.57735f, 0.57735f),
+        XMFLOAT3(0.0f, -1.0f, 0.0f),
+        XMFLOAT3(-0.8f, -0.2f, 0.1f),
+    };
+
+    UINT failures = 0;
+    for (auto& eye : eyes)
+    {
+        cam.LookAt(eye[0], eye[1], XMFLOAT3(0.0f, 1.0f, 0.0f));
+        cam.UpdateViewMatrix();
+        for (auto& lightDir : lightDirs)
+            failures += shadows.Validate(cam, lightDir, casters);
+    }
+    return failures;
+}
+#pragma endregion
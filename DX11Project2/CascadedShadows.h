@@ -0,0 +1,116 @@
+//***************************************************************************************
+// CascadedShadows.h
+//
+// Cascaded shadow maps for one directional light, fitted on the CPU.
+//
+// The camera frustum up to the shadow distance is cut into CascadeCount slices
+// (practical split scheme).  Each slice gets an orthographic light projection
+// built around the slice's bounding sphere, whose size does not depend on the
+// camera orientation, and whose origin is snapped to whole shadow map texels,
+// so shadow edges do not shimmer while the camera moves.  The near plane of
+// every cascade is pulled back to the nearest caster so geometry between the
+// light and the slice still casts into it.
+//
+// Cull tests caster bounds against one cascade's volume; only the casters and
+// terrain patches it returns are drawn into that cascade.
+//
+// The device is optional: without one only the cascade fitting and culling are
+// available, which is all Validate needs.
+//***************************************************************************************
+
+#ifndef CASCADEDSHADOWS_H
+#define CASCADEDSHADOWS_H
+
+#include "d3dUtil.h"
+
+class Camera;
+
+// Must match cbShadows in FX/CascadedShadows.fx.  Matrices are stored
+// transposed since effect matrices are column major.
+struct ShadowConstants
+{
+    XMFLOAT4X4  ShadowTransforms[4];    // world to shadow map uv and depth, per cascade
+    XMFLOAT4    CascadeSplits;          // far view depth of each cascade
+    XMFLOAT4    Params;                 // x: shadow map texel size in uv
+};
+
+class CascadedShadows
+{
+public:
+    static const UINT CascadeCount = 4;
+
+    struct Stats
+    {
+        UINT    Casters;        // caster bounds tested per cascade
+        UINT    Drawn;          // caster draws summed over all cascades
+        UINT    Culled;         // caster draws skipped summed over all cascades
+        double  FitMs;
+    };
+
+public:
+    CascadedShadows(ID3D11Device* device, UINT mapSize, float shadowDistance);
+    ~CascadedShadows();
+
+    // Fits the cascades to 'cam' for a light shining along 'lightDir'.  'casters'
+    // are the world bounds of everything that can cast a shadow.
+    void    Update(const Camera& cam, const XMFLOAT3& lightDir, const std::vector<XNA::AxisAlignedBox>& casters);
+
+    // Appends the indices of the 'casters' that intersect 'cascade' to 'visible'.
+    void    Cull(UINT cascade, const std::vector<XNA::AxisAlignedBox>& casters, std::vector<UINT>& visible);
+
+    // Same as Cull, but projects every box corner into the cascade instead of using its planes.
+    void    CullReference(UINT cascade, const std::vector<XNA::AxisAlignedBox>& casters, std::vector<UINT>& visible) const;
+
+    // Fits the cascades and checks that the splits are ordered, that every camera
+    // slice lies inside its cascade and that Cull agrees with CullReference.  Then
+    // moves the camera by less than a texel and checks that the cascades moved by
+    // whole texels only.  Returns the number of failed checks.
+    UINT    Validate(const Camera& cam, const XMFLOAT3& lightDir, const std::vector<XNA::AxisAlignedBox>& casters);
+
+    // Validates a scattered scene without a device from several views and light
+    // directions.  Returns the number of failed checks.
+    static UINT SelfTest();
+
+    // Binds the depth view of 'cascade' with no color target and clears it.
+    void    BeginCascade(ID3D11DeviceContext* dc, UINT cascade);
+
+    XMMATRIX                    GetViewProj(UINT cascade) const { return XMLoadFloat4x4(&m_ViewProj[cascade]); }
+    float                       GetSplit(UINT i) const          { return m_Splits[i]; }
+    const ShadowConstants&      GetConstants() const            { return m_Constants; }
+    const Stats&                GetStats() const                { return m_Stats; }
+    ID3D11ShaderResourceView*   GetSRV() const                  { return m_SRV; }
+
+public:
+    CascadedShadows(const CascadedShadows& rhs)             = delete;
+    CascadedShadows& operator=(const CascadedShadows& rhs)  = delete;
+
+private:
+    void    ComputeSplits(float zn);
+    void    GetSliceCorners(const Camera& cam, float zn, float zf, XMVECTOR corners[8]) const;
+    void    FitCascade(UINT cascade, const Camera& cam, CXMMATRIX lightView, float minCasterZ);
+
+    // Shadow map texel coordinates of 'posW' in 'cascade', unclamped.
+    XMFLOAT2 GetTexelPosition(UINT cascade, FXMVECTOR posW) const;
+
+    static bool AabbBehindPlane(const XNA::AxisAlignedBox& box, FXMVECTOR plane);
+
+private:
+    UINT                        m_MapSize;
+    float                       m_ShadowDistance;
+
+    ID3D11Texture2D*            m_ShadowMap;
+    ID3D11DepthStencilView*     m_DSV[CascadeCount];
+    ID3D11ShaderResourceView*   m_SRV;
+    D3D11_VIEWPORT              m_Viewport;
+
+    float                       m_Splits[CascadeCount + 1];
+    XMFLOAT4X4                  m_ViewProj[CascadeCount];
+    XMFLOAT4                    m_Planes[CascadeCount][6];
+    float                       m_TexelSize[CascadeCount];      // world units per texel
+    XMFLOAT2                    m_Origin[CascadeCount];         // light space left/bottom of the cascade
+
+    ShadowConstants             m_Constants;
+    Stats                       m_Stats;
+};
+
+#endif // CASCADEDSHADOWS_H
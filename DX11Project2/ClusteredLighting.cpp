@@ -0,0 +1,607 @@
+//***************************************************************************************
+// ClusteredLighting.cpp
+//***************************************************************************************
+
+#include "ClusteredLighting.h"
+#include "Random.h"
+#include "GameTimer.h"
+#include <ppl.h>
+
+namespace
+{
+    // Lights whose falloff is below this are treated as out of the cone.
+    const float SpotCutoff = 1.0f / 256.0f;
+}
+
+ClusteredLighting::ClusteredLighting(ID3D11Device* device)
+:   m_PointLightBuffer(nullptr),
+    m_SpotLightBuffer(nullptr),
+    m_GridBuffer(nullptr),
+    m_IndexBuffer(nullptr),
+    m_PointLightSRV(nullptr),
+    m_SpotLightSRV(nullptr),
+    m_GridSRV(nullptr),
+    m_IndexSRV(nullptr)
+{
+    ZeroMemory(&m_Constants, sizeof(m_Constants));
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+    ZeroMemory(m_SliceDepth, sizeof(m_SliceDepth));
+
+    m_Bounds.resize(ClusterCount);
+    m_ClusterLights.resize(ClusterCount * MaxLightsPerCluster);
+    m_ClusterCounts.resize(ClusterCount);
+    m_Grid.resize(ClusterCount);
+    m_Indices.reserve(ClusterCount * MaxLightsPerCluster);
+
+    if (device)
+    {
+        CreateBuffer(device, sizeof(PointLight), MaxPointLights, &m_PointLightBuffer, &m_PointLightSRV);
+        CreateBuffer(device, sizeof(SpotLight), MaxSpotLights, &m_SpotLightBuffer, &m_SpotLightSRV);
+        CreateBuffer(device, sizeof(ClusterRange), ClusterCount, &m_GridBuffer, &m_GridSRV);
+        CreateBuffer(device, sizeof(UINT), ClusterCount * MaxLightsPerCluster, &m_IndexBuffer, &m_IndexSRV);
+    }
+}
+
+ClusteredLighting::~ClusteredLighting()
+{
+    ReleaseCOM(m_IndexSRV);
+    ReleaseCOM(m_GridSRV);
+    ReleaseCOM(m_SpotLightSRV);
+    ReleaseCOM(m_PointLightSRV);
+    ReleaseCOM(m_IndexBuffer);
+    ReleaseCOM(m_GridBuffer);
+    ReleaseCOM(m_SpotLightBuffer);
+    ReleaseCOM(m_PointLightBuffer);
+}
+
+void ClusteredLighting::CreateBuffer(ID3D11Device* device, UINT stride, UINT count,
+                                     ID3D11Buffer** buffer, ID3D11ShaderResourceView** srv)
+{
+    D3D11_BUFFER_DESC bd;
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.ByteWidth = stride * count;
+    bd.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bd.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    bd.StructureByteStride = stride;
+    HR(device->CreateBuffer(&bd, 0, buffer));
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+    srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    srvDesc.Buffer.FirstElement = 0;
+    srvDesc.Buffer.NumElements = count;
+    HR(device->CreateShaderResourceView(*buffer, &srvDesc, srv));
+}
+
+void ClusteredLighting::SetLens(float fovY, float aspect, float zn, float zf, int clientWidth, int clientHeight)
+{
+    float logRange = log(zf / zn) / log(2.0f);
+    m_Constants.Scale.x = (float)TilesX / clientWidth;
+    m_Constants.Scale.y = (float)TilesY / clientHeight;
+    m_Constants.Scale.z = Slices / logRange;
+    m_Constants.Scale.w = -(float)Slices * (log(zn) / log(2.0f)) / logRange;
+    m_Constants.Dims[0] = TilesX;
+    m_Constants.Dims[1] = TilesY;
+    m_Constants.Dims[2] = Slices;
+    m_Constants.Dims[3] = 0;
+
+    // Exponential slicing keeps clusters roughly cubic along the view direction.
+    for (UINT z = 0; z <= Slices; ++z)
+    {
+        m_SliceDepth[z] = zn * powf(zf / zn, (float)z / Slices);
+    }
+
+    float tanHalfY = tanf(0.5f*fovY);
+    float tanHalfX = aspect * tanHalfY;
+
+    for (UINT z = 0; z < Slices; ++z)
+    {
+        float depth[2] = { m_SliceDepth[z], m_SliceDepth[z + 1] };
+        for (UINT y = 0; y < TilesY; ++y)
+        {
+            // Tile rows run top to bottom like SV_Position.
+            float ndcY[2] = { 1.0f - 2.0f*y / TilesY, 1.0f - 2.0f*(y + 1) / TilesY };
+            for (UINT x = 0; x < TilesX; ++x)
+            {
+                float ndcX[2] = { -1.0f + 2.0f*x / TilesX, -1.0f + 2.0f*(x + 1) / TilesX };
+
+                XMVECTOR vMin = XMVectorReplicate(+MathHelper::Infinity);
+                XMVECTOR vMax = XMVectorReplicate(-MathHelper::Infinity);
+                for (UINT i = 0; i < 8; ++i)
+                {
+                    float d = depth[i & 1];
+                    XMVECTOR p = XMVectorSet(ndcX[(i >> 1) & 1] * d * tanHalfX, ndcY[i >> 2] * d * tanHalfY, d, 0.0f);
+                    vMin = XMVectorMin(vMin, p);
+                    vMax = XMVectorMax(vMax, p);
+                }
+
+                ClusterBounds& b = m_Bounds[(z*TilesY + y)*TilesX + x];
+                XMStoreFloat3(&b.Min, vMin);
+                XMStoreFloat3(&b.Max, vMax);
+                XMStoreFloat3(&b.Center, 0.5f*(vMin + vMax));
+                b.Radius = XMVectorGetX(XMVector3Length(0.5f*(vMax - vMin)));
+            }
+        }
+    }
+}
+
+void ClusteredLighting::Update(ID3D11DeviceContext* dc, CXMMATRIX view,
+                               const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights)
+{
+    Bin(view, pointLights, spotLights);
+    if (m_IndexBuffer)
+        Upload(dc, pointLights, spotLights);
+}
+
+#pragma region Binning
+float ClusteredLighting::SpotCosAngle(const SpotLight& light)
+{
+    // The effect has no hard cone; cut it where pow(cos, Spot) drops below SpotCutoff.
+    if (light.Spot <= 0.0f)
+        return -1.0f;
+    return powf(SpotCutoff, 1.0f / light.Spot);
+}
+
+void ClusteredLighting::PrepareLights(CXMMATRIX view, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights)
+{
+    LightSoA* lists[2] = { &m_Points, &m_Spots };
+    for (auto soa : lists)
+    {
+        soa->X.clear(); soa->Y.clear(); soa->Z.clear(); soa->RadiusSq.clear();
+        soa->MinZ.clear(); soa->MaxZ.clear();
+        soa->DirX.clear(); soa->DirY.clear(); soa->DirZ.clear();
+        soa->Range.clear(); soa->CosAngle.clear(); soa->SinAngle.clear();
+        soa->Count = 0;
+    }
+
+    UINT pointCount = std::min((UINT)pointLights.size(), MaxPointLights);
+    for (UINT i = 0; i < pointCount; ++i)
+    {
+        const PointLight& light = pointLights[i];
+        XMFLOAT3 posV;
+        XMStoreFloat3(&posV, XMVector3TransformCoord(XMLoadFloat3(&light.Position), view));
+
+        m_Points.X.push_back(posV.x);
+        m_Points.Y.push_back(posV.y);
+        m_Points.Z.push_back(posV.z);
+        m_Points.RadiusSq.push_back(light.Range * light.Range);
+        m_Points.MinZ.push_back(posV.z - light.Range);
+        m_Points.MaxZ.push_back(posV.z + light.Range);
+    }
+    m_Points.Count = pointCount;
+
+    UINT spotCount = std::min((UINT)spotLights.size(), MaxSpotLights);
+    for (UINT i = 0; i < spotCount; ++i)
+    {
+        const SpotLight& light = spotLights[i];
+        XMFLOAT3 posV, dirV;
+        XMStoreFloat3(&posV, XMVector3TransformCoord(XMLoadFloat3(&light.Position), view));
+        XMStoreFloat3(&dirV, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&light.Direction), view)));
+        float cosAngle = SpotCosAngle(light);
+
+        m_Spots.X.push_back(posV.x);
+        m_Spots.Y.push_back(posV.y);
+        m_Spots.Z.push_back(posV.z);
+        m_Spots.RadiusSq.push_back(light.Range * light.Range);
+        m_Spots.MinZ.push_back(posV.z - light.Range);
+        m_Spots.MaxZ.push_back(posV.z + light.Range);
+        m_Spots.DirX.push_back(dirV.x);
+        m_Spots.DirY.push_back(dirV.y);
+        m_Spots.DirZ.push_back(dirV.z);
+        m_Spots.Range.push_back(light.Range);
+        m_Spots.CosAngle.push_back(cosAngle);
+        m_Spots.SinAngle.push_back(sqrtf(1.0f - cosAngle*cosAngle));
+    }
+    m_Spots.Count = spotCount;
+}
+
+void ClusteredLighting::Append(LightSoA& dst, const LightSoA& src, UINT i, bool spot)
+{
+    dst.X.push_back(src.X[i]);
+    dst.Y.push_back(src.Y[i]);
+    dst.Z.push_back(src.Z[i]);
+    dst.RadiusSq.push_back(src.RadiusSq[i]);
+    if (spot)
+    {
+        dst.DirX.push_back(src.DirX[i]);
+        dst.DirY.push_back(src.DirY[i]);
+        dst.DirZ.push_back(src.DirZ[i]);
+        dst.Range.push_back(src.Range[i]);
+        dst.CosAngle.push_back(src.CosAngle[i]);
+        dst.SinAngle.push_back(src.SinAngle[i]);
+    }
+    ++dst.Count;
+}
+
+void ClusteredLighting::PadToFour(LightSoA& soa, bool spot)
+{
+    // A negative squared radius never passes the sphere test.
+    while (soa.X.size() % 4)
+    {
+        soa.X.push_back(0.0f);
+        soa.Y.push_back(0.0f);
+        soa.Z.push_back(0.0f);
+        soa.RadiusSq.push_back(-1.0f);
+        if (spot)
+        {
+            soa.DirX.push_back(0.0f);
+            soa.DirY.push_back(0.0f);
+            soa.DirZ.push_back(1.0f);
+            soa.Range.push_back(0.0f);
+            soa.CosAngle.push_back(1.0f);
+            soa.SinAngle.push_back(0.0f);
+        }
+    }
+}
+
+void ClusteredLighting::Bin(CXMMATRIX view, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights)
+{
+    double start = GameTimer::NowMs();
+
+    PrepareLights(view, pointLights, spotLights);
+    concurrency::parallel_for(0u, Slices, [this](UINT slice) { BinSlice(slice); });
+    Compact();
+
+    m_Stats.PointLights = m_Points.Count;
+    m_Stats.SpotLights = m_Spots.Count;
+    m_Stats.BinMs = GameTimer::NowMs() - start;
+}
+
+void ClusteredLighting::BinSlice(UINT slice)
+{
+    float sliceNear = m_SliceDepth[slice];
+    float sliceFar = m_SliceDepth[slice + 1];
+
+    SliceScratch& scratch = m_Scratch[slice];
+    LightSoA* lists[2] = { &scratch.Points, &scratch.Spots };
+    for (auto soa : lists)
+    {
+        soa->X.clear(); soa->Y.clear(); soa->Z.clear(); soa->RadiusSq.clear();
+        soa->DirX.clear(); soa->DirY.clear(); soa->DirZ.clear();
+        soa->Range.clear(); soa->CosAngle.clear(); soa->SinAngle.clear();
+        soa->Count = 0;
+    }
+    scratch.PointIndex.clear();
+    scratch.SpotIndex.clear();
+
+    for (UINT i = 0; i < m_Points.Count; ++i)
+    {
+        if (m_Points.MaxZ[i] >= sliceNear && m_Points.MinZ[i] <= sliceFar)
+        {
+            Append(scratch.Points, m_Points, i, false);
+            scratch.PointIndex.push_back(i);
+        }
+    }
+    for (UINT i = 0; i < m_Spots.Count; ++i)
+    {
+        if (m_Spots.MaxZ[i] >= sliceNear && m_Spots.MinZ[i] <= sliceFar)
+        {
+            Append(scratch.Spots, m_Spots, i, true);
+            scratch.SpotIndex.push_back(i);
+        }
+    }
+    PadToFour(scratch.Points, false);
+    PadToFour(scratch.Spots, true);
+
+    const LightSoA& points = scratch.Points;
+    const LightSoA& spots = scratch.Spots;
+    XMVECTOR zero = XMVectorZero();
+
+    for (UINT c = slice*TilesX*TilesY; c < (slice + 1)*TilesX*TilesY; ++c)
+    {
+        const ClusterBounds& b = m_Bounds[c];
+        XMVECTOR minX = XMVectorReplicate(b.Min.x), maxX = XMVectorReplicate(b.Max.x);
+        XMVECTOR minY = XMVectorReplicate(b.Min.y), maxY = XMVectorReplicate(b.Max.y);
+        XMVECTOR minZ = XMVectorReplicate(b.Min.z), maxZ = XMVectorReplicate(b.Max.z);
+
+        USHORT* out = &m_ClusterLights[c * MaxLightsPerCluster];
+        UINT count = 0;
+        bool overflow = false;
+
+        // Sphere vs. box for four point lights at a time.
+        for (UINT i = 0; i < points.X.size(); i += 4)
+        {
+            XMVECTOR x = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&points.X[i]));
+            XMVECTOR y = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&points.Y[i]));
+            XMVECTOR z = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&points.Z[i]));
+            XMVECTOR r2 = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&points.RadiusSq[i]));
+
+            XMVECTOR dx = XMVectorMax(minX - x, zero) + XMVectorMax(x - maxX, zero);
+            XMVECTOR dy = XMVectorMax(minY - y, zero) + XMVectorMax(y - maxY, zero);
+            XMVECTOR dz = XMVectorMax(minZ - z, zero) + XMVectorMax(z - maxZ, zero);
+            XMVECTOR distSq = dx*dx + dy*dy + dz*dz;
+
+            UINT hit[4];
+            XMStoreInt4(hit, XMVectorLessOrEqual(distSq, r2));
+            for (UINT k = 0; k < 4; ++k)
+            {
+                if (!hit[k])
+                    continue;
+                if (count == MaxLightsPerCluster) { overflow = true; break; }
+                out[count++] = (USHORT)scratch.PointIndex[i + k];
+            }
+        }
+        UINT pointCount = count;
+
+        // Sphere vs. box, then cone vs. the cluster's bounding sphere.
+        XMVECTOR centerX = XMVectorReplicate(b.Center.x);
+        XMVECTOR centerY = XMVectorReplicate(b.Center.y);
+        XMVECTOR centerZ = XMVectorReplicate(b.Center.z);
+        XMVECTOR radius = XMVectorReplicate(b.Radius);
+        for (UINT i = 0; i < spots.X.size(); i += 4)
+        {
+            XMVECTOR x = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&spots.X[i]));
+            XMVECTOR y = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&spots.Y[i]));
+            XMVECTOR z = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&spots.Z[i]));
+            XMVECTOR r2 = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&spots.RadiusSq[i]));
+
+            XMVECTOR dx = XMVectorMax(minX - x, zero) + XMVectorMax(x - maxX, zero);
+            XMVECTOR dy = XMVectorMax(minY - y, zero) + XMVectorMax(y - maxY, zero);
+            XMVECTOR dz = XMVectorMax(minZ - z, zero) + XMVectorMax(z - maxZ, zero);
+            XMVECTOR inRange = XMVectorLessOrEqual(dx*dx + dy*dy + dz*dz, r2);
+
+            XMVECTOR dirX = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&spots.DirX[i]));
+            XMVECTOR dirY = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&spots.DirY[i]));
+            XMVECTOR dirZ = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&spots.DirZ[i]));
+            XMVECTOR range = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&spots.Range[i]));
+            XMVECTOR cosAngle = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&spots.CosAngle[i]));
+            XMVECTOR sinAngle = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&spots.SinAngle[i]));
+
+            XMVECTOR vx = centerX - x;
+            XMVECTOR vy = centerY - y;
+            XMVECTOR vz = centerZ - z;
+            XMVECTOR lenSq = vx*vx + vy*vy + vz*vz;
+            XMVECTOR along = vx*dirX + vy*dirY + vz*dirZ;
+            XMVECTOR across = XMVectorSqrt(XMVectorMax(lenSq - along*along, zero));
+            XMVECTOR distToCone = cosAngle*across - along*sinAngle;
+
+            XMVECTOR inCone = XMVectorLessOrEqual(distToCone, radius);
+            XMVECTOR notPastEnd = XMVectorLessOrEqual(along, radius + range);
+            XMVECTOR notBehind = XMVectorOrInt(XMVectorGreaterOrEqual(along, -radius),
+                                               XMVectorLessOrEqual(cosAngle, zero));
+
+            XMVECTOR touches = XMVectorAndInt(XMVectorAndInt(inRange, inCone), XMVectorAndInt(notPastEnd, notBehind));
+
+            UINT hit[4];
+            XMStoreInt4(hit, touches);
+            for (UINT k = 0; k < 4; ++k)
+            {
+                if (!hit[k])
+                    continue;
+                if (count == MaxLightsPerCluster) { overflow = true; break; }
+                out[count++] = (USHORT)scratch.SpotIndex[i + k];
+            }
+        }
+
+        ClusterRange& counts = m_ClusterCounts[c];
+        counts.Offset = 0;
+        counts.PointCount = pointCount;
+        counts.SpotCount = count - pointCount;
+        counts.Pad = overflow ? 1 : 0;
+    }
+}
+
+void ClusteredLighting::Compact()
+{
+    m_Indices.clear();
+    m_Stats.MaxClusterLights = 0;
+    m_Stats.Overflows = 0;
+
+    for (UINT c = 0; c < ClusterCount; ++c)
+    {
+        const ClusterRange& counts = m_ClusterCounts[c];
+        UINT total = counts.PointCount + counts.SpotCount;
+
+        ClusterRange& range = m_Grid[c];
+        range.Offset = (UINT)m_Indices.size();
+        range.PointCount = counts.PointCount;
+        range.SpotCount = counts.SpotCount;
+        range.Pad = 0;
+
+        const USHORT* lights = &m_ClusterLights[c * MaxLightsPerCluster];
+        m_Indices.insert(m_Indices.end(), lights, lights + total);
+
+        m_Stats.MaxClusterLights = std::max(m_Stats.MaxClusterLights, total);
+        m_Stats.Overflows += counts.Pad;
+    }
+    m_Stats.IndexCount = (UINT)m_Indices.size();
+}
+
+void ClusteredLighting::Upload(ID3D11DeviceContext* dc, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights)
+{
+    D3D11_MAPPED_SUBRESOURCE mapped;
+
+    if (m_Points.Count)
+    {
+        HR(dc->Map(m_PointLightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+        memcpy(mapped.pData, &pointLights[0], m_Points.Count * sizeof(PointLight));
+        dc->Unmap(m_PointLightBuffer, 0);
+    }
+    if (m_Spots.Count)
+    {
+        HR(dc->Map(m_SpotLightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+        memcpy(mapped.pData, &spotLights[0], m_Spots.Count * sizeof(SpotLight));
+        dc->Unmap(m_SpotLightBuffer, 0);
+    }
+
+    HR(dc->Map(m_GridBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+    memcpy(mapped.pData, &m_Grid[0], m_Grid.size() * sizeof(ClusterRange));
+    dc->Unmap(m_GridBuffer, 0);
+
+    if (!m_Indices.empty())
+    {
+        HR(dc->Map(m_IndexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+        memcpy(mapped.pData, &m_Indices[0], m_Indices.size() * sizeof(UINT));
+        dc->Unmap(m_IndexBuffer, 0);
+    }
+}
+#pragma endregion
+
+#pragma region Reference
+bool ClusteredLighting::PointTouches(const ClusterBounds& b, const XMFLOAT3& pos, float range)
+{
+    float dx = std::max(b.Min.x - pos.x, 0.0f) + std::max(pos.x - b.Max.x, 0.0f);
+    float dy = std::max(b.Min.y - pos.y, 0.0f) + std::max(pos.y - b.Max.y, 0.0f);
+    float dz = std::max(b.Min.z - pos.z, 0.0f) + std::max(pos.z - b.Max.z, 0.0f);
+    return dx*dx + dy*dy + dz*dz <= range*range;
+}
+
+bool ClusteredLighting::SpotTouches(const ClusterBounds& b, const XMFLOAT3& pos, const XMFLOAT3& dir,
+                                    float range, float cosAngle, float sinAngle)
+{
+    if (!PointTouches(b, pos, range))
+        return false;
+
+    float vx = b.Center.x - pos.x;
+    float vy = b.Center.y - pos.y;
+    float vz = b.Center.z - pos.z;
+    float lenSq = vx*vx + vy*vy + vz*vz;
+    float along = vx*dir.x + vy*dir.y + vz*dir.z;
+    float across = sqrtf(std::max(lenSq - along*along, 0.0f));
+    float distToCone = cosAngle*across - along*sinAngle;
+
+    if (distToCone > b.Radius)
+        return false;
+    if (along > b.Radius + range)
+        return false;
+    if (along < -b.Radius && cosAngle > 0.0f)
+        return false;
+    return true;
+}
+
+void ClusteredLighting::BinReference(CXMMATRIX view, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights,
+                                     std::vector<ClusterRange>& grid, std::vector<UINT>& indices) const
+{
+    UINT pointCount = std::min((UINT)pointLights.size(), MaxPointLights);
+    UINT spotCount = std::min((UINT)spotLights.size(), MaxSpotLights);
+
+    grid.resize(ClusterCount);
+    indices.clear();
+
+    for (UINT c = 0; c < ClusterCount; ++c)
+    {
+        const ClusterBounds& b = m_Bounds[c];
+        ClusterRange& range = grid[c];
+        range.Offset = (UINT)indices.size();
+        range.PointCount = 0;
+        range.SpotCount = 0;
+        range.Pad = 0;
+
+        for (UINT i = 0; i < pointCount; ++i)
+        {
+            const PointLight& light = pointLights[i];
+            XMFLOAT3 posV;
+            XMStoreFloat3(&posV, XMVector3TransformCoord(XMLoadFloat3(&light.Position), view));
+
+            if (PointTouches(b, posV, light.Range))
+            {
+                indices.push_back(i);
+                ++range.PointCount;
+            }
+        }
+        for (UINT i = 0; i < spotCount; ++i)
+        {
+            const SpotLight& light = spotLights[i];
+            XMFLOAT3 posV, dirV;
+            XMStoreFloat3(&posV, XMVector3TransformCoord(XMLoadFloat3(&light.Position), view));
+            XMStoreFloat3(&dirV, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&light.Direction), view)));
+            float cosAngle = SpotCosAngle(light);
+
+            if (SpotTouches(b, posV, dirV, light.Range, cosAngle, sqrtf(1.0f - cosAngle*cosAngle)))
+            {
+                indices.push_back(i);
+                ++range.SpotCount;
+            }
+        }
+    }
+}
+
+UINT ClusteredLighting::Validate(CXMMATRIX view, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights)
+{
+    Bin(view, pointLights, spotLights);
+
+    std::vector<ClusterRange> refGrid;
+    std::vector<UINT> refIndices;
+    BinReference(view, pointLights, spotLights, refGrid, refIndices);
+
+    UINT mismatches = 0;
+    for (UINT c = 0; c < ClusterCount; ++c)
+    {
+        // Capped clusters cannot match the uncapped reference.
+        if (m_ClusterCounts[c].Pad)
+            continue;
+
+        const ClusterRange& a = m_Grid[c];
+        const ClusterRange& r = refGrid[c];
+        if (a.PointCount != r.PointCount || a.SpotCount != r.SpotCount)
+        {
+            ++mismatches;
+            continue;
+        }
+
+        UINT total = a.PointCount + a.SpotCount;
+        std::vector<UINT> binned(m_Indices.begin() + a.Offset, m_Indices.begin() + a.Offset + total);
+        std::vector<UINT> expected(refIndices.begin() + r.Offset, refIndices.begin() + r.Offset + total);
+        std::sort(binned.begin(), binned.begin() + a.PointCount);
+        std::sort(binned.begin() + a.PointCount, binned.end());
+        if (binned != expected)
+            ++mismatches;
+    }
+    return mismatches;
+}
+#pragma endregion
+
+#pragma region Testing
+UINT ClusteredLighting::SelfTest()
+{
+    // Lights scattered like D3DManager's over a 128 x 128 field, with a few
+    // piled up in one spot so that some clusters hit MaxLightsPerCluster.
+    Random random(29);
+    std::vector<PointLight> pointLights(300);
+    for (UINT i = 0; i < pointLights.size(); ++i)
+    {
+        PointLight& light = pointLights[i];
+        bool piled = i < 80;
+        light.Position = piled ?
+            XMFLOAT3(random.NextFloat(-1.0f, 1.0f), 5.0f, random.NextFloat(-1.0f, 1.0f)) :
+            XMFLOAT3(random.NextFloat(-64.0f, 64.0f), random.NextFloat(0.0f, 30.0f), random.NextFloat(-64.0f, 64.0f));
+        light.Range = random.NextFloat(2.0f, 12.0f);
+    }
+    std::vector<SpotLight> spotLights(40);
+    for (auto& light : spotLights)
+    {
+        light.Position = XMFLOAT3(random.NextFloat(-64.0f, 64.0f), random.NextFloat(10.0f, 40.0f), random.NextFloat(-64.0f, 64.0f));
+        XMStoreFloat3(&light.Direction, random.NextHemisphereUnitVec3(XMVectorSet(0.0f, -1.0f, 0.0f, 0.0f)));
+        light.Range = random.NextFloat(10.0f, 40.0f);
+        light.Spot = random.NextFloat(2.0f, 64.0f);
+    }
+
+    ClusteredLighting clusters(nullptr);
+    clusters.SetLens(0.25f*MathHelper::Pi, 1280.0f / 720.0f, 1.0f, 1000.0f, 1280, 720);
+
+    // From inside the field looking across it, from above looking down and
+    // from far outside, where most clusters are empty.
+    const XMFLOAT3 eyes[][2] =
+    {
+        { XMFLOAT3(0.0f, 8.0f, -40.0f),     XMFLOAT3(0.0f, 5.0f, 0.0f) },
+        { XMFLOAT3(10.0f, 80.0f, 10.0f),    XMFLOAT3(0.0f, 0.0f, 0.0f) },
+        { XMFLOAT3(-30.0f, 3.0f, 20.0f),    XMFLOAT3(40.0f, 10.0f, -30.0f) },
+        { XMFLOAT3(0.0f, 20.0f, -400.0f),   XMFLOAT3(0.0f, 0.0f, 0.0f) },
+    };
+
+    UINT failures = 0;
+    for (auto& eye : eyes)
+    {
+        XMMATRIX view = XMMatrixLookAtLH(XMLoadFloat3(&eye[0]), XMLoadFloat3(&eye[1]), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+        failures += clusters.Validate(view, pointLights, spotLights);
+    }
+
+    // The pile has to have filled some cluster, or the capping went untested.
+    XMMATRIX view = XMMatrixLookAtLH(XMLoadFloat3(&eyes[0][0]), XMLoadFloat3(&eyes[0][1]), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+    clusters.Bin(view, pointLights, spotLights);
+    if (clusters.GetStats().Overflows == 0 || clusters.GetStats().IndexCount == 0)
+        ++failures;
+    return failures;
+}
+#pragma endregion
@@ -0,0 +1,173 @@
+//***************************************************************************************
+// ClusteredLighting.h
+//
+// Bins point and spot lights into view space clusters (froxels) on the CPU.
+//
+// The frustum is split into TilesX * TilesY screen tiles and Slices exponential
+// depth slices.  Every frame the lights are moved to view space, each slice
+// gathers the lights overlapping its depth range and then tests them against
+// its clusters four at a time with XNA Math; slices are processed in parallel.
+// The per cluster lists are compacted into one index buffer that the shaders
+// read through FX/ClusteredLighting.fx.
+//
+// The device is optional: without one only the CPU binning is available, which
+// is enough to compare Bin against the brute force BinReference.
+//***************************************************************************************
+
+#ifndef CLUSTEREDLIGHTING_H
+#define CLUSTEREDLIGHTING_H
+
+#include "d3dUtil.h"
+
+// Must match cbClusters in FX/ClusteredLighting.fx.
+struct ClusterConstants
+{
+    XMFLOAT4    Scale;      // xy: tiles per pixel, z/w: log2(depth) to slice scale and bias
+    UINT        Dims[4];
+};
+
+class ClusteredLighting
+{
+public:
+    static const UINT TilesX = 16;
+    static const UINT TilesY = 9;
+    static const UINT Slices = 24;
+    static const UINT ClusterCount = TilesX * TilesY * Slices;
+
+    static const UINT MaxPointLights = 1024;
+    static const UINT MaxSpotLights = 256;
+    static const UINT MaxLightsPerCluster = 64;
+
+    // Must match ClusterRange in FX/ClusteredLighting.fx.
+    struct ClusterRange
+    {
+        UINT Offset;
+        UINT PointCount;
+        UINT SpotCount;
+        UINT Pad;
+    };
+
+    struct Stats
+    {
+        UINT    PointLights;
+        UINT    SpotLights;
+        UINT    IndexCount;         // total entries in the light index list
+        UINT    MaxClusterLights;   // longest list of any cluster
+        UINT    Overflows;          // clusters that hit MaxLightsPerCluster
+        double  BinMs;
+    };
+
+public:
+    explicit ClusteredLighting(ID3D11Device* device);
+    ~ClusteredLighting();
+
+    // Rebuilds the cluster bounds; call whenever the projection or the client size changes.
+    void    SetLens(float fovY, float aspect, float zn, float zf, int clientWidth, int clientHeight);
+
+    // Bins the lights against 'view' and uploads lights, grid and index list.
+    void    Update(ID3D11DeviceContext* dc, CXMMATRIX view,
+                   const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights);
+
+    // CPU part of Update.
+    void    Bin(CXMMATRIX view, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights);
+
+    // Scalar brute force version of Bin: every light against every cluster.
+    void    BinReference(CXMMATRIX view, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights,
+                         std::vector<ClusterRange>& grid, std::vector<UINT>& indices) const;
+
+    // Bins with both versions and returns the number of clusters whose light sets differ.
+    UINT    Validate(CXMMATRIX view, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights);
+
+    // Validates a scattered scene without a device from several views and
+    // checks that crowded clusters are capped.  Returns the number of failures.
+    static UINT SelfTest();
+
+    const ClusterConstants&     GetConstants() const        { return m_Constants; }
+    const std::vector<ClusterRange>& GetGrid() const        { return m_Grid; }
+    const std::vector<UINT>&    GetIndices() const          { return m_Indices; }
+    const Stats&                GetStats() const            { return m_Stats; }
+
+    ID3D11ShaderResourceView*   GetPointLightSRV() const    { return m_PointLightSRV; }
+    ID3D11ShaderResourceView*   GetSpotLightSRV() const     { return m_SpotLightSRV; }
+    ID3D11ShaderResourceView*   GetGridSRV() const          { return m_GridSRV; }
+    ID3D11ShaderResourceView*   GetIndexSRV() const         { return m_IndexSRV; }
+
+public:
+    ClusteredLighting(const ClusteredLighting& rhs)             = delete;
+    ClusteredLighting& operator=(const ClusteredLighting& rhs)  = delete;
+
+private:
+    // View space light data, structure of arrays padded to a multiple of four.
+    struct LightSoA
+    {
+        std::vector<float>  X, Y, Z, RadiusSq;
+        std::vector<float>  MinZ, MaxZ;
+        // Spot lights only.
+        std::vector<float>  DirX, DirY, DirZ, Range, CosAngle, SinAngle;
+        UINT                Count;
+    };
+
+    struct ClusterBounds
+    {
+        XMFLOAT3    Min;
+        XMFLOAT3    Max;
+        XMFLOAT3    Center;     // bounding sphere for the spot cone test
+        float       Radius;
+    };
+
+    static void Append(LightSoA& dst, const LightSoA& src, UINT i, bool spot);
+    static void PadToFour(LightSoA& soa, bool spot);
+
+    void    PrepareLights(CXMMATRIX view, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights);
+    void    BinSlice(UINT slice);
+    void    Compact();
+    void    Upload(ID3D11DeviceContext* dc, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights);
+
+    static float SpotCosAngle(const SpotLight& light);
+    static bool  PointTouches(const ClusterBounds& b, const XMFLOAT3& pos, float range);
+    static bool  SpotTouches(const ClusterBounds& b, const XMFLOAT3& pos, const XMFLOAT3& dir,
+                             float range, float cosAngle, float sinAngle);
+
+    void    CreateBuffer(ID3D11Device* device, UINT stride, UINT count,
+                         ID3D11Buffer** buffer, ID3D11ShaderResourceView** srv);
+
+private:
+    ID3D11Buffer*               m_PointLightBuffer;
+    ID3D11Buffer*               m_SpotLightBuffer;
+    ID3D11Buffer*               m_GridBuffer;
+    ID3D11Buffer*               m_IndexBuffer;
+    ID3D11ShaderResourceView*   m_PointLightSRV;
+    ID3D11ShaderResourceView*   m_SpotLightSRV;
+    ID3D11ShaderResourceView*   m_GridSRV;
+    ID3D11ShaderResourceView*   m_IndexSRV;
+
+    ClusterConstants            m_Constants;
+    std::vector<ClusterBounds>  m_Bounds;
+    float                       m_SliceDepth[Slices + 1];
+
+    LightSoA                    m_Points;
+    LightSoA                    m_Spots;
+
+    // Lights overlapping one slice's depth range, copied so they can be
+    // tested four at a time, plus their indices into the light lists.
+    struct SliceScratch
+    {
+        LightSoA            Points;
+        LightSoA            Spots;
+        std::vector<UINT>   PointIndex;
+        std::vector<UINT>   SpotIndex;
+    };
+
+    // Per slice scratch, and per cluster results (point indices first,
+    // then spot indices) before compaction.
+    SliceScratch                m_Scratch[Slices];
+    std::vector<USHORT>         m_ClusterLights;
+    std::vector<ClusterRange>   m_ClusterCounts;
+
+    std::vector<ClusterRange>   m_Grid;
+    std::vector<UINT>           m_Indices;
+
+    Stats                       m_Stats;
+};
+
+#endif // CLUSTEREDLIGHTING_H
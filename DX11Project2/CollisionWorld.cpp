@@ -0,0 +1,645 @@
+//***************************************************************************************
+// CollisionWorld.cpp
+//***************************************************************************************
+
+#include "CollisionWorld.h"
+#include "GameTimer.h"
+#include <ppl.h>
+
+namespace
+{
+    UINT64 MakeKey(UINT a, UINT b)
+    {
+        return a < b ? ((UINT64)a << 32) | b : ((UINT64)b << 32) | a;
+    }
+
+    // Extents of the box that encloses 'extents' after the rotation R.
+    XMVECTOR RotatedExtents(FXMVECTOR extents, CXMMATRIX R)
+    {
+        XMMATRIX absR;
+        absR.r[0] = XMVectorAbs(R.r[0]);
+        absR.r[1] = XMVectorAbs(R.r[1]);
+        absR.r[2] = XMVectorAbs(R.r[2]);
+        absR.r[3] = XMVectorZero();
+        return XMVector3TransformNormal(extents, absR);
+    }
+
+    struct TestRandom
+    {
+        explicit TestRandom(UINT seed) : State(seed) {}
+
+        float Next(float a, float b)
+        {
+            State = State * 1664525u + 1013904223u;
+            return a + (b - a) * (float)(State >> 8) / (float)(1 << 24);
+        }
+
+        UINT State;
+    };
+}
+
+CollisionWorld::CollisionWorld()
+{
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+#pragma region Bodies
+UINT CollisionWorld::CreateBody(const XNA::Sphere& sphere, UINT userData)
+{
+    Shape shape;
+    shape.Type = SphereShape;
+    shape.Center = sphere.Center;
+    shape.Extents = XMFLOAT3(sphere.Radius, sphere.Radius, sphere.Radius);
+    shape.Orientation = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+    return AddBody(shape, userData);
+}
+
+UINT CollisionWorld::CreateBody(const XNA::AxisAlignedBox& box, UINT userData)
+{
+    Shape shape;
+    shape.Type = BoxShape;
+    shape.Center = box.Center;
+    shape.Extents = box.Extents;
+    shape.Orientation = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+    return AddBody(shape, userData);
+}
+
+UINT CollisionWorld::CreateBody(const XNA::OrientedBox& box, UINT userData)
+{
+    Shape shape;
+    shape.Type = OrientedBoxShape;
+    shape.Center = box.Center;
+    shape.Extents = box.Extents;
+    shape.Orientation = box.Orientation;
+    return AddBody(shape, userData);
+}
+
+UINT CollisionWorld::AddBody(const Shape& local, UINT userData)
+{
+    UINT body;
+    if (!m_FreeBodies.empty())
+    {
+        body = m_FreeBodies.back();
+        m_FreeBodies.pop_back();
+    }
+    else
+    {
+        body = (UINT)m_Local.size();
+        m_Local.push_back(local);
+        m_World.push_back(local);
+        m_Min.push_back(XMFLOAT3());
+        m_Max.push_back(XMFLOAT3());
+        m_UserData.push_back(0);
+        m_Flags.push_back(0);
+    }
+
+    m_Local[body] = local;
+    m_World[body] = local;
+    m_UserData[body] = userData;
+    m_Flags[body] = Alive | Moved;
+    UpdateBounds(body);
+
+    m_Order.push_back(body);
+    return body;
+}
+
+void CollisionWorld::DestroyBody(UINT body)
+{
+    assert(body < m_Flags.size() && (m_Flags[body] & Alive));
+
+    // Step drops it from the sweep order.
+    m_Flags[body] = 0;
+    m_DestroyedBodies.push_back(body);
+}
+
+void CollisionWorld::Clear()
+{
+    m_Local.clear();
+    m_World.clear();
+    m_Min.clear();
+    m_Max.clear();
+    m_UserData.clear();
+    m_Flags.clear();
+    m_FreeBodies.clear();
+    m_DestroyedBodies.clear();
+    m_Order.clear();
+    m_Pairs.clear();
+    m_Contacts.clear();
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+void CollisionWorld::SetTransform(UINT body, FXMVECTOR scale, FXMVECTOR rotation, FXMVECTOR translation)
+{
+    assert(m_Flags[body] & Alive);
+
+    const Shape& local = m_Local[body];
+    Shape& world = m_World[body];
+    XMMATRIX R = XMMatrixRotationQuaternion(rotation);
+    XMVECTOR absScale = XMVectorAbs(scale);
+    XMVECTOR extents = XMLoadFloat3(&local.Extents) * absScale;
+
+    XMStoreFloat3(&world.Center, XMVector3TransformNormal(XMLoadFloat3(&local.Center) * scale, R) + translation);
+    switch (local.Type)
+    {
+    case SphereShape:
+    {
+        XMFLOAT3 e;
+        XMStoreFloat3(&e, extents);
+        float radius = MathHelper::Max(e.x, MathHelper::Max(e.y, e.z));
+        world.Extents = XMFLOAT3(radius, radius, radius);
+        break;
+    }
+    case BoxShape:
+        XMStoreFloat3(&world.Extents, RotatedExtents(extents, R));
+        break;
+    case OrientedBoxShape:
+        XMStoreFloat3(&world.Extents, extents);
+        XMStoreFloat4(&world.Orientation, XMQuaternionMultiply(XMLoadFloat4(&local.Orientation), rotation));
+        break;
+    }
+
+    m_Flags[body] |= Moved;
+    UpdateBounds(body);
+}
+
+void CollisionWorld::SetTransform(UINT body, CXMMATRIX world)
+{
+    XMVECTOR scale, rotation, translation;
+    XMMatrixDecompose(&scale, &rotation, &translation, world);
+    SetTransform(body, scale, rotation, translation);
+}
+
+void CollisionWorld::UpdateBounds(UINT body)
+{
+    const Shape& world = m_World[body];
+
+    XMVECTOR center = XMLoadFloat3(&world.Center);
+    XMVECTOR extents = XMLoadFloat3(&world.Extents);
+    if (world.Type == OrientedBoxShape)
+        extents = RotatedExtents(extents, XMMatrixRotationQuaternion(XMLoadFloat4(&world.Orientation)));
+
+    XMStoreFloat3(&m_Min[body], center - extents);
+    XMStoreFloat3(&m_Max[body], center + extents);
+}
+#pragma endregion
+
+#pragma region Step
+void CollisionWorld::Step()
+{
+    double start = GameTimer::NowMs();
+
+    // Broadphase: bounds that overlap on all three axes.
+    m_Order.erase(std::remove_if(m_Order.begin(), m_Order.end(),
+        [this](UINT body) { return !(m_Flags[body] & Alive); }), m_Order.end());
+    SortBodies();
+
+    const UINT count = (UINT)m_Order.size();
+    m_Sweep.resize(count);
+    for (UINT k = 0; k < count; ++k)
+    {
+        UINT body = m_Order[k];
+        m_Sweep[k].Min = m_Min[body];
+        m_Sweep[k].Max = m_Max[body];
+        m_Sweep[k].Body = body;
+    }
+
+    m_Candidates.clear();
+    if (count < ParallelThreshold)
+    {
+        FindPairs(0, count, m_Candidates);
+    }
+    else
+    {
+        // Every body scans on its own, so chunks of the order can run at once.
+        const UINT chunks = (count + ChunkSize - 1) / ChunkSize;
+        if (m_ChunkKeys.size() < chunks)
+            m_ChunkKeys.resize(chunks);
+
+        concurrency::parallel_for(0u, chunks, [&](UINT c)
+        {
+            m_ChunkKeys[c].clear();
+            FindPairs(c * ChunkSize, MathHelper::Min(count, (c + 1) * ChunkSize), m_ChunkKeys[c]);
+        });
+
+        for (UINT c = 0; c < chunks; ++c)
+            m_Candidates.insert(m_Candidates.end(), m_ChunkKeys[c].begin(), m_ChunkKeys[c].end());
+    }
+    std::sort(m_Candidates.begin(), m_Candidates.end());
+
+    m_Stats.BroadphaseMs = GameTimer::NowMs() - start;
+    start = GameTimer::NowMs();
+
+    // Narrowphase: only pairs without a cached result.
+    MergePairs();
+
+    const UINT tests = (UINT)m_Tests.size();
+    auto test = [this](UINT t)
+    {
+        Pair& pair = m_NewPairs[m_Tests[t]];
+        pair.Touching = Intersect(m_World[(UINT)(pair.Key >> 32)], m_World[(UINT)pair.Key]);
+    };
+    if (tests < ParallelThreshold)
+    {
+        for (UINT t = 0; t < tests; ++t)
+            test(t);
+    }
+    else
+    {
+        concurrency::parallel_for(0u, (tests + ChunkSize - 1) / ChunkSize, [&](UINT c)
+        {
+            for (UINT t = c * ChunkSize; t < MathHelper::Min(tests, (c + 1) * ChunkSize); ++t)
+                test(t);
+        });
+    }
+
+    // Contacts from the pairs of both steps, both sorted by key.
+    m_Contacts.clear();
+    UINT touching = 0;
+    UINT i = 0;
+    UINT j = 0;
+    while (i < m_Pairs.size() || j < m_NewPairs.size())
+    {
+        bool wasTouching = false;
+        bool isTouching = false;
+        UINT64 key;
+        if (j == m_NewPairs.size() || (i < m_Pairs.size() && m_Pairs[i].Key < m_NewPairs[j].Key))
+        {
+            key = m_Pairs[i].Key;
+            wasTouching = m_Pairs[i++].Touching;
+        }
+        else if (i == m_Pairs.size() || m_NewPairs[j].Key < m_Pairs[i].Key)
+        {
+            key = m_NewPairs[j].Key;
+            isTouching = m_NewPairs[j++].Touching;
+        }
+        else
+        {
+            key = m_NewPairs[j].Key;
+            wasTouching = m_Pairs[i++].Touching;
+            isTouching = m_NewPairs[j++].Touching;
+        }
+
+        if (!wasTouching && !isTouching)
+            continue;
+
+        Contact contact;
+        contact.BodyA = (UINT)(key >> 32);
+        contact.BodyB = (UINT)key;
+        contact.State = !isTouching ? Ended : wasTouching ? Persisting : Began;
+        m_Contacts.push_back(contact);
+        if (isTouching)
+            ++touching;
+    }
+    m_Pairs.swap(m_NewPairs);
+
+    for (auto& flags : m_Flags)
+        flags &= ~Moved;
+    m_FreeBodies.insert(m_FreeBodies.end(), m_DestroyedBodies.begin(), m_DestroyedBodies.end());
+    m_DestroyedBodies.clear();
+
+    m_Stats.Bodies = count;
+    m_Stats.Candidates = (UINT)m_Candidates.size();
+    m_Stats.Tested = tests;
+    m_Stats.Touching = touching;
+    m_Stats.NarrowphaseMs = GameTimer::NowMs() - start;
+}
+
+void CollisionWorld::SortBodies()
+{
+    // Nearly sorted from the last step: insertion sort, unless bodies jumped
+    // far enough to make it quadratic.
+    const UINT count = (UINT)m_Order.size();
+    const UINT budget = 8 * count + 64;
+    UINT moves = 0;
+    for (UINT i = 1; i < count; ++i)
+    {
+        UINT body = m_Order[i];
+        float key = m_Min[body].x;
+
+        UINT j = i;
+        while (j > 0 && m_Min[m_Order[j - 1]].x > key && moves < budget)
+        {
+            m_Order[j] = m_Order[j - 1];
+            --j;
+            ++moves;
+        }
+        m_Order[j] = body;
+
+        if (moves >= budget)
+        {
+            std::sort(m_Order.begin(), m_Order.end(),
+                [this](UINT a, UINT b) { return m_Min[a].x < m_Min[b].x; });
+            return;
+        }
+    }
+}
+
+void CollisionWorld::FindPairs(UINT begin, UINT end, std::vector<UINT64>& keys) const
+{
+    const UINT count = (UINT)m_Sweep.size();
+    for (UINT i = begin; i < end; ++i)
+    {
+        const SweepBox& a = m_Sweep[i];
+        for (UINT j = i + 1; j < count && m_Sweep[j].Min.x <= a.Max.x; ++j)
+        {
+            const SweepBox& b = m_Sweep[j];
+            if (a.Min.y <= b.Max.y && b.Min.y <= a.Max.y &&
+                a.Min.z <= b.Max.z && b.Min.z <= a.Max.z)
+                keys.push_back(MakeKey(a.Body, b.Body));
+        }
+    }
+}
+
+void CollisionWorld::MergePairs()
+{
+    m_NewPairs.resize(m_Candidates.size());
+    m_Tests.clear();
+
+    UINT i = 0;
+    for (UINT k = 0; k < m_Candidates.size(); ++k)
+    {
+        UINT64 key = m_Candidates[k];
+        Pair& pair = m_NewPairs[k];
+        pair.Key = key;
+        pair.Touching = false;
+
+        while (i < m_Pairs.size() && m_Pairs[i].Key < key)
+            ++i;
+
+        // Neither body moved: last step's answer still holds.
+        UINT a = (UINT)(key >> 32);
+        UINT b = (UINT)key;
+        if (i < m_Pairs.size() && m_Pairs[i].Key == key && !((m_Flags[a] | m_Flags[b]) & Moved))
+            pair.Touching = m_Pairs[i].Touching;
+        else
+            m_Tests.push_back(k);
+    }
+}
+
+// Fills in the volume of the shape's type.
+void CollisionWorld::ToVolume(const Shape& shape, XNA::Sphere& sphere, XNA::AxisAlignedBox& box, XNA::OrientedBox& oriented)
+{
+    switch (shape.Type)
+    {
+    case SphereShape:
+        sphere.Center = shape.Center;
+        sphere.Radius = shape.Extents.x;
+        break;
+    case BoxShape:
+        box.Center = shape.Center;
+        box.Extents = shape.Extents;
+        break;
+    case OrientedBoxShape:
+        oriented.Center = shape.Center;
+        oriented.Extents = shape.Extents;
+        oriented.Orientation = shape.Orientation;
+        break;
+    }
+}
+
+bool CollisionWorld::Intersect(const Shape& a, const Shape& b)
+{
+    if (a.Type > b.Type)
+        return Intersect(b, a);
+
+    XNA::Sphere sphereA, sphereB;
+    XNA::AxisAlignedBox boxA, boxB;
+    XNA::OrientedBox orientedA, orientedB;
+    ToVolume(a, sphereA, boxA, orientedA);
+    ToVolume(b, sphereB, boxB, orientedB);
+
+    switch (a.Type * ShapeTypeCount + b.Type)
+    {
+    case SphereShape * ShapeTypeCount + SphereShape:
+        return XNA::IntersectSphereSphere(&sphereA, &sphereB) != FALSE;
+    case SphereShape * ShapeTypeCount + BoxShape:
+        return XNA::IntersectSphereAxisAlignedBox(&sphereA, &boxB) != FALSE;
+    case SphereShape * ShapeTypeCount + OrientedBoxShape:
+        return XNA::IntersectSphereOrientedBox(&sphereA, &orientedB) != FALSE;
+    case BoxShape * ShapeTypeCount + BoxShape:
+        return XNA::IntersectAxisAlignedBoxAxisAlignedBox(&boxA, &boxB) != FALSE;
+    case BoxShape * ShapeTypeCount + OrientedBoxShape:
+        return XNA::IntersectAxisAlignedBoxOrientedBox(&boxA, &orientedB) != FALSE;
+    case OrientedBoxShape * ShapeTypeCount + OrientedBoxShape:
+        return XNA::IntersectOrientedBoxOrientedBox(&orientedA, &orientedB) != FALSE;
+    }
+    return false;
+}
+#pragma endregion
+
+#pragma region Validation
+UINT CollisionWorld::SelfTest()
+{
+    const UINT count = 300;
+    const float worldSize = 30.0f;
+
+    TestRandom random(4242);
+    CollisionWorld world;
+    UINT failures = 0;
+
+    std::vector<UINT> bodies(count, 0);
+    std::vector<XMFLOAT3> positions(count);
+    std::vector<bool> alive(count, false);
+
+    auto create = [&](UINT i)
+    {
+        switch (i % 3)
+        {
+        case 0:
+        {
+            XNA::Sphere sphere;
+            sphere.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+            sphere.Radius = random.Next(0.3f, 1.5f);
+            bodies[i] = world.CreateBody(sphere, i);
+            break;
+        }
+        case 1:
+        {
+            XNA::AxisAlignedBox box;
+            box.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+            box.Extents = XMFLOAT3(random.Next(0.3f, 1.5f), random.Next(0.3f, 1.5f), random.Next(0.3f, 1.5f));
+            bodies[i] = world.CreateBody(box, i);
+            break;
+        }
+        default:
+        {
+            XNA::OrientedBox box;
+            box.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+            box.Extents = XMFLOAT3(random.Next(0.3f, 1.5f), random.Next(0.3f, 1.5f), random.Next(0.3f, 1.5f));
+            box.Orientation = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+            bodies[i] = world.CreateBody(box, i);
+            break;
+        }
+        }
+        positions[i] = XMFLOAT3(random.Next(0.0f, worldSize), random.Next(0.0f, worldSize), random.Next(0.0f, worldSize));
+        alive[i] = true;
+    };
+
+    for (UINT i = 0; i < count; ++i)
+        create(i);
+
+    // What the contacts say is touching, to check Began, Persisting and Ended against.
+    std::vector<UINT64> touching;
+    std::vector<UINT64> expected;
+    std::vector<UINT64> stillTouching;
+
+    for (UINT step = 0; step < 40; ++step)
+    {
+        for (UINT i = 0; i < count; ++i)
+        {
+            if (alive[i] && i % 23 == step % 23)
+            {
+                world.DestroyBody(bodies[i]);
+                alive[i] = false;
+                continue;
+            }
+            if (!alive[i])
+                create(i);
+
+            // A third of the bodies stay put and keep their cached pairs.
+            if (i % 3 != 0 || step == 0)
+            {
+                XMFLOAT3& p = positions[i];
+                p = XMFLOAT3(p.x + random.Next(-0.5f, 0.5f), p.y + random.Next(-0.5f, 0.5f), p.z + random.Next(-0.5f, 0.5f));
+                XMVECTOR rotation = XMQuaternionRotationRollPitchYaw(random.Next(0.0f, 3.0f), random.Next(0.0f, 3.0f), 0.0f);
+                XMVECTOR scale = XMVectorSet(random.Next(0.5f, 1.5f), random.Next(0.5f, 1.5f), random.Next(0.5f, 1.5f), 0.0f);
+                world.SetTransform(bodies[i], scale, rotation, XMLoadFloat3(&p));
+            }
+        }
+
+        world.Step();
+
+        stillTouching.clear();
+        for (const Contact& contact : world.GetContacts())
+        {
+            UINT64 key = MakeKey(contact.BodyA, contact.BodyB);
+            bool known = std::binary_search(touching.begin(), touching.end(), key);
+            if (contact.BodyA >= contact.BodyB || known != (contact.State != Began))
+                ++failures;
+            if (contact.State != Ended)
+                stillTouching.push_back(key);
+        }
+        std::sort(stillTouching.begin(), stillTouching.end());
+
+        // Every pair that was touching and is not Ended must have been reported again.
+        for (UINT64 key : touching)
+        {
+            bool ended = false;
+            for (const Contact& contact : world.GetContacts())
+                ended |= contact.State == Ended && MakeKey(contact.BodyA, contact.BodyB) == key;
+            if (!ended && !std::binary_search(stillTouching.begin(), stillTouching.end(), key))
+                ++failures;
+        }
+        touching.swap(stillTouching);
+
+        // Against every pair of live bodies.
+        expected.clear();
+        for (UINT a = 0; a < count; ++a)
+        {
+            for (UINT b = a + 1; b < count; ++b)
+            {
+                if (alive[a] && alive[b] && Intersect(world.m_World[bodies[a]], world.m_World[bodies[b]]))
+                    expected.push_back(MakeKey(bodies[a], bodies[b]));
+            }
+        }
+        std::sort(expected.begin(), expected.end());
+        if (expected != touching || world.GetStats().Touching != expected.size())
+            ++failures;
+    }
+
+    return failures;
+}
+
+CollisionWorld::BenchmarkResult CollisionWorld::Benchmark(UINT count, UINT frames)
+{
+    BenchmarkResult result;
+    ZeroMemory(&result, sizeof(result));
+    result.Count = count;
+    result.Frames = frames;
+
+    // A flat world like the terrain, with room for about one neighbour per body.
+    const float height = 20.0f;
+    const float worldSize = sqrtf(count * 125.0f / height);
+
+    TestRandom random(99);
+    CollisionWorld world;
+    std::vector<UINT> bodies(count);
+    std::vector<XMFLOAT3> positions(count);
+    std::vector<XMFLOAT3> velocities(count);
+    for (UINT i = 0; i < count; ++i)
+    {
+        if (i % 2)
+        {
+            XNA::Sphere sphere;
+            sphere.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+            sphere.Radius = random.Next(0.5f, 1.5f);
+            bodies[i] = world.CreateBody(sphere, i);
+        }
+        else
+        {
+            XNA::OrientedBox box;
+            box.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+            box.Extents = XMFLOAT3(random.Next(0.5f, 1.5f), random.Next(0.5f, 1.5f), random.Next(0.5f, 1.5f));
+            box.Orientation = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+            bodies[i] = world.CreateBody(box, i);
+        }
+
+        positions[i] = XMFLOAT3(random.Next(0.0f, worldSize), random.Next(0.0f, height), random.Next(0.0f, worldSize));
+
+        // A quarter of the bodies rest.
+        float speed = i % 4 ? 0.05f : 0.0f;
+        velocities[i] = XMFLOAT3(random.Next(-speed, speed), random.Next(-speed, speed), random.Next(-speed, speed));
+        world.SetTransform(bodies[i], XMVectorReplicate(1.0f), XMQuaternionIdentity(), XMLoadFloat3(&positions[i]));
+    }
+    world.Step();
+
+    UINT64 candidates = 0;
+    for (UINT f = 0; f < frames; ++f)
+    {
+        for (UINT i = 0; i < count; ++i)
+        {
+            if (i % 4 == 0)
+                continue;
+
+            XMFLOAT3& p = positions[i];
+            XMFLOAT3& v = velocities[i];
+            p = XMFLOAT3(p.x + v.x, p.y + v.y, p.z + v.z);
+            if (p.x < 0.0f || p.x > worldSize) v.x = -v.x;
+            if (p.y < 0.0f || p.y > height) v.y = -v.y;
+            if (p.z < 0.0f || p.z > worldSize) v.z = -v.z;
+            world.SetTransform(bodies[i], XMVectorReplicate(1.0f),
+                XMQuaternionRotationRollPitchYaw(0.0f, 0.01f * (f + i), 0.0f), XMLoadFloat3(&p));
+        }
+
+        world.Step();
+        result.BroadphaseMs += world.GetStats().BroadphaseMs;
+        result.NarrowphaseMs += world.GetStats().NarrowphaseMs;
+        candidates += world.GetStats().Candidates;
+    }
+
+    // All pairs of bounds, once; it grows with the square of the count.
+    double start = GameTimer::NowMs();
+    UINT bruteCandidates = 0;
+    for (UINT a = 0; a < count; ++a)
+    {
+        const XMFLOAT3& minA = world.m_Min[bodies[a]];
+        const XMFLOAT3& maxA = world.m_Max[bodies[a]];
+        for (UINT b = a + 1; b < count; ++b)
+        {
+            const XMFLOAT3& minB = world.m_Min[bodies[b]];
+            const XMFLOAT3& maxB = world.m_Max[bodies[b]];
+            if (minA.x <= maxB.x && minB.x <= maxA.x && minA.y <= maxB.y && minB.y <= maxA.y &&
+                minA.z <= maxB.z && minB.z <= maxA.z)
+                ++bruteCandidates;
+        }
+    }
+    result.BruteForceMs = GameTimer::NowMs() - start;
+    assert(bruteCandidates == world.GetStats().Candidates);
+
+    result.Candidates = (UINT)(candidates / frames);
+    result.Touching = world.GetStats().Touching;
+    result.BroadphaseMs /= frames;
+    result.NarrowphaseMs /= frames;
+    return result;
+}
+#pragma endregion
@@ -0,0 +1,169 @@
+//***************************************************************************************
+// CollisionWorld.h
+//
+// Finds which bodies touch, once per Step.  A body is a sphere, an axis aligned
+// box or an oriented box in its own space, placed in the world by SetTransform.
+//
+// The broadphase keeps the bodies sorted by the low x of their world bounds;
+// the order barely changes between steps, so an insertion sort keeps it up to
+// date, and each body then only scans forward over the bodies that start
+// before it ends on x.  The narrowphase sends every candidate pair to the
+// XNA::Intersect* test for its two shape types.  Both run in parallel chunks
+// once there is enough work.
+//
+// Pairs are cached from step to step: a pair whose bodies did not move since
+// the last Step keeps its result without another test, and GetContacts lists
+// each touching pair as Began or Persisting, and each pair that stopped
+// touching as Ended.  An Ended contact may name a body destroyed since the last
+// Step; its id is not handed out again before the following Step.
+//***************************************************************************************
+
+#ifndef COLLISIONWORLD_H
+#define COLLISIONWORLD_H
+
+#include "d3dUtil.h"
+
+class CollisionWorld
+{
+public:
+    enum ShapeType
+    {
+        SphereShape,
+        BoxShape,               // stays axis aligned; the world box encloses the rotated one
+        OrientedBoxShape,
+        ShapeTypeCount
+    };
+
+    enum ContactState
+    {
+        Began,
+        Persisting,
+        Ended,
+    };
+
+    struct Contact
+    {
+        UINT            BodyA;
+        UINT            BodyB;  // BodyA < BodyB
+        ContactState    State;
+    };
+
+    struct Stats
+    {
+        UINT    Bodies;
+        UINT    Candidates;     // pairs whose world bounds overlap
+        UINT    Tested;         // candidates sent to the narrowphase
+        UINT    Touching;
+        double  BroadphaseMs;
+        double  NarrowphaseMs;
+    };
+
+    struct BenchmarkResult
+    {
+        UINT    Count;
+        UINT    Frames;
+        UINT    Candidates;     // per frame, on average
+        UINT    Touching;
+        double  BroadphaseMs;   // per frame
+        double  NarrowphaseMs;
+        double  BruteForceMs;   // one pass of the bounds of every body against every other
+    };
+
+public:
+    CollisionWorld();
+
+    UINT    CreateBody(const XNA::Sphere& sphere, UINT userData);
+    UINT    CreateBody(const XNA::AxisAlignedBox& box, UINT userData);
+    UINT    CreateBody(const XNA::OrientedBox& box, UINT userData);
+    void    DestroyBody(UINT body);
+    void    Clear();
+
+    // Scale stretches the shape along its own axes, then it is rotated and moved.
+    void    SetTransform(UINT body, FXMVECTOR scale, FXMVECTOR rotation, FXMVECTOR translation);
+    void    SetTransform(UINT body, CXMMATRIX world);
+
+    UINT        GetUserData(UINT body) const    { return m_UserData[body]; }
+    ShapeType   GetShapeType(UINT body) const   { return m_Local[body].Type; }
+
+    void                        Step();
+    const std::vector<Contact>& GetContacts() const     { return m_Contacts; }
+    const Stats&                GetStats() const        { return m_Stats; }
+
+    // Checks the contacts of every step against testing every pair while bodies
+    // move, appear and go away.  Returns the number of mismatches.
+    static UINT             SelfTest();
+
+    // Steps 'count' moving bodies 'frames' times.
+    static BenchmarkResult  Benchmark(UINT count, UINT frames);
+
+public:
+    CollisionWorld(const CollisionWorld& rhs)               = delete;
+    CollisionWorld& operator=(const CollisionWorld& rhs)    = delete;
+
+private:
+    // Below this many bodies, or pairs to test, the work stays on the calling thread.
+    static const UINT ParallelThreshold = 4096;
+    static const UINT ChunkSize = 1024;
+
+    enum BodyFlags : BYTE
+    {
+        Alive   = 1 << 0,
+        Moved   = 1 << 1,       // since the last Step
+    };
+
+    // What the three XNA volumes need, in one layout.
+    struct Shape
+    {
+        ShapeType   Type;
+        XMFLOAT3    Center;
+        XMFLOAT3    Extents;        // the radius in x for spheres
+        XMFLOAT4    Orientation;    // oriented boxes only
+    };
+
+    // World bounds in sweep order.
+    struct SweepBox
+    {
+        XMFLOAT3    Min;
+        XMFLOAT3    Max;
+        UINT        Body;
+    };
+
+    struct Pair
+    {
+        UINT64      Key;        // lower body id in the high half
+        bool        Touching;
+    };
+
+    UINT    AddBody(const Shape& local, UINT userData);
+    void    UpdateBounds(UINT body);
+    void    SortBodies();
+    void    FindPairs(UINT begin, UINT end, std::vector<UINT64>& keys) const;
+    void    MergePairs();
+
+    static void     ToVolume(const Shape& shape, XNA::Sphere& sphere, XNA::AxisAlignedBox& box, XNA::OrientedBox& oriented);
+    static bool     Intersect(const Shape& a, const Shape& b);
+
+private:
+    std::vector<Shape>      m_Local;
+    std::vector<Shape>      m_World;
+    std::vector<XMFLOAT3>   m_Min;
+    std::vector<XMFLOAT3>   m_Max;
+    std::vector<UINT>       m_UserData;
+    std::vector<BYTE>       m_Flags;
+    std::vector<UINT>       m_FreeBodies;
+    std::vector<UINT>       m_DestroyedBodies;  // free after the next Step
+
+    std::vector<UINT>       m_Order;            // live bodies by the low x of their bounds
+    std::vector<SweepBox>   m_Sweep;
+    std::vector<std::vector<UINT64>> m_ChunkKeys;
+    std::vector<UINT64>     m_Candidates;
+
+    std::vector<Pair>       m_Pairs;            // candidates of the last Step, sorted by key
+    std::vector<Pair>       m_NewPairs;
+    std::vector<UINT>       m_Tests;            // indices into m_NewPairs
+    std::vector<Contact>    m_Contacts;
+
+    Stats                   m_Stats;
+};
+
+#endif // COLLISIONWORLD_H
@@ -0,0 +1,95 @@
+//***************************************************************************************
+// ConstantBuffers.cpp
+//***************************************************************************************
+
+#include "ConstantBuffers.h"
+
+#pragma region ConstantBufferRing
+ConstantBufferRing::ConstantBufferRing(ID3D11Device* device, UINT sizeInBytes)
+:   m_Buffer(nullptr),
+    m_Size(sizeInBytes),
+    m_Head(sizeInBytes),    // first Map wraps, so the buffer always starts with a DISCARD
+    m_Mapped(false)
+{
+    ZeroMemory(&m_FrameStats, sizeof(m_FrameStats));
+    ZeroMemory(&m_LastFrameStats, sizeof(m_LastFrameStats));
+
+    D3D11_BUFFER_DESC bd;
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.ByteWidth = m_Size;
+    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bd.MiscFlags = 0;
+    bd.StructureByteStride = 0;
+    HR(device->CreateBuffer(&bd, 0, &m_Buffer));
+}
+
+ConstantBufferRing::~ConstantBufferRing()
+{
+    ReleaseCOM(m_Buffer);
+}
+
+void ConstantBufferRing::BeginFrame()
+{
+    m_LastFrameStats = m_FrameStats;
+    ZeroMemory(&m_FrameStats, sizeof(m_FrameStats));
+}
+
+void* ConstantBufferRing::Map(ID3D11DeviceContext* dc, UINT size, UINT* offset)
+{
+    assert(!m_Mapped);
+    assert(size <= m_Size);
+
+    UINT head = (m_Head + Alignment - 1) & ~(Alignment - 1);
+
+    // Append while the block fits; the GPU may still be reading earlier
+    // blocks, but NO_OVERWRITE promises we never touch them.  On wrap the
+    // driver hands out a fresh buffer and the old contents stay valid for
+    // draws already in flight.
+    D3D11_MAP mapType = D3D11_MAP_WRITE_NO_OVERWRITE;
+    if (head + size > m_Size)
+    {
+        mapType = D3D11_MAP_WRITE_DISCARD;
+        head = 0;
+        ++m_FrameStats.DiscardCount;
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    HR(dc->Map(m_Buffer, 0, mapType, 0, &mapped));
+    m_Mapped = true;
+
+    m_Head = head + size;
+    ++m_FrameStats.MapCount;
+    m_FrameStats.UploadBytes += size;
+
+    *offset = head;
+    return static_cast<BYTE*>(mapped.pData) + head;
+}
+
+void ConstantBufferRing::Unmap(ID3D11DeviceContext* dc)
+{
+    assert(m_Mapped);
+    dc->Unmap(m_Buffer, 0);
+    m_Mapped = false;
+}
+
+void ConstantBufferRing::Bind(ID3D11DeviceContext* dc, UINT slot, UINT stride, UINT offset)
+{
+    dc->IASetVertexBuffers(slot, 1, &m_Buffer, &stride, &offset);
+}
+#pragma endregion
+
+#pragma region ConstantBuffers
+ConstantBufferRing* ConstantBuffers::PerDraw = nullptr;
+
+void ConstantBuffers::InitAll(ID3D11Device* device)
+{
+    // 2MB holds ~6500 object blocks before the ring wraps.
+    PerDraw = new ConstantBufferRing(device, 2 * 1024 * 1024);
+}
+
+void ConstantBuffers::DestroyAll()
+{
+    SafeDelete(PerDraw);
+}
+#pragma endregion
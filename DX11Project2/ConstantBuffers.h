@@ -0,0 +1,93 @@
+//***************************************************************************************
+// ConstantBuffers.h
+//
+// Explicit per-draw constant storage that bypasses the effect framework.
+//
+// Per-object data is packed into one large dynamic buffer that is sub-allocated
+// front to back with D3D11_MAP_WRITE_NO_OVERWRITE and only discarded when it
+// wraps.  Feature level 11_0 can neither map constant buffers with NO_OVERWRITE
+// nor bind them at an offset, so the buffer is created as a vertex buffer and
+// bound to a per-instance input slot at the allocation offset; a non-instanced
+// draw fetches instance 0, i.e. exactly the block that was written for it.
+//***************************************************************************************
+
+#ifndef CONSTANTBUFFERS_H
+#define CONSTANTBUFFERS_H
+
+#include "d3dUtil.h"
+
+// Must match the per-instance elements of InputLayoutDesc::Basic32 and
+// the PerObject input struct in Basic.fx.
+struct PerObjectConstants
+{
+    XMFLOAT4X4  World;
+    XMFLOAT4X4  WorldInvTranspose;
+    XMFLOAT4X4  WorldViewProj;
+    XMFLOAT4X4  TexTransform;
+    Material    Mat;
+    UINT        DiffuseSlice;   // into the diffuse map array
+    UINT        Pad[3];
+};
+
+class ConstantBufferRing
+{
+public:
+    struct Stats
+    {
+        UINT MapCount;
+        UINT DiscardCount;
+        UINT UploadBytes;
+    };
+
+public:
+    ConstantBufferRing(ID3D11Device* device, UINT sizeInBytes);
+    ~ConstantBufferRing();
+
+    ID3D11Buffer*   GetBuffer() const           { return m_Buffer; }
+    UINT            GetSize() const             { return m_Size; }
+    const Stats&    GetFrameStats() const       { return m_FrameStats; }
+    const Stats&    GetLastFrameStats() const   { return m_LastFrameStats; }
+
+    // Call once per frame before any allocation.
+    void    BeginFrame();
+
+    // Maps 'size' bytes at the ring head and returns the write pointer.
+    // The byte offset of the block is returned through 'offset'.
+    // Every Map must be paired with Unmap before the block is drawn with.
+    void*   Map(ID3D11DeviceContext* dc, UINT size, UINT* offset);
+    void    Unmap(ID3D11DeviceContext* dc);
+
+    // Binds the buffer to input slot 'slot' starting at 'offset'.
+    void    Bind(ID3D11DeviceContext* dc, UINT slot, UINT stride, UINT offset);
+
+public:
+    ConstantBufferRing(const ConstantBufferRing& rhs)               = delete;
+    ConstantBufferRing& operator=(const ConstantBufferRing& rhs)    = delete;
+
+private:
+    // IASetVertexBuffers offsets only need 4 byte alignment, but keeping
+    // blocks 16 byte aligned keeps every matrix row on a cache-friendly boundary.
+    static const UINT Alignment = 16;
+
+    ID3D11Buffer*   m_Buffer;
+    UINT            m_Size;
+    UINT            m_Head;
+    bool            m_Mapped;
+
+    Stats           m_FrameStats;
+    Stats           m_LastFrameStats;
+};
+
+class ConstantBuffers
+{
+public:
+    static void InitAll(ID3D11Device* device);
+    static void DestroyAll();
+
+    // Input slot the per-draw ring is bound to.
+    static const UINT PerDrawSlot = 1;
+
+    static ConstantBufferRing* PerDraw;
+};
+
+#endif // CONSTANTBUFFERS_H
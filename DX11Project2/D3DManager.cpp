@@ -1,13 +1,16 @@
 #include "D3DManager.h"
 #include "InputManager.h"
 #include "Effects.h"
+#include "ConstantBuffers.h"
+#include "FrameConstants.h"
 #include "Vertex.h"
 #include "RenderStates.h"
-#include "BasisVector.h"
-#include "Box.h"
-#include "Land.h"
 #include "Sky.h"
 #include "Terrain.h"
+#include "ClusteredLighting.h"
+#include "CascadedShadows.h"
+#include "OcclusionCulling.h"
+#include "TextureArrays.h"
 
 #define MAX_OBJECT_NUM 100
 
@@ -20,6 +23,12 @@ D3DManager::D3DManager()
     m_DepthStencil(nullptr),
     m_DepthStencilView(nullptr),
     m_RenderTargetView(nullptr),
+    m_ClusteredLighting(nullptr),
+    m_Shadows(nullptr),
+    m_Occlusion(nullptr),
+    m_Land(nullptr),
+    m_LandEnabled(false),
+    m_SimulationThreaded(false),
     m_ClientWidth(800),
     m_ClientHeight(600),
     m_4xMsaaQuality(0),
@@ -27,6 +36,14 @@ D3DManager::D3DManager()
 {
     m_ObjectList.reserve(MAX_OBJECT_NUM);
     m_BlendObjectList.reserve(MAX_OBJECT_NUM);
+    m_VisibleObjects.reserve(MAX_OBJECT_NUM);
+    m_VisibleBlendObjects.reserve(MAX_OBJECT_NUM);
+    m_SceneProxies.reserve(2 * MAX_OBJECT_NUM);
+    m_FrustumHits.reserve(2 * MAX_OBJECT_NUM);
+    m_BatchOrder.reserve(MAX_OBJECT_NUM);
+    m_BatchObjects.reserve(Object::MaxBatchSize);
+    m_DrawStats.Draws = 0;
+    m_DrawStats.Objects = 0;
 }
 
 
@@ -42,41 +59,74 @@ bool D3DManager::InitDevice(HWND hWnd)
     CreateDeviceAndSwapChain(hWnd);
     SetRenderTargets();
     SetViewport();
+    InitScene();
+
+    Resize();
+
+    if (m_SimulationThreaded)
+        m_Simulation.StartThread([this](float dt) { Tick(dt); });
+
+    return true;
+}
+
+bool D3DManager::InitHeadless(int width, int height)
+{
+    m_ClientWidth = width;
+    m_ClientHeight = height;
+
+    CreateDevice();
+    InitScene();
+    SetLens();
+
+    if (m_SimulationThreaded)
+        m_Simulation.StartThread([this](float dt) { Tick(dt); });
+
+    return true;
+}
+
+void D3DManager::InitScene()
+{
     SetLight();
 
     Effects::InitAll(m_Device);
     InputLayouts::InitAll(m_Device);
     RenderStates::InitAll(m_Device);
+    ConstantBuffers::InitAll(m_Device);
 
     SetSky();
     SetTerrain();
+    SetLocalLights();
+    SetShadowMaps();
+    SetOcclusion();
     SetObjectList();
-
-    Resize();
-    return true;
 }
 
 void D3DManager::CleanupDevice()
 {
+    m_Simulation.StopThread();
+
     if (m_ImmediateContext)
         m_ImmediateContext->ClearState();
 
-    for (auto& object : m_ObjectList)
-    {
-        object->Release();
-        SafeDelete(object);
-    }
+    m_SceneTree.Clear();
+    m_Collision.Clear();
+    m_SceneProxies.clear();
     m_ObjectList.clear();
-    for (auto& object : m_BlendObjectList)
-    {
-        object->Release();
-        SafeDelete(object);
-    }
     m_BlendObjectList.clear();
-
+    m_BasisVectorPool.Clear();
+    m_BoxPool.Clear();
+    m_LandPool.Clear();
+    m_Land = nullptr;
+    m_WaterPool.Clear();
+    TextureArrays::getInstance()->Release();
+
+    SafeDelete(m_Occlusion);
+    SafeDelete(m_Shadows);
+    SafeDelete(m_ClusteredLighting);
     SafeDelete(m_Terrain);
     SafeDelete(m_Sky);
 
+    ConstantBuffers::DestroyAll();
     RenderStates::DestroyAll();
     InputLayouts::DestroyAll();
     Effects::DestroyAll();
@@ -96,6 +146,9 @@ void D3DManager::Update(float dt)
     m_Camera.Update(dt);
 
     auto input = InputManager::getInstance();
+    auto pos = input->GetMousePos();
+    m_ViewContext.Build(m_Camera, pos.x, pos.y, m_ClientWidth, m_ClientHeight);
+
     if (input->GetMouseState(MK_RBUTTON))
         return;
     if (input->GetKeyState('1'))
@@ -104,53 +157,103 @@ void D3DManager::Update(float dt)
         RenderStates::m_RenderOptions = RenderOptions::Textures;
     if (input->GetKeyState('3'))
         RenderStates::m_RenderOptions = RenderOptions::TexturesAndFog;
-    
-    auto pos = input->GetMousePos();
-    auto view = m_Camera.View();
-    auto proj = m_Camera.Proj();
+    if (input->GetKeyState('4'))
+        RenderStates::m_RenderOptions = RenderOptions::ClusteredLights;
+    if (input->GetKeyState('5'))
+        RenderStates::m_RenderOptions = RenderOptions::Shadows;
+
+    if (!m_Simulation.IsThreaded())
+        m_Simulation.Advance(dt, [this](float step) { Tick(step); });
+
+    // Picking works on what was drawn last, the interpolated transforms.  The
+    // tree only hands out objects whose box the ray goes through; the hits are
+    // in each object's space, so the ray itself is never shortened.
     auto tmin = MathHelper::Infinity;
     Object::InitPickedObject();
-    for (auto& object : m_ObjectList)
+    m_SceneTree.RayCast(m_ViewContext.GetPickRayOrigin(), m_ViewContext.GetPickRayDir(), MathHelper::Infinity,
+        [&](UINT proxy, float&)
     {
+        m_SceneProxies[m_SceneTree.GetUserData(proxy)].Owner->Pick(m_ViewContext, tmin);
+    });
+}
+
+void D3DManager::Tick(float dt)
+{
+    SceneStore::getInstance()->BeginTick();
+    for (auto& object : m_ObjectList)
         object->Update(dt);
-        object->Pick(pos.x, pos.y, m_ClientWidth, m_ClientHeight, view, proj, tmin);
-    }
     for (auto& object : m_BlendObjectList)
-    {
         object->Update(dt);
-        object->Pick(pos.x, pos.y, m_ClientWidth, m_ClientHeight, view, proj, tmin);
+}
+
+void D3DManager::SetSimulation(float tickRate, UINT maxCatchUpSteps, bool threaded)
+{
+    m_Simulation.SetTickRate(tickRate);
+    m_Simulation.SetMaxCatchUpSteps(maxCatchUpSteps);
+    m_SimulationThreaded = threaded;
+}
+
+void D3DManager::PrepareFrame()
+{
+    {
+        // Everything below reads only what Interpolate writes, so a tick may
+        // run alongside: the interpolated transforms and the store's copies
+        // of the texture transforms, materials and flags the ticks set.
+        std::lock_guard<std::mutex> lock(m_Simulation.GetStateMutex());
+        SceneStore::getInstance()->Interpolate(m_Simulation.GetAlpha());
     }
+    UpdateProxies();
+    m_Collision.Step();
 }
 
 void D3DManager::Render()
 {
+    assert(m_SwapChain);
+    PrepareFrame();
+
+    ConstantBuffers::PerDraw->BeginFrame();
+    FrameConstants::BeginFrame();
+
+    if (RenderStates::m_RenderOptions == RenderOptions::Shadows)
+        RenderShadowMaps();
+
     float ClearColor[4] = { 0.0f, 0.125f, 0.3f, 1.0f }; //red, green, blue, alpha
     m_ImmediateContext->ClearRenderTargetView(m_RenderTargetView, ClearColor);
     m_ImmediateContext->ClearDepthStencilView(m_DepthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
 
-    m_Terrain->Draw(m_ImmediateContext, m_Camera, m_DirLights);
-    m_Sky->Draw(m_ImmediateContext, m_Camera);
+    if (RenderStates::m_RenderOptions == RenderOptions::ClusteredLights)
+    {
+        m_ClusteredLighting->Update(m_ImmediateContext, m_ViewContext.View(), m_PointLights, m_SpotLights);
+        Effects::TerrainFX->SetClusteredLighting(*m_ClusteredLighting);
+        Effects::BasicFX->SetClusteredLighting(*m_ClusteredLighting);
+    }
+
+    m_Terrain->Draw(m_ImmediateContext, m_ViewContext, m_DirLights);
+    m_Sky->Draw(m_ImmediateContext, m_ViewContext);
 
-    auto viewProj = m_Camera.ViewProj();
-    auto eyePos = m_Camera.GetPosition();
+    auto viewProj = m_ViewContext.ViewProj();
+    auto eyePos = m_ViewContext.GetEyePosW();
 
+    // Only the eye position normally changes; the rest is filtered out by the effect.
     Effects::BasicFX->SetDirLights(m_DirLights);
     Effects::BasicFX->SetEyePosW(eyePos);
     Effects::BasicFX->SetFogColor(Colors::Silver);
     Effects::BasicFX->SetFogStart(50.0f);
     Effects::BasicFX->SetFogRange(150.0f);
 
+    CullOccludedObjects();
+
+    m_DrawStats.Draws = 0;
+    m_DrawStats.Objects = 0;
+
     m_ImmediateContext->OMSetBlendState(0, 0, 0xffffffff);
-    for (auto& object : m_ObjectList)
-    {
-        object->Render(m_ImmediateContext, viewProj);
-    }
+    RenderObjects(m_VisibleObjects, viewProj, true);
 
+    // Blended objects write depth too, so the far ones go first.  The water
+    // spans the scene below the crates and comes last.
+    SortBackToFront(m_VisibleBlendObjects, eyePos);
     m_ImmediateContext->OMSetBlendState(RenderStates::TransparentBS, 0, 0xffffffff);
-    for (auto& object : m_BlendObjectList)
-    {
-        object->Render(m_ImmediateContext, viewProj);
-    }
+    RenderObjects(m_VisibleBlendObjects, viewProj, false);
     
     HR(m_SwapChain->Present(0, 0)); // ù°  :  
 }
@@ -169,8 +272,13 @@ void D3DManager::Resize()
     HR(m_SwapChain->ResizeBuffers(1, m_ClientWidth, m_ClientHeight, DXGI_FORMAT_R8G8B8A8_UNORM, 0));
     SetRenderTargets();
     SetViewport();
+    SetLens();
+}
 
+void D3DManager::SetLens()
+{
     m_Camera.SetLens(0.25f*MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f);
+    m_ClusteredLighting->SetLens(0.25f*MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f, m_ClientWidth, m_ClientHeight);
 }
 
 
@@ -183,7 +291,7 @@ void D3DManager::InitClientSize(HWND hWnd)
     m_ClientHeight = rc.bottom - rc.top;
 }
 
-void D3DManager::CreateDeviceAndSwapChain(HWND hWnd)
+void D3DManager::CreateDevice()
 {
     // Flag 
     UINT createDeviceFlags = 0;
@@ -214,7 +322,11 @@ void D3DManager::CreateDeviceAndSwapChain(HWND hWnd)
     HR(m_Device->CheckMultisampleQualityLevels(
         DXGI_FORMAT_R8G8B8A8_UNORM, 4, &m_4xMsaaQuality));
     assert(m_4xMsaaQuality > 0);
+}
 
+void D3DManager::CreateDeviceAndSwapChain(HWND hWnd)
+{
+    CreateDevice();
 
     DXGI_SWAP_CHAIN_DESC sd;
     ZeroMemory(&sd, sizeof(sd));
@@ -356,11 +468,11 @@ void D3DManager::SetTerrain()
 {
     Terrain::InitInfo tii;
     tii.HeightMapFilename = L"Textures/heightMap.raw";
-//     tii.LayerMapFilename0 = L"Textures/grass.dds";
-//     tii.LayerMapFilename1 = L"Textures/darkdirt.dds";
-//     tii.LayerMapFilename2 = L"Textures/stone.dds";
-//     tii.LayerMapFilename3 = L"Textures/lightdirt.dds";
-//     tii.LayerMapFilename4 = L"Textures/snow.dds";
+    tii.LayerMapFilename0 = L"Textures/grass.dds";
+    tii.LayerMapFilename1 = L"Textures/darkdirt.dds";
+    tii.LayerMapFilename2 = L"Textures/stone.dds";
+    tii.LayerMapFilename3 = L"Textures/lightdirt.dds";
+    tii.LayerMapFilename4 = L"Textures/snow.dds";
     tii.BlendMapFilename = L"Textures/heightMap.jpg";
     tii.HeightScale = 50.0f;
     tii.HeightmapWidth = 257;
@@ -371,18 +483,333 @@ void D3DManager::SetTerrain()
     m_Terrain->Init(m_Device, m_ImmediateContext, tii);
 }
 
+void D3DManager::SetLocalLights()
+{
+    m_ClusteredLighting = new ClusteredLighting(m_Device);
+
+    // Scatter small colored point lights and a few down facing spot lights over the terrain.
+    float halfWidth = 0.5f*m_Terrain->GetWidth();
+    float halfDepth = 0.5f*m_Terrain->GetDepth();
+
+    for (int i = 0; i < 256; ++i)
+    {
+        PointLight light;
+        float x = MathHelper::RandF(-halfWidth, halfWidth);
+        float z = MathHelper::RandF(-halfDepth, halfDepth);
+        XMFLOAT4 color(MathHelper::RandF(), MathHelper::RandF(), MathHelper::RandF(), 1.0f);
+
+        light.Ambient = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+        light.Diffuse = color;
+        light.Specular = XMFLOAT4(0.5f*color.x, 0.5f*color.y, 0.5f*color.z, 1.0f);
+        light.Position = XMFLOAT3(x, m_Terrain->GetHeight(x, z) + 2.0f, z);
+        light.Range = 8.0f;
+        light.Att = XMFLOAT3(0.0f, 0.25f, 0.0f);
+        m_PointLights.push_back(light);
+    }
+
+    for (int i = 0; i < 32; ++i)
+    {
+        SpotLight light;
+        float x = MathHelper::RandF(-halfWidth, halfWidth);
+        float z = MathHelper::RandF(-halfDepth, halfDepth);
+
+        light.Ambient = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+        light.Diffuse = XMFLOAT4(1.0f, 1.0f, 0.8f, 1.0f);
+        light.Specular = XMFLOAT4(0.5f, 0.5f, 0.4f, 1.0f);
+        light.Position = XMFLOAT3(x, m_Terrain->GetHeight(x, z) + 12.0f, z);
+        light.Direction = XMFLOAT3(0.0f, -1.0f, 0.0f);
+        light.Range = 25.0f;
+        light.Spot = 16.0f;
+        light.Att = XMFLOAT3(1.0f, 0.0f, 0.0f);
+        m_SpotLights.push_back(light);
+    }
+}
+
+void D3DManager::SetShadowMaps()
+{
+    // The shadows reach about as far as the fog lets anything be seen.
+    m_Shadows = new CascadedShadows(m_Device, 2048, 200.0f);
+}
+
+void D3DManager::SetOcclusion()
+{
+    // A vertex every 8 heightmap cells keeps the terrain occluder at a few thousand triangles.
+    std::vector<XMFLOAT3> vertices;
+    std::vector<UINT> indices;
+    m_Terrain->BuildOccluder(vertices, indices, 8);
+
+    m_Occlusion = new OcclusionCulling();
+    m_Occlusion->SetStaticOccluder(vertices, indices);
+}
+
 void D3DManager::SetObjectList()
 {
-    auto bv = new BasisVector();
-    auto box = new Box();
-    //auto land = new Land();
+    auto bv = m_BasisVectorPool.Create();
     m_ObjectList.push_back(bv);
-    //m_ObjectList.push_back(land);
-    m_BlendObjectList.push_back(box);
+
+    // When enabled, the chunked heightmap joins the terrain on its +x side, at
+    // the terrain's cell spacing and height scale.
+    if (m_LandEnabled)
+    {
+        m_Land = m_LandPool.Create();
+        m_Land->Place(XMFLOAT3(0.5f*m_Terrain->GetWidth(), 0.0f, -0.5f*m_Terrain->GetDepth()), 0.5f, 50.0f);
+        m_ObjectList.push_back(m_Land);
+    }
+
+    // The crates and the fence are all 512x512 BC3 with mips, so they share
+    // one texture array and draw as one batch.
+    const struct { XMFLOAT3 Center; const wchar_t* DiffuseMap; } boxes[] =
+    {
+        { XMFLOAT3(0.0f, 20.0f, 20.0f), L"Textures/WoodCrate01.dds" },
+        { XMFLOAT3(0.0f, 20.0f, 24.0f), L"Textures/WoodCrate02.dds" },
+        { XMFLOAT3(0.0f, 20.0f, 28.0f), L"Textures/WireFence.dds" },
+    };
+    for (auto& desc : boxes)
+    {
+        auto box = m_BoxPool.Create();
+        box->Place(desc.Center, desc.DiffuseMap);
+        m_BlendObjectList.push_back(box);
+    }
+
+    // A lake over the whole terrain, a quarter of the way up from the lowest
+    // point, so it fills the valleys.
+    float halfWidth = 0.5f*m_Terrain->GetWidth();
+    float halfDepth = 0.5f*m_Terrain->GetDepth();
+    float lowest = MathHelper::Infinity;
+    float highest = -MathHelper::Infinity;
+    for (UINT i = 0; i < 64; ++i)
+    {
+        for (UINT j = 0; j < 64; ++j)
+        {
+            float y = m_Terrain->GetHeight(-halfWidth + j * halfWidth / 32.0f, halfDepth - i * halfDepth / 32.0f);
+            lowest = MathHelper::Min(lowest, y);
+            highest = MathHelper::Max(highest, y);
+        }
+    }
+    auto water = m_WaterPool.Create();
+    water->Place(XMFLOAT3(0.0f, lowest + 0.25f*(highest - lowest), 0.0f), m_Terrain->GetWidth(), L"Textures/water2.dds");
+    m_BlendObjectList.push_back(water);
 
     for (auto& object : m_ObjectList)
         object->Init(m_Device);
     for (auto& object : m_BlendObjectList)
         object->Init(m_Device);
+    TextureArrays::getInstance()->Build(m_Device, m_ImmediateContext);
+
+    for (auto& object : m_ObjectList)
+    {
+        SceneProxy entry = { object, 0, 0, false };
+        m_SceneProxies.push_back(entry);
+    }
+    for (auto& object : m_BlendObjectList)
+    {
+        SceneProxy entry = { object, 0, 0, true };
+        m_SceneProxies.push_back(entry);
+    }
+    for (UINT i = 0; i < m_SceneProxies.size(); ++i)
+    {
+        SceneProxy& entry = m_SceneProxies[i];
+        entry.Proxy = m_SceneTree.CreateProxy(entry.Owner->GetWorldBounds(), i);
+
+        // The mesh box turns with the object.
+        XNA::OrientedBox box;
+        box.Center = entry.Owner->GetMeshBox().Center;
+        box.Extents = entry.Owner->GetMeshBox().Extents;
+        box.Orientation = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+        entry.Body = m_Collision.CreateBody(box, i);
+        m_Collision.SetTransform(entry.Body, entry.Owner->GetWorldMatrix());
+    }
+}
+
+void D3DManager::UpdateProxies()
+{
+    // Only objects whose world data the last Interpolate recomputed moved.
+    auto store = SceneStore::getInstance();
+    for (auto& entry : m_SceneProxies)
+    {
+        if (!store->HasFlag(entry.Owner->GetHandle(), SceneStore::WorldChanged))
+            continue;
+
+        m_SceneTree.MoveProxy(entry.Proxy, entry.Owner->GetWorldBounds());
+        m_Collision.SetTransform(entry.Body, entry.Owner->GetWorldMatrix());
+    }
+}
+
+void D3DManager::GatherShadowCasters()
+{
+    m_ShadowCasters.clear();
+    m_CasterBounds = m_Terrain->GetPatchBounds();
+
+    for (auto& object : m_ObjectList)
+    {
+        if (object->CastsShadow())
+            m_ShadowCasters.push_back(object);
+    }
+    for (auto& object : m_BlendObjectList)
+    {
+        if (object->CastsShadow())
+            m_ShadowCasters.push_back(object);
+    }
+
+    for (auto& object : m_ShadowCasters)
+    {
+        m_CasterBounds.push_back(object->GetWorldBounds());
+    }
+}
+
+void D3DManager::RenderShadowMaps()
+{
+    GatherShadowCasters();
+    m_Shadows->Update(m_Camera, m_DirLights[0].Direction, m_CasterBounds);
+
+    // Last frame's shadow map may still be bound as a shader input.
+    ID3D11ShaderResourceView* nullSRVs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT] = { 0 };
+    m_ImmediateContext->PSSetShaderResources(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, nullSRVs);
+
+    m_ImmediateContext->RSSetState(RenderStates::ShadowDepthRS);
+    m_ImmediateContext->OMSetBlendState(0, 0, 0xffffffff);
+
+    UINT patchCount = m_Terrain->GetPatchBounds().size();
+    for (UINT c = 0; c < CascadedShadows::CascadeCount; ++c)
+    {
+        m_Shadows->BeginCascade(m_ImmediateContext, c);
+
+        m_VisibleCasters.clear();
+        m_Shadows->Cull(c, m_CasterBounds, m_VisibleCasters);
+
+        // Patches come first in the caster list, so they are the leading indices.
+        m_VisiblePatches.clear();
+        UINT i = 0;
+        for (; i < m_VisibleCasters.size() && m_VisibleCasters[i] < patchCount; ++i)
+            m_VisiblePatches.push_back(m_VisibleCasters[i]);
+
+        XMMATRIX lightViewProj = m_Shadows->GetViewProj(c);
+        m_Terrain->DrawShadow(m_ImmediateContext, m_ViewContext, lightViewProj, m_VisiblePatches);
+        for (; i < m_VisibleCasters.size(); ++i)
+            m_ShadowCasters[m_VisibleCasters[i] - patchCount]->RenderShadow(m_ImmediateContext, lightViewProj);
+    }
+
+    m_ImmediateContext->RSSetState(0);
+    m_ImmediateContext->OMSetRenderTargets(1, &m_RenderTargetView, m_DepthStencilView);
+    SetViewport();
+
+    Effects::TerrainFX->SetShadows(*m_Shadows);
+    Effects::BasicFX->SetShadows(*m_Shadows);
+}
+
+void D3DManager::CullOccludedObjects()
+{
+    // Objects outside the view frustum neither show nor hide anything.  Sorting
+    // the hits keeps the draw order of the lists.
+    m_FrustumHits.clear();
+    m_SceneTree.QueryFrustum(m_ViewContext.GetPlanes(), [this](UINT proxy)
+    {
+        m_FrustumHits.push_back(m_SceneTree.GetUserData(proxy));
+        return true;
+    });
+    std::sort(m_FrustumHits.begin(), m_FrustumHits.end());
+
+    m_Occlusion->BeginFrame(m_ViewContext.ViewProj());
+    for (UINT i : m_FrustumHits)
+    {
+        const SceneProxy& entry = m_SceneProxies[i];
+        if (!entry.Blend && entry.Owner->IsOccluder())
+            m_Occlusion->AddOccluderBox(entry.Owner->GetMeshBox(), entry.Owner->GetWorldMatrix());
+    }
+    m_Occlusion->Rasterize();
+
+    // An occluder never hides itself, its faces are never nearer than the nearest
+    // corner of its bounds.
+    m_VisibleObjects.clear();
+    m_VisibleBlendObjects.clear();
+    for (UINT i : m_FrustumHits)
+    {
+        const SceneProxy& entry = m_SceneProxies[i];
+        if (m_Occlusion->IsOccluded(entry.Owner->GetWorldBounds()))
+            continue;
+
+        if (entry.Blend)
+            m_VisibleBlendObjects.push_back(entry.Owner);
+        else
+            m_VisibleObjects.push_back(entry.Owner);
+    }
+}
+
+void D3DManager::SortBackToFront(std::vector<Object*>& objects, const XMFLOAT3& eyePos)
+{
+    auto distanceSq = [&eyePos](const Object* object)
+    {
+        const XNA::AxisAlignedBox& box = object->GetWorldBounds();
+        float dx = MathHelper::Max(fabsf(eyePos.x - box.Center.x) - box.Extents.x, 0.0f);
+        float dy = MathHelper::Max(fabsf(eyePos.y - box.Center.y) - box.Extents.y, 0.0f);
+        float dz = MathHelper::Max(fabsf(eyePos.z - box.Center.z) - box.Extents.z, 0.0f);
+        return dx*dx + dy*dy + dz*dz;
+    };
+    std::sort(objects.begin(), objects.end(), [&distanceSq](const Object* a, const Object* b)
+    {
+        return distanceSq(a) > distanceSq(b);
+    });
 }
 
+void D3DManager::RenderObjects(const std::vector<Object*>& objects, CXMMATRIX viewProj, bool sortByKey)
+{
+    // Sorting by key keeps the list order within a key.
+    m_BatchOrder.clear();
+    for (UINT i = 0; i < objects.size(); ++i)
+    {
+        BatchEntry entry = { objects[i]->GetBatchKey(), i };
+        m_BatchOrder.push_back(entry);
+    }
+    if (sortByKey)
+        std::sort(m_BatchOrder.begin(), m_BatchOrder.end());
+
+    // Objects without a mesh in their key draw one by one; sorted, they come
+    // first.  The others upload their blocks a chunk at a time, then each run
+    // of equal keys in the chunk draws from its part of the upload.  The picked
+    // triangle maps a block of its own; should that wrap the ring, the runs
+    // left in the chunk upload again, their blocks went with the discarded
+    // buffer.
+    auto ring = ConstantBuffers::PerDraw;
+    UINT i = 0;
+    while (i < m_BatchOrder.size())
+    {
+        if (!m_BatchOrder[i].Key.Mesh)
+        {
+            objects[m_BatchOrder[i].Index]->Render(m_ImmediateContext, viewProj);
+            ++m_DrawStats.Draws;
+            ++m_DrawStats.Objects;
+            ++i;
+            continue;
+        }
+
+        m_BatchObjects.clear();
+        for (; i < m_BatchOrder.size() && m_BatchOrder[i].Key.Mesh && m_BatchObjects.size() < Object::MaxBatchSize; ++i)
+            m_BatchObjects.push_back(objects[m_BatchOrder[i].Index]);
+
+        const UINT chunkStart = i - (UINT)m_BatchObjects.size();
+        const UINT count = (UINT)m_BatchObjects.size();
+        UINT offset = Effects::BasicFX->UploadInstances(m_ImmediateContext, viewProj, &m_BatchObjects[0], count);
+        UINT discards = ring->GetFrameStats().DiscardCount;
+
+        for (UINT first = 0; first < count; )
+        {
+            const Object::BatchKey& key = m_BatchOrder[chunkStart + first].Key;
+            UINT last = first + 1;
+            while (last < count && m_BatchOrder[chunkStart + last].Key == key)
+                ++last;
+
+            Object::RenderBatch(m_ImmediateContext, viewProj, &m_BatchObjects[first], last - first,
+                offset + first * sizeof(PerObjectConstants));
+
+            ++m_DrawStats.Draws;
+            m_DrawStats.Objects += last - first;
+            first = last;
+
+            if (ring->GetFrameStats().DiscardCount != discards)
+            {
+                i = chunkStart + last;
+                break;
+            }
+        }
+    }
+}
@@ -1,9 +1,20 @@
 #pragma once
 #include "d3dUtil.h"
 #include "Camera.h"
+#include "ViewContext.h"
+#include "Simulation.h"
+#include "Allocators.h"
+#include "DynamicAabbTree.h"
+#include "CollisionWorld.h"
+#include "BasisVector.h"
+#include "Box.h"
+#include "Land.h"
+#include "Water.h"
 class Sky;
 class Terrain;
-class Object;
+class ClusteredLighting;
+class CascadedShadows;
+class OcclusionCulling;
 
 class D3DManager
 {
@@ -17,24 +28,72 @@ public:
     inline ID3D11Device*    GetDevice() const { return m_Device; }
     inline float            AspectRatio() const { return static_cast<float>(m_ClientWidth) / m_ClientHeight; }
     inline void             SetClientSize(int w, int h){ m_ClientWidth = w; m_ClientHeight = h; }
+    inline const ClusteredLighting* GetClusteredLighting() const { return m_ClusteredLighting; }
+    inline const CascadedShadows*   GetCascadedShadows() const { return m_Shadows; }
+    inline const OcclusionCulling*  GetOcclusionCulling() const { return m_Occlusion; }
+    inline const CollisionWorld&    GetCollisionWorld() const { return m_Collision; }
+    inline const Terrain*           GetTerrain() const { return m_Terrain; }
+    inline const Land*              GetLand() const { return m_Land; }
+
+    // Draw calls the visible objects took last frame, batches counted once.
+    struct DrawStats
+    {
+        UINT    Draws;
+        UINT    Objects;
+    };
+    inline const DrawStats&         GetDrawStats() const { return m_DrawStats; }
+
+    // Ticks per second, ticks run after a slow frame and whether ticks get their own
+    // thread.  Call before InitDevice.
+    void    SetSimulation(float tickRate, UINT maxCatchUpSteps, bool threaded);
+    const Simulation&   GetSimulation() const { return m_Simulation; }
+
+    // Whether the chunked heightmap Land joins the scene beside the terrain.  It
+    // is left out by default.  Call before InitDevice.
+    inline void         SetLandEnabled(bool enabled) { m_LandEnabled = enabled; }
 
     bool    InitDevice(HWND hWnd);
+
+    // Makes the device and the scene for a 'width' x 'height' view without a
+    // window or a swap chain, for replays that time Update and PrepareFrame
+    // only.  Render must not be called.
+    bool    InitHeadless(int width, int height);
+
     void    CleanupDevice();
     void    Update(float dt);
+
+    // Interpolates the scene store and moves the proxies; Render starts with it.
+    void    PrepareFrame();
     void    Render();
     void    Resize();
 
 private:
     void    InitClientSize(HWND hWnd);
+    void    CreateDevice();
     void    CreateDeviceAndSwapChain(HWND hWnd);
     void    SetRenderTargets();
     void    CreateDepthStencilView();
     void    CreateRenderTargetView();
     void    SetViewport();
+    void    SetLens();
+    void    InitScene();
     void    SetLight();
     void    SetSky();
     void    SetTerrain();
+    void    SetLocalLights();
+    void    SetShadowMaps();
+    void    SetOcclusion();
     void    SetObjectList();
+    void    UpdateProxies();
+    void    GatherShadowCasters();
+    void    RenderShadowMaps();
+    void    CullOccludedObjects();
+    // With 'sortByKey' every run of equal batch keys draws instanced; without,
+    // the list order is kept and only neighbours with equal keys batch.
+    void    RenderObjects(const std::vector<Object*>& objects, CXMMATRIX viewProj, bool sortByKey);
+    // Far to near from the eye, by the nearest point of the world bounds.
+    void    SortBackToFront(std::vector<Object*>& objects, const XMFLOAT3& eyePos);
+    void    Tick(float dt);
 
 private:
     D3DManager();
@@ -50,14 +109,72 @@ private:
     ID3D11DepthStencilView* m_DepthStencilView;
     ID3D11RenderTargetView* m_RenderTargetView;
 
+    Simulation              m_Simulation;
+    bool                    m_SimulationThreaded;
+
     Camera                  m_Camera;
+    ViewContext             m_ViewContext;
 
     Sky*                    m_Sky;
     Terrain*                m_Terrain;
+    Land*                   m_Land;             // also in m_ObjectList, null unless enabled
+    bool                    m_LandEnabled;
     std::vector<Object*>    m_ObjectList;
     std::vector<Object*>    m_BlendObjectList;
 
+    // Storage of the objects in the lists above, one pool per type.
+    ObjectPool<BasisVector> m_BasisVectorPool;
+    ObjectPool<Box>         m_BoxPool;
+    ObjectPool<Land>        m_LandPool;
+    ObjectPool<Water>       m_WaterPool;
+
+    // Both lists in one tree and one collision world; the user data of proxies
+    // and bodies is the index in m_SceneProxies.
+    struct SceneProxy
+    {
+        Object*             Owner;
+        UINT                Proxy;
+        UINT                Body;
+        bool                Blend;
+    };
+    DynamicAabbTree         m_SceneTree;
+    CollisionWorld          m_Collision;
+    std::vector<SceneProxy> m_SceneProxies;
+    std::vector<UINT>       m_FrustumHits;
+
     DirectionalLight        m_DirLights[3];
+    std::vector<PointLight> m_PointLights;
+    std::vector<SpotLight>  m_SpotLights;
+    ClusteredLighting*      m_ClusteredLighting;
+
+    // Shadow casters are the terrain patches followed by m_ShadowCasters.
+    CascadedShadows*                    m_Shadows;
+    std::vector<Object*>                m_ShadowCasters;
+    std::vector<XNA::AxisAlignedBox>    m_CasterBounds;
+    std::vector<UINT>                   m_VisibleCasters;
+    std::vector<UINT>                   m_VisiblePatches;
+
+    // Objects left after occlusion culling against the terrain and the occluder objects.
+    OcclusionCulling*       m_Occlusion;
+    std::vector<Object*>    m_VisibleObjects;
+    std::vector<Object*>    m_VisibleBlendObjects;
+
+    // Visible objects in draw order; runs of equal keys draw instanced.
+    struct BatchEntry
+    {
+        Object::BatchKey    Key;
+        UINT                Index;
+
+        bool operator<(const BatchEntry& rhs) const
+        {
+            if (Key == rhs.Key)
+                return Index < rhs.Index;
+            return Key < rhs.Key;
+        }
+    };
+    std::vector<BatchEntry> m_BatchOrder;
+    std::vector<Object*>    m_BatchObjects;
+    DrawStats               m_DrawStats;
 
     int                     m_ClientWidth;
     int                     m_ClientHeight;
@@ -0,0 +1,806 @@
+//***************************************************************************************
+// DynamicAabbTree.cpp
+//***************************************************************************************
+
+#include "DynamicAabbTree.h"
+#include "GameTimer.h"
+#include <functional>
+
+namespace
+{
+    // Half the surface area, the cost of a box in the insertion heuristic.
+    float Area(const XMFLOAT3& vMin, const XMFLOAT3& vMax)
+    {
+        float dx = vMax.x - vMin.x;
+        float dy = vMax.y - vMin.y;
+        float dz = vMax.z - vMin.z;
+        return dx*dy + dy*dz + dz*dx;
+    }
+
+    float UnionArea(const XMFLOAT3& aMin, const XMFLOAT3& aMax, const XMFLOAT3& bMin, const XMFLOAT3& bMax)
+    {
+        XMFLOAT3 vMin(MathHelper::Min(aMin.x, bMin.x), MathHelper::Min(aMin.y, bMin.y), MathHelper::Min(aMin.z, bMin.z));
+        XMFLOAT3 vMax(MathHelper::Max(aMax.x, bMax.x), MathHelper::Max(aMax.y, bMax.y), MathHelper::Max(aMax.z, bMax.z));
+        return Area(vMin, vMax);
+    }
+
+    void Union(const XMFLOAT3& aMin, const XMFLOAT3& aMax, const XMFLOAT3& bMin, const XMFLOAT3& bMax,
+        XMFLOAT3& vMin, XMFLOAT3& vMax)
+    {
+        vMin = XMFLOAT3(MathHelper::Min(aMin.x, bMin.x), MathHelper::Min(aMin.y, bMin.y), MathHelper::Min(aMin.z, bMin.z));
+        vMax = XMFLOAT3(MathHelper::Max(aMax.x, bMax.x), MathHelper::Max(aMax.y, bMax.y), MathHelper::Max(aMax.z, bMax.z));
+    }
+
+    bool Contains(const XMFLOAT3& outerMin, const XMFLOAT3& outerMax, const XMFLOAT3& vMin, const XMFLOAT3& vMax)
+    {
+        return outerMin.x <= vMin.x && outerMin.y <= vMin.y && outerMin.z <= vMin.z &&
+            vMax.x <= outerMax.x && vMax.y <= outerMax.y && vMax.z <= outerMax.z;
+    }
+
+    void MinMax(const XNA::AxisAlignedBox& box, XMFLOAT3& vMin, XMFLOAT3& vMax)
+    {
+        vMin = XMFLOAT3(box.Center.x - box.Extents.x, box.Center.y - box.Extents.y, box.Center.z - box.Extents.z);
+        vMax = XMFLOAT3(box.Center.x + box.Extents.x, box.Center.y + box.Extents.y, box.Center.z + box.Extents.z);
+    }
+
+    // Slab test.  't' is where the ray enters the box, 0 when it starts inside.
+    bool RayHitsMinMax(FXMVECTOR origin, FXMVECTOR invDir, const XMFLOAT3& vMin, const XMFLOAT3& vMax,
+        float maxT, float& t)
+    {
+        XMVECTOR t1 = (XMLoadFloat3(&vMin) - origin) * invDir;
+        XMVECTOR t2 = (XMLoadFloat3(&vMax) - origin) * invDir;
+        XMFLOAT3 tNear, tFar;
+        XMStoreFloat3(&tNear, XMVectorMin(t1, t2));
+        XMStoreFloat3(&tFar, XMVectorMax(t1, t2));
+
+        float enter = MathHelper::Max(MathHelper::Max(tNear.x, tNear.y), MathHelper::Max(tNear.z, 0.0f));
+        float exit = MathHelper::Min(MathHelper::Min(tFar.x, tFar.y), MathHelper::Min(tFar.z, maxT));
+        t = enter;
+        return enter <= exit;
+    }
+
+    // Same test as CascadedShadows::AabbBehindPlane, for every plane.
+    bool OutsidePlanes(const XMFLOAT3& vMin, const XMFLOAT3& vMax, const XMFLOAT4 planes[6])
+    {
+        XMVECTOR center = XMVectorSetW(0.5f*(XMLoadFloat3(&vMin) + XMLoadFloat3(&vMax)), 1.0f);
+        XMVECTOR extents = 0.5f*(XMLoadFloat3(&vMax) - XMLoadFloat3(&vMin));
+        for (UINT p = 0; p < 6; ++p)
+        {
+            XMVECTOR plane = XMLoadFloat4(&planes[p]);
+            float r = XMVectorGetX(XMVector3Dot(extents, XMVectorAbs(plane)));
+            float s = XMVectorGetX(XMVector4Dot(plane, center));
+            if (s + r < 0.0f)
+                return true;
+        }
+        return false;
+    }
+
+    bool Overlaps(const XMFLOAT3& aMin, const XMFLOAT3& aMax, const XMFLOAT3& bMin, const XMFLOAT3& bMax)
+    {
+        return aMin.x <= bMax.x && bMin.x <= aMax.x &&
+            aMin.y <= bMax.y && bMin.y <= aMax.y &&
+            aMin.z <= bMax.z && bMin.z <= aMax.z;
+    }
+
+    // Small deterministic generator, so the test and the benchmark repeat exactly.
+    struct TestRandom
+    {
+        explicit TestRandom(UINT seed) : State(seed) {}
+
+        float Next(float a, float b)
+        {
+            State = State * 1664525u + 1013904223u;
+            return a + (b - a) * (float)(State >> 8) / (float)(1 << 24);
+        }
+
+        UINT State;
+    };
+
+    // A frustum looking down +z from 'eye', made of inward planes like ExtractFrustumPlanes.
+    void TestFrustum(const XMFLOAT3& eye, float nearZ, float farZ, float slope, XMFLOAT4 planes[6])
+    {
+        float n = 1.0f / sqrtf(1.0f + slope*slope);
+        planes[0] = XMFLOAT4( n, 0.0f, slope*n, 0.0f);      // left
+        planes[1] = XMFLOAT4(-n, 0.0f, slope*n, 0.0f);      // right
+        planes[2] = XMFLOAT4(0.0f,  n, slope*n, 0.0f);      // bottom
+        planes[3] = XMFLOAT4(0.0f, -n, slope*n, 0.0f);      // top
+        planes[4] = XMFLOAT4(0.0f, 0.0f,  1.0f, -nearZ);    // near
+        planes[5] = XMFLOAT4(0.0f, 0.0f, -1.0f,  farZ);     // far
+
+        for (UINT p = 0; p < 6; ++p)
+            planes[p].w -= planes[p].x*eye.x + planes[p].y*eye.y + planes[p].z*eye.z;
+    }
+}
+
+const UINT DynamicAabbTree::NullNode;
+
+DynamicAabbTree::DynamicAabbTree(float margin)
+:   m_Root(NullNode),
+    m_FreeList(NullNode),
+    m_ProxyCount(0),
+    m_Margin(margin),
+    m_Reinserts(0),
+    m_Rotations(0)
+{
+}
+
+#pragma region Proxies
+UINT DynamicAabbTree::CreateProxy(const XNA::AxisAlignedBox& box, UINT userData)
+{
+    UINT proxy = AllocateNode();
+    Node& node = m_Nodes[proxy];
+
+    MinMax(box, node.Min, node.Max);
+    node.Min = XMFLOAT3(node.Min.x - m_Margin, node.Min.y - m_Margin, node.Min.z - m_Margin);
+    node.Max = XMFLOAT3(node.Max.x + m_Margin, node.Max.y + m_Margin, node.Max.z + m_Margin);
+    node.Height = 0;
+    node.UserData = userData;
+
+    InsertLeaf(proxy);
+    ++m_ProxyCount;
+    return proxy;
+}
+
+void DynamicAabbTree::DestroyProxy(UINT proxy)
+{
+    assert(proxy < m_Nodes.size() && m_Nodes[proxy].IsLeaf() && m_Nodes[proxy].Height == 0);
+
+    RemoveLeaf(proxy);
+    FreeNode(proxy);
+    --m_ProxyCount;
+}
+
+bool DynamicAabbTree::MoveProxy(UINT proxy, const XNA::AxisAlignedBox& box)
+{
+    assert(proxy < m_Nodes.size() && m_Nodes[proxy].IsLeaf() && m_Nodes[proxy].Height == 0);
+
+    XMFLOAT3 vMin, vMax;
+    MinMax(box, vMin, vMax);
+
+    Node& node = m_Nodes[proxy];
+    if (Contains(node.Min, node.Max, vMin, vMax))
+        return false;
+
+    // The box moved out of its fat box; the new one also reaches ahead along
+    // the way the box went, so steady movers stay put for a while.  A jump
+    // does not stretch it further than a few margins.
+    float reach = 4.0f * m_Margin;
+    XMFLOAT3 move(
+        MathHelper::Clamp(0.5f*(vMin.x + vMax.x - node.Min.x - node.Max.x), -reach, reach),
+        MathHelper::Clamp(0.5f*(vMin.y + vMax.y - node.Min.y - node.Max.y), -reach, reach),
+        MathHelper::Clamp(0.5f*(vMin.z + vMax.z - node.Min.z - node.Max.z), -reach, reach));
+
+    RemoveLeaf(proxy);
+
+    Node& leaf = m_Nodes[proxy];
+    leaf.Min = XMFLOAT3(vMin.x - m_Margin, vMin.y - m_Margin, vMin.z - m_Margin);
+    leaf.Max = XMFLOAT3(vMax.x + m_Margin, vMax.y + m_Margin, vMax.z + m_Margin);
+    if (move.x < 0.0f) leaf.Min.x += move.x; else leaf.Max.x += move.x;
+    if (move.y < 0.0f) leaf.Min.y += move.y; else leaf.Max.y += move.y;
+    if (move.z < 0.0f) leaf.Min.z += move.z; else leaf.Max.z += move.z;
+
+    InsertLeaf(proxy);
+    ++m_Reinserts;
+    return true;
+}
+
+void DynamicAabbTree::Clear()
+{
+    m_Nodes.clear();
+    m_Root = NullNode;
+    m_FreeList = NullNode;
+    m_ProxyCount = 0;
+    ResetStats();
+}
+
+XNA::AxisAlignedBox DynamicAabbTree::GetFatBox(UINT proxy) const
+{
+    const Node& node = m_Nodes[proxy];
+    XNA::AxisAlignedBox box;
+    XMStoreFloat3(&box.Center, 0.5f*(XMLoadFloat3(&node.Min) + XMLoadFloat3(&node.Max)));
+    XMStoreFloat3(&box.Extents, 0.5f*(XMLoadFloat3(&node.Max) - XMLoadFloat3(&node.Min)));
+    return box;
+}
+
+DynamicAabbTree::Stats DynamicAabbTree::GetStats() const
+{
+    Stats stats;
+    stats.Proxies = m_ProxyCount;
+    stats.Height = m_Root == NullNode ? 0 : (UINT)m_Nodes[m_Root].Height;
+    stats.Reinserts = m_Reinserts;
+    stats.Rotations = m_Rotations;
+    return stats;
+}
+#pragma endregion
+
+#pragma region Nodes
+UINT DynamicAabbTree::AllocateNode()
+{
+    UINT index;
+    if (m_FreeList != NullNode)
+    {
+        index = m_FreeList;
+        m_FreeList = m_Nodes[index].Parent;
+    }
+    else
+    {
+        index = (UINT)m_Nodes.size();
+        m_Nodes.push_back(Node());
+    }
+
+    Node& node = m_Nodes[index];
+    node.Parent = NullNode;
+    node.Child1 = NullNode;
+    node.Child2 = NullNode;
+    node.Height = 0;
+    node.UserData = 0;
+    return index;
+}
+
+void DynamicAabbTree::FreeNode(UINT node)
+{
+    m_Nodes[node].Parent = m_FreeList;
+    m_Nodes[node].Height = -1;
+    m_FreeList = node;
+}
+
+void DynamicAabbTree::InsertLeaf(UINT leaf)
+{
+    if (m_Root == NullNode)
+    {
+        m_Root = leaf;
+        m_Nodes[leaf].Parent = NullNode;
+        return;
+    }
+
+    // Walk down to the sibling that makes the tree cheapest.  Every node on the
+    // way grows to hold the leaf, which is the inherited cost of going deeper.
+    XMFLOAT3 leafMin = m_Nodes[leaf].Min;
+    XMFLOAT3 leafMax = m_Nodes[leaf].Max;
+    UINT index = m_Root;
+    while (!m_Nodes[index].IsLeaf())
+    {
+        const Node& node = m_Nodes[index];
+        const Node& child1 = m_Nodes[node.Child1];
+        const Node& child2 = m_Nodes[node.Child2];
+
+        float area = Area(node.Min, node.Max);
+        float combinedArea = UnionArea(node.Min, node.Max, leafMin, leafMax);
+
+        // Pairing the leaf with this node.
+        float cost = 2.0f * combinedArea;
+        float inheritanceCost = 2.0f * (combinedArea - area);
+
+        float cost1 = UnionArea(child1.Min, child1.Max, leafMin, leafMax) + inheritanceCost;
+        if (!child1.IsLeaf())
+            cost1 -= Area(child1.Min, child1.Max);
+        float cost2 = UnionArea(child2.Min, child2.Max, leafMin, leafMax) + inheritanceCost;
+        if (!child2.IsLeaf())
+            cost2 -= Area(child2.Min, child2.Max);
+
+        if (cost < cost1 && cost < cost2)
+            break;
+
+        index = cost1 < cost2 ? node.Child1 : node.Child2;
+    }
+
+    UINT sibling = index;
+    UINT oldParent = m_Nodes[sibling].Parent;
+    UINT newParent = AllocateNode();
+
+    Node& parent = m_Nodes[newParent];
+    parent.Parent = oldParent;
+    parent.Child1 = sibling;
+    parent.Child2 = leaf;
+    parent.Height = m_Nodes[sibling].Height + 1;
+    Union(m_Nodes[sibling].Min, m_Nodes[sibling].Max, leafMin, leafMax, parent.Min, parent.Max);
+
+    if (oldParent != NullNode)
+    {
+        if (m_Nodes[oldParent].Child1 == sibling)
+            m_Nodes[oldParent].Child1 = newParent;
+        else
+            m_Nodes[oldParent].Child2 = newParent;
+    }
+    else
+    {
+        m_Root = newParent;
+    }
+    m_Nodes[sibling].Parent = newParent;
+    m_Nodes[leaf].Parent = newParent;
+
+    Refit(m_Nodes[leaf].Parent);
+}
+
+void DynamicAabbTree::RemoveLeaf(UINT leaf)
+{
+    if (leaf == m_Root)
+    {
+        m_Root = NullNode;
+        return;
+    }
+
+    UINT parent = m_Nodes[leaf].Parent;
+    UINT grandParent = m_Nodes[parent].Parent;
+    UINT sibling = m_Nodes[parent].Child1 == leaf ? m_Nodes[parent].Child2 : m_Nodes[parent].Child1;
+
+    // The sibling takes the parent's place.
+    if (grandParent != NullNode)
+    {
+        if (m_Nodes[grandParent].Child1 == parent)
+            m_Nodes[grandParent].Child1 = sibling;
+        else
+            m_Nodes[grandParent].Child2 = sibling;
+        m_Nodes[sibling].Parent = grandParent;
+        FreeNode(parent);
+
+        Refit(grandParent);
+    }
+    else
+    {
+        m_Root = sibling;
+        m_Nodes[sibling].Parent = NullNode;
+        FreeNode(parent);
+    }
+}
+
+// Rebalances and refits the ancestors from 'node' up.
+void DynamicAabbTree::Refit(UINT node)
+{
+    UINT index = node;
+    while (index != NullNode)
+    {
+        index = Balance(index);
+
+        Node& n = m_Nodes[index];
+        const Node& child1 = m_Nodes[n.Child1];
+        const Node& child2 = m_Nodes[n.Child2];
+        n.Height = 1 + MathHelper::Max(child1.Height, child2.Height);
+        Union(child1.Min, child1.Max, child2.Min, child2.Max, n.Min, n.Max);
+
+        index = n.Parent;
+    }
+}
+
+// Rotates the taller grandchild of 'iA' up when its children differ in height
+// by more than one.  Returns the node that now stands where 'iA' was.
+//
+//        A              C
+//       / \            / \
+//      B   C    ->    A   F
+//         / \        / \
+//        F   G      B   G
+UINT DynamicAabbTree::Balance(UINT iA)
+{
+    Node& A = m_Nodes[iA];
+    if (A.IsLeaf() || A.Height < 2)
+        return iA;
+
+    UINT iB = A.Child1;
+    UINT iC = A.Child2;
+    Node& B = m_Nodes[iB];
+    Node& C = m_Nodes[iC];
+
+    int balance = C.Height - B.Height;
+
+    // Rotate C up.
+    if (balance > 1)
+    {
+        UINT iF = C.Child1;
+        UINT iG = C.Child2;
+        Node& F = m_Nodes[iF];
+        Node& G = m_Nodes[iG];
+
+        C.Child1 = iA;
+        C.Parent = A.Parent;
+        A.Parent = iC;
+
+        if (C.Parent != NullNode)
+        {
+            if (m_Nodes[C.Parent].Child1 == iA)
+                m_Nodes[C.Parent].Child1 = iC;
+            else
+                m_Nodes[C.Parent].Child2 = iC;
+        }
+        else
+        {
+            m_Root = iC;
+        }
+
+        // The taller of F and G stays under C.
+        if (F.Height > G.Height)
+        {
+            C.Child2 = iF;
+            A.Child2 = iG;
+            G.Parent = iA;
+            Union(B.Min, B.Max, G.Min, G.Max, A.Min, A.Max);
+            Union(A.Min, A.Max, F.Min, F.Max, C.Min, C.Max);
+            A.Height = 1 + MathHelper::Max(B.Height, G.Height);
+            C.Height = 1 + MathHelper::Max(A.Height, F.Height);
+        }
+        else
+        {
+            C.Child2 = iG;
+            A.Child2 = iF;
+            F.Parent = iA;
+            Union(B.Min, B.Max, F.Min, F.Max, A.Min, A.Max);
+            Union(A.Min, A.Max, G.Min, G.Max, C.Min, C.Max);
+            A.Height = 1 + MathHelper::Max(B.Height, F.Height);
+            C.Height = 1 + MathHelper::Max(A.Height, G.Height);
+        }
+
+        ++m_Rotations;
+        return iC;
+    }
+
+    // Rotate B up.
+    if (balance < -1)
+    {
+        UINT iD = B.Child1;
+        UINT iE = B.Child2;
+        Node& D = m_Nodes[iD];
+        Node& E = m_Nodes[iE];
+
+        B.Child1 = iA;
+        B.Parent = A.Parent;
+        A.Parent = iB;
+
+        if (B.Parent != NullNode)
+        {
+            if (m_Nodes[B.Parent].Child1 == iA)
+                m_Nodes[B.Parent].Child1 = iB;
+            else
+                m_Nodes[B.Parent].Child2 = iB;
+        }
+        else
+        {
+            m_Root = iB;
+        }
+
+        if (D.Height > E.Height)
+        {
+            B.Child2 = iD;
+            A.Child1 = iE;
+            E.Parent = iA;
+            Union(C.Min, C.Max, E.Min, E.Max, A.Min, A.Max);
+            Union(A.Min, A.Max, D.Min, D.Max, B.Min, B.Max);
+            A.Height = 1 + MathHelper::Max(C.Height, E.Height);
+            B.Height = 1 + MathHelper::Max(A.Height, D.Height);
+        }
+        else
+        {
+            B.Child2 = iE;
+            A.Child1 = iD;
+            D.Parent = iA;
+            Union(C.Min, C.Max, D.Min, D.Max, A.Min, A.Max);
+            Union(A.Min, A.Max, E.Min, E.Max, B.Min, B.Max);
+            A.Height = 1 + MathHelper::Max(C.Height, D.Height);
+            B.Height = 1 + MathHelper::Max(A.Height, E.Height);
+        }
+
+        ++m_Rotations;
+        return iB;
+    }
+
+    return iA;
+}
+
+bool DynamicAabbTree::RayHitsBox(FXMVECTOR origin, FXMVECTOR invDir, const Node& node, float maxT, float& t)
+{
+    return RayHitsMinMax(origin, invDir, node.Min, node.Max, maxT, t);
+}
+#pragma endregion
+
+#pragma region Validation
+UINT DynamicAabbTree::Validate() const
+{
+    if (m_Root == NullNode)
+        return m_ProxyCount == 0 ? 0 : 1;
+
+    UINT failures = m_Nodes[m_Root].Parent == NullNode ? 0 : 1;
+    failures += ValidateNode(m_Root, NullNode);
+
+    // Every node is either in the tree or on the free list.
+    UINT freeCount = 0;
+    for (UINT index = m_FreeList; index != NullNode; index = m_Nodes[index].Parent)
+        ++freeCount;
+    if (freeCount + 2 * m_ProxyCount - 1 != m_Nodes.size())
+        ++failures;
+
+    return failures;
+}
+
+UINT DynamicAabbTree::ValidateNode(UINT index, UINT parent) const
+{
+    const Node& node = m_Nodes[index];
+    if (node.Parent != parent)
+        return 1;
+
+    if (node.IsLeaf())
+        return node.Child2 == NullNode && node.Height == 0 ? 0 : 1;
+
+    const Node& child1 = m_Nodes[node.Child1];
+    const Node& child2 = m_Nodes[node.Child2];
+
+    UINT failures = 0;
+    if (node.Height != 1 + MathHelper::Max(child1.Height, child2.Height))
+        ++failures;
+    if (!Contains(node.Min, node.Max, child1.Min, child1.Max) || !Contains(node.Min, node.Max, child2.Min, child2.Max))
+        ++failures;
+
+    return failures + ValidateNode(node.Child1, index) + ValidateNode(node.Child2, index);
+}
+
+UINT DynamicAabbTree::SelfTest()
+{
+    const UINT count = 600;
+    const float worldSize = 100.0f;
+
+    TestRandom random(12345);
+    DynamicAabbTree tree(0.5f);
+    UINT failures = 0;
+
+    std::vector<XNA::AxisAlignedBox> boxes(count);
+    std::vector<UINT> proxies(count, NullNode);
+
+    auto randomBox = [&](XNA::AxisAlignedBox& box)
+    {
+        box.Center = XMFLOAT3(random.Next(0.0f, worldSize), random.Next(0.0f, worldSize), random.Next(0.0f, worldSize));
+        box.Extents = XMFLOAT3(random.Next(0.1f, 2.0f), random.Next(0.1f, 2.0f), random.Next(0.1f, 2.0f));
+    };
+
+    for (UINT i = 0; i < count; ++i)
+    {
+        randomBox(boxes[i]);
+        proxies[i] = tree.CreateProxy(boxes[i], i);
+    }
+
+    std::vector<UINT> found;
+    for (UINT round = 0; round < 40; ++round)
+    {
+        // Small moves, long jumps, and a few proxies leaving and coming back.
+        for (UINT i = 0; i < count; ++i)
+        {
+            float reach = (i % 10 == 0) ? 20.0f : 0.3f;
+            boxes[i].Center.x += random.Next(-reach, reach);
+            boxes[i].Center.y += random.Next(-reach, reach);
+            boxes[i].Center.z += random.Next(-reach, reach);
+
+            if (proxies[i] != NullNode && i % 37 == round % 37)
+            {
+                tree.DestroyProxy(proxies[i]);
+                proxies[i] = NullNode;
+            }
+            else if (proxies[i] == NullNode)
+            {
+                proxies[i] = tree.CreateProxy(boxes[i], i);
+            }
+            else
+            {
+                tree.MoveProxy(proxies[i], boxes[i]);
+            }
+        }
+
+        failures += tree.Validate();
+
+        // The tree reports every proxy whose box passes the test, only proxies
+        // whose fat box passes it, and each of them once.
+        auto compare = [&](std::function<bool(const XMFLOAT3&, const XMFLOAT3&)> passes)
+        {
+            std::vector<UINT> hits(count, 0);
+            for (UINT proxy : found)
+            {
+                UINT i = tree.GetUserData(proxy);
+                if (proxies[i] != proxy || ++hits[i] > 1 ||
+                    !passes(tree.m_Nodes[proxy].Min, tree.m_Nodes[proxy].Max))
+                    ++failures;
+            }
+            for (UINT i = 0; i < count; ++i)
+            {
+                XMFLOAT3 vMin, vMax;
+                MinMax(boxes[i], vMin, vMax);
+                if (proxies[i] != NullNode && !hits[i] && passes(vMin, vMax))
+                    ++failures;
+            }
+        };
+
+        for (UINT q = 0; q < 8; ++q)
+        {
+            XNA::AxisAlignedBox query;
+            randomBox(query);
+            query.Extents = XMFLOAT3(10.0f * query.Extents.x, 10.0f * query.Extents.y, 10.0f * query.Extents.z);
+
+            XMFLOAT3 qMin, qMax;
+            MinMax(query, qMin, qMax);
+
+            found.clear();
+            tree.QueryBox(query, [&](UINT proxy) { found.push_back(proxy); return true; });
+            compare([&](const XMFLOAT3& vMin, const XMFLOAT3& vMax) { return Overlaps(vMin, vMax, qMin, qMax); });
+        }
+
+        XMFLOAT4 planes[6];
+        XMFLOAT3 eye(random.Next(0.0f, worldSize), random.Next(0.0f, worldSize), -10.0f);
+        TestFrustum(eye, 1.0f, random.Next(20.0f, 150.0f), random.Next(0.5f, 2.0f), planes);
+
+        found.clear();
+        tree.QueryFrustum(planes, [&](UINT proxy) { found.push_back(proxy); return true; });
+        compare([&](const XMFLOAT3& vMin, const XMFLOAT3& vMax) { return !OutsidePlanes(vMin, vMax, planes); });
+
+        for (UINT r = 0; r < 8; ++r)
+        {
+            XMVECTOR origin = XMVectorSet(random.Next(0.0f, worldSize), random.Next(0.0f, worldSize), -10.0f, 0.0f);
+            XMVECTOR target = XMVectorSet(random.Next(0.0f, worldSize), random.Next(0.0f, worldSize), worldSize, 0.0f);
+            XMVECTOR dir = XMVector3Normalize(target - origin);
+            XMVECTOR invDir = XMVectorReciprocal(dir);
+            const float maxT = 200.0f;
+
+            found.clear();
+            tree.RayCast(origin, dir, maxT, [&](UINT proxy, float&) { found.push_back(proxy); });
+            compare([&](const XMFLOAT3& vMin, const XMFLOAT3& vMax)
+            {
+                float t = 0.0f;
+                return RayHitsMinMax(origin, invDir, vMin, vMax, maxT, t);
+            });
+
+            // Shortening the ray at every hit still finds the nearest box.
+            float nearest = maxT;
+            tree.RayCast(origin, dir, maxT, [&](UINT proxy, float& t)
+            {
+                XMFLOAT3 vMin, vMax;
+                MinMax(boxes[tree.GetUserData(proxy)], vMin, vMax);
+                float hitT = 0.0f;
+                if (RayHitsMinMax(origin, invDir, vMin, vMax, t, hitT))
+                    t = nearest = hitT;
+            });
+
+            float expected = maxT;
+            for (UINT i = 0; i < count; ++i)
+            {
+                XMFLOAT3 vMin, vMax;
+                MinMax(boxes[i], vMin, vMax);
+                float hitT = 0.0f;
+                if (proxies[i] != NullNode && RayHitsMinMax(origin, invDir, vMin, vMax, expected, hitT))
+                    expected = hitT;
+            }
+            if (nearest != expected)
+                ++failures;
+        }
+    }
+
+    // Insertion in sorted order is the worst case for an unbalanced tree.
+    DynamicAabbTree sorted;
+    for (UINT i = 0; i < 1024; ++i)
+    {
+        XNA::AxisAlignedBox box;
+        box.Center = XMFLOAT3(2.0f * i, 0.0f, 0.0f);
+        box.Extents = XMFLOAT3(0.5f, 0.5f, 0.5f);
+        sorted.CreateProxy(box, i);
+    }
+    if (sorted.Validate() != 0 || sorted.GetStats().Height > 20)
+        ++failures;
+
+    for (UINT i = 0; i < count; ++i)
+    {
+        if (proxies[i] != NullNode)
+            tree.DestroyProxy(proxies[i]);
+    }
+    if (tree.m_Root != NullNode || tree.GetStats().Proxies != 0)
+        ++failures;
+
+    return failures;
+}
+
+DynamicAabbTree::BenchmarkResult DynamicAabbTree::Benchmark(UINT count, UINT frames)
+{
+    BenchmarkResult result;
+    result.Count = count;
+    result.Frames = frames;
+
+    // About one object per 1000 cubic units, however many there are.
+    const float worldSize = 10.0f * powf((float)count, 1.0f / 3.0f);
+    const UINT queries = 64;
+
+    TestRandom random(777);
+    DynamicAabbTree tree;
+
+    std::vector<XNA::AxisAlignedBox> boxes(count);
+    std::vector<XMFLOAT3> velocities(count);
+    std::vector<UINT> proxies(count);
+    for (UINT i = 0; i < count; ++i)
+    {
+        boxes[i].Center = XMFLOAT3(random.Next(0.0f, worldSize), random.Next(0.0f, worldSize), random.Next(0.0f, worldSize));
+        boxes[i].Extents = XMFLOAT3(random.Next(0.25f, 1.5f), random.Next(0.25f, 1.5f), random.Next(0.25f, 1.5f));
+        velocities[i] = XMFLOAT3(random.Next(-0.1f, 0.1f), random.Next(-0.1f, 0.1f), random.Next(-0.1f, 0.1f));
+        proxies[i] = tree.CreateProxy(boxes[i], i);
+    }
+
+    result.UpdateMs = 0.0;
+    result.TreeQueryMs = 0.0;
+    result.BruteQueryMs = 0.0;
+
+    result.TreeHits = 0;
+    result.BruteHits = 0;
+    for (UINT f = 0; f < frames; ++f)
+    {
+        double start = GameTimer::NowMs();
+        for (UINT i = 0; i < count; ++i)
+        {
+            XMFLOAT3& c = boxes[i].Center;
+            XMFLOAT3& v = velocities[i];
+            c = XMFLOAT3(c.x + v.x, c.y + v.y, c.z + v.z);
+            if (c.x < 0.0f || c.x > worldSize) v.x = -v.x;
+            if (c.y < 0.0f || c.y > worldSize) v.y = -v.y;
+            if (c.z < 0.0f || c.z > worldSize) v.z = -v.z;
+            tree.MoveProxy(proxies[i], boxes[i]);
+        }
+        result.UpdateMs += GameTimer::NowMs() - start;
+
+        XNA::AxisAlignedBox query[queries];
+        XMVECTOR origin[queries];
+        XMVECTOR dir[queries];
+        for (UINT q = 0; q < queries; ++q)
+        {
+            query[q].Center = XMFLOAT3(random.Next(0.0f, worldSize), random.Next(0.0f, worldSize), random.Next(0.0f, worldSize));
+            query[q].Extents = XMFLOAT3(5.0f, 5.0f, 5.0f);
+            origin[q] = XMVectorSet(random.Next(0.0f, worldSize), random.Next(0.0f, worldSize), -1.0f, 0.0f);
+            dir[q] = XMVector3Normalize(XMVectorSet(random.Next(-0.5f, 0.5f), random.Next(-0.5f, 0.5f), 1.0f, 0.0f));
+        }
+        XMFLOAT4 planes[6];
+        TestFrustum(XMFLOAT3(0.5f * worldSize, 0.5f * worldSize, -1.0f), 1.0f, 0.5f * worldSize, 1.5f, planes);
+
+        // Tree: the queries the renderer and picking make, with the ray shortened at each hit.
+        start = GameTimer::NowMs();
+        for (UINT q = 0; q < queries; ++q)
+        {
+            tree.QueryBox(query[q], [&](UINT) { ++result.TreeHits; return true; });
+
+            XMVECTOR invDir = XMVectorReciprocal(dir[q]);
+            tree.RayCast(origin[q], dir[q], worldSize, [&](UINT proxy, float& maxT)
+            {
+                XMFLOAT3 vMin, vMax;
+                MinMax(boxes[tree.GetUserData(proxy)], vMin, vMax);
+                float t = 0.0f;
+                if (RayHitsMinMax(origin[q], invDir, vMin, vMax, maxT, t))
+                    maxT = t;
+            });
+        }
+        tree.QueryFrustum(planes, [&](UINT) { ++result.TreeHits; return true; });
+        result.TreeQueryMs += GameTimer::NowMs() - start;
+
+        // Brute force: every box for every query.
+        start = GameTimer::NowMs();
+        for (UINT q = 0; q < queries; ++q)
+        {
+            XMFLOAT3 qMin, qMax;
+            MinMax(query[q], qMin, qMax);
+            XMVECTOR invDir = XMVectorReciprocal(dir[q]);
+            float maxT = worldSize;
+            for (UINT i = 0; i < count; ++i)
+            {
+                XMFLOAT3 vMin, vMax;
+                MinMax(boxes[i], vMin, vMax);
+                if (Overlaps(vMin, vMax, qMin, qMax))
+                    ++result.BruteHits;
+
+                float t = 0.0f;
+                if (RayHitsMinMax(origin[q], invDir, vMin, vMax, maxT, t))
+                    maxT = t;
+            }
+        }
+        for (UINT i = 0; i < count; ++i)
+        {
+            XMFLOAT3 vMin, vMax;
+            MinMax(boxes[i], vMin, vMax);
+            if (!OutsidePlanes(vMin, vMax, planes))
+                ++result.BruteHits;
+        }
+        result.BruteQueryMs += GameTimer::NowMs() - start;
+    }
+
+    result.Height = tree.GetStats().Height;
+    result.UpdateMs /= frames;
+    result.TreeQueryMs /= frames;
+    result.BruteQueryMs /= frames;
+    return result;
+}
+#pragma endregion
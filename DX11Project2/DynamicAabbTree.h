@@ -0,0 +1,277 @@
+//***************************************************************************************
+// DynamicAabbTree.h
+//
+// Bounding volume hierarchy over boxes that move every frame.  Each proxy is a
+// leaf holding a fattened copy of its box, so a box that moves a little stays
+// inside its leaf and costs nothing; only a box that leaves its fat box is
+// removed and inserted again.  Insertion picks the sibling by the surface area
+// heuristic and the ancestors are rebalanced with rotations on the way up, so
+// the tree stays shallow however the proxies arrive.
+//
+// Queries walk the tree with a fixed stack and call back with the proxy ids
+// they find:  QueryBox and QueryFrustum call visit(proxy), which returns false
+// to stop; RayCast calls visit(proxy, maxT) and the visitor may shorten maxT to
+// prune everything further along the ray.
+//***************************************************************************************
+
+#ifndef DYNAMICAABBTREE_H
+#define DYNAMICAABBTREE_H
+
+#include "d3dUtil.h"
+
+class DynamicAabbTree
+{
+public:
+    static const UINT NullNode = 0xffffffff;
+
+    struct Stats
+    {
+        UINT    Proxies;
+        UINT    Height;
+        UINT    Reinserts;      // moves that left the fat box, since the last ResetStats
+        UINT    Rotations;
+    };
+
+    struct BenchmarkResult
+    {
+        UINT    Count;
+        UINT    Frames;
+        UINT    Height;
+        double  UpdateMs;       // per frame, moving every proxy
+        double  TreeQueryMs;    // per frame, box, frustum and ray queries on the tree
+        double  BruteQueryMs;   // per frame, the same queries against every box
+        UINT    TreeHits;       // fat boxes the tree reported to box and frustum queries
+        UINT    BruteHits;      // boxes that passed the same queries
+    };
+
+public:
+    // 'margin' is how far a fat box reaches past the box it was made from.
+    explicit DynamicAabbTree(float margin = 0.25f);
+
+    UINT    CreateProxy(const XNA::AxisAlignedBox& box, UINT userData);
+    void    DestroyProxy(UINT proxy);
+
+    // Returns true when the box left its fat box and the proxy was reinserted.
+    bool    MoveProxy(UINT proxy, const XNA::AxisAlignedBox& box);
+
+    void    Clear();
+
+    UINT                GetUserData(UINT proxy) const   { return m_Nodes[proxy].UserData; }
+    XNA::AxisAlignedBox GetFatBox(UINT proxy) const;
+
+    Stats   GetStats() const;
+    void    ResetStats()                                { m_Reinserts = 0; m_Rotations = 0; }
+
+    template <typename Visitor>
+    void    QueryBox(const XNA::AxisAlignedBox& box, Visitor visit) const;
+
+    // Planes as ExtractFrustumPlanes makes them, pointing inwards.
+    template <typename Visitor>
+    void    QueryFrustum(const XMFLOAT4 planes[6], Visitor visit) const;
+
+    template <typename Visitor>
+    void    RayCast(FXMVECTOR origin, FXMVECTOR dir, float maxT, Visitor visit) const;
+
+    // Checks the links, heights and enclosing boxes.  Returns the number of broken nodes.
+    UINT    Validate() const;
+
+    // Compares the queries with testing every box while proxies are added, moved
+    // and removed.  Returns the number of mismatches.
+    static UINT             SelfTest();
+
+    // Moves 'count' proxies for 'frames' frames.
+    static BenchmarkResult  Benchmark(UINT count, UINT frames);
+
+public:
+    DynamicAabbTree(const DynamicAabbTree& rhs)             = delete;
+    DynamicAabbTree& operator=(const DynamicAabbTree& rhs)  = delete;
+
+private:
+    // A balanced tree of a million leaves is less than half as deep.
+    static const UINT StackSize = 64;
+
+    struct Node
+    {
+        XMFLOAT3    Min;
+        XMFLOAT3    Max;
+        UINT        Parent;         // next free node while on the free list
+        UINT        Child1;
+        UINT        Child2;
+        int         Height;         // 0 for leaves, -1 for free nodes
+        UINT        UserData;
+
+        bool        IsLeaf() const  { return Child1 == NullNode; }
+    };
+
+    UINT    AllocateNode();
+    void    FreeNode(UINT node);
+    void    InsertLeaf(UINT leaf);
+    void    RemoveLeaf(UINT leaf);
+    UINT    Balance(UINT a);
+    void    Refit(UINT node);
+    UINT    ValidateNode(UINT node, UINT parent) const;
+
+    static bool     RayHitsBox(FXMVECTOR origin, FXMVECTOR invDir, const Node& node, float maxT, float& t);
+
+private:
+    std::vector<Node>   m_Nodes;
+    UINT                m_Root;
+    UINT                m_FreeList;
+    UINT                m_ProxyCount;
+    float               m_Margin;
+
+    UINT                m_Reinserts;
+    UINT                m_Rotations;
+};
+
+template <typename Visitor>
+void DynamicAabbTree::QueryBox(const XNA::AxisAlignedBox& box, Visitor visit) const
+{
+    if (m_Root == NullNode)
+        return;
+
+    XMFLOAT3 qMin(box.Center.x - box.Extents.x, box.Center.y - box.Extents.y, box.Center.z - box.Extents.z);
+    XMFLOAT3 qMax(box.Center.x + box.Extents.x, box.Center.y + box.Extents.y, box.Center.z + box.Extents.z);
+
+    UINT stack[StackSize];
+    UINT count = 0;
+    stack[count++] = m_Root;
+    while (count > 0)
+    {
+        UINT index = stack[--count];
+        const Node& node = m_Nodes[index];
+        if (node.Min.x > qMax.x || node.Max.x < qMin.x ||
+            node.Min.y > qMax.y || node.Max.y < qMin.y ||
+            node.Min.z > qMax.z || node.Max.z < qMin.z)
+            continue;
+
+        if (node.IsLeaf())
+        {
+            if (!visit(index))
+                return;
+        }
+        else
+        {
+            assert(count + 2 <= StackSize);
+            stack[count++] = node.Child1;
+            stack[count++] = node.Child2;
+        }
+    }
+}
+
+template <typename Visitor>
+void DynamicAabbTree::QueryFrustum(const XMFLOAT4 planes[6], Visitor visit) const
+{
+    if (m_Root == NullNode)
+        return;
+
+    XMVECTOR P[6];
+    XMVECTOR absP[6];
+    for (UINT p = 0; p < 6; ++p)
+    {
+        P[p] = XMLoadFloat4(&planes[p]);
+        absP[p] = XMVectorAbs(P[p]);
+    }
+
+    // Each entry carries the planes its box is not yet known to be inside of;
+    // a subtree inside all six is reported without further tests.
+    UINT stack[StackSize];
+    UINT masks[StackSize];
+    UINT count = 0;
+    stack[count] = m_Root;
+    masks[count++] = 0x3f;
+    while (count > 0)
+    {
+        --count;
+        UINT index = stack[count];
+        UINT mask = masks[count];
+        const Node& node = m_Nodes[index];
+
+        if (mask)
+        {
+            XMVECTOR vMin = XMLoadFloat3(&node.Min);
+            XMVECTOR vMax = XMLoadFloat3(&node.Max);
+            XMVECTOR center = XMVectorSetW(0.5f*(vMin + vMax), 1.0f);
+            XMVECTOR extents = 0.5f*(vMax - vMin);
+
+            bool outside = false;
+            for (UINT p = 0; p < 6 && !outside; ++p)
+            {
+                if (!(mask & (1 << p)))
+                    continue;
+
+                float r = XMVectorGetX(XMVector3Dot(extents, absP[p]));
+                float s = XMVectorGetX(XMVector4Dot(P[p], center));
+                outside = s + r < 0.0f;
+                if (s - r >= 0.0f)
+                    mask &= ~(1 << p);
+            }
+            if (outside)
+                continue;
+        }
+
+        if (node.IsLeaf())
+        {
+            if (!visit(index))
+                return;
+        }
+        else
+        {
+            assert(count + 2 <= StackSize);
+            stack[count] = node.Child1;
+            masks[count++] = mask;
+            stack[count] = node.Child2;
+            masks[count++] = mask;
+        }
+    }
+}
+
+template <typename Visitor>
+void DynamicAabbTree::RayCast(FXMVECTOR origin, FXMVECTOR dir, float maxT, Visitor visit) const
+{
+    if (m_Root == NullNode)
+        return;
+
+    XMVECTOR invDir = XMVectorReciprocal(dir);
+
+    UINT stack[StackSize];
+    UINT count = 0;
+    stack[count++] = m_Root;
+    while (count > 0)
+    {
+        UINT index = stack[--count];
+        const Node& node = m_Nodes[index];
+
+        float t = 0.0f;
+        if (!RayHitsBox(origin, invDir, node, maxT, t))
+            continue;
+
+        if (node.IsLeaf())
+        {
+            visit(index, maxT);
+            continue;
+        }
+
+        // The nearer child goes on top, so it can shorten the ray for the other.
+        float t1 = 0.0f;
+        float t2 = 0.0f;
+        bool hit1 = RayHitsBox(origin, invDir, m_Nodes[node.Child1], maxT, t1);
+        bool hit2 = RayHitsBox(origin, invDir, m_Nodes[node.Child2], maxT, t2);
+        assert(count + 2 <= StackSize);
+        if (hit1 && hit2)
+        {
+            stack[count++] = t1 < t2 ? node.Child2 : node.Child1;
+            stack[count++] = t1 < t2 ? node.Child1 : node.Child2;
+        }
+        else if (hit1)
+        {
+            stack[count++] = node.Child1;
+        }
+        else if (hit2)
+        {
+            stack[count++] = node.Child2;
+        }
+    }
+}
+
+#endif // DYNAMICAABBTREE_H
@@ -0,0 +1,232 @@
+//***************************************************************************************
+// EffectPermutations.cpp
+//***************************************************************************************
+
+#include "EffectPermutations.h"
+#include "AssetArchive.h"
+#include "GameTimer.h"
+
+namespace
+{
+    std::wstring DirectoryOf(const std::wstring& file)
+    {
+        size_t slash = file.find_last_of(L"/\\");
+        return (slash == std::wstring::npos) ? std::wstring() : file.substr(0, slash + 1);
+    }
+
+    bool GetWriteTime(const std::wstring& file, FILETIME& time)
+    {
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!GetFileAttributesExW(file.c_str(), GetFileExInfoStandard, &data))
+            return false;
+        time = data.ftLastWriteTime;
+        return true;
+    }
+
+    // Includes are not tracked individually; any edited .fx in the source
+    // directory invalidates the cache.
+    bool GetNewestSourceTime(const std::wstring& dir, FILETIME& newest)
+    {
+        WIN32_FIND_DATAW fd;
+        HANDLE find = FindFirstFileW((dir + L"*.fx").c_str(), &fd);
+        if (find == INVALID_HANDLE_VALUE)
+            return false;
+
+        newest = fd.ftLastWriteTime;
+        while (FindNextFileW(find, &fd))
+        {
+            if (CompareFileTime(&fd.ftLastWriteTime, &newest) > 0)
+                newest = fd.ftLastWriteTime;
+        }
+        FindClose(find);
+        return true;
+    }
+}
+
+EffectPermutations::EffectPermutations(ID3D11Device* device, const std::wstring& sourceFile, const std::wstring& name,
+                                       const EffectFeature* features, UINT featureCount)
+:   m_Device(device),
+    m_SourceFile(sourceFile),
+    m_Name(name),
+    m_Features(features, features + featureCount)
+{
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+    CreateDirectoryW((DirectoryOf(m_SourceFile) + L"Cache").c_str(), 0);
+}
+
+EffectPermutations::~EffectPermutations()
+{
+    for (auto& variant : m_Variants)
+    {
+        ReleaseCOM(variant.second);
+    }
+}
+
+ID3DX11Effect* EffectPermutations::Get(UINT mask)
+{
+    auto it = m_Variants.find(mask);
+    if (it != m_Variants.end())
+        return it->second;
+
+    double start = GameTimer::NowMs();
+
+    // A cached blob the effect framework rejects is rebuilt from source.
+    std::wstring cacheFile = CacheFile(mask);
+    std::vector<char> blob;
+    ID3DX11Effect* fx = nullptr;
+    bool cached = LoadCached(cacheFile, blob) &&
+        SUCCEEDED(D3DX11CreateEffectFromMemory(&blob[0], blob.size(), 0, m_Device, &fx));
+    if (!cached && (!Compile(mask, blob) ||
+        FAILED(D3DX11CreateEffectFromMemory(&blob[0], blob.size(), 0, m_Device, &fx))))
+    {
+        // Remembered, so a broken variant is not rebuilt every frame.
+        m_Variants[mask] = nullptr;
+        ++m_Stats.Failed;
+
+        std::wostringstream outs;
+        outs << m_Name << L" variant 0x" << std::hex << mask << std::dec << L" could not be built\n";
+        OutputDebugStringW(outs.str().c_str());
+        return nullptr;
+    }
+    if (!cached && !WriteCached(cacheFile, blob))
+    {
+        std::wostringstream outs;
+        outs << cacheFile << L" could not be written\n";
+        OutputDebugStringW(outs.str().c_str());
+    }
+    m_Variants[mask] = fx;
+
+    double elapsed = GameTimer::NowMs() - start;
+    if (cached)
+    {
+        ++m_Stats.Loaded;
+        m_Stats.LoadMs += elapsed;
+    }
+    else
+    {
+        ++m_Stats.Compiled;
+        m_Stats.CompileMs += elapsed;
+    }
+
+    std::wostringstream outs;
+    outs << m_Name << L" variant 0x" << std::hex << mask << std::dec
+        << (cached ? L" loaded from cache in " : L" compiled in ") << elapsed << L" ms\n";
+    OutputDebugStringW(outs.str().c_str());
+
+    return fx;
+}
+
+std::wstring EffectPermutations::CacheFile(UINT mask) const
+{
+    std::wostringstream outs;
+    outs << DirectoryOf(m_SourceFile) << L"Cache/" << m_Name << L"_0x" << std::hex << mask << L".cso";
+    return outs.str();
+}
+
+bool EffectPermutations::LoadCached(const std::wstring& cacheFile, std::vector<char>& blob)
+{
+    FILETIME cacheTime, sourceTime;
+    bool haveSources = GetNewestSourceTime(DirectoryOf(m_SourceFile), sourceTime);
+    if (!GetWriteTime(cacheFile, cacheTime))
+    {
+        // A shipped build has no sources and its cache in the asset pack.
+        AssetArchive::Asset asset;
+        if (haveSources || !AssetArchive::getInstance()->Contains(cacheFile) ||
+            !AssetArchive::getInstance()->Load(cacheFile, asset) || asset.Size == 0)
+            return false;
+        blob.assign(asset.Data, asset.Data + asset.Size);
+        return true;
+    }
+
+    // Without sources (e.g. a shipped build) whatever is cached is used as is.
+    if (haveSources && CompareFileTime(&cacheTime, &sourceTime) <= 0)
+        return false;
+
+    std::ifstream fin(cacheFile, std::ios::binary);
+    if (!fin)
+        return false;
+
+    fin.seekg(0, std::ios_base::end);
+    int size = (int)fin.tellg();
+    fin.seekg(0, std::ios_base::beg);
+    if (size <= 0)
+        return false;
+
+    blob.resize(size);
+    fin.read(&blob[0], size);
+    return !fin.fail();
+}
+
+bool EffectPermutations::Compile(UINT mask, std::vector<char>& blob)
+{
+    std::vector<std::string> values(m_Features.size());
+    std::vector<D3D10_SHADER_MACRO> macros(m_Features.size() + 1);
+    for (UINT i = 0; i < m_Features.size(); ++i)
+    {
+        const EffectFeature& feature = m_Features[i];
+        UINT value = (mask >> feature.Shift) & ((1 << feature.Bits) - 1);
+
+        std::ostringstream outs;
+        outs << value;
+        values[i] = outs.str();
+
+        macros[i].Name = feature.Macro;
+        macros[i].Definition = values[i].c_str();
+    }
+    macros.back().Name = 0;
+    macros.back().Definition = 0;
+
+    DWORD shaderFlags = 0;
+#if defined( DEBUG ) || defined( _DEBUG )
+    shaderFlags |= D3D10_SHADER_DEBUG;
+    shaderFlags |= D3D10_SHADER_SKIP_OPTIMIZATION;
+#endif
+
+    ID3D10Blob* compiledShader = 0;
+    ID3D10Blob* compilationMsgs = 0;
+    HRESULT hr = D3DX11CompileFromFile(m_SourceFile.c_str(), &macros[0], 0, 0, "fx_5_0", shaderFlags,
+                                       0, 0, &compiledShader, &compilationMsgs, 0);
+
+    // compilationMsgs can store errors or warnings.
+    if (compilationMsgs != 0)
+    {
+        OutputDebugStringA((char*)compilationMsgs->GetBufferPointer());
+        ReleaseCOM(compilationMsgs);
+    }
+    if (FAILED(hr) || !compiledShader)
+    {
+        ReleaseCOM(compiledShader);
+        return false;
+    }
+
+    const char* data = static_cast<const char*>(compiledShader->GetBufferPointer());
+    blob.assign(data, data + compiledShader->GetBufferSize());
+    ReleaseCOM(compiledShader);
+    return true;
+}
+
+bool EffectPermutations::WriteCached(const std::wstring& cacheFile, const std::vector<char>& blob)
+{
+    // Written aside and moved into place, so a failed write never leaves a
+    // truncated blob that is newer than the sources.
+    std::wstring tempFile = cacheFile + L".tmp";
+    {
+        std::ofstream fout(tempFile, std::ios::binary);
+        if (!fout)
+            return false;
+        fout.write(&blob[0], blob.size());
+        fout.close();
+        if (fout.fail())
+        {
+            DeleteFileW(tempFile.c_str());
+            return false;
+        }
+    }
+
+    if (!MoveFileExW(tempFile.c_str(), cacheFile.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileW(tempFile.c_str());
+        return false;
+    }
+    return true;
+}
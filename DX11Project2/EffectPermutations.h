@@ -0,0 +1,72 @@
+//***************************************************************************************
+// EffectPermutations.h
+//
+// Lazily built variants of one effect source, keyed by a feature bitmask.
+//
+// Every feature owns a bit field of the mask and is passed to the compiler as a
+// macro carrying the field's value.  A variant is built the first time it is
+// requested: it is loaded from the on-disk cache when the cached blob is newer
+// than every .fx file, and compiled from source (and written to the cache)
+// otherwise.  Variants nobody asks for are never compiled or loaded.  A variant
+// that cannot be built (no sources and no cache, or a compile error) is
+// reported as null once and not tried again.
+//***************************************************************************************
+
+#ifndef EFFECTPERMUTATIONS_H
+#define EFFECTPERMUTATIONS_H
+
+#include "d3dUtil.h"
+#include <map>
+
+struct EffectFeature
+{
+    const char* Macro;
+    UINT        Shift;
+    UINT        Bits;
+};
+
+class EffectPermutations
+{
+public:
+    struct Stats
+    {
+        UINT    Compiled;
+        UINT    Loaded;
+        UINT    Failed;     // neither loaded nor compiled
+        double  CompileMs;
+        double  LoadMs;
+    };
+
+public:
+    // 'name' prefixes the cache files, e.g. FX/Cache/Basic_0x15.cso.
+    EffectPermutations(ID3D11Device* device, const std::wstring& sourceFile, const std::wstring& name,
+                       const EffectFeature* features, UINT featureCount);
+    ~EffectPermutations();
+
+    // Returns the effect built for 'mask', building it on first use, or null
+    // when the variant can be neither loaded nor compiled.
+    ID3DX11Effect*  Get(UINT mask);
+
+    const Stats&    GetStats() const { return m_Stats; }
+
+public:
+    EffectPermutations(const EffectPermutations& rhs)               = delete;
+    EffectPermutations& operator=(const EffectPermutations& rhs)    = delete;
+
+private:
+    std::wstring    CacheFile(UINT mask) const;
+    bool            LoadCached(const std::wstring& cacheFile, std::vector<char>& blob);
+    bool            Compile(UINT mask, std::vector<char>& blob);
+    bool            WriteCached(const std::wstring& cacheFile, const std::vector<char>& blob);
+
+private:
+    ID3D11Device*                       m_Device;
+    std::wstring                        m_SourceFile;
+    std::wstring                        m_Name;
+    std::vector<EffectFeature>          m_Features;
+
+    std::map<UINT, ID3DX11Effect*>      m_Variants;
+    Stats                               m_Stats;
+};
+
+#endif // EFFECTPERMUTATIONS_H
@@ -4,22 +4,19 @@
 
 #include "Effects.h"
 #include "Object.h"
+#include "ConstantBuffers.h"
+#include "TextureArrays.h"
+#include "AssetArchive.h"
+#include "Allocators.h"
 
 #pragma region Effect
 Effect::Effect(ID3D11Device* device, const std::wstring& filename)
 	: m_FX(nullptr)
 {
-	std::ifstream fin(filename, std::ios::binary);
-
-	fin.seekg(0, std::ios_base::end);
-	int size = (int)fin.tellg();
-	fin.seekg(0, std::ios_base::beg);
-	std::vector<char> compiledShader(size);
-
-	fin.read(&compiledShader[0], size);
-	fin.close();
+	AssetArchive::Asset compiledShader;
+	AssetArchive::getInstance()->Load(filename, compiledShader);
 	
-	HR(D3DX11CreateEffectFromMemory(&compiledShader[0], size, 0, device, &m_FX));
+	HR(D3DX11CreateEffectFromMemory(compiledShader.Data, compiledShader.Size, 0, device, &m_FX));
 }
 
 Effect::~Effect()
@@ -50,67 +47,245 @@ void ColorEffect::UpdateCb(ID3D11DeviceContext* context, CXMMATRIX viewProj, Obj
 }
 #pragma endregion
 
+#pragma region PermutedEffect
+PermutedEffect::PermutedEffect(ID3D11Device* device, const std::wstring& filename, const std::wstring& sourceFile,
+                               const std::wstring& name, const EffectFeature* features, UINT featureCount)
+:   Effect(device, filename),
+    m_Permutations(device, sourceFile, name, features, featureCount),
+    m_Current(nullptr)
+{
+    m_DefaultTech = m_FX->GetTechniqueByName("Main");
+}
+
+PermutedEffect::~PermutedEffect()
+{
+    for (auto group : m_Groups)
+    {
+        SafeDelete(group);
+    }
+}
+
+UINT PermutedEffect::AddGroup(const char* cbufferName)
+{
+    assert(m_Variants.empty());
+
+    auto group = new ConstantGroup();
+    group->Init(m_FX->GetConstantBufferByName(cbufferName));
+    m_Groups.push_back(group);
+    m_GroupNames.push_back(cbufferName);
+    return m_Groups.size() - 1;
+}
+
+UINT PermutedEffect::AddResource(const char* name)
+{
+    assert(m_Variants.empty());
+
+    m_ResourceNames.push_back(name);
+    m_ResourceValues.push_back(nullptr);
+    return m_ResourceNames.size() - 1;
+}
+
+void PermutedEffect::SetResource(UINT resource, ID3D11ShaderResourceView* srv)
+{
+    m_ResourceValues[resource] = srv;
+    if (m_Current)
+        m_Current->Resources[resource]->SetResource(srv);
+}
+
+ID3DX11EffectTechnique* PermutedEffect::SelectTech(UINT features)
+{
+    auto it = m_Variants.find(features);
+    if (it == m_Variants.end())
+    {
+        // Without the variant the project's build of the effect stands in,
+        // drawing with its default features rather than not at all.
+        ID3DX11Effect* fx = m_Permutations.Get(features);
+        if (!fx)
+            fx = m_FX;
+
+        Variant variant;
+        variant.Tech = fx->GetTechniqueByName("Main");
+        for (auto name : m_GroupNames)
+        {
+            variant.Groups.push_back(fx->GetConstantBufferByName(name));
+            variant.GroupVersions.push_back(0);
+        }
+        for (auto name : m_ResourceNames)
+        {
+            variant.Resources.push_back(fx->GetVariableByName(name)->AsShaderResource());
+        }
+        it = m_Variants.insert(std::make_pair(features, variant)).first;
+    }
+
+    Variant& variant = it->second;
+    for (UINT i = 0; i < m_Groups.size(); ++i)
+    {
+        m_Groups[i]->Upload(variant.Groups[i], variant.GroupVersions[i]);
+    }
+    for (UINT i = 0; i < m_ResourceValues.size(); ++i)
+    {
+        variant.Resources[i]->SetResource(m_ResourceValues[i]);
+    }
+    m_Current = &variant;
+    return variant.Tech;
+}
+#pragma endregion
+
 #pragma region BasicEffect
-BasicEffect::BasicEffect(ID3D11Device* device, const std::wstring& filename)
-: Effect(device, filename)
+static const EffectFeature BasicFeatureTable[] =
+{
+    { "LIGHT_COUNT",    0, 2 },
+    { "USE_TEXTURE",    2, 1 },
+    { "ALPHA_CLIP",     3, 1 },
+    { "FOG",            4, 1 },
+    { "CLUSTERED",      5, 1 },
+    { "SHADOW",         6, 2 },
+};
+
+BasicEffect::BasicEffect(ID3D11Device* device, const std::wstring& filename, const std::wstring& sourceFile)
+: PermutedEffect(device, filename, sourceFile, L"Basic", BasicFeatureTable, ARRAYSIZE(BasicFeatureTable))
 {
-    m_Light1Tech                = m_FX->GetTechniqueByName("Light1");
-    m_Light2Tech                = m_FX->GetTechniqueByName("Light2");
-    m_Light3Tech                = m_FX->GetTechniqueByName("Light3");
-
-    m_Light0TexTech             = m_FX->GetTechniqueByName("Light0Tex");
-    m_Light1TexTech             = m_FX->GetTechniqueByName("Light1Tex");
-    m_Light2TexTech             = m_FX->GetTechniqueByName("Light2Tex");
-    m_Light3TexTech             = m_FX->GetTechniqueByName("Light3Tex");
-
-    m_Light0TexAlphaClipTech    = m_FX->GetTechniqueByName("Light0TexAlphaClip");
-    m_Light1TexAlphaClipTech    = m_FX->GetTechniqueByName("Light1TexAlphaClip");
-    m_Light2TexAlphaClipTech    = m_FX->GetTechniqueByName("Light2TexAlphaClip");
-    m_Light3TexAlphaClipTech    = m_FX->GetTechniqueByName("Light3TexAlphaClip");
-
-    m_Light1FogTech             = m_FX->GetTechniqueByName("Light1Fog");
-    m_Light2FogTech             = m_FX->GetTechniqueByName("Light2Fog");
-    m_Light3FogTech             = m_FX->GetTechniqueByName("Light3Fog");
-
-    m_Light0TexFogTech          = m_FX->GetTechniqueByName("Light0TexFog");
-    m_Light1TexFogTech          = m_FX->GetTechniqueByName("Light1TexFog");
-    m_Light2TexFogTech          = m_FX->GetTechniqueByName("Light2TexFog");
-    m_Light3TexFogTech          = m_FX->GetTechniqueByName("Light3TexFog");
-
-    m_Light0TexAlphaClipFogTech = m_FX->GetTechniqueByName("Light0TexAlphaClipFog");
-    m_Light1TexAlphaClipFogTech = m_FX->GetTechniqueByName("Light1TexAlphaClipFog");
-    m_Light2TexAlphaClipFogTech = m_FX->GetTechniqueByName("Light2TexAlphaClipFog");
-    m_Light3TexAlphaClipFogTech = m_FX->GetTechniqueByName("Light3TexAlphaClipFog");
-
-    m_WorldViewProj     = m_FX->GetVariableByName("gWorldViewProj")->AsMatrix();
-    m_World             = m_FX->GetVariableByName("gWorld")->AsMatrix();
-    m_WorldInvTranspose = m_FX->GetVariableByName("gWorldInvTranspose")->AsMatrix();
-    m_TexTransform      = m_FX->GetVariableByName("gTexTransform")->AsMatrix();
-    m_EyePosW           = m_FX->GetVariableByName("gEyePosW")->AsVector();
-	m_FogColor          = m_FX->GetVariableByName("gFogColor")->AsVector();
-	m_FogStart          = m_FX->GetVariableByName("gFogStart")->AsScalar();
-	m_FogRange          = m_FX->GetVariableByName("gFogRange")->AsScalar();
-    m_DirLights         = m_FX->GetVariableByName("gDirLights");
-    m_Mat               = m_FX->GetVariableByName("gMaterial");
-    m_DiffuseMap        = m_FX->GetVariableByName("gDiffuseMap")->AsShaderResource();
+    m_PerFrame          = AddGroup("cbPerFrame");
+    m_PerScene          = AddGroup("cbPerScene");
+
+    m_EyePosW           = OffsetOf("gEyePosW");
+    m_FogColor          = OffsetOf("gFogColor");
+    m_FogStart          = OffsetOf("gFogStart");
+    m_FogRange          = OffsetOf("gFogRange");
+    m_DirLights         = OffsetOf("gDirLights");
+
+    m_Clusters          = AddGroup("cbClusters");
+    m_ClusterScale      = OffsetOf("gClusterScale");
+
+    m_Shadows           = AddGroup("cbShadows");
+    m_ShadowTransforms  = OffsetOf("gShadowTransforms");
+
+    m_DiffuseMapArray       = AddResource("gDiffuseMapArray");
+    m_PointLights           = AddResource("gPointLights");
+    m_SpotLights            = AddResource("gSpotLights");
+    m_ClusterGrid           = AddResource("gClusterGrid");
+    m_ClusterLightIndices   = AddResource("gClusterLightIndices");
+    m_ShadowMap             = AddResource("gShadowMap");
 }
 
 BasicEffect::~BasicEffect()
 {
 }
 
+UINT BasicEffect::FeaturesFor(RenderOptions options)
+{
+    switch (options)
+    {
+    case RenderOptions::Lighting:
+        return 3;
+    case RenderOptions::Textures:
+        return 3 | BasicTexture;
+    case RenderOptions::TexturesAndFog:
+        return 3 | BasicTexture | BasicFog;
+    case RenderOptions::ClusteredLights:
+        return 3 | BasicTexture | BasicFog | BasicClustered;
+    case RenderOptions::Shadows:
+        return 3 | BasicTexture | BasicFog | BasicShadowReceive;
+    }
+    return 3;
+}
+
+namespace
+{
+    TextureArrays::Slice GetDiffuseSlice(const Object* object)
+    {
+        TextureArrays::Slice none = { TextureArrays::InvalidHandle, 0 };
+        UINT handle = object->GetDiffuseMap();
+        return handle == TextureArrays::InvalidHandle ? none : TextureArrays::getInstance()->GetSlice(handle);
+    }
+
+    ID3D11ShaderResourceView* GetDiffuseArraySRV(const Object* object)
+    {
+        TextureArrays::Slice slice = GetDiffuseSlice(object);
+        return slice.Array == TextureArrays::InvalidHandle ? nullptr : TextureArrays::getInstance()->GetSRV(slice.Array);
+    }
+
+    // The blocks of 'objects', the transforms in one pass of the scene store's kernel.
+    void WriteInstances(PerObjectConstants* cb, CXMMATRIX viewProj, Object* const* objects, UINT count)
+    {
+        auto handles = FrameArena::getInstance()->AllocateArray<SceneStore::Handle>(count);
+        for (UINT i = 0; i < count; ++i)
+            handles[i] = objects[i]->GetHandle();
+
+        const SceneStore::DrawLayout layout =
+        {
+            sizeof(PerObjectConstants),
+            offsetof(PerObjectConstants, World),
+            offsetof(PerObjectConstants, WorldInvTranspose),
+            offsetof(PerObjectConstants, WorldViewProj),
+            offsetof(PerObjectConstants, TexTransform),
+        };
+        SceneStore::getInstance()->GetDrawTransforms(handles, count, viewProj, layout, cb);
+
+        for (UINT i = 0; i < count; ++i)
+        {
+            cb[i].Mat = objects[i]->GetMaterial();
+            cb[i].DiffuseSlice = GetDiffuseSlice(objects[i]).Index;
+        }
+    }
+}
+
 void BasicEffect::UpdateCb(ID3D11DeviceContext* context, CXMMATRIX viewProj, Object* object)
 {
-    XMMATRIX world = object->GetWorldMatrix();
-    XMMATRIX worldInvTranspose = MathHelper::InverseTranspose(world);
-    XMMATRIX worldViewProj = world*viewProj;
+    UpdatePerObject(context, viewProj, object, object->GetMaterial());
+    SetDiffuseMapArray(GetDiffuseArraySRV(object));
+}
 
-    SetWorld(world);
-    SetWorldInvTranspose(worldInvTranspose);
-    SetWorldViewProj(worldViewProj);
-    SetTexTransform(object->GetTexTransform());
-    SetMaterial(object->GetMaterial());
-    SetDiffuseMap(object->GetSRV());
+void BasicEffect::UpdatePerObject(ID3D11DeviceContext* context, CXMMATRIX viewProj, Object* object, const Material& mat)
+{
+    auto ring = ConstantBuffers::PerDraw;
+    UINT offset = 0;
+    auto cb = static_cast<PerObjectConstants*>(ring->Map(context, sizeof(PerObjectConstants), &offset));
+    WriteInstances(cb, viewProj, &object, 1);
+    cb->Mat = mat;
+    ring->Unmap(context);
+
+    ring->Bind(context, ConstantBuffers::PerDrawSlot, sizeof(PerObjectConstants), offset);
+}
+
+UINT BasicEffect::UploadInstances(ID3D11DeviceContext* context, CXMMATRIX viewProj, Object* const* objects, UINT count)
+{
+    auto ring = ConstantBuffers::PerDraw;
+    UINT offset = 0;
+    auto cb = static_cast<PerObjectConstants*>(ring->Map(context, count * sizeof(PerObjectConstants), &offset));
+    WriteInstances(cb, viewProj, objects, count);
+    ring->Unmap(context);
+    return offset;
+}
+
+void BasicEffect::BindInstances(ID3D11DeviceContext* context, UINT offset, const Object* first)
+{
+    ConstantBuffers::PerDraw->Bind(context, ConstantBuffers::PerDrawSlot, sizeof(PerObjectConstants), offset);
+    SetDiffuseMapArray(GetDiffuseArraySRV(first));
+}
+
+void BasicEffect::SetFogColor(const FXMVECTOR v)
+{
+    XMFLOAT4 color;
+    XMStoreFloat4(&color, v);
+    Write(m_PerScene, m_FogColor, color);
+}
+
+void BasicEffect::SetClusteredLighting(const ClusteredLighting& clusters)
+{
+    // ClusterConstants covers the whole cbuffer, starting at gClusterScale.
+    Write(m_Clusters, m_ClusterScale, clusters.GetConstants());
+    SetResource(m_PointLights, clusters.GetPointLightSRV());
+    SetResource(m_SpotLights, clusters.GetSpotLightSRV());
+    SetResource(m_ClusterGrid, clusters.GetGridSRV());
+    SetResource(m_ClusterLightIndices, clusters.GetIndexSRV());
+}
+
+void BasicEffect::SetShadows(const CascadedShadows& shadows)
+{
+    // ShadowConstants covers the whole cbuffer, starting at gShadowTransforms.
+    Write(m_Shadows, m_ShadowTransforms, shadows.GetConstants());
+    SetResource(m_ShadowMap, shadows.GetSRV());
 }
 #pragma endregion
 
@@ -129,41 +304,92 @@ SkyEffect::~SkyEffect()
 #pragma endregion
 
 #pragma region TerrainEffect
-TerrainEffect::TerrainEffect(ID3D11Device* device, const std::wstring& filename)
-: Effect(device, filename)
+static const EffectFeature TerrainFeatureTable[] =
+{
+    { "LIGHT_COUNT",    0, 2 },
+    { "FOG",            2, 1 },
+    { "CLUSTERED",      3, 1 },
+    { "SHADOW",         4, 2 },
+    { "VIRTUAL_TEXTURE", 6, 1 },
+};
+
+TerrainEffect::TerrainEffect(ID3D11Device* device, const std::wstring& filename, const std::wstring& sourceFile)
+: PermutedEffect(device, filename, sourceFile, L"Terrain", TerrainFeatureTable, ARRAYSIZE(TerrainFeatureTable))
 {
-    m_Light1Tech    = m_FX->GetTechniqueByName("Light1");
-    m_Light2Tech    = m_FX->GetTechniqueByName("Light2");
-    m_Light3Tech    = m_FX->GetTechniqueByName("Light3");
-    m_Light1FogTech = m_FX->GetTechniqueByName("Light1Fog");
-    m_Light2FogTech = m_FX->GetTechniqueByName("Light2Fog");
-    m_Light3FogTech = m_FX->GetTechniqueByName("Light3Fog");
-
-    m_ViewProj      = m_FX->GetVariableByName("gViewProj")->AsMatrix();
-    m_EyePosW       = m_FX->GetVariableByName("gEyePosW")->AsVector();
-    m_FogColor      = m_FX->GetVariableByName("gFogColor")->AsVector();
-    m_FogStart      = m_FX->GetVariableByName("gFogStart")->AsScalar();
-    m_FogRange      = m_FX->GetVariableByName("gFogRange")->AsScalar();
-    m_DirLights     = m_FX->GetVariableByName("gDirLights");
-    m_Mat           = m_FX->GetVariableByName("gMaterial");
-
-    m_MinDist               = m_FX->GetVariableByName("gMinDist")->AsScalar();
-    m_MaxDist               = m_FX->GetVariableByName("gMaxDist")->AsScalar();
-    m_MinTess               = m_FX->GetVariableByName("gMinTess")->AsScalar();
-    m_MaxTess               = m_FX->GetVariableByName("gMaxTess")->AsScalar();
-    m_TexelCellSpaceU       = m_FX->GetVariableByName("gTexelCellSpaceU")->AsScalar();
-    m_TexelCellSpaceV       = m_FX->GetVariableByName("gTexelCellSpaceV")->AsScalar();
-    m_WorldCellSpace        = m_FX->GetVariableByName("gWorldCellSpace")->AsScalar();
-    m_WorldFrustumPlanes    = m_FX->GetVariableByName("gWorldFrustumPlanes")->AsVector();
-
-    m_LayerMapArray = m_FX->GetVariableByName("gLayerMapArray")->AsShaderResource();
-    m_BlendMap      = m_FX->GetVariableByName("gBlendMap")->AsShaderResource();
-    m_HeightMap     = m_FX->GetVariableByName("gHeightMap")->AsShaderResource();
+    m_PerFrame      = AddGroup("cbPerFrame");
+    m_PerScene      = AddGroup("cbPerScene");
+
+    m_ViewProj              = OffsetOf("gViewProj");
+    m_EyePosW               = OffsetOf("gEyePosW");
+    m_WorldFrustumPlanes    = OffsetOf("gWorldFrustumPlanes");
+    m_FogColor              = OffsetOf("gFogColor");
+    m_FogStart              = OffsetOf("gFogStart");
+    m_FogRange              = OffsetOf("gFogRange");
+    m_DirLights             = OffsetOf("gDirLights");
+    m_Mat                   = OffsetOf("gMaterial");
+
+    m_MinDist               = OffsetOf("gMinDist");
+    m_MaxDist               = OffsetOf("gMaxDist");
+    m_MinTess               = OffsetOf("gMinTess");
+    m_MaxTess               = OffsetOf("gMaxTess");
+    m_TexelCellSpaceU       = OffsetOf("gTexelCellSpaceU");
+    m_TexelCellSpaceV       = OffsetOf("gTexelCellSpaceV");
+    m_WorldCellSpace        = OffsetOf("gWorldCellSpace");
+    m_VirtualTextureLayout  = OffsetOf("gVirtualTextureLayout");
+
+    m_Clusters      = AddGroup("cbClusters");
+    m_ClusterScale  = OffsetOf("gClusterScale");
+
+    m_Shadows           = AddGroup("cbShadows");
+    m_ShadowTransforms  = OffsetOf("gShadowTransforms");
+
+    m_LayerMapArray         = AddResource("gLayerMapArray");
+    m_BlendMap              = AddResource("gBlendMap");
+    m_HeightMap             = AddResource("gHeightMap");
+    m_PageTable             = AddResource("gPageTable");
+    m_PageCache             = AddResource("gPageCache");
+    m_PointLights           = AddResource("gPointLights");
+    m_SpotLights            = AddResource("gSpotLights");
+    m_ClusterGrid           = AddResource("gClusterGrid");
+    m_ClusterLightIndices   = AddResource("gClusterLightIndices");
+    m_ShadowMap             = AddResource("gShadowMap");
 }
 
 TerrainEffect::~TerrainEffect()
 {
 }
+
+void TerrainEffect::SetViewProj(CXMMATRIX M)
+{
+    // Effect matrices are stored column major; SetMatrix used to transpose for us.
+    XMFLOAT4X4 viewProj;
+    XMStoreFloat4x4(&viewProj, XMMatrixTranspose(M));
+    Write(m_PerFrame, m_ViewProj, viewProj);
+}
+
+void TerrainEffect::SetFogColor(const FXMVECTOR v)
+{
+    XMFLOAT4 color;
+    XMStoreFloat4(&color, v);
+    Write(m_PerScene, m_FogColor, color);
+}
+
+void TerrainEffect::SetClusteredLighting(const ClusteredLighting& clusters)
+{
+    // ClusterConstants covers the whole cbuffer, starting at gClusterScale.
+    Write(m_Clusters, m_ClusterScale, clusters.GetConstants());
+    SetResource(m_PointLights, clusters.GetPointLightSRV());
+    SetResource(m_SpotLights, clusters.GetSpotLightSRV());
+    SetResource(m_ClusterGrid, clusters.GetGridSRV());
+    SetResource(m_ClusterLightIndices, clusters.GetIndexSRV());
+}
+
+void TerrainEffect::SetShadows(const CascadedShadows& shadows)
+{
+    // ShadowConstants covers the whole cbuffer, starting at gShadowTransforms.
+    Write(m_Shadows, m_ShadowTransforms, shadows.GetConstants());
+    SetResource(m_ShadowMap, shadows.GetSRV());
+}
 #pragma endregion
 
 
@@ -177,9 +403,9 @@ TerrainEffect*  Effects::TerrainFX  = nullptr;
 void Effects::InitAll(ID3D11Device* device)
 {
     ColorFX     = new ColorEffect(device, L"FX/color.cso");
-    BasicFX     = new BasicEffect(device, L"FX/Basic.cso");
+    BasicFX     = new BasicEffect(device, L"FX/Basic.cso", L"FX/Basic.fx");
     SkyFX       = new SkyEffect(device, L"FX/Sky.cso");
-    TerrainFX   = new TerrainEffect(device, L"FX/Terrain.cso");
+    TerrainFX   = new TerrainEffect(device, L"FX/Terrain.cso", L"FX/Terrain.fx");
 }
 
 void Effects::DestroyAll()
@@ -9,8 +9,16 @@
 #define EFFECTS_H
 
 #include "d3dUtil.h"
+#include "FrameConstants.h"
+#include "EffectPermutations.h"
+#include "ClusteredLighting.h"
+#include "CascadedShadows.h"
+#include "RenderStates.h"
 class Object;
 
+typedef DirectionalLight    DirLightArray[3];
+typedef XMFLOAT4            FrustumPlaneArray[6];
+
 #pragma region Effect
 class Effect
 {
@@ -46,67 +54,125 @@ public:
 };
 #pragma endregion
 
+#pragma region PermutedEffect
+// Base for effects whose techniques are built per feature mask.  Constants live in
+// CPU copies of the effect's cbuffers and are pushed into a variant when it is
+// selected.  m_FX is the variant produced by the project build; it serves
+// reflection (cbuffer layouts and the input signature) and stands in for a
+// variant that cannot be built.
+class PermutedEffect : public Effect
+{
+public:
+    PermutedEffect(ID3D11Device* device, const std::wstring& filename, const std::wstring& sourceFile,
+                   const std::wstring& name, const EffectFeature* features, UINT featureCount);
+    virtual ~PermutedEffect();
+
+    // Builds the variant for 'features' on first use, brings its constants and
+    // resources up to date and returns its technique.  Set constants before this.
+    ID3DX11EffectTechnique* SelectTech(UINT features);
+
+    const EffectPermutations::Stats& GetPermutationStats() const { return m_Permutations.GetStats(); }
+
+    ID3DX11EffectTechnique*         m_DefaultTech;
+
+protected:
+    UINT    AddGroup(const char* cbufferName);
+    UINT    AddResource(const char* name);
+    UINT    OffsetOf(const char* name) const { return ConstantGroup::OffsetOf(m_FX, name); }
+
+    template<typename T>
+    void    Write(UINT group, UINT offset, const T& v) { m_Groups[group]->Update(offset, v); }
+    void    SetResource(UINT resource, ID3D11ShaderResourceView* srv);
+
+private:
+    struct Variant
+    {
+        ID3DX11EffectTechnique*                             Tech;
+        std::vector<ID3DX11EffectConstantBuffer*>           Groups;
+        std::vector<UINT>                                   GroupVersions;
+        std::vector<ID3DX11EffectShaderResourceVariable*>   Resources;
+    };
+
+    EffectPermutations                      m_Permutations;
+    std::vector<const char*>                m_GroupNames;
+    std::vector<ConstantGroup*>             m_Groups;
+    std::vector<const char*>                m_ResourceNames;
+    std::vector<ID3D11ShaderResourceView*>  m_ResourceValues;
+    std::map<UINT, Variant>                 m_Variants;
+    Variant*                                m_Current;
+};
+#pragma endregion
+
 #pragma region BasicEffect
-class BasicEffect : public Effect
+enum BasicFeatures
+{
+    BasicLightCountMask = 0x3,      // number of directional lights, 0..3
+    BasicTexture        = 1 << 2,
+    BasicAlphaClip      = 1 << 3,
+    BasicFog            = 1 << 4,
+    BasicClustered      = 1 << 5,
+    BasicShadowReceive  = 1 << 6,   // two bit field: receive shadows or
+    BasicShadowCaster   = 2 << 6,   // depth only pass into a shadow map
+};
+
+class BasicEffect : public PermutedEffect
 {
 public:
-    BasicEffect(ID3D11Device* device, const std::wstring& filename);
+    BasicEffect(ID3D11Device* device, const std::wstring& filename, const std::wstring& sourceFile);
     virtual ~BasicEffect();
 
-    virtual void UpdateCb(ID3D11DeviceContext* context, CXMMATRIX viewProj, Object* object);
+    // The features an object lit and textured by BasicFX draws with under 'options'.
+    static UINT FeaturesFor(RenderOptions options);
 
-    void SetWorldViewProj(CXMMATRIX M)                  { m_WorldViewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
-    void SetWorld(CXMMATRIX M)                          { m_World->SetMatrix(reinterpret_cast<const float*>(&M)); }
-    void SetWorldInvTranspose(CXMMATRIX M)              { m_WorldInvTranspose->SetMatrix(reinterpret_cast<const float*>(&M)); }
-    void SetTexTransform(CXMMATRIX M)                   { m_TexTransform->SetMatrix(reinterpret_cast<const float*>(&M)); }
-    void SetEyePosW(const XMFLOAT3& v)                  { m_EyePosW->SetRawValue(&v, 0, sizeof(XMFLOAT3)); }
-    void SetFogColor(const FXMVECTOR v)                 { m_FogColor->SetFloatVector(reinterpret_cast<const float*>(&v)); }
-    void SetFogStart(float f)                           { m_FogStart->SetFloat(f); }
-    void SetFogRange(float f)                           { m_FogRange->SetFloat(f); }
-    void SetDirLights(const DirectionalLight* lights)   { m_DirLights->SetRawValue(lights, 0, 3 * sizeof(DirectionalLight)); }
-    void SetMaterial(const Material& mat)               { m_Mat->SetRawValue(&mat, 0, sizeof(Material)); }
-    void SetDiffuseMap(ID3D11ShaderResourceView* tex)   { m_DiffuseMap->SetResource(tex); }
-
-    ID3DX11EffectTechnique*         m_Light1Tech;
-    ID3DX11EffectTechnique*         m_Light2Tech;
-    ID3DX11EffectTechnique*         m_Light3Tech;
-
-    ID3DX11EffectTechnique*         m_Light0TexTech;
-    ID3DX11EffectTechnique*         m_Light1TexTech;
-    ID3DX11EffectTechnique*         m_Light2TexTech;
-    ID3DX11EffectTechnique*         m_Light3TexTech;
-
-    ID3DX11EffectTechnique*         m_Light0TexAlphaClipTech;
-    ID3DX11EffectTechnique*         m_Light1TexAlphaClipTech;
-    ID3DX11EffectTechnique*         m_Light2TexAlphaClipTech;
-    ID3DX11EffectTechnique*         m_Light3TexAlphaClipTech;
-
-    ID3DX11EffectTechnique*         m_Light1FogTech;
-    ID3DX11EffectTechnique*         m_Light2FogTech;
-    ID3DX11EffectTechnique*         m_Light3FogTech;
-
-    ID3DX11EffectTechnique*         m_Light0TexFogTech;
-    ID3DX11EffectTechnique*         m_Light1TexFogTech;
-    ID3DX11EffectTechnique*         m_Light2TexFogTech;
-    ID3DX11EffectTechnique*         m_Light3TexFogTech;
-
-    ID3DX11EffectTechnique*         m_Light0TexAlphaClipFogTech;
-    ID3DX11EffectTechnique*         m_Light1TexAlphaClipFogTech;
-    ID3DX11EffectTechnique*         m_Light2TexAlphaClipFogTech;
-    ID3DX11EffectTechnique*         m_Light3TexAlphaClipFogTech;
+    virtual void UpdateCb(ID3D11DeviceContext* context, CXMMATRIX viewProj, Object* object);
 
-    ID3DX11EffectMatrixVariable*    m_WorldViewProj;
-    ID3DX11EffectMatrixVariable*    m_World;
-    ID3DX11EffectMatrixVariable*    m_WorldInvTranspose;
-    ID3DX11EffectMatrixVariable*    m_TexTransform;
-    ID3DX11EffectVectorVariable*    m_EyePosW;
-    ID3DX11EffectVectorVariable*    m_FogColor;
-    ID3DX11EffectScalarVariable*    m_FogStart;
-    ID3DX11EffectScalarVariable*    m_FogRange;
-    ID3DX11EffectVariable*          m_DirLights;
-    ID3DX11EffectVariable*          m_Mat;
-
-    ID3DX11EffectShaderResourceVariable* m_DiffuseMap;
+    // Writes the per-object block into ConstantBuffers::PerDraw and binds it.
+    void UpdatePerObject(ID3D11DeviceContext* context, CXMMATRIX viewProj, Object* object, const Material& mat);
+
+    // Writes one block per object back to back with SceneStore::GetDrawTransforms
+    // and returns the ring offset of the first.  Batches of any key can share one
+    // upload.
+    UINT UploadInstances(ID3D11DeviceContext* context, CXMMATRIX viewProj, Object* const* objects, UINT count);
+
+    // Binds the uploaded block at 'offset', so instance i of the draw reads the
+    // i-th block from there, and the diffuse array of 'first'.
+    void BindInstances(ID3D11DeviceContext* context, UINT offset, const Object* first);
+
+    // Per frame / per scene values are only uploaded when they differ from the last write.
+    void SetEyePosW(const XMFLOAT3& v)                  { Write(m_PerFrame, m_EyePosW, v); }
+    void SetFogColor(const FXMVECTOR v);
+    void SetFogStart(float f)                           { Write(m_PerScene, m_FogStart, f); }
+    void SetFogRange(float f)                           { Write(m_PerScene, m_FogRange, f); }
+    void SetDirLights(const DirectionalLight* lights)   { Write(m_PerScene, m_DirLights, *reinterpret_cast<const DirLightArray*>(lights)); }
+    void SetDiffuseMapArray(ID3D11ShaderResourceView* tex) { SetResource(m_DiffuseMapArray, tex); }
+
+    void SetClusteredLighting(const ClusteredLighting& clusters);
+    void SetShadows(const CascadedShadows& shadows);
+
+private:
+    // Constant group indices and the byte offsets of their variables.
+    UINT    m_PerFrame;
+    UINT    m_PerScene;
+
+    UINT    m_EyePosW;
+    UINT    m_FogColor;
+    UINT    m_FogStart;
+    UINT    m_FogRange;
+    UINT    m_DirLights;
+
+    UINT    m_Clusters;
+    UINT    m_ClusterScale;
+
+    UINT    m_Shadows;
+    UINT    m_ShadowTransforms;
+
+    // Resource indices.
+    UINT    m_DiffuseMapArray;
+    UINT    m_PointLights;
+    UINT    m_SpotLights;
+    UINT    m_ClusterGrid;
+    UINT    m_ClusterLightIndices;
+    UINT    m_ShadowMap;
 };
 #pragma endregion
 
@@ -131,65 +197,93 @@ public:
 #pragma endregion
 
 #pragma region TerrainEffect
-class TerrainEffect : public Effect
+enum TerrainFeatures
+{
+    TerrainLightCountMask   = 0x3,  // number of directional lights, 0..3
+    TerrainFog              = 1 << 2,
+    TerrainClustered        = 1 << 3,
+    TerrainShadowReceive    = 1 << 4,   // two bit field, see BasicShadowReceive
+    TerrainShadowCaster     = 2 << 4,
+    TerrainVirtualTexture   = 1 << 6,   // color from the page cache, see VirtualTexture
+};
+
+class TerrainEffect : public PermutedEffect
 {
 public:
-    TerrainEffect(ID3D11Device* device, const std::wstring& filename);
+    TerrainEffect(ID3D11Device* device, const std::wstring& filename, const std::wstring& sourceFile);
     virtual ~TerrainEffect();
 
     virtual void UpdateCb(ID3D11DeviceContext* context, CXMMATRIX viewProj, Object* object){}
 
-    void SetViewProj(CXMMATRIX M)                       { m_ViewProj->SetMatrix(reinterpret_cast<const float*>(&M)); }
-    void SetEyePosW(const XMFLOAT3& v)                  { m_EyePosW->SetRawValue(&v, 0, sizeof(XMFLOAT3)); }
-    void SetFogColor(const FXMVECTOR v)                 { m_FogColor->SetFloatVector(reinterpret_cast<const float*>(&v)); }
-    void SetFogStart(float f)                           { m_FogStart->SetFloat(f); }
-    void SetFogRange(float f)                           { m_FogRange->SetFloat(f); }
-    void SetDirLights(const DirectionalLight* lights)   { m_DirLights->SetRawValue(lights, 0, 3 * sizeof(DirectionalLight)); }
-    void SetMaterial(const Material& mat)               { m_Mat->SetRawValue(&mat, 0, sizeof(Material)); }
-
-    void SetMinDist(float f)                            { m_MinDist->SetFloat(f); }
-    void SetMaxDist(float f)                            { m_MaxDist->SetFloat(f); }
-    void SetMinTess(float f)                            { m_MinTess->SetFloat(f); }
-    void SetMaxTess(float f)                            { m_MaxTess->SetFloat(f); }
-    void SetTexelCellSpaceU(float f)                    { m_TexelCellSpaceU->SetFloat(f); }
-    void SetTexelCellSpaceV(float f)                    { m_TexelCellSpaceV->SetFloat(f); }
-    void SetWorldCellSpace(float f)                     { m_WorldCellSpace->SetFloat(f); }
-    void SetWorldFrustumPlanes(XMFLOAT4 planes[6])      { m_WorldFrustumPlanes->SetFloatVectorArray(reinterpret_cast<float*>(planes), 0, 6); }
-
-    void SetLayerMapArray(ID3D11ShaderResourceView* tex){ m_LayerMapArray->SetResource(tex); }
-    void SetBlendMap(ID3D11ShaderResourceView* tex)     { m_BlendMap->SetResource(tex); }
-    void SetHeightMap(ID3D11ShaderResourceView* tex)    { m_HeightMap->SetResource(tex); }
-
-
-    ID3DX11EffectTechnique*         m_Light1Tech;
-    ID3DX11EffectTechnique*         m_Light2Tech;
-    ID3DX11EffectTechnique*         m_Light3Tech;
-    ID3DX11EffectTechnique*         m_Light1FogTech;
-    ID3DX11EffectTechnique*         m_Light2FogTech;
-    ID3DX11EffectTechnique*         m_Light3FogTech;
-
-    ID3DX11EffectMatrixVariable*    m_ViewProj;
-    ID3DX11EffectMatrixVariable*    m_World;
-    ID3DX11EffectMatrixVariable*    m_WorldInvTranspose;
-    ID3DX11EffectMatrixVariable*    m_TexTransform;
-    ID3DX11EffectVectorVariable*    m_EyePosW;
-    ID3DX11EffectVectorVariable*    m_FogColor;
-    ID3DX11EffectScalarVariable*    m_FogStart;
-    ID3DX11EffectScalarVariable*    m_FogRange;
-    ID3DX11EffectVariable*          m_DirLights;
-    ID3DX11EffectVariable*          m_Mat;
-    ID3DX11EffectScalarVariable*    m_MinDist;
-    ID3DX11EffectScalarVariable*    m_MaxDist;
-    ID3DX11EffectScalarVariable*    m_MinTess;
-    ID3DX11EffectScalarVariable*    m_MaxTess;
-    ID3DX11EffectScalarVariable*    m_TexelCellSpaceU;
-    ID3DX11EffectScalarVariable*    m_TexelCellSpaceV;
-    ID3DX11EffectScalarVariable*    m_WorldCellSpace;
-    ID3DX11EffectVectorVariable*    m_WorldFrustumPlanes;
-
-    ID3DX11EffectShaderResourceVariable* m_LayerMapArray;
-    ID3DX11EffectShaderResourceVariable* m_BlendMap;
-    ID3DX11EffectShaderResourceVariable* m_HeightMap;
+    // Per frame / per scene values are only uploaded when they differ from the last write.
+    void SetViewProj(CXMMATRIX M);
+    void SetEyePosW(const XMFLOAT3& v)                  { Write(m_PerFrame, m_EyePosW, v); }
+    void SetFogColor(const FXMVECTOR v);
+    void SetFogStart(float f)                           { Write(m_PerScene, m_FogStart, f); }
+    void SetFogRange(float f)                           { Write(m_PerScene, m_FogRange, f); }
+    void SetDirLights(const DirectionalLight* lights)   { Write(m_PerScene, m_DirLights, *reinterpret_cast<const DirLightArray*>(lights)); }
+    void SetMaterial(const Material& mat)               { Write(m_PerScene, m_Mat, mat); }
+
+    void SetMinDist(float f)                            { Write(m_PerScene, m_MinDist, f); }
+    void SetMaxDist(float f)                            { Write(m_PerScene, m_MaxDist, f); }
+    void SetMinTess(float f)                            { Write(m_PerScene, m_MinTess, f); }
+    void SetMaxTess(float f)                            { Write(m_PerScene, m_MaxTess, f); }
+    void SetTexelCellSpaceU(float f)                    { Write(m_PerScene, m_TexelCellSpaceU, f); }
+    void SetTexelCellSpaceV(float f)                    { Write(m_PerScene, m_TexelCellSpaceV, f); }
+    void SetWorldCellSpace(float f)                     { Write(m_PerScene, m_WorldCellSpace, f); }
+    void SetWorldFrustumPlanes(const XMFLOAT4 planes[6]) { Write(m_PerFrame, m_WorldFrustumPlanes, *reinterpret_cast<const FrustumPlaneArray*>(planes)); }
+
+    // Pages across at mip 0, texels per page, border texels, cache texels across.
+    void SetVirtualTextureLayout(const XMFLOAT4& v)     { Write(m_PerScene, m_VirtualTextureLayout, v); }
+
+    void SetLayerMapArray(ID3D11ShaderResourceView* tex){ SetResource(m_LayerMapArray, tex); }
+    void SetBlendMap(ID3D11ShaderResourceView* tex)     { SetResource(m_BlendMap, tex); }
+    void SetHeightMap(ID3D11ShaderResourceView* tex)    { SetResource(m_HeightMap, tex); }
+    void SetPageTable(ID3D11ShaderResourceView* tex)    { SetResource(m_PageTable, tex); }
+    void SetPageCache(ID3D11ShaderResourceView* tex)    { SetResource(m_PageCache, tex); }
+
+    void SetClusteredLighting(const ClusteredLighting& clusters);
+    void SetShadows(const CascadedShadows& shadows);
+
+private:
+    // Constant group indices and the byte offsets of their variables.
+    UINT    m_PerFrame;
+    UINT    m_PerScene;
+
+    UINT    m_ViewProj;
+    UINT    m_EyePosW;
+    UINT    m_WorldFrustumPlanes;
+    UINT    m_FogColor;
+    UINT    m_FogStart;
+    UINT    m_FogRange;
+    UINT    m_DirLights;
+    UINT    m_Mat;
+    UINT    m_MinDist;
+    UINT    m_MaxDist;
+    UINT    m_MinTess;
+    UINT    m_MaxTess;
+    UINT    m_TexelCellSpaceU;
+    UINT    m_TexelCellSpaceV;
+    UINT    m_WorldCellSpace;
+    UINT    m_VirtualTextureLayout;
+
+    UINT    m_Clusters;
+    UINT    m_ClusterScale;
+
+    UINT    m_Shadows;
+    UINT    m_ShadowTransforms;
+
+    // Resource indices.
+    UINT    m_LayerMapArray;
+    UINT    m_BlendMap;
+    UINT    m_HeightMap;
+    UINT    m_PageTable;
+    UINT    m_PageCache;
+    UINT    m_PointLights;
+    UINT    m_SpotLights;
+    UINT    m_ClusterGrid;
+    UINT    m_ClusterLightIndices;
+    UINT    m_ShadowMap;
 };
 #pragma endregion
 
@@ -5,27 +5,56 @@
 //=============================================================================
 
 #include "LightHelper.fx"
+#include "ClusteredLighting.fx"
+#include "CascadedShadows.fx"
  
 cbuffer cbPerFrame
 {
-	DirectionalLight gDirLights[3];
 	float3 gEyePosW;
+};
+
+// Lights and fog rarely change; keeping them apart from the eye position
+// means moving the camera does not re-upload them.
+cbuffer cbPerScene
+{
+	DirectionalLight gDirLights[3];
 
 	float  gFogStart;
 	float  gFogRange;
 	float4 gFogColor;
 };
 
-cbuffer cbPerObject
-{
-	float4x4 gWorld;
-	float4x4 gWorldInvTranspose;
-	float4x4 gWorldViewProj;
-	float4x4 gTexTransform;
-	Material gMaterial;
-}; 
+// Per-object data is not in a cbuffer; it is streamed from the per-draw
+// ring buffer on input slot 1 (see ConstantBuffers.h).  Matrices arrive
+// as rows so they match the XMFLOAT4X4 memory layout on the CPU.
+struct PerObject
+{
+	float4 World0             : WORLD0;
+	float4 World1             : WORLD1;
+	float4 World2             : WORLD2;
+	float4 World3             : WORLD3;
+	float4 WorldInvTranspose0 : WORLDINVTRANSPOSE0;
+	float4 WorldInvTranspose1 : WORLDINVTRANSPOSE1;
+	float4 WorldInvTranspose2 : WORLDINVTRANSPOSE2;
+	float4 WorldInvTranspose3 : WORLDINVTRANSPOSE3;
+	float4 WorldViewProj0     : WORLDVIEWPROJ0;
+	float4 WorldViewProj1     : WORLDVIEWPROJ1;
+	float4 WorldViewProj2     : WORLDVIEWPROJ2;
+	float4 WorldViewProj3     : WORLDVIEWPROJ3;
+	float4 TexTransform0      : TEXTRANSFORM0;
+	float4 TexTransform1      : TEXTRANSFORM1;
+	float4 TexTransform2      : TEXTRANSFORM2;
+	float4 TexTransform3      : TEXTRANSFORM3;
+	float4 MatAmbient         : MATERIAL0;
+	float4 MatDiffuse         : MATERIAL1;
+	float4 MatSpecular        : MATERIAL2;
+	float4 MatReflect         : MATERIAL3;
+	uint   DiffuseSlice       : TEXSLICE;
+};
 
-Texture2D gDiffuseMap;
+// Diffuse maps of the same size and format share an array (see TextureArrays),
+// so objects with different textures can be drawn by one instanced draw.
+Texture2DArray gDiffuseMapArray;
 
 SamplerState samAnisotropic
 {
@@ -49,24 +78,47 @@ struct VertexOut
     float3 PosW    : POSITION;
     float3 NormalW : NORMAL;
 	float2 Tex     : TEXCOORD;
+
+	// Material is constant over the draw.  Reflect is not used by this effect.
+	nointerpolation float4 MatAmbient  : MATERIAL0;
+	nointerpolation float4 MatDiffuse  : MATERIAL1;
+	nointerpolation float4 MatSpecular : MATERIAL2;
+	nointerpolation uint   DiffuseSlice : TEXSLICE;
 };
 
-VertexOut VS(VertexIn vin)
+VertexOut VS(VertexIn vin, PerObject obj)
 {
 	VertexOut vout;
+
+	float4x4 world             = float4x4(obj.World0, obj.World1, obj.World2, obj.World3);
+	float4x4 worldInvTranspose = float4x4(obj.WorldInvTranspose0, obj.WorldInvTranspose1, obj.WorldInvTranspose2, obj.WorldInvTranspose3);
+	float4x4 worldViewProj     = float4x4(obj.WorldViewProj0, obj.WorldViewProj1, obj.WorldViewProj2, obj.WorldViewProj3);
+	float4x4 texTransform      = float4x4(obj.TexTransform0, obj.TexTransform1, obj.TexTransform2, obj.TexTransform3);
 	
-	vout.PosH       = mul(float4(vin.PosL, 1.0f), gWorldViewProj);
-	vout.PosW       = mul(float4(vin.PosL, 1.0f), gWorld).xyz;
-	vout.NormalW    = mul(vin.NormalL, (float3x3)gWorldInvTranspose);
-	vout.Tex        = mul(float4(vin.Tex, 0.0f, 1.0f), gTexTransform).xy;
+	vout.PosH       = mul(float4(vin.PosL, 1.0f), worldViewProj);
+	vout.PosW       = mul(float4(vin.PosL, 1.0f), world).xyz;
+	vout.NormalW    = mul(vin.NormalL, (float3x3)worldInvTranspose);
+	vout.Tex        = mul(float4(vin.Tex, 0.0f, 1.0f), texTransform).xy;
+
+	vout.MatAmbient  = obj.MatAmbient;
+	vout.MatDiffuse  = obj.MatDiffuse;
+	vout.MatSpecular = obj.MatSpecular;
+	vout.DiffuseSlice = obj.DiffuseSlice;
 
 	return vout;
 }
  
-float4 PS(VertexOut pin, uniform int gLightCount, uniform bool gUseTexure, uniform bool gAlphaClip, uniform bool gFogEnabled) : SV_Target
+float4 PS(VertexOut pin, uniform int gLightCount, uniform bool gUseTexure, uniform bool gAlphaClip, uniform bool gFogEnabled,
+          uniform bool gClustered, uniform bool gShadowed) : SV_Target
 {
     pin.NormalW = normalize(pin.NormalW);
 
+	Material mat;
+	mat.Ambient  = pin.MatAmbient;
+	mat.Diffuse  = pin.MatDiffuse;
+	mat.Specular = pin.MatSpecular;
+	mat.Reflect  = float4(0.0f, 0.0f, 0.0f, 0.0f);
+
 	float3 toEye = gEyePosW - pin.PosW; 
 	float distToEye = length(toEye);
 	toEye /= distToEye;
@@ -74,7 +126,7 @@ float4 PS(VertexOut pin, uniform int gLightCount, uniform bool gUseTexure, unifo
     float4 texColor = float4(1, 1, 1, 1);
     if(gUseTexure)
 	{
-		texColor = gDiffuseMap.Sample( samAnisotropic, pin.Tex );
+		texColor = gDiffuseMapArray.Sample( samAnisotropic, float3(pin.Tex, pin.DiffuseSlice) );
 
 		if(gAlphaClip)
 		{
@@ -86,23 +138,41 @@ float4 PS(VertexOut pin, uniform int gLightCount, uniform bool gUseTexure, unifo
 	// Lighting.
 	//
 	float4 litColor = texColor;
-	if( gLightCount > 0  )
+	if( gLightCount > 0 || gClustered )
 	{  
 		float4 ambient = float4(0.0f, 0.0f, 0.0f, 0.0f);
 		float4 diffuse = float4(0.0f, 0.0f, 0.0f, 0.0f);
 		float4 spec    = float4(0.0f, 0.0f, 0.0f, 0.0f);
 
+		// Only the first directional light casts shadows.
+		float shadow = 1.0f;
+		if( gShadowed )
+		{
+			shadow = CalcCascadedShadowFactor(pin.PosW, pin.PosH.w);
+		}
+
 		[unroll]
 		for(int i = 0; i < gLightCount; ++i)
 		{
 			float4 A, D, S;
-			ComputeDirectionalLight(gMaterial, gDirLights[i], pin.NormalW, toEye, 
+			ComputeDirectionalLight(mat, gDirLights[i], pin.NormalW, toEye, 
 				A, D, S);
 
+			if( i == 0 )
+			{
+				D *= shadow;
+				S *= shadow;
+			}
+
 			ambient += A;
 			diffuse += D;
 			spec    += S;
 		}
+
+		if( gClustered )
+		{
+			ComputeClusteredLights(mat, pin.PosH, pin.PosW, pin.NormalW, toEye, ambient, diffuse, spec);
+		}
 		litColor = texColor*(ambient + diffuse) + spec;
 	}
 
@@ -115,226 +185,43 @@ float4 PS(VertexOut pin, uniform int gLightCount, uniform bool gUseTexure, unifo
 		litColor = lerp(litColor, gFogColor, fogLerp);
 	}
 
-	litColor.a = gMaterial.Diffuse.a * texColor.a;
+	litColor.a = mat.Diffuse.a * texColor.a;
     return litColor;
 }
 
-technique11 Light1
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(1, false, false, false) ) );
-    }
-}
-
-technique11 Light2
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(2, false, false, false) ) );
-    }
-}
-
-technique11 Light3
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(3, false, false, false) ) );
-    }
-}
-
-technique11 Light0Tex
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(0, true, false, false) ) );
-    }
-}
-
-technique11 Light1Tex
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(1, true, false, false) ) );
-    }
-}
-
-technique11 Light2Tex
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(2, true, false, false) ) );
-    }
-}
-
-technique11 Light3Tex
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(3, true, false, false) ) );
-    }
-}
-
-technique11 Light0TexAlphaClip
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(0, true, true, false) ) );
-    }
-}
-
-technique11 Light1TexAlphaClip
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(1, true, true, false) ) );
-    }
-}
-
-technique11 Light2TexAlphaClip
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(2, true, true, false) ) );
-    }
-}
-
-technique11 Light3TexAlphaClip
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(3, true, true, false) ) );
-    }
-}
-
-technique11 Light1Fog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(1, false, false, true) ) );
-    }
-}
-
-technique11 Light2Fog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(2, false, false, true) ) );
-    }
-}
-
-technique11 Light3Fog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(3, false, false, true) ) );
-    }
-}
-
-technique11 Light0TexFog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(0, true, false, true) ) );
-    }
-}
-
-technique11 Light1TexFog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(1, true, false, true) ) );
-    }
-}
-
-technique11 Light2TexFog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(2, true, false, true) ) );
-    }
-}
-
-technique11 Light3TexFog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(3, true, false, true) ) );
-    }
-}
+// Feature switches.  The application compiles one effect per combination it
+// actually uses (see EffectPermutations); the defaults below only describe
+// the variant produced by the project build, which is used for reflection.
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 3
+#endif
+#ifndef USE_TEXTURE
+#define USE_TEXTURE 1
+#endif
+#ifndef ALPHA_CLIP
+#define ALPHA_CLIP 0
+#endif
+#ifndef FOG
+#define FOG 1
+#endif
+#ifndef CLUSTERED
+#define CLUSTERED 0
+#endif
+// 0: no shadows, 1: receive cascaded shadows, 2: depth only shadow caster.
+#ifndef SHADOW
+#define SHADOW 0
+#endif
 
-technique11 Light0TexAlphaClipFog
+technique11 Main
 {
     pass P0
     {
         SetVertexShader( CompileShader( vs_5_0, VS() ) );
 		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(0, true, true, true) ) );
+#if SHADOW == 2
+        SetPixelShader( NULL );
+#else
+        SetPixelShader( CompileShader( ps_5_0, PS(LIGHT_COUNT, USE_TEXTURE, ALPHA_CLIP, FOG, CLUSTERED, SHADOW == 1) ) );
+#endif
     }
 }
-
-technique11 Light1TexAlphaClipFog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(1, true, true, true) ) );
-    }
-}
-
-technique11 Light2TexAlphaClipFog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(2, true, true, true) ) );
-    }
-}
-
-technique11 Light3TexAlphaClipFog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(3, true, true, true) ) ); 
-    }
-}
\ No newline at end of file
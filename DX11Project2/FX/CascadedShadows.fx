@@ -0,0 +1,61 @@
+//=============================================================================
+// CascadedShadows.fx
+//
+// Shadow lookup for the cascaded shadow maps of the first directional light
+// (see CascadedShadows.h).  The cascade is picked by view depth and filtered
+// with a 3x3 PCF kernel.
+//=============================================================================
+
+#define CASCADE_COUNT 4
+
+// Must match ShadowConstants in CascadedShadows.h.
+cbuffer cbShadows
+{
+	float4x4 gShadowTransforms[CASCADE_COUNT];
+	float4   gCascadeSplits;
+	// x: shadow map texel size in uv.
+	float4   gShadowParams;
+};
+
+Texture2DArray gShadowMap;
+
+SamplerComparisonState samShadow
+{
+	Filter   = COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+	AddressU = BORDER;
+	AddressV = BORDER;
+	AddressW = BORDER;
+	BorderColor = float4(1.0f, 1.0f, 1.0f, 1.0f);
+
+	ComparisonFunc = LESS;
+};
+
+// viewDepth is SV_Position.w.  Returns 1 when fully lit and 0 when fully in shadow.
+float CalcCascadedShadowFactor(float3 posW, float viewDepth)
+{
+	// Number of cascades that end in front of the pixel.
+	uint cascade = (uint)dot(step(gCascadeSplits, viewDepth), 1.0f);
+	if( cascade >= CASCADE_COUNT )
+		return 1.0f;
+
+	// Orthographic projection, no divide by w.
+	float3 shadowPos = mul(float4(posW, 1.0f), gShadowTransforms[cascade]).xyz;
+
+	const float dx = gShadowParams.x;
+	const float2 offsets[9] =
+	{
+		float2(-dx, -dx), float2(0.0f, -dx), float2(dx, -dx),
+		float2(-dx, 0.0f), float2(0.0f, 0.0f), float2(dx, 0.0f),
+		float2(-dx, +dx), float2(0.0f, +dx), float2(dx, +dx)
+	};
+
+	float percentLit = 0.0f;
+	[unroll]
+	for(int i = 0; i < 9; ++i)
+	{
+		percentLit += gShadowMap.SampleCmpLevelZero(samShadow,
+			float3(shadowPos.xy + offsets[i], cascade), shadowPos.z).r;
+	}
+
+	return percentLit / 9.0f;
+}
@@ -0,0 +1,62 @@
+//=============================================================================
+// ClusteredLighting.fx
+//
+// Point and spot lights binned into view space clusters (see ClusteredLighting.h).
+// The view frustum is split into gClusterDims.x * gClusterDims.y screen tiles
+// and gClusterDims.z exponential depth slices; every cluster stores the range
+// of the light index list that touches it.
+//=============================================================================
+
+// Must match ClusterConstants in ClusteredLighting.h.
+cbuffer cbClusters
+{
+	// xy: tiles per pixel, z/w: scale and bias turning log2(view depth) into a slice.
+	float4 gClusterScale;
+	uint4  gClusterDims;
+};
+
+// Must match ClusteredLighting::ClusterRange.
+struct ClusterRange
+{
+	uint Offset;
+	uint PointCount;
+	uint SpotCount;
+	uint Pad;
+};
+
+StructuredBuffer<PointLight>   gPointLights;
+StructuredBuffer<SpotLight>    gSpotLights;
+StructuredBuffer<ClusterRange> gClusterGrid;
+StructuredBuffer<uint>         gClusterLightIndices;
+
+// posH is SV_Position: pixel coordinates in xy and view depth in w.
+void ComputeClusteredLights(Material mat, float4 posH, float3 pos, float3 normal, float3 toEye,
+                            inout float4 ambient, inout float4 diffuse, inout float4 spec)
+{
+	float slice = log2(posH.w)*gClusterScale.z + gClusterScale.w;
+	uint3 cluster = uint3(posH.xy*gClusterScale.xy, max(slice, 0.0f));
+	cluster = min(cluster, gClusterDims.xyz - 1);
+
+	ClusterRange range = gClusterGrid[(cluster.z*gClusterDims.y + cluster.y)*gClusterDims.x + cluster.x];
+
+	uint index = range.Offset;
+	for(uint i = 0; i < range.PointCount; ++i, ++index)
+	{
+		float4 A, D, S;
+		ComputePointLight(mat, gPointLights[gClusterLightIndices[index]], pos, normal, toEye, A, D, S);
+
+		ambient += A;
+		diffuse += D;
+		spec    += S;
+	}
+
+	for(uint j = 0; j < range.SpotCount; ++j, ++index)
+	{
+		float4 A, D, S;
+		ComputeSpotLight(mat, gSpotLights[gClusterLightIndices[index]], pos, normal, toEye, A, D, S);
+
+		ambient += A;
+		diffuse += D;
+		spec    += S;
+	}
+}
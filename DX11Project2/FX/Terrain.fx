@@ -1,11 +1,25 @@
  
 #include "LightHelper.fx"
+#include "ClusteredLighting.fx"
+#include "CascadedShadows.fx"
  
 cbuffer cbPerFrame
 {
-	DirectionalLight gDirLights[3];
 	float3 gEyePosW;
 
+	// Terrain coordinate specified directly 
+	// at center of world space.
+	
+	float4x4 gViewProj;
+	float4 gWorldFrustumPlanes[6];
+};
+
+// Lights, fog, tessellation ranges and the heightmap layout only change
+// when the scene does, so they are kept out of the per-frame upload.
+cbuffer cbPerScene
+{
+	DirectionalLight gDirLights[3];
+
 	float  gFogStart;
 	float  gFogRange;
 	float4 gFogColor;
@@ -26,16 +40,11 @@ cbuffer cbPerFrame
 	float gTexelCellSpaceV;
 	float gWorldCellSpace;
 	float2 gTexScale = 50.0f;
-	
-	float4 gWorldFrustumPlanes[6];
-};
 
-cbuffer cbPerObject
-{
-	// Terrain coordinate specified directly 
-	// at center of world space.
-	
-	float4x4 gViewProj;
+	// Pages across at mip 0, texels per page, border texels on each side,
+	// cache texels across.  See VirtualTexture.h.
+	float4 gVirtualTextureLayout;
+
 	Material gMaterial;
 };
 
@@ -44,6 +53,10 @@ Texture2DArray gLayerMapArray;
 Texture2D gBlendMap;
 Texture2D gHeightMap;
 
+// Per mip 0 page: cache slot x, slot y and the mip of the page it shows.
+Texture2D<uint4> gPageTable;
+Texture2D gPageCache;
+
 SamplerState samLinear
 {
 	Filter = MIN_MAG_MIP_LINEAR;
@@ -60,6 +73,14 @@ SamplerState samHeightmap
 	AddressV = CLAMP;
 };
 
+SamplerState samPageCache
+{
+	Filter = MIN_MAG_MIP_LINEAR;
+
+	AddressU = CLAMP;
+	AddressV = CLAMP;
+};
+
 struct VertexIn
 {
 	float3 PosL     : POSITION;
@@ -272,9 +293,30 @@ DomainOut DS(PatchTess patchTess,
 	return dout;
 }
 
+// The baked color at 'uv' over the whole terrain.  Each page is baked at the
+// mip the camera needs, so the cache is sampled at its only level; the border
+// keeps the bilinear taps inside the page.
+float4 SampleVirtualTexture(float2 uv)
+{
+	float pages    = gVirtualTextureLayout.x;
+	float pageSize = gVirtualTextureLayout.y;
+	float border   = gVirtualTextureLayout.z;
+
+	uint2 page = (uint2)clamp(uv*pages, 0.0f, pages - 1.0f);
+	uint4 entry = gPageTable.Load(int3(page, 0));
+
+	float2 inPage = frac(uv*(pages / (float)(1u << entry.b)));
+	float2 texel = entry.rg*pageSize + border + inPage*(pageSize - 2.0f*border);
+
+	return gPageCache.SampleLevel(samPageCache, texel / gVirtualTextureLayout.w, 0);
+}
+
 float4 PS(DomainOut pin, 
           uniform int gLightCount, 
-		  uniform bool gFogEnabled) : SV_Target
+		  uniform bool gFogEnabled,
+		  uniform bool gClustered,
+		  uniform bool gShadowed,
+		  uniform bool gVirtualTexture) : SV_Target
 {
 	//
 	// Estimate normal and tangent using central differences.
@@ -324,19 +366,32 @@ float4 PS(DomainOut pin,
     //texColor = lerp(texColor, c2, t.g);
     //texColor = lerp(texColor, c3, t.b);
     //texColor = lerp(texColor, c4, t.a);
+
+	// The layers blended ahead of time into pages, see Terrain::UpdateVirtualTexture.
+	if( gVirtualTexture )
+	{
+		texColor = SampleVirtualTexture(pin.Tex);
+	}
  
 	//
 	// Lighting.
 	//
 
 	float4 litColor = texColor;
-	if( gLightCount > 0  )
+	if( gLightCount > 0 || gClustered )
 	{  
 		// Start with a sum of zero. 
 		float4 ambient = float4(0.0f, 0.0f, 0.0f, 0.0f);
 		float4 diffuse = float4(0.0f, 0.0f, 0.0f, 0.0f);
 		float4 spec    = float4(0.0f, 0.0f, 0.0f, 0.0f);
 
+		// Only the first directional light casts shadows.
+		float shadow = 1.0f;
+		if( gShadowed )
+		{
+			shadow = CalcCascadedShadowFactor(pin.PosW, pin.PosH.w);
+		}
+
 		// Sum the light contribution from each light source.  
 		[unroll]
 		for(int i = 0; i < gLightCount; ++i)
@@ -345,11 +400,23 @@ float4 PS(DomainOut pin,
 			ComputeDirectionalLight(gMaterial, gDirLights[i], normalW, toEye, 
 				A, D, S);
 
+			if( i == 0 )
+			{
+				D *= shadow;
+				S *= shadow;
+			}
+
 			ambient += A;
 			diffuse += D;
 			spec    += S;
 		}
 
+		// Plus every point and spot light binned into this pixel's cluster.
+		if( gClustered )
+		{
+			ComputeClusteredLights(gMaterial, pin.PosH, pin.PosW, normalW, toEye, ambient, diffuse, spec);
+		}
+
 		litColor = texColor*(ambient + diffuse) + spec;
 	}
  
@@ -368,67 +435,24 @@ float4 PS(DomainOut pin,
     return litColor;
 }
 
-technique11 Light1
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-        SetHullShader( CompileShader( hs_5_0, HS() ) );
-        SetDomainShader( CompileShader( ds_5_0, DS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(1, false) ) );
-    }
-}
-
-technique11 Light2
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-        SetHullShader( CompileShader( hs_5_0, HS() ) );
-        SetDomainShader( CompileShader( ds_5_0, DS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(2, false) ) );
-    }
-}
-
-technique11 Light3
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-        SetHullShader( CompileShader( hs_5_0, HS() ) );
-        SetDomainShader( CompileShader( ds_5_0, DS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(3, false) ) );
-    }
-}
-
-technique11 Light1Fog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-        SetHullShader( CompileShader( hs_5_0, HS() ) );
-        SetDomainShader( CompileShader( ds_5_0, DS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(1, true) ) );
-    }
-}
-
-technique11 Light2Fog
-{
-    pass P0
-    {
-        SetVertexShader( CompileShader( vs_5_0, VS() ) );
-        SetHullShader( CompileShader( hs_5_0, HS() ) );
-        SetDomainShader( CompileShader( ds_5_0, DS() ) );
-		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(2, true) ) );
-    }
-}
-
-technique11 Light3Fog
+// Feature switches, see Basic.fx.
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 3
+#endif
+#ifndef FOG
+#define FOG 1
+#endif
+#ifndef CLUSTERED
+#define CLUSTERED 0
+#endif
+#ifndef SHADOW
+#define SHADOW 0
+#endif
+#ifndef VIRTUAL_TEXTURE
+#define VIRTUAL_TEXTURE 0
+#endif
+
+technique11 Main
 {
     pass P0
     {
@@ -436,6 +460,10 @@ technique11 Light3Fog
         SetHullShader( CompileShader( hs_5_0, HS() ) );
         SetDomainShader( CompileShader( ds_5_0, DS() ) );
 		SetGeometryShader( NULL );
-        SetPixelShader( CompileShader( ps_5_0, PS(3, true) ) );
+#if SHADOW == 2
+        SetPixelShader( NULL );
+#else
+        SetPixelShader( CompileShader( ps_5_0, PS(LIGHT_COUNT, FOG, CLUSTERED, SHADOW == 1, VIRTUAL_TEXTURE) ) );
+#endif
     }
 }
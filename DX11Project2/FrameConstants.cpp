@@ -0,0 +1,84 @@
+//***************************************************************************************
+// FrameConstants.cpp
+//***************************************************************************************
+
+#include "FrameConstants.h"
+
+#pragma region ConstantGroup
+ConstantGroup::ConstantGroup()
+:   m_Version(1),   // effects start out with version 0, so the first Upload always copies
+    m_Writes(0),
+    m_SkippedWrites(0),
+    m_UploadBytes(0)
+{
+}
+
+ConstantGroup::~ConstantGroup()
+{
+    FrameConstants::Unregister(this);
+}
+
+void ConstantGroup::Init(ID3DX11EffectConstantBuffer* cb)
+{
+    assert(cb->IsValid());
+
+    D3DX11_EFFECT_TYPE_DESC typeDesc;
+    HR(cb->GetType()->GetDesc(&typeDesc));
+    m_Data.resize(typeDesc.UnpackedSize);
+    HR(cb->GetRawValue(&m_Data[0], 0, typeDesc.UnpackedSize));
+
+    FrameConstants::Register(this);
+}
+
+UINT ConstantGroup::OffsetOf(ID3DX11Effect* fx, const char* name)
+{
+    ID3DX11EffectVariable* var = fx->GetVariableByName(name);
+    assert(var->IsValid());
+
+    D3DX11_EFFECT_VARIABLE_DESC desc;
+    HR(var->GetDesc(&desc));
+    return desc.BufferOffset;
+}
+
+void ConstantGroup::Upload(ID3DX11EffectConstantBuffer* cb, UINT& version)
+{
+    if (version == m_Version)
+        return;
+
+    HR(cb->SetRawValue(&m_Data[0], 0, (UINT)m_Data.size()));
+    version = m_Version;
+    m_UploadBytes += (UINT)m_Data.size();
+}
+#pragma endregion
+
+#pragma region FrameConstants
+std::vector<ConstantGroup*>     FrameConstants::m_Groups;
+FrameConstants::Stats           FrameConstants::m_LastFrameStats = { 0, 0, 0 };
+
+void FrameConstants::BeginFrame()
+{
+    Stats stats = { 0, 0, 0 };
+    for (auto group : m_Groups)
+    {
+        stats.Writes += group->m_Writes;
+        stats.SkippedWrites += group->m_SkippedWrites;
+        stats.UploadBytes += group->m_UploadBytes;
+
+        group->m_Writes = 0;
+        group->m_SkippedWrites = 0;
+        group->m_UploadBytes = 0;
+    }
+    m_LastFrameStats = stats;
+}
+
+void FrameConstants::Register(ConstantGroup* group)
+{
+    if (std::find(m_Groups.begin(), m_Groups.end(), group) == m_Groups.end())
+        m_Groups.push_back(group);
+}
+
+void FrameConstants::Unregister(ConstantGroup* group)
+{
+    m_Groups.erase(std::remove(m_Groups.begin(), m_Groups.end(), group), m_Groups.end());
+}
+#pragma endregion
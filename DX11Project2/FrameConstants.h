@@ -0,0 +1,94 @@
+//***************************************************************************************
+// FrameConstants.h
+//
+// CPU copies of effect cbuffers that are set every frame but rarely change.
+//
+// The effect framework re-uploads a whole cbuffer on Apply as soon as any of its
+// variables was written, even if the value is identical.  ConstantGroup keeps the
+// cbuffer contents on the CPU and drops writes that do not change them; every
+// write that does change them bumps the group's version.
+//
+// Whoever owns a cbuffer the group feeds keeps the version that cbuffer last
+// received, and Upload copies the block only when that version is older.  One
+// group can feed any number of cbuffers this way, e.g. the same block compiled
+// into several effects, and FrameConstants can report how many bytes were really
+// uploaded per frame.
+//***************************************************************************************
+
+#ifndef FRAMECONSTANTS_H
+#define FRAMECONSTANTS_H
+
+#include "d3dUtil.h"
+
+class ConstantGroup
+{
+public:
+    ConstantGroup();
+    ~ConstantGroup();
+
+    // Sizes the CPU copy after 'cb' and seeds it with the cbuffer's initial values.
+    void Init(ID3DX11EffectConstantBuffer* cb);
+
+    // Byte offset of the variable 'name' inside its cbuffer.
+    static UINT OffsetOf(ID3DX11Effect* fx, const char* name);
+
+    // T must be laid out like the HLSL variable; arrays are fine.
+    template<typename T>
+    void Update(UINT offset, const T& v)
+    {
+        assert(offset + sizeof(T) <= m_Data.size());
+        if (memcmp(&m_Data[offset], &v, sizeof(T)) == 0)
+        {
+            ++m_SkippedWrites;
+            return;
+        }
+        memcpy(&m_Data[offset], &v, sizeof(T));
+        ++m_Writes;
+        ++m_Version;
+    }
+
+    // Copies the CPU data into 'cb' unless 'version', the caller's record of
+    // what 'cb' holds, is already current.  Start records at 0; groups start at
+    // version 1, so the first Upload always copies.
+    void    Upload(ID3DX11EffectConstantBuffer* cb, UINT& version);
+
+    UINT    GetSize() const     { return (UINT)m_Data.size(); }
+    UINT    GetVersion() const  { return m_Version; }
+
+public:
+    ConstantGroup(const ConstantGroup& rhs)             = delete;
+    ConstantGroup& operator=(const ConstantGroup& rhs)  = delete;
+
+private:
+    friend class FrameConstants;
+
+    std::vector<BYTE>   m_Data;
+    UINT                m_Version;
+    UINT                m_Writes;
+    UINT                m_SkippedWrites;
+    UINT                m_UploadBytes;
+};
+
+class FrameConstants
+{
+public:
+    struct Stats
+    {
+        UINT Writes;
+        UINT SkippedWrites;
+        UINT UploadBytes;   // bytes copied into effect cbuffers during the frame
+    };
+
+    // Closes the previous frame's accounting; call once at the start of a frame.
+    static void             BeginFrame();
+    static const Stats&     GetLastFrameStats() { return m_LastFrameStats; }
+
+    static void             Register(ConstantGroup* group);
+    static void             Unregister(ConstantGroup* group);
+
+private:
+    static std::vector<ConstantGroup*>  m_Groups;
+    static Stats                        m_LastFrameStats;
+};
+
+#endif // FRAMECONSTANTS_H
@@ -0,0 +1,226 @@
+//***************************************************************************************
+// FramePacer.cpp
+//***************************************************************************************
+
+#include "FramePacer.h"
+#include <cmath>
+
+namespace
+{
+    class PerformanceClock : public FrameClock
+    {
+    public:
+        PerformanceClock()
+        {
+            __int64 countsPerSec;
+            QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+            m_SecondsPerCount = 1.0 / (double)countsPerSec;
+        }
+
+        virtual double Now()
+        {
+            __int64 counts;
+            QueryPerformanceCounter((LARGE_INTEGER*)&counts);
+            return counts * m_SecondsPerCount;
+        }
+
+        virtual void Sleep(UINT ms)
+        {
+            ::Sleep(ms);
+        }
+
+    private:
+        double  m_SecondsPerCount;
+    };
+
+    // Every reading costs SpinStep; every sleep comes back Overshoot late.
+    class SimulatedClock : public FrameClock
+    {
+    public:
+        SimulatedClock(double spinStep, double overshoot)
+        :   Time(0.0), SpinStep(spinStep), Overshoot(overshoot)
+        {
+        }
+
+        virtual double Now()
+        {
+            Time += SpinStep;
+            return Time;
+        }
+
+        virtual void Sleep(UINT ms)
+        {
+            Time += ms / 1000.0 + Overshoot;
+        }
+
+        double  Time;
+        double  SpinStep;
+        double  Overshoot;
+    };
+}
+
+FramePacer::FramePacer(FrameClock* clock)
+:   m_Clock(clock),
+    m_OwnsClock(clock == nullptr),
+    m_TargetFrameTime(0.0),
+    m_Deadline(0.0),
+    m_SleepMargin(0.002)
+{
+    if (m_OwnsClock)
+        m_Clock = new PerformanceClock();
+
+    ResetStats();
+    Reset();
+}
+
+FramePacer::~FramePacer()
+{
+    if (m_OwnsClock)
+        delete m_Clock;
+}
+
+void FramePacer::SetTargetFrameTime(double seconds)
+{
+    m_TargetFrameTime = seconds > 0.0 ? seconds : 0.0;
+    Reset();
+}
+
+void FramePacer::Reset()
+{
+    m_Deadline = m_Clock->Now() + m_TargetFrameTime;
+}
+
+void FramePacer::WaitForNextFrame()
+{
+    if (m_TargetFrameTime <= 0.0)
+        return;
+
+    double now = m_Clock->Now();
+
+    // Sleep whole milliseconds up to the margin before the deadline.
+    double sleepTime = m_Deadline - now - m_SleepMargin;
+    if (sleepTime >= 0.001)
+    {
+        UINT ms = (UINT)(sleepTime * 1000.0);
+        double before = now;
+        m_Clock->Sleep(ms);
+        now = m_Clock->Now();
+        m_Stats.SleepMs += 1000.0 * (now - before);
+
+        // Follow late wake ups at once and forget them slowly.
+        double overshoot = (now - before) - ms / 1000.0;
+        m_SleepMargin = overshoot > m_SleepMargin ? overshoot : 0.99*m_SleepMargin + 0.01*overshoot;
+        if (m_SleepMargin < 0.0005)
+            m_SleepMargin = 0.0005;
+    }
+
+    double spinStart = now;
+    while (now < m_Deadline)
+    {
+        YieldProcessor();
+        now = m_Clock->Now();
+    }
+    m_Stats.SpinMs += 1000.0 * (now - spinStart);
+
+    double errorMs = 1000.0 * (now - m_Deadline);
+    ++m_Stats.Frames;
+    m_Stats.MeanErrorMs += (errorMs - m_Stats.MeanErrorMs) / m_Stats.Frames;
+    if (errorMs > m_Stats.MaxErrorMs)
+        m_Stats.MaxErrorMs = errorMs;
+
+    if (now - m_Deadline >= m_TargetFrameTime)
+    {
+        ++m_Stats.Missed;
+        m_Deadline = now + m_TargetFrameTime;
+    }
+    else
+    {
+        m_Deadline += m_TargetFrameTime;
+    }
+}
+
+void FramePacer::ResetStats()
+{
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+UINT FramePacer::SelfTest()
+{
+    UINT failures = 0;
+    const double target = 1.0 / 60.0;
+    const double spinStep = 0.00001;
+
+    // 'work' seconds of frame work; returns the frame start times after warm up.
+    struct Run
+    {
+        static void Frames(FramePacer& pacer, SimulatedClock& clock, double work, UINT count, double* starts)
+        {
+            for (UINT i = 0; i < count; ++i)
+            {
+                clock.Time += work;
+                pacer.WaitForNextFrame();
+                starts[i] = clock.Time;
+            }
+        }
+    };
+
+    // Precise sleeps: every frame starts on time.
+    {
+        SimulatedClock clock(spinStep, 0.0002);
+        FramePacer pacer(&clock);
+        pacer.SetTargetFrameTime(target);
+
+        double starts[120];
+        Run::Frames(pacer, clock, 0.005, 120, starts);
+        for (UINT i = 1; i < 120; ++i)
+        {
+            if (fabs(starts[i] - starts[i - 1] - target) > 4.0*spinStep)
+                ++failures;
+        }
+        if (pacer.GetStats().Missed != 0 || pacer.GetStats().MaxErrorMs > 1000.0*2.0*spinStep)
+            ++failures;
+        if (pacer.GetStats().SleepMs <= 0.0)
+            ++failures;
+    }
+
+    // Coarse sleeps, 10 ms late: the margin grows, later frames are on time again.
+    {
+        SimulatedClock clock(spinStep, 0.010);
+        FramePacer pacer(&clock);
+        pacer.SetTargetFrameTime(target);
+
+        double starts[120];
+        Run::Frames(pacer, clock, 0.002, 120, starts);
+        for (UINT i = 11; i < 120; ++i)
+        {
+            if (fabs(starts[i] - starts[i - 1] - target) > 4.0*spinStep)
+                ++failures;
+        }
+        if (pacer.GetStats().Missed != 0)
+            ++failures;
+    }
+
+    // Frames longer than the target: never waits, counts the misses.
+    {
+        SimulatedClock clock(spinStep, 0.0);
+        FramePacer pacer(&clock);
+        pacer.SetTargetFrameTime(target);
+
+        double starts[30];
+        Run::Frames(pacer, clock, 2.5*target, 30, starts);
+        if (pacer.GetStats().Missed != 30 || pacer.GetStats().SleepMs != 0.0)
+            ++failures;
+    }
+
+    // Disabled pacing returns at once.
+    {
+        SimulatedClock clock(spinStep, 0.0);
+        FramePacer pacer(&clock);
+        double before = clock.Time;
+        pacer.WaitForNextFrame();
+        if (clock.Time != before || pacer.GetStats().Frames != 0)
+            ++failures;
+    }
+
+    return failures;
+}
@@ -0,0 +1,82 @@
+//***************************************************************************************
+// FramePacer.h
+//
+// Holds the main loop to a target frame time.
+//
+// Every frame has a deadline one target frame time after the previous one.
+// WaitForNextFrame sleeps until shortly before the deadline and spins for the
+// rest: Sleep only wakes up on the system timer's ticks, so the pacer measures
+// how late its sleeps come back and keeps at least that much time for the
+// spin.  A frame that finishes after its deadline is late by the pacing error;
+// one that misses it by a whole frame restarts the cadence from now instead of
+// rushing to catch up.
+//
+// Time comes from a FrameClock, the performance counter GameTimer uses by
+// default, so SelfTest can drive the pacer with a simulated clock.
+//***************************************************************************************
+
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <windows.h>
+
+class FrameClock
+{
+public:
+    virtual ~FrameClock() {}
+
+    // Seconds since an arbitrary origin.
+    virtual double  Now() = 0;
+    virtual void    Sleep(UINT ms) = 0;
+};
+
+class FramePacer
+{
+public:
+    struct Stats
+    {
+        UINT    Frames;
+        UINT    Missed;         // frames late by a whole target frame time or more
+        double  MeanErrorMs;    // lateness past the deadline, averaged
+        double  MaxErrorMs;
+        double  SleepMs;        // time spent sleeping and spinning, summed
+        double  SpinMs;
+    };
+
+public:
+    // Uses the performance counter when 'clock' is null.
+    explicit FramePacer(FrameClock* clock = nullptr);
+    ~FramePacer();
+
+    // Zero or less disables pacing.
+    void    SetTargetFrameTime(double seconds);
+    double  GetTargetFrameTime() const      { return m_TargetFrameTime; }
+
+    // Starts a new cadence: the next deadline is one frame time from now.
+    void    Reset();
+
+    // Returns once the current frame's deadline has passed.
+    void    WaitForNextFrame();
+
+    const Stats&    GetStats() const        { return m_Stats; }
+    void            ResetStats();
+
+    // Drives the pacer with a simulated clock and returns the number of failed checks.
+    static UINT     SelfTest();
+
+public:
+    FramePacer(const FramePacer& rhs)               = delete;
+    FramePacer& operator=(const FramePacer& rhs)    = delete;
+
+private:
+    FrameClock*     m_Clock;
+    bool            m_OwnsClock;
+
+    double          m_TargetFrameTime;
+    double          m_Deadline;
+    double          m_SleepMargin;      // time left for spinning after a sleep
+
+    Stats           m_Stats;
+};
+
+#endif // FRAMEPACER_H
@@ -125,3 +125,10 @@ void GameTimer::Tick()
 	}
 }
 
+double GameTimer::NowMs()
+{
+	__int64 counts, countsPerSec;
+	QueryPerformanceCounter((LARGE_INTEGER*)&counts);
+	QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+	return 1000.0 * (double)counts / (double)countsPerSec;
+}
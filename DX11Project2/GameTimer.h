@@ -18,6 +18,9 @@ public:
 	void Stop();  // Call when paused.
 	void Tick();  // Call every frame.
 
+	// The performance counter in milliseconds, for timing a piece of code.
+	static double NowMs();
+
 private:
 	double mSecondsPerCount;
 	double mDeltaTime;
@@ -10,12 +10,59 @@
 //   1. Change the Direct3D cull mode or manually reverse the winding order.
 //   2. Invert the normal.
 //   3. Update the texture coordinates and tangent vectors.
+//
+// The templated Create functions write straight into the caller's vertex and
+// index memory, which may be a mapped buffer; the matching Counts function
+// says how much room they need.  VertexAttributes tells them which attributes
+// a vertex type has, and attributes it does not have are never computed.
 //***************************************************************************************
 
 #ifndef GEOMETRYGENERATOR_H
 #define GEOMETRYGENERATOR_H
 
 #include "d3dUtil.h"
+#include "Vertex.h"
+
+// Any vertex type that starts with an XMFLOAT3 Pos gets positions only;
+// specializations map the other attributes.
+template <typename VertexT>
+struct VertexAttributes
+{
+	static const bool HasNormal   = false;
+	static const bool HasTangentU = false;
+	static const bool HasTexC     = false;
+
+	static void SetPosition(VertexT& v, const XMFLOAT3& p)  { v.Pos = p; }
+	static void SetNormal(VertexT& v, const XMFLOAT3& n)    {}
+	static void SetTangentU(VertexT& v, const XMFLOAT3& t)  {}
+	static void SetTexC(VertexT& v, const XMFLOAT2& uv)     {}
+};
+
+template <>
+struct VertexAttributes<XMFLOAT3>
+{
+	static const bool HasNormal   = false;
+	static const bool HasTangentU = false;
+	static const bool HasTexC     = false;
+
+	static void SetPosition(XMFLOAT3& v, const XMFLOAT3& p) { v = p; }
+	static void SetNormal(XMFLOAT3& v, const XMFLOAT3& n)   {}
+	static void SetTangentU(XMFLOAT3& v, const XMFLOAT3& t) {}
+	static void SetTexC(XMFLOAT3& v, const XMFLOAT2& uv)    {}
+};
+
+template <>
+struct VertexAttributes<Vertex::Basic32>
+{
+	static const bool HasNormal   = true;
+	static const bool HasTangentU = false;
+	static const bool HasTexC     = true;
+
+	static void SetPosition(Vertex::Basic32& v, const XMFLOAT3& p)  { v.Pos = p; }
+	static void SetNormal(Vertex::Basic32& v, const XMFLOAT3& n)    { v.Normal = n; }
+	static void SetTangentU(Vertex::Basic32& v, const XMFLOAT3& t)  {}
+	static void SetTexC(Vertex::Basic32& v, const XMFLOAT2& uv)     { v.Tex = uv; }
+};
 
 class GeometryGenerator
 {
@@ -45,46 +92,490 @@ public:
 		std::vector<UINT> Indices;
 	};
 
+	// Exact sizes of the arrays the templated Create functions fill.
+	struct Counts
+	{
+		UINT Vertices;
+		UINT Indices;
+	};
+
+	static Counts BoxCounts();
+	static Counts SphereCounts(UINT sliceCount, UINT stackCount);
+	static Counts CylinderCounts(UINT sliceCount, UINT stackCount);
+	static Counts GridCounts(UINT m, UINT n);
+	static Counts FullscreenQuadCounts();
+
+	///<summary>
+	/// Write the shapes below into 'vertices' and 'indices', which hold at least
+	/// the matching Counts.  IndexT is UINT or USHORT.
+	///</summary>
+	template <typename VertexT, typename IndexT>
+	static void CreateBox(float width, float height, float depth, VertexT* vertices, IndexT* indices);
+	template <typename VertexT, typename IndexT>
+	static void CreateSphere(float radius, UINT sliceCount, UINT stackCount, VertexT* vertices, IndexT* indices);
+	template <typename VertexT, typename IndexT>
+	static void CreateCylinder(float bottomRadius, float topRadius, float height, UINT sliceCount, UINT stackCount,
+		VertexT* vertices, IndexT* indices);
+	template <typename VertexT, typename IndexT>
+	static void CreateGrid(float width, float depth, UINT m, UINT n, VertexT* vertices, IndexT* indices);
+	template <typename VertexT, typename IndexT>
+	static void CreateFullscreenQuad(VertexT* vertices, IndexT* indices);
+
 	///<summary>
 	/// Creates a box centered at the origin with the given dimensions.
 	///</summary>
-	void CreateBox(float width, float height, float depth, MeshData& meshData);
+	static void CreateBox(float width, float height, float depth, MeshData& meshData);
 
 	///<summary>
 	/// Creates a sphere centered at the origin with the given radius.  The
 	/// slices and stacks parameters control the degree of tessellation.
 	///</summary>
-	void CreateSphere(float radius, UINT sliceCount, UINT stackCount, MeshData& meshData);
+	static void CreateSphere(float radius, UINT sliceCount, UINT stackCount, MeshData& meshData);
 
 	///<summary>
 	/// Creates a geosphere centered at the origin with the given radius.  The
 	/// depth controls the level of tessellation.
 	///</summary>
-	void CreateGeosphere(float radius, UINT numSubdivisions, MeshData& meshData);
+	static void CreateGeosphere(float radius, UINT numSubdivisions, MeshData& meshData);
 
 	///<summary>
 	/// Creates a cylinder parallel to the y-axis, and centered about the origin.  
 	/// The bottom and top radius can vary to form various cone shapes rather than true
 	// cylinders.  The slices and stacks parameters control the degree of tessellation.
 	///</summary>
-	void CreateCylinder(float bottomRadius, float topRadius, float height, UINT sliceCount, UINT stackCount, MeshData& meshData);
+	static void CreateCylinder(float bottomRadius, float topRadius, float height, UINT sliceCount, UINT stackCount, MeshData& meshData);
 
 	///<summary>
 	/// Creates an mxn grid in the xz-plane with m rows and n columns, centered
 	/// at the origin with the specified width and depth.
 	///</summary>
-	void CreateGrid(float width, float depth, UINT m, UINT n, MeshData& meshData);
+	static void CreateGrid(float width, float depth, UINT m, UINT n, MeshData& meshData);
 
 	///<summary>
 	/// Creates a quad covering the screen in NDC coordinates.  This is useful for
 	/// postprocessing effects.
 	///</summary>
-	void CreateFullscreenQuad(MeshData& meshData);
+	static void CreateFullscreenQuad(MeshData& meshData);
 
 private:
-	void Subdivide(MeshData& meshData);
-	void BuildCylinderTopCap(float bottomRadius, float topRadius, float height, UINT sliceCount, UINT stackCount, MeshData& meshData);
-	void BuildCylinderBottomCap(float bottomRadius, float topRadius, float height, UINT sliceCount, UINT stackCount, MeshData& meshData);
+	static void Subdivide(MeshData& meshData);
+
+	// Both caps of a cylinder: a ring and a center vertex each.
+	template <typename VertexT, typename IndexT>
+	static void BuildCylinderCap(float radius, float y, float height, UINT sliceCount,
+		UINT baseIndex, VertexT* vertices, IndexT* indices, bool top);
+
+	template <typename VertexT>
+	static void SetVertex(VertexT& v, float px, float py, float pz, float nx, float ny, float nz,
+		float tx, float ty, float tz, float u, float w);
 };
 
+template <>
+struct VertexAttributes<GeometryGenerator::Vertex>
+{
+	static const bool HasNormal   = true;
+	static const bool HasTangentU = true;
+	static const bool HasTexC     = true;
+
+	static void SetPosition(GeometryGenerator::Vertex& v, const XMFLOAT3& p)  { v.Position = p; }
+	static void SetNormal(GeometryGenerator::Vertex& v, const XMFLOAT3& n)    { v.Normal = n; }
+	static void SetTangentU(GeometryGenerator::Vertex& v, const XMFLOAT3& t)  { v.TangentU = t; }
+	static void SetTexC(GeometryGenerator::Vertex& v, const XMFLOAT2& uv)     { v.TexC = uv; }
+};
+
+template <typename VertexT>
+void GeometryGenerator::SetVertex(VertexT& v, float px, float py, float pz, float nx, float ny, float nz,
+	float tx, float ty, float tz, float u, float w)
+{
+	typedef VertexAttributes<VertexT> Attributes;
+
+	Attributes::SetPosition(v, XMFLOAT3(px, py, pz));
+	Attributes::SetNormal(v, XMFLOAT3(nx, ny, nz));
+	Attributes::SetTangentU(v, XMFLOAT3(tx, ty, tz));
+	Attributes::SetTexC(v, XMFLOAT2(u, w));
+}
+
+template <typename VertexT, typename IndexT>
+void GeometryGenerator::CreateBox(float width, float height, float depth, VertexT* v, IndexT* i)
+{
+	//
+	// Create the vertices.
+	//
+
+	float w2 = 0.5f*width;
+	float h2 = 0.5f*height;
+	float d2 = 0.5f*depth;
+
+	// Fill in the front face vertex data.
+	SetVertex(v[0], -w2, -h2, -d2, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+	SetVertex(v[1], -w2, +h2, -d2, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+	SetVertex(v[2], +w2, +h2, -d2, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+	SetVertex(v[3], +w2, -h2, -d2, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f);
+
+	// Fill in the back face vertex data.
+	SetVertex(v[4], -w2, -h2, +d2, 0.0f, 0.0f, 1.0f, -1.0f, 0.0f, 0.0f, 1.0f, 1.0f);
+	SetVertex(v[5], +w2, -h2, +d2, 0.0f, 0.0f, 1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+	SetVertex(v[6], +w2, +h2, +d2, 0.0f, 0.0f, 1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+	SetVertex(v[7], -w2, +h2, +d2, 0.0f, 0.0f, 1.0f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+
+	// Fill in the top face vertex data.
+	SetVertex(v[8],  -w2, +h2, -d2, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+	SetVertex(v[9],  -w2, +h2, +d2, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+	SetVertex(v[10], +w2, +h2, +d2, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+	SetVertex(v[11], +w2, +h2, -d2, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f);
+
+	// Fill in the bottom face vertex data.
+	SetVertex(v[12], -w2, -h2, -d2, 0.0f, -1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f, 1.0f);
+	SetVertex(v[13], +w2, -h2, -d2, 0.0f, -1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+	SetVertex(v[14], +w2, -h2, +d2, 0.0f, -1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+	SetVertex(v[15], -w2, -h2, +d2, 0.0f, -1.0f, 0.0f, -1.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+
+	// Fill in the left face vertex data.
+	SetVertex(v[16], -w2, -h2, +d2, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f);
+	SetVertex(v[17], -w2, +h2, +d2, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f);
+	SetVertex(v[18], -w2, +h2, -d2, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f);
+	SetVertex(v[19], -w2, -h2, -d2, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, 1.0f, 1.0f);
+
+	// Fill in the right face vertex data.
+	SetVertex(v[20], +w2, -h2, -d2, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f);
+	SetVertex(v[21], +w2, +h2, -d2, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+	SetVertex(v[22], +w2, +h2, +d2, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f);
+	SetVertex(v[23], +w2, -h2, +d2, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f);
+
+	//
+	// Create the indices, two triangles per face.
+	//
+
+	for(UINT face = 0; face < 6; ++face)
+	{
+		IndexT base = (IndexT)(4*face);
+		IndexT* k = i + 6*face;
+		k[0] = base; k[1] = base + 1; k[2] = base + 2;
+		k[3] = base; k[4] = base + 2; k[5] = base + 3;
+	}
+}
+
+template <typename VertexT, typename IndexT>
+void GeometryGenerator::CreateSphere(float radius, UINT sliceCount, UINT stackCount, VertexT* vertices, IndexT* indices)
+{
+	typedef VertexAttributes<VertexT> Attributes;
+	assert(sizeof(IndexT) >= sizeof(UINT) || SphereCounts(sliceCount, stackCount).Vertices <= 0x10000);
+
+	//
+	// Compute the vertices stating at the top pole and moving down the stacks.
+	//
+
+	// Poles: note that there will be texture coordinate distortion as there is
+	// not a unique point on the texture map to assign to the pole when mapping
+	// a rectangular texture onto a sphere.
+	UINT vertex = 0;
+	SetVertex(vertices[vertex++], 0.0f, +radius, 0.0f, 0.0f, +1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+
+	float phiStep   = XM_PI/stackCount;
+	float thetaStep = 2.0f*XM_PI/sliceCount;
+
+	// Compute vertices for each stack ring (do not count the poles as rings).
+	for(UINT i = 1; i <= stackCount-1; ++i)
+	{
+		float phi = i*phiStep;
+
+		// Vertices of ring.
+		for(UINT j = 0; j <= sliceCount; ++j)
+		{
+			float theta = j*thetaStep;
+			VertexT& v = vertices[vertex++];
+
+			// spherical to cartesian
+			XMFLOAT3 position(radius*sinf(phi)*cosf(theta), radius*cosf(phi), radius*sinf(phi)*sinf(theta));
+			Attributes::SetPosition(v, position);
+
+			if (Attributes::HasNormal)
+			{
+				XMFLOAT3 normal;
+				XMStoreFloat3(&normal, XMVector3Normalize(XMLoadFloat3(&position)));
+				Attributes::SetNormal(v, normal);
+			}
+
+			// Partial derivative of P with respect to theta
+			if (Attributes::HasTangentU)
+			{
+				XMFLOAT3 tangent(-radius*sinf(phi)*sinf(theta), 0.0f, +radius*sinf(phi)*cosf(theta));
+				XMStoreFloat3(&tangent, XMVector3Normalize(XMLoadFloat3(&tangent)));
+				Attributes::SetTangentU(v, tangent);
+			}
+
+			if (Attributes::HasTexC)
+				Attributes::SetTexC(v, XMFLOAT2(theta / XM_2PI, phi / XM_PI));
+		}
+	}
+
+	SetVertex(vertices[vertex++], 0.0f, -radius, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+
+	//
+	// Compute indices for top stack.  The top stack was written first to the vertex buffer
+	// and connects the top pole to the first ring.
+	//
+
+	UINT k = 0;
+	for(UINT i = 1; i <= sliceCount; ++i)
+	{
+		indices[k++] = 0;
+		indices[k++] = (IndexT)(i+1);
+		indices[k++] = (IndexT)i;
+	}
+
+	//
+	// Compute indices for inner stacks (not connected to poles).
+	//
+
+	// Offset the indices to the index of the first vertex in the first ring.
+	// This is just skipping the top pole vertex.
+	UINT baseIndex = 1;
+	UINT ringVertexCount = sliceCount+1;
+	for(UINT i = 0; i < stackCount-2; ++i)
+	{
+		for(UINT j = 0; j < sliceCount; ++j)
+		{
+			indices[k++] = (IndexT)(baseIndex + i*ringVertexCount + j);
+			indices[k++] = (IndexT)(baseIndex + i*ringVertexCount + j+1);
+			indices[k++] = (IndexT)(baseIndex + (i+1)*ringVertexCount + j);
+
+			indices[k++] = (IndexT)(baseIndex + (i+1)*ringVertexCount + j);
+			indices[k++] = (IndexT)(baseIndex + i*ringVertexCount + j+1);
+			indices[k++] = (IndexT)(baseIndex + (i+1)*ringVertexCount + j+1);
+		}
+	}
+
+	//
+	// Compute indices for bottom stack.  The bottom stack was written last to the vertex buffer
+	// and connects the bottom pole to the bottom ring.
+	//
+
+	// South pole vertex was added last.
+	UINT southPoleIndex = vertex-1;
+
+	// Offset the indices to the index of the first vertex in the last ring.
+	baseIndex = southPoleIndex - ringVertexCount;
+
+	for(UINT i = 0; i < sliceCount; ++i)
+	{
+		indices[k++] = (IndexT)southPoleIndex;
+		indices[k++] = (IndexT)(baseIndex+i);
+		indices[k++] = (IndexT)(baseIndex+i+1);
+	}
+}
+
+template <typename VertexT, typename IndexT>
+void GeometryGenerator::CreateCylinder(float bottomRadius, float topRadius, float height, UINT sliceCount, UINT stackCount,
+	VertexT* vertices, IndexT* indices)
+{
+	typedef VertexAttributes<VertexT> Attributes;
+	assert(sizeof(IndexT) >= sizeof(UINT) || CylinderCounts(sliceCount, stackCount).Vertices <= 0x10000);
+
+	//
+	// Build Stacks.
+	//
+
+	float stackHeight = height / stackCount;
+
+	// Amount to increment radius as we move up each stack level from bottom to top.
+	float radiusStep = (topRadius - bottomRadius) / stackCount;
+
+	UINT ringCount = stackCount+1;
+
+	// Compute vertices for each stack ring starting at the bottom and moving up.
+	UINT vertex = 0;
+	for(UINT i = 0; i < ringCount; ++i)
+	{
+		float y = -0.5f*height + i*stackHeight;
+		float r = bottomRadius + i*radiusStep;
+
+		// vertices of ring
+		float dTheta = 2.0f*XM_PI/sliceCount;
+		for(UINT j = 0; j <= sliceCount; ++j)
+		{
+			VertexT& v = vertices[vertex++];
+
+			float c = cosf(j*dTheta);
+			float s = sinf(j*dTheta);
+
+			Attributes::SetPosition(v, XMFLOAT3(r*c, y, r*s));
+
+			if (Attributes::HasTexC)
+				Attributes::SetTexC(v, XMFLOAT2((float)j/sliceCount, 1.0f - (float)i/stackCount));
+
+			// Cylinder can be parameterized as follows, where we introduce v
+			// parameter that goes in the same direction as the v tex-coord
+			// so that the bitangent goes in the same direction as the v tex-coord.
+			//   Let r0 be the bottom radius and let r1 be the top radius.
+			//   y(v) = h - hv for v in [0,1].
+			//   r(v) = r1 + (r0-r1)v
+			//
+			//   x(t, v) = r(v)*cos(t)
+			//   y(t, v) = h - hv
+			//   z(t, v) = r(v)*sin(t)
+			//
+			//  dx/dt = -r(v)*sin(t)
+			//  dy/dt = 0
+			//  dz/dt = +r(v)*cos(t)
+			//
+			//  dx/dv = (r0-r1)*cos(t)
+			//  dy/dv = -h
+			//  dz/dv = (r0-r1)*sin(t)
+
+			// This is unit length.
+			XMFLOAT3 tangent(-s, 0.0f, c);
+			Attributes::SetTangentU(v, tangent);
+
+			if (Attributes::HasNormal)
+			{
+				float dr = bottomRadius-topRadius;
+				XMFLOAT3 bitangent(dr*c, -height, dr*s);
+
+				XMVECTOR T = XMLoadFloat3(&tangent);
+				XMVECTOR B = XMLoadFloat3(&bitangent);
+				XMFLOAT3 normal;
+				XMStoreFloat3(&normal, XMVector3Normalize(XMVector3Cross(T, B)));
+				Attributes::SetNormal(v, normal);
+			}
+		}
+	}
+
+	// Add one because we duplicate the first and last vertex per ring
+	// since the texture coordinates are different.
+	UINT ringVertexCount = sliceCount+1;
+
+	// Compute indices for each stack.
+	UINT k = 0;
+	for(UINT i = 0; i < stackCount; ++i)
+	{
+		for(UINT j = 0; j < sliceCount; ++j)
+		{
+			indices[k++] = (IndexT)(i*ringVertexCount + j);
+			indices[k++] = (IndexT)((i+1)*ringVertexCount + j);
+			indices[k++] = (IndexT)((i+1)*ringVertexCount + j+1);
+
+			indices[k++] = (IndexT)(i*ringVertexCount + j);
+			indices[k++] = (IndexT)((i+1)*ringVertexCount + j+1);
+			indices[k++] = (IndexT)(i*ringVertexCount + j+1);
+		}
+	}
+
+	BuildCylinderCap(topRadius, 0.5f*height, height, sliceCount, vertex, vertices + vertex, indices + k, true);
+	vertex += sliceCount + 2;
+	k += 3*sliceCount;
+	BuildCylinderCap(bottomRadius, -0.5f*height, height, sliceCount, vertex, vertices + vertex, indices + k, false);
+}
+
+template <typename VertexT, typename IndexT>
+void GeometryGenerator::BuildCylinderCap(float radius, float y, float height, UINT sliceCount,
+	UINT baseIndex, VertexT* vertices, IndexT* indices, bool top)
+{
+	float ny = top ? 1.0f : -1.0f;
+	float dTheta = 2.0f*XM_PI/sliceCount;
+
+	// Duplicate cap ring vertices because the texture coordinates and normals differ.
+	for(UINT i = 0; i <= sliceCount; ++i)
+	{
+		float x = radius*cosf(i*dTheta);
+		float z = radius*sinf(i*dTheta);
+
+		// Scale down by the height to try and make top cap texture coord area
+		// proportional to base.
+		float u = x/height + 0.5f;
+		float v = z/height + 0.5f;
+
+		SetVertex(vertices[i], x, y, z, 0.0f, ny, 0.0f, 1.0f, 0.0f, 0.0f, u, v);
+	}
+
+	// Cap center vertex.
+	SetVertex(vertices[sliceCount+1], 0.0f, y, 0.0f, 0.0f, ny, 0.0f, 1.0f, 0.0f, 0.0f, 0.5f, 0.5f);
+
+	// The top faces up, the bottom down.
+	IndexT centerIndex = (IndexT)(baseIndex + sliceCount+1);
+	for(UINT i = 0; i < sliceCount; ++i)
+	{
+		indices[3*i+0] = centerIndex;
+		indices[3*i+1] = (IndexT)(baseIndex + (top ? i+1 : i));
+		indices[3*i+2] = (IndexT)(baseIndex + (top ? i : i+1));
+	}
+}
+
+template <typename VertexT, typename IndexT>
+void GeometryGenerator::CreateGrid(float width, float depth, UINT m, UINT n, VertexT* vertices, IndexT* indices)
+{
+	typedef VertexAttributes<VertexT> Attributes;
+	assert(sizeof(IndexT) >= sizeof(UINT) || m*n <= 0x10000);
+
+	//
+	// Create the vertices.
+	//
+
+	float halfWidth = 0.5f*width;
+	float halfDepth = 0.5f*depth;
+
+	float dx = width / (n-1);
+	float dz = depth / (m-1);
+
+	float du = 1.0f / (n-1);
+	float dv = 1.0f / (m-1);
+
+	for(UINT i = 0; i < m; ++i)
+	{
+		float z = halfDepth - i*dz;
+		for(UINT j = 0; j < n; ++j)
+		{
+			float x = -halfWidth + j*dx;
+
+			VertexT& v = vertices[i*n+j];
+			Attributes::SetPosition(v, XMFLOAT3(x, 0.0f, z));
+			Attributes::SetNormal(v, XMFLOAT3(0.0f, 1.0f, 0.0f));
+			Attributes::SetTangentU(v, XMFLOAT3(1.0f, 0.0f, 0.0f));
+
+			// Stretch texture over grid.
+			Attributes::SetTexC(v, XMFLOAT2(j*du, i*dv));
+		}
+	}
+
+	//
+	// Create the indices.
+	//
+
+	// Iterate over each quad and compute indices.
+	UINT k = 0;
+	for(UINT i = 0; i < m-1; ++i)
+	{
+		for(UINT j = 0; j < n-1; ++j)
+		{
+			indices[k]   = (IndexT)(i*n+j);
+			indices[k+1] = (IndexT)(i*n+j+1);
+			indices[k+2] = (IndexT)((i+1)*n+j);
+
+			indices[k+3] = (IndexT)((i+1)*n+j);
+			indices[k+4] = (IndexT)(i*n+j+1);
+			indices[k+5] = (IndexT)((i+1)*n+j+1);
+
+			k += 6; // next quad
+		}
+	}
+}
+
+template <typename VertexT, typename IndexT>
+void GeometryGenerator::CreateFullscreenQuad(VertexT* vertices, IndexT* indices)
+{
+	// Position coordinates specified in NDC space.
+	SetVertex(vertices[0], -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+	SetVertex(vertices[1], -1.0f, +1.0f, 0.0f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+	SetVertex(vertices[2], +1.0f, +1.0f, 0.0f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+	SetVertex(vertices[3], +1.0f, -1.0f, 0.0f, 0.0f, 0.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f);
+
+	indices[0] = 0;
+	indices[1] = 1;
+	indices[2] = 2;
+
+	indices[3] = 0;
+	indices[4] = 2;
+	indices[5] = 3;
+}
+
 #endif // GEOMETRYGENERATOR_H
\ No newline at end of file
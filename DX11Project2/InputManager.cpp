@@ -3,12 +3,7 @@
 
 InputManager::InputManager()
 {
-    SetKeyState();
-    m_MouseState[MK_LBUTTON] = false;
-    m_MouseState[MK_MBUTTON] = false;
-    m_MouseState[MK_RBUTTON] = false;
-    m_PrevMousePos = { 0, 0 };
-    m_LastMousePos = { 0, 0 };
+    Clear();
 }
 
 
@@ -16,17 +11,71 @@ InputManager::~InputManager()
 {
 }
 
-void InputManager::SetKeyState()
+void InputManager::PushEvent(float time, UINT type, UINT code, int x, int y)
 {
-    BYTE byKey[256];
-    if (GetKeyboardState(byKey))
+    InputEvent e = { time, type, code, x, y };
+    m_Queue.push_back(e);
+}
+
+void InputManager::ReleaseAll(float time)
+{
+    // Releases still in the queue are harmless; the events only set state.
+    for (UINT key = 0; key < 256; ++key)
+    {
+        if (m_KeyState[key])
+            PushEvent(time, InputEvent::KeyUp, key);
+    }
+
+    const UINT buttons[] = { MK_LBUTTON, MK_MBUTTON, MK_RBUTTON };
+    for (auto button : buttons)
+    {
+        if (m_MouseState & button)
+            PushEvent(time, InputEvent::MouseUp, button, m_MousePos.x, m_MousePos.y);
+    }
+}
+
+void InputManager::ProcessEvents()
+{
+    m_MouseDelta.x = 0;
+    m_MouseDelta.y = 0;
+
+    for (auto& e : m_Queue)
     {
-        for (int i = 0; i < 256; ++i)
+        switch (e.Type)
         {
-            if (byKey[i] & 0x80)
-                m_KeyState[i] = true;
-            else
-                m_KeyState[i] = false;
+        case InputEvent::KeyDown:
+            m_KeyState[e.Code & 0xff] = true;
+            break;
+        case InputEvent::KeyUp:
+            m_KeyState[e.Code & 0xff] = false;
+            break;
+        case InputEvent::MouseDown:
+            m_MouseState |= e.Code;
+            m_MousePos.x = e.X;
+            m_MousePos.y = e.Y;
+            break;
+        case InputEvent::MouseUp:
+            m_MouseState &= ~e.Code;
+            break;
+        case InputEvent::MouseMove:
+            m_MouseDelta.x += e.X - m_MousePos.x;
+            m_MouseDelta.y += e.Y - m_MousePos.y;
+            m_MousePos.x = e.X;
+            m_MousePos.y = e.Y;
+            break;
         }
     }
+
+    m_FrameEvents.swap(m_Queue);
+    m_Queue.clear();
+}
+
+void InputManager::Clear()
+{
+    m_KeyState.reset();
+    m_MouseState = 0;
+    m_MousePos.x = m_MousePos.y = 0;
+    m_MouseDelta.x = m_MouseDelta.y = 0;
+    m_Queue.clear();
+    m_FrameEvents.clear();
 }
@@ -1,6 +1,30 @@
 #pragma once
 #include <windows.h>
-#include <map>
+#include <bitset>
+#include <vector>
+
+struct InputEvent
+{
+    enum Type : UINT
+    {
+        KeyDown,
+        KeyUp,
+        MouseDown,      // Code is the MK_ button
+        MouseUp,
+        MouseMove,
+    };
+
+    float   Time;       // GameTimer::TotalTime when the message arrived
+    UINT    Type;
+    UINT    Code;
+    int     X;
+    int     Y;
+};
+
+// Input state is only changed by events: the window procedure queues them as
+// messages arrive and ProcessEvents applies the queue once per frame, so the
+// state seen by a frame depends on nothing but its events.  That is what lets
+// InputRecorder replay a session exactly.
 class InputManager
 {
 public:
@@ -10,28 +34,37 @@ public:
         return &inputManager;
     }
 
-    void            SetKeyState();
-    inline bool     GetKeyState(int button) const { return m_KeyState.find(button)->second; }
+    void            PushEvent(const InputEvent& e) { m_Queue.push_back(e); }
+    void            PushEvent(float time, UINT type, UINT code, int x = 0, int y = 0);
 
-    inline void     SetMouseState(UINT button, bool state){ m_MouseState[button] = state; }
-    inline bool     GetMouseState(UINT button) const { return m_MouseState.find(button)->second; }
+    // Queues key and button releases for everything held, e.g. when the window loses focus.
+    void            ReleaseAll(float time);
 
-    inline void     SetMousePos(int x, int y){ m_PrevMousePos = m_LastMousePos; m_LastMousePos.x = x; m_LastMousePos.y = y; }
-    inline POINT    GetMousePos() const { return m_LastMousePos; }
-    inline POINT    GetMouseDeltaPos()
-    {
-        POINT pos = { m_LastMousePos.x - m_PrevMousePos.x, m_LastMousePos.y - m_PrevMousePos.y };
-        m_PrevMousePos = m_LastMousePos;
-        return pos;
-    }
+    // Applies the queued events in order and moves them to GetFrameEvents.
+    void            ProcessEvents();
+
+    // Drops the queued events and the current state.
+    void            Clear();
+
+    inline bool     GetKeyState(int key) const { return m_KeyState[key & 0xff]; }
+    inline bool     GetMouseState(UINT button) const { return (m_MouseState & button) != 0; }
+    inline POINT    GetMousePos() const { return m_MousePos; }
+
+    // Mouse movement of the current frame.
+    inline POINT    GetMouseDeltaPos() const { return m_MouseDelta; }
+
+    // Events applied by the last ProcessEvents.
+    inline const std::vector<InputEvent>& GetFrameEvents() const { return m_FrameEvents; }
 
 private:
     InputManager();
     ~InputManager();
 
-    std::map<int, bool>     m_KeyState;
-    std::map<UINT, bool>    m_MouseState;
-    POINT                   m_PrevMousePos;
-    POINT                   m_LastMousePos;
-};
+    std::bitset<256>        m_KeyState;
+    UINT                    m_MouseState;
+    POINT                   m_MousePos;
+    POINT                   m_MouseDelta;
 
+    std::vector<InputEvent> m_Queue;
+    std::vector<InputEvent> m_FrameEvents;
+};
@@ -0,0 +1,141 @@
+//***************************************************************************************
+// InputRecorder.cpp
+//***************************************************************************************
+
+#include "InputRecorder.h"
+#include <fstream>
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+    // File layout: the header, then FrameCount frames, then EventCount events.
+    struct FileHeader
+    {
+        char    Magic[4];
+        UINT    Version;
+        UINT    FrameCount;
+        UINT    EventCount;
+    };
+
+    const char FileMagic[4] = { 'I', 'N', 'P', 'R' };
+    const UINT FileVersion = 1;
+}
+
+InputRecorder::InputRecorder()
+:   m_Mode(Off),
+    m_NextFrame(0)
+{
+}
+
+InputRecorder::~InputRecorder()
+{
+}
+
+void InputRecorder::BeginRecording(const std::wstring& filename)
+{
+    m_Mode = Recording;
+    m_Filename = filename;
+    m_Frames.clear();
+    m_Events.clear();
+}
+
+void InputRecorder::RecordFrame(float dt, const std::vector<InputEvent>& events)
+{
+    assert(m_Mode == Recording);
+
+    Frame frame = { dt, (UINT)m_Events.size(), (UINT)events.size() };
+    m_Frames.push_back(frame);
+    m_Events.insert(m_Events.end(), events.begin(), events.end());
+}
+
+bool InputRecorder::EndRecording()
+{
+    if (m_Mode != Recording)
+        return false;
+    m_Mode = Off;
+
+    std::ofstream fout(m_Filename.c_str(), std::ios_base::binary);
+    if (!fout)
+        return false;
+
+    FileHeader header;
+    memcpy(header.Magic, FileMagic, sizeof(FileMagic));
+    header.Version = FileVersion;
+    header.FrameCount = (UINT)m_Frames.size();
+    header.EventCount = (UINT)m_Events.size();
+
+    fout.write((const char*)&header, sizeof(header));
+    if (!m_Frames.empty())
+        fout.write((const char*)&m_Frames[0], m_Frames.size()*sizeof(Frame));
+    if (!m_Events.empty())
+        fout.write((const char*)&m_Events[0], m_Events.size()*sizeof(InputEvent));
+    return fout.good();
+}
+
+bool InputRecorder::BeginReplay(const std::wstring& filename)
+{
+    m_Mode = Off;
+    m_Filename = filename;
+    m_Frames.clear();
+    m_Events.clear();
+    m_FrameMs.clear();
+    m_NextFrame = 0;
+
+    std::ifstream fin(filename.c_str(), std::ios_base::binary);
+    if (!fin)
+        return false;
+
+    FileHeader header;
+    fin.read((char*)&header, sizeof(header));
+    if (!fin || memcmp(header.Magic, FileMagic, sizeof(FileMagic)) != 0 || header.Version != FileVersion)
+        return false;
+
+    m_Frames.resize(header.FrameCount);
+    m_Events.resize(header.EventCount);
+    if (!m_Frames.empty())
+        fin.read((char*)&m_Frames[0], m_Frames.size()*sizeof(Frame));
+    if (!m_Events.empty())
+        fin.read((char*)&m_Events[0], m_Events.size()*sizeof(InputEvent));
+    if (!fin)
+        return false;
+
+    // Reject files whose frames point past the events.
+    for (auto& frame : m_Frames)
+    {
+        if (frame.FirstEvent > m_Events.size() || frame.EventCount > m_Events.size() - frame.FirstEvent)
+            return false;
+    }
+
+    m_FrameMs.reserve(m_Frames.size());
+    m_Mode = Replaying;
+    return true;
+}
+
+bool InputRecorder::ReplayFrame(InputManager& input, float& dt)
+{
+    if (m_Mode != Replaying || m_NextFrame >= m_Frames.size())
+        return false;
+
+    const Frame& frame = m_Frames[m_NextFrame++];
+    for (UINT i = 0; i < frame.EventCount; ++i)
+    {
+        input.PushEvent(m_Events[frame.FirstEvent + i]);
+    }
+    dt = frame.DeltaTime;
+    return true;
+}
+
+bool InputRecorder::WriteProfile(const std::wstring& filename) const
+{
+    std::ofstream fout(filename.c_str());
+    if (!fout)
+        return false;
+
+    fout << "frame,dt,ms\n";
+    for (UINT i = 0; i < m_FrameMs.size() && i < m_Frames.size(); ++i)
+    {
+        fout << i << ',' << m_Frames[i].DeltaTime << ',' << m_FrameMs[i] << '\n';
+    }
+    return fout.good();
+}
@@ -0,0 +1,80 @@
+//***************************************************************************************
+// InputRecorder.h
+//
+// Records a session as the frame time step and the input events of every frame,
+// and plays it back.
+//
+// During replay the application feeds each frame's recorded events to the
+// InputManager and passes the recorded step to D3DManager::Update instead of
+// the timer's, so the simulation goes through exactly the same states as in the
+// recorded session, whatever the frame rate.  The measured CPU time of each
+// replayed frame is kept so two builds can be compared on the same session.
+// The Tests console replays without a window or drawing, see Tests/TestMain.cpp.
+//***************************************************************************************
+
+#ifndef INPUTRECORDER_H
+#define INPUTRECORDER_H
+
+#include "InputManager.h"
+#include <string>
+
+class InputRecorder
+{
+public:
+    enum Mode
+    {
+        Off,
+        Recording,
+        Replaying,
+    };
+
+public:
+    InputRecorder();
+    ~InputRecorder();
+
+    // Recording is kept in memory and written by EndRecording.
+    void    BeginRecording(const std::wstring& filename);
+    void    RecordFrame(float dt, const std::vector<InputEvent>& events);
+    bool    EndRecording();
+
+    // Loads a file written by EndRecording.
+    bool    BeginReplay(const std::wstring& filename);
+
+    void    EndReplay()                 { m_Mode = Off; }
+
+    // Queues the next frame's events into 'input'; false once every frame was replayed.
+    bool    ReplayFrame(InputManager& input, float& dt);
+
+    // CPU time of the replayed frame, see WriteProfile.
+    void    AddFrameTime(double ms)     { m_FrameMs.push_back(ms); }
+
+    // Writes "frame,dt,ms" lines for the replayed frames.
+    bool    WriteProfile(const std::wstring& filename) const;
+
+    Mode                GetMode() const         { return m_Mode; }
+    const std::wstring& GetFilename() const     { return m_Filename; }
+    UINT                GetFrameCount() const   { return (UINT)m_Frames.size(); }
+
+public:
+    InputRecorder(const InputRecorder& rhs)             = delete;
+    InputRecorder& operator=(const InputRecorder& rhs)  = delete;
+
+private:
+    struct Frame
+    {
+        float   DeltaTime;
+        UINT    FirstEvent;
+        UINT    EventCount;
+    };
+
+    Mode                    m_Mode;
+    std::wstring            m_Filename;
+
+    std::vector<Frame>      m_Frames;
+    std::vector<InputEvent> m_Events;
+    UINT                    m_NextFrame;
+
+    std::vector<double>     m_FrameMs;
+};
+
+#endif // INPUTRECORDER_H
@@ -2,10 +2,24 @@
 #include "Effects.h"
 #include "GeometryGenerator.h"
 #include "RenderStates.h"
+#include "AssetArchive.h"
 
 
 Land::Land()
+:   m_VertexCount(0),
+    m_NumVertices(0),
+    m_LodDistance(2.0f * ChunkCells),
+    m_ChunkIB(nullptr),
+    m_Corner(0.0f, 0.0f, 0.0f),
+    m_CellSpacing(1.0f),
+    m_HeightScale(255.0f)
 {
+    m_Stats.Chunks = 0;
+    m_Stats.DrawnChunks = 0;
+    m_Stats.Triangles = 0;
+    m_Stats.FullTriangles = 0;
+
+    SetCastsShadow(true);
 }
 
 
@@ -13,24 +27,39 @@ Land::~Land()
 {
 }
 
+void Land::Place(const XMFLOAT3& corner, float cellSpacing, float heightScale)
+{
+    m_Corner = corner;
+    m_CellSpacing = cellSpacing;
+    m_HeightScale = heightScale;
+}
+
 void Land::Init(ID3D11Device* device)
 {
     //CreateBuffer(device);
     CreateBufferWithLoadHeightmap(device);
     m_Effect = Effects::BasicFX;
-    m_Tech = Effects::BasicFX->m_Light1TexTech;
-    HR(D3DX11CreateShaderResourceViewFromFile(device, L"Textures/heightMap.jpg", 0, 0, &m_DiffuseMapSRV, 0));
+    m_Tech = Effects::BasicFX->m_DefaultTech;
+    SetDiffuseMap(L"Textures/heightMap.jpg");
 
     XMMATRIX grassTexScale = XMMatrixScaling(1.0f, 1.0f, 0.0f);
-    XMStoreFloat4x4(&m_TexTransform, grassTexScale);
+    SetTexTransform(grassTexScale);
+
+    Material mat;
+    mat.Ambient = XMFLOAT4(0.5f, 0.5f, 0.5f, 1.0f);
+    mat.Diffuse = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+    mat.Specular = XMFLOAT4(0.2f, 0.2f, 0.2f, 16.0f);
+    SetMaterial(mat);
 
-    m_Mat.Ambient = XMFLOAT4(0.5f, 0.5f, 0.5f, 1.0f);
-    m_Mat.Diffuse = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
-    m_Mat.Specular = XMFLOAT4(0.2f, 0.2f, 0.2f, 16.0f);
+    // The mesh has a cell per unit and a unit per heightmap step.
+    XMVECTOR scale = XMVectorSet(m_CellSpacing, m_HeightScale / 255.0f, m_CellSpacing, 0.0f);
+    SetTransform(scale, XMQuaternionIdentity(), XMLoadFloat3(&m_Corner));
 }
 
 void Land::Release()
 {
+    ReleaseCOM(m_ChunkIB);
+    m_Chunks.clear();
     Object::Release();
 }
 
@@ -41,172 +70,386 @@ void Land::Update(float dt)
 
 void Land::Render(ID3D11DeviceContext* context, CXMMATRIX viewProj)
 {
-    UINT stride = sizeof(Vertex::Basic32);
-    UINT offset = 0;
-    context->IASetVertexBuffers(0, 1, &m_VertexBuffer, &stride, &offset);
-    context->IASetIndexBuffer(m_IndexBuffer, DXGI_FORMAT_R32_UINT, 0);
+    SelectChunks(viewProj, true);
+    m_Mesh->Bind(context);
     context->IASetInputLayout(InputLayouts::Basic32);
-    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-    switch (RenderStates::m_RenderOptions)
-    {
-    case RenderOptions::Lighting:
-        m_Tech = Effects::BasicFX->m_Light3Tech;
-        break;
-    case RenderOptions::Textures:
-        m_Tech = Effects::BasicFX->m_Light3TexTech;
-        break;
-    case RenderOptions::TexturesAndFog:
-        m_Tech = Effects::BasicFX->m_Light3TexFogTech;
-        break;
-    }
+    m_Tech = Effects::BasicFX->SelectTech(BasicEffect::FeaturesFor(RenderStates::m_RenderOptions));
 
     Object::Render(context, viewProj);
 }
 
 
-void Land::CreateBuffer(ID3D11Device* device)
+void Land::RenderShadow(ID3D11DeviceContext* context, CXMMATRIX lightViewProj)
 {
-    GeometryGenerator::MeshData grid;
-    GeometryGenerator geoGen;
-    geoGen.CreateGrid(160.0f, 160.0f, 50, 50, grid);
+    SelectChunks(lightViewProj, false);
+    m_Mesh->Bind(context);
+    context->IASetInputLayout(InputLayouts::Basic32);
 
-    m_IndexCount = grid.Indices.size();
+    m_Tech = Effects::BasicFX->SelectTech(BasicShadowCaster);
+    Object::RenderDepth(context, lightViewProj);
+}
 
-    XMFLOAT3 vMinf3(+MathHelper::Infinity, +MathHelper::Infinity, +MathHelper::Infinity);
-    XMFLOAT3 vMaxf3(-MathHelper::Infinity, -MathHelper::Infinity, -MathHelper::Infinity);
-    XMVECTOR vMin = XMLoadFloat3(&vMinf3);
-    XMVECTOR vMax = XMLoadFloat3(&vMaxf3);
+void Land::DrawMesh(ID3D11DeviceContext* context)
+{
+    if (m_Chunks.empty())
+    {
+        Object::DrawMesh(context);
+        return;
+    }
+
+    // Every chunk draws one of the shared LOD index lists from its own vertices.
+    context->IASetIndexBuffer(m_ChunkIB, DXGI_FORMAT_R16_UINT, 0);
+    for (UINT c : m_DrawChunks)
+    {
+        const Chunk& chunk = m_Chunks[c];
+        UINT start = m_LodStarts[chunk.Lod];
+        context->DrawIndexed(m_LodStarts[chunk.Lod + 1] - start, start, (INT)chunk.BaseVertex);
+    }
+}
 
-    m_MeshVertices.resize(grid.Vertices.size());
-    for (UINT i = 0; i < grid.Vertices.size(); ++i)
+void Land::SelectChunks(CXMMATRIX viewProj, bool cameraPass)
+{
+    m_DrawChunks.clear();
+    if (m_Chunks.empty())
+        return;
+
+    // The planes and the eye in mesh space, where the chunk boxes are.
+    XMMATRIX worldViewProj = XMMatrixMultiply(GetWorldMatrix(), viewProj);
+    XMFLOAT4 planes[6];
+    ExtractFrustumPlanes(planes, worldViewProj);
+
+    // A perspective projection takes the eye to w = 0 on the view axis.
+    XMFLOAT3 eye(0.0f, 0.0f, 0.0f);
+    if (cameraPass)
     {
-        XMFLOAT3 p = grid.Vertices[i].Position;
-        p.y = GetHillHeight(p.x, p.z);
+        XMVECTOR det;
+        XMVECTOR e = XMVector4Transform(XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMMatrixInverse(&det, worldViewProj));
+        XMStoreFloat3(&eye, XMVectorDivide(e, XMVectorSplatW(e)));
+    }
+
+    for (UINT c = 0; c < m_Chunks.size(); ++c)
+    {
+        Chunk& chunk = m_Chunks[c];
+        const XMFLOAT3& center = chunk.Box.Center;
+        const XMFLOAT3& extents = chunk.Box.Extents;
+
+        bool outside = false;
+        for (UINT p = 0; p < 6 && !outside; ++p)
+        {
+            const XMFLOAT4& plane = planes[p];
+            float r = extents.x*fabsf(plane.x) + extents.y*fabsf(plane.y) + extents.z*fabsf(plane.z);
+            float s = plane.x*center.x + plane.y*center.y + plane.z*center.z + plane.w;
+            outside = s + r < 0.0f;
+        }
+        if (outside)
+            continue;
 
-        m_MeshVertices[i].Pos = p;
-        m_MeshVertices[i].Normal = GetHillNormal(p.x, p.z);
-        m_MeshVertices[i].Tex = grid.Vertices[i].TexC;
+        if (cameraPass)
+        {
+            float dx = MathHelper::Max(fabsf(eye.x - center.x) - extents.x, 0.0f);
+            float dy = MathHelper::Max(fabsf(eye.y - center.y) - extents.y, 0.0f);
+            float dz = MathHelper::Max(fabsf(eye.z - center.z) - extents.z, 0.0f);
+            float distance = sqrtf(dx*dx + dy*dy + dz*dz);
+
+            chunk.Lod = 0;
+            for (float limit = m_LodDistance; chunk.Lod + 1 < LodCount && distance > limit; limit *= 2.0f)
+                ++chunk.Lod;
+        }
 
-        XMVECTOR P = XMLoadFloat3(&m_MeshVertices[i].Pos);
-        vMin = XMVectorMin(vMin, P);
-        vMax = XMVectorMax(vMax, P);
+        m_DrawChunks.push_back(c);
     }
-    XMStoreFloat3(&m_MeshBox.Center, 0.5f*(vMin + vMax));
-    XMStoreFloat3(&m_MeshBox.Extents, 0.5f*(vMax - vMin));
 
-    D3D11_BUFFER_DESC vbd;
-    vbd.Usage = D3D11_USAGE_IMMUTABLE;
-    vbd.ByteWidth = sizeof(Vertex::Basic32) * grid.Vertices.size();
-    vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    vbd.CPUAccessFlags = 0;
-    vbd.MiscFlags = 0;
-    D3D11_SUBRESOURCE_DATA vinitData;
-    vinitData.pSysMem = &m_MeshVertices[0];
-    HR(device->CreateBuffer(&vbd, &vinitData, &m_VertexBuffer));
+    if (cameraPass)
+    {
+        const UINT fullTriangles = (m_LodStarts[1] - m_LodStarts[0]) / 3;
+        m_Stats.Chunks = (UINT)m_Chunks.size();
+        m_Stats.DrawnChunks = (UINT)m_DrawChunks.size();
+        m_Stats.Triangles = 0;
+        m_Stats.FullTriangles = m_Stats.Chunks * fullTriangles;
+        for (UINT c : m_DrawChunks)
+            m_Stats.Triangles += (m_LodStarts[m_Chunks[c].Lod + 1] - m_LodStarts[m_Chunks[c].Lod]) / 3;
+    }
+}
 
 
-    m_MeshIndices.insert(m_MeshIndices.end(), grid.Indices.begin(), grid.Indices.end());
-    D3D11_BUFFER_DESC ibd;
-    ibd.Usage = D3D11_USAGE_IMMUTABLE;
-    ibd.ByteWidth = sizeof(UINT)* m_IndexCount;
-    ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    ibd.CPUAccessFlags = 0;
-    ibd.MiscFlags = 0;
-    D3D11_SUBRESOURCE_DATA iinitData;
-    iinitData.pSysMem = &m_MeshIndices[0];
-    HR(device->CreateBuffer(&ibd, &iinitData, &m_IndexBuffer));
+void Land::CreateBuffer(ID3D11Device* device)
+{
+    m_Mesh = MeshAsset::Find(L"Land.Hills");
+    if (!m_Mesh)
+    {
+        GeometryGenerator::Counts counts = GeometryGenerator::GridCounts(50, 50);
+        std::vector<Vertex::Basic32> vertices(counts.Vertices);
+        std::vector<UINT> indices(counts.Indices);
+        GeometryGenerator::CreateGrid(160.0f, 160.0f, 50, 50, &vertices[0], &indices[0]);
+
+        for (UINT i = 0; i < counts.Vertices; ++i)
+        {
+            XMFLOAT3& p = vertices[i].Pos;
+            p.y = GetHillHeight(p.x, p.z);
+            vertices[i].Normal = GetHillNormal(p.x, p.z);
+        }
+        m_Mesh = MeshAsset::Create(device, L"Land.Hills", vertices, indices);
+    }
+
+    SetMeshBox(m_Mesh->GetBounds());
 }
 
 void Land::CreateBufferWithLoadHeightmap(ID3D11Device* device)
 {
     m_VertexCount = 257;
     m_NumVertices = 66049;
-    
+
+    // The chunk boxes come from the heights even when the mesh is shared.
     LoadHeightmap();
 
-    XMFLOAT3 vMinf3(+MathHelper::Infinity, +MathHelper::Infinity, +MathHelper::Infinity);
-    XMFLOAT3 vMaxf3(-MathHelper::Infinity, -MathHelper::Infinity, -MathHelper::Infinity);
-    XMVECTOR vMin = XMLoadFloat3(&vMinf3);
-    XMVECTOR vMax = XMLoadFloat3(&vMaxf3);
+    std::vector<USHORT> lodIndices;
+    BuildLodIndices(lodIndices, m_LodStarts);
 
-    m_MeshVertices.resize(m_NumVertices);
-    for (int z = 0; z < m_VertexCount; ++z)
+    D3D11_BUFFER_DESC ibd;
+    ibd.Usage = D3D11_USAGE_IMMUTABLE;
+    ibd.ByteWidth = sizeof(USHORT) * lodIndices.size();
+    ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+    ibd.CPUAccessFlags = 0;
+    ibd.MiscFlags = 0;
+    ibd.StructureByteStride = 0;
+
+    D3D11_SUBRESOURCE_DATA iinitData;
+    iinitData.pSysMem = &lodIndices[0];
+    HR(device->CreateBuffer(&ibd, &iinitData, &m_ChunkIB));
+
+    m_Mesh = MeshAsset::Find(L"Land.Heightmap");
+    bool buildMesh = m_Mesh == nullptr;
+
+    const UINT chunksPerSide = (m_VertexCount - 1) / ChunkCells;
+    const UINT rowVertices = ChunkCells + 1;
+    m_Chunks.resize(chunksPerSide * chunksPerSide);
+
+    std::vector<Vertex::Basic32> vertices;
+    std::vector<UINT> indices;
+    if (buildMesh)
+    {
+        vertices.resize(m_Chunks.size() * ChunkVertices);
+        indices.reserve(m_Chunks.size() * ChunkCells * ChunkCells * 6);
+    }
+
+    for (UINT cz = 0; cz < chunksPerSide; ++cz)
     {
-        for (int x = 0; x < m_VertexCount; ++x)
+        for (UINT cx = 0; cx < chunksPerSide; ++cx)
         {
-            int idx = x + (z * (m_VertexCount));
-            m_MeshVertices[idx].Pos = XMFLOAT3(x, m_Heightmap[idx], z);
-            m_MeshVertices[idx].Tex = XMFLOAT2(x / (float)(m_VertexCount - 1), z / (float)(m_VertexCount - 1));
-            m_MeshVertices[idx].Normal = GetHillNormal(x, z);
-
-            XMVECTOR P = XMLoadFloat3(&m_MeshVertices[idx].Pos);
-            vMin = XMVectorMin(vMin, P);
-            vMax = XMVectorMax(vMax, P);
+            UINT c = cz * chunksPerSide + cx;
+            Chunk& chunk = m_Chunks[c];
+            chunk.BaseVertex = c * ChunkVertices;
+            chunk.Lod = 0;
+
+            float minY = MathHelper::Infinity;
+            float maxY = -MathHelper::Infinity;
+            for (UINT z = 0; z <= ChunkCells; ++z)
+            {
+                for (UINT x = 0; x <= ChunkCells; ++x)
+                {
+                    UINT hx = cx * ChunkCells + x;
+                    UINT hz = cz * ChunkCells + z;
+                    float y = (float)m_Heightmap[hx + hz * m_VertexCount];
+                    minY = MathHelper::Min(minY, y);
+                    maxY = MathHelper::Max(maxY, y);
+
+                    if (!buildMesh)
+                        continue;
+
+                    Vertex::Basic32& vertex = vertices[chunk.BaseVertex + z * rowVertices + x];
+                    vertex.Pos = XMFLOAT3((float)hx, y, (float)hz);
+                    vertex.Tex = XMFLOAT2(hx / (float)(m_VertexCount - 1), hz / (float)(m_VertexCount - 1));
+                    vertex.Normal = GetHeightmapNormal(hx, hz);
+                }
+            }
+
+            // A neighbour at another LOD never dips below this chunk's lowest point
+            // along the shared edge, so a skirt hanging beneath it closes any gap.
+            float skirtY = minY - 1.0f;
+            chunk.Box.Center = XMFLOAT3((cx + 0.5f) * ChunkCells, 0.5f * (skirtY + maxY), (cz + 0.5f) * ChunkCells);
+            chunk.Box.Extents = XMFLOAT3(0.5f * ChunkCells, 0.5f * (maxY - skirtY), 0.5f * ChunkCells);
+
+            if (!buildMesh)
+                continue;
+
+            // The skirt copies the edges z = 0, z = max, x = 0 and x = max in that order.
+            Vertex::Basic32* v = &vertices[chunk.BaseVertex];
+            Vertex::Basic32* skirt = v + ChunkGridVertices;
+            for (UINT i = 0; i <= ChunkCells; ++i)
+            {
+                skirt[i]                    = v[i];
+                skirt[rowVertices + i]      = v[ChunkCells * rowVertices + i];
+                skirt[2 * rowVertices + i]  = v[i * rowVertices];
+                skirt[3 * rowVertices + i]  = v[i * rowVertices + ChunkCells];
+            }
+            for (UINT i = 0; i < 4 * rowVertices; ++i)
+                skirt[i].Pos.y = skirtY;
+
+            // Picking and the picked triangle use the full detail surface, which
+            // leads LOD 0.
+            for (UINT i = 0; i < ChunkCells * ChunkCells * 6; ++i)
+                indices.push_back(chunk.BaseVertex + lodIndices[i]);
         }
     }
-    XMStoreFloat3(&m_MeshBox.Center, 0.5f*(vMin + vMax));
-    XMStoreFloat3(&m_MeshBox.Extents, 0.5f*(vMax - vMin));
-
-    D3D11_BUFFER_DESC vbd;
-    vbd.Usage = D3D11_USAGE_IMMUTABLE;
-    vbd.ByteWidth = sizeof(Vertex::Basic32) * m_NumVertices;
-    vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    vbd.CPUAccessFlags = 0;
-    vbd.MiscFlags = 0;
-    D3D11_SUBRESOURCE_DATA vinitData;
-    vinitData.pSysMem = &m_MeshVertices[0];
-    HR(device->CreateBuffer(&vbd, &vinitData, &m_VertexBuffer));
-
-
-    int triangleCount = (m_VertexCount - 1) * (m_VertexCount - 1) * 2;    // ﰢ 
-    m_IndexCount = triangleCount * 3;
-
-    m_MeshIndices.resize(m_IndexCount);
-    int baseIndex = 0;
-    int _numVertsPerRow = m_VertexCount;
-    for (int z = 0; z < _numVertsPerRow - 1; z++)
+
+    if (buildMesh)
+        m_Mesh = MeshAsset::Create(device, L"Land.Heightmap", vertices, indices);
+    SetMeshBox(m_Mesh->GetBounds());
+
+    // The mesh keeps what picking needs.
+    std::vector<UINT>().swap(m_Heightmap);
+}
+
+void Land::BuildLodIndices(std::vector<USHORT>& indices, std::vector<UINT>& lodStarts)
+{
+    const UINT rowVertices = ChunkCells + 1;
+
+    // Two triangles down from the edge segment a-b to the skirt vertices below them.
+    auto skirtQuad = [&indices](UINT a, UINT b, UINT aBelow, UINT bBelow)
     {
-        for (int x = 0; x < _numVertsPerRow - 1; x++)
+        USHORT quad[6] = { (USHORT)a, (USHORT)b, (USHORT)aBelow, (USHORT)b, (USHORT)bBelow, (USHORT)aBelow };
+        indices.insert(indices.end(), quad, quad + 6);
+    };
+
+    indices.clear();
+    lodStarts.clear();
+    for (UINT lod = 0; lod < LodCount; ++lod)
+    {
+        lodStarts.push_back((UINT)indices.size());
+        UINT step = 1 << lod;
+
+        // Wound like the heightmap grid, surface first.
+        for (UINT z = 0; z < ChunkCells; z += step)
+        {
+            for (UINT x = 0; x < ChunkCells; x += step)
+            {
+                USHORT i0 = (USHORT)(z * rowVertices + x);
+                USHORT i1 = (USHORT)((z + step) * rowVertices + x);
+                USHORT i2 = (USHORT)(z * rowVertices + x + step);
+                USHORT i3 = (USHORT)((z + step) * rowVertices + x + step);
+
+                USHORT quad[6] = { i0, i1, i2, i1, i3, i2 };
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+        }
+
+        // Skirt faces point away from the chunk; on the z = max and x = 0 edges
+        // that takes the segment backwards.
+        for (UINT i = 0; i < ChunkCells; i += step)
         {
-            m_MeshIndices[baseIndex]        =  z        * _numVertsPerRow + x;      //  0
-            m_MeshIndices[baseIndex + 2]    =  z        * _numVertsPerRow + x + 1;  //  3
-            m_MeshIndices[baseIndex + 1]    = (z + 1)   * _numVertsPerRow + x;      //  1
+            UINT j = i + step;
+            UINT below = ChunkGridVertices;
+            skirtQuad(i, j, below + i, below + j);
 
-            m_MeshIndices[baseIndex + 3]    = (z + 1)   * _numVertsPerRow + x;      //  3
-            m_MeshIndices[baseIndex + 5]    =  z        * _numVertsPerRow + x + 1;  //  4
-            m_MeshIndices[baseIndex + 4]    = (z + 1)   * _numVertsPerRow + x + 1;  //  1
+            below += rowVertices;
+            skirtQuad(ChunkCells * rowVertices + j, ChunkCells * rowVertices + i, below + j, below + i);
 
-            baseIndex += 6;
+            below += rowVertices;
+            skirtQuad(j * rowVertices, i * rowVertices, below + j, below + i);
+
+            below += rowVertices;
+            skirtQuad(i * rowVertices + ChunkCells, j * rowVertices + ChunkCells, below + i, below + j);
         }
     }
-
-    D3D11_BUFFER_DESC ibd;
-    ibd.Usage = D3D11_USAGE_IMMUTABLE;
-    ibd.ByteWidth = sizeof(UINT)* m_IndexCount;
-    ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    ibd.CPUAccessFlags = 0;
-    ibd.MiscFlags = 0;
-    D3D11_SUBRESOURCE_DATA iinitData;
-    iinitData.pSysMem = &m_MeshIndices[0];
-    HR(device->CreateBuffer(&ibd, &iinitData, &m_IndexBuffer));
+    lodStarts.push_back((UINT)indices.size());
 }
 
-void Land::LoadHeightmap()
+UINT Land::SelfTest()
 {
-    std::vector<BYTE> in(m_NumVertices);
-    std::ifstream loadFile;
-    loadFile.open(L"Textures/heightMap.raw", std::ios_base::binary);
+    std::vector<USHORT> indices;
+    std::vector<UINT> lodStarts;
+    BuildLodIndices(indices, lodStarts);
+
+    // A flat chunk at y = 0 with its skirt at y = -1.
+    const UINT rowVertices = ChunkCells + 1;
+    std::vector<XMFLOAT3> positions(ChunkVertices);
+    for (UINT z = 0; z < rowVertices; ++z)
+        for (UINT x = 0; x < rowVertices; ++x)
+            positions[z * rowVertices + x] = XMFLOAT3((float)x, 0.0f, (float)z);
+    for (UINT i = 0; i < rowVertices; ++i)
+    {
+        positions[ChunkGridVertices + i]                    = XMFLOAT3((float)i, -1.0f, 0.0f);
+        positions[ChunkGridVertices + rowVertices + i]      = XMFLOAT3((float)i, -1.0f, (float)ChunkCells);
+        positions[ChunkGridVertices + 2 * rowVertices + i]  = XMFLOAT3(0.0f, -1.0f, (float)i);
+        positions[ChunkGridVertices + 3 * rowVertices + i]  = XMFLOAT3((float)ChunkCells, -1.0f, (float)i);
+    }
+    XMVECTOR center = XMVectorSet(0.5f * ChunkCells, 0.0f, 0.5f * ChunkCells, 0.0f);
 
-    if (loadFile)
+    // Every LOD must cover the chunk once with upward triangles, and wrap it in
+    // one skirt triangle pair per edge segment, all facing out.
+    UINT failures = 0;
+    for (UINT lod = 0; lod < LodCount; ++lod)
     {
-        loadFile.read((char*)&in[0], (std::streamsize)in.size());
-        loadFile.close();
+        UINT segments = ChunkCells >> lod;
+        float area = 0.0f;
+        UINT skirtTriangles = 0;
+        bool broken = lodStarts[lod + 1] - lodStarts[lod] != 6 * (segments * segments + 4 * segments);
+
+        for (UINT t = lodStarts[lod]; t < lodStarts[lod + 1] && !broken; t += 3)
+        {
+            if (indices[t] >= ChunkVertices || indices[t + 1] >= ChunkVertices || indices[t + 2] >= ChunkVertices)
+            {
+                broken = true;
+                break;
+            }
+
+            XMVECTOR p0 = XMLoadFloat3(&positions[indices[t]]);
+            XMVECTOR p1 = XMLoadFloat3(&positions[indices[t + 1]]);
+            XMVECTOR p2 = XMLoadFloat3(&positions[indices[t + 2]]);
+            XMFLOAT3 n;
+            XMStoreFloat3(&n, XMVector3Cross(p1 - p0, p2 - p0));
+
+            bool surface = indices[t] < ChunkGridVertices && indices[t + 1] < ChunkGridVertices &&
+                indices[t + 2] < ChunkGridVertices;
+            if (surface)
+            {
+                broken = n.y <= 0.0f;
+                area += 0.5f * n.y;
+            }
+            else
+            {
+                XMVECTOR out = (p0 + p1 + p2) / 3.0f - center;
+                broken = fabsf(n.y) > 1e-4f || XMVectorGetX(XMVector3Dot(XMLoadFloat3(&n), out)) <= 0.0f;
+                ++skirtTriangles;
+            }
+        }
+
+        if (broken || fabsf(area - (float)(ChunkCells * ChunkCells)) > 1e-3f || skirtTriangles != 8 * segments)
+            ++failures;
     }
+    return failures;
+}
+
+XMFLOAT3 Land::GetHeightmapNormal(UINT x, UINT z) const
+{
+    // The mesh has a unit per cell and per heightmap step.  The world transform
+    // scales it by m_CellSpacing and m_HeightScale / 255, and the shader takes
+    // normals through its inverse transpose, so the slope is left unscaled here
+    // and one shared mesh serves every spacing and height scale.
+    UINT x0 = x > 0 ? x - 1 : x;
+    UINT x1 = x + 1 < m_VertexCount ? x + 1 : x;
+    UINT z0 = z > 0 ? z - 1 : z;
+    UINT z1 = z + 1 < m_VertexCount ? z + 1 : z;
+
+    float dydx = ((float)m_Heightmap[x1 + z * m_VertexCount] - (float)m_Heightmap[x0 + z * m_VertexCount]) / (float)(x1 - x0);
+    float dydz = ((float)m_Heightmap[x + z1 * m_VertexCount] - (float)m_Heightmap[x + z0 * m_VertexCount]) / (float)(z1 - z0);
+
+    // n = (-dy/dx, 1, -dy/dz)
+    XMFLOAT3 n(-dydx, 1.0f, -dydz);
+    XMStoreFloat3(&n, XMVector3Normalize(XMLoadFloat3(&n)));
+    return n;
+}
+
+void Land::LoadHeightmap()
+{
+    AssetArchive::Asset file;
+    AssetArchive::getInstance()->Load(L"Textures/heightMap.raw", file);
 
-    m_Heightmap.resize(m_NumVertices);
-    for (int i = 0; i < in.size(); ++i)
+    m_Heightmap.assign(m_NumVertices, 0.0f);
+    UINT count = MathHelper::Min(file.Size, (UINT)m_NumVertices);
+    for (UINT i = 0; i < count; ++i)
     {
-        m_Heightmap[i] = in[i];
+        m_Heightmap[i] = file.Data[i];
     }
 }
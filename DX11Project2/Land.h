@@ -2,16 +2,40 @@
 #include "Object.h"
 class Land : public Object
 {
+public:
+    // What the last camera pass drew, against every chunk at full detail.
+    struct Stats
+    {
+        UINT    Chunks;
+        UINT    DrawnChunks;
+        UINT    Triangles;
+        UINT    FullTriangles;
+    };
+
 public:
     Land();
     virtual ~Land();
 
+    // Where the heightmap's corner lies, the side of a cell and the height of
+    // the highest heightmap value; call before Init.
+    void Place(const XMFLOAT3& corner, float cellSpacing, float heightScale);
+
     virtual void Init(ID3D11Device* device);
     virtual void Release();
     virtual void Update(float dt);
     virtual void Render(ID3D11DeviceContext* context, CXMMATRIX viewProj);
+    virtual void RenderShadow(ID3D11DeviceContext* context, CXMMATRIX lightViewProj);
     virtual void CreateBuffer(ID3D11Device* device);
-    
+
+    // Checks that every LOD of a chunk covers the whole chunk with triangles of
+    // its own vertices.  Returns the number of broken LODs.
+    static UINT SelfTest();
+
+    const Stats& GetStats() const { return m_Stats; }
+
+protected:
+    // Draws the chunks chosen by the last SelectChunks.
+    virtual void DrawMesh(ID3D11DeviceContext* context);
 
 private:
     float       GetHillHeight(float x, float z) const { return 0.3f*(z*sinf(0.1f*x) + x*cosf(0.1f*z)); }
@@ -29,13 +53,54 @@ private:
         return n;
     }
 
+    // The surface normal at heightmap vertex (x, z) in mesh space, from central
+    // differences of the neighbouring heights, one-sided at the edges.
+    XMFLOAT3    GetHeightmapNormal(UINT x, UINT z) const;
+
     void CreateBufferWithLoadHeightmap(ID3D11Device* device);
     void LoadHeightmap();
 
+    // Keeps the chunks inside the frustum of 'viewProj'.  The camera pass
+    // also picks their LODs by distance; other passes reuse the last choice.
+    void SelectChunks(CXMMATRIX viewProj, bool cameraPass);
+
+    // Indices of every LOD of one chunk, relative to its first vertex, each LOD
+    // after the one before.
+    static void BuildLodIndices(std::vector<USHORT>& indices, std::vector<UINT>& lodStarts);
+
 private:
+    // The heightmap is cut into chunks of ChunkCells x ChunkCells cells.  Each
+    // chunk has its own grid of vertices followed by a skirt: a copy of its four
+    // edges hanging below the lowest point of the chunk, which hides the cracks
+    // where neighbours of different LODs meet.  LOD l takes every 2^l-th vertex.
+    static const UINT ChunkCells = 32;
+    static const UINT LodCount = 5;
+    static const UINT ChunkGridVertices = (ChunkCells + 1) * (ChunkCells + 1);
+    static const UINT ChunkVertices = ChunkGridVertices + 4 * (ChunkCells + 1);
+
+    struct Chunk
+    {
+        XNA::AxisAlignedBox Box;        // mesh space, skirt included
+        UINT                BaseVertex;
+        UINT                Lod;        // chosen by the last camera pass
+    };
+
     UINT m_VertexCount;
     UINT m_NumVertices;
 
     std::vector<UINT> m_Heightmap;
+
+    // LOD 0 is used within LodDistance of the eye, every further LOD within
+    // twice the distance of the one before.
+    float               m_LodDistance;
+    std::vector<Chunk>  m_Chunks;
+    std::vector<UINT>   m_LodStarts;        // LodCount + 1 entries into m_ChunkIB
+    ID3D11Buffer*       m_ChunkIB;
+    std::vector<UINT>   m_DrawChunks;
+    Stats               m_Stats;
+
+    XMFLOAT3    m_Corner;
+    float       m_CellSpacing;
+    float       m_HeightScale;
 };
 
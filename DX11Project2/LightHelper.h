@@ -65,7 +65,7 @@ struct SpotLight
 
 struct Material
 {
-	Material() { ZeroMemory(this, sizeof(this)); }
+	Material() { ZeroMemory(this, sizeof(*this)); }
 
 	XMFLOAT4 Ambient;
 	XMFLOAT4 Diffuse;
@@ -9,14 +9,15 @@
 
 #include <Windows.h>
 #include <xnamath.h>
+#include "Random.h"
 
 class MathHelper
 {
 public:
-	// Returns random float in [0, 1).
+	// Returns random float in [0, 1), from the calling thread's generator.
 	static float RandF()
 	{
-		return (float)(rand()) / (float)RAND_MAX;
+		return Random::ForThread().NextFloat();
 	}
 
 	// Returns random float in [a, b).
@@ -0,0 +1,264 @@
+//***************************************************************************************
+// MeshAsset.cpp
+//***************************************************************************************
+
+#include "MeshAsset.h"
+#include <map>
+
+namespace
+{
+    std::map<std::wstring, MeshAsset*> g_Meshes;
+
+    XNA::AxisAlignedBox BoxFromMinMax(FXMVECTOR vMin, FXMVECTOR vMax)
+    {
+        XNA::AxisAlignedBox box;
+        XMStoreFloat3(&box.Center, 0.5f*(vMin + vMax));
+        XMStoreFloat3(&box.Extents, 0.5f*(vMax - vMin));
+        return box;
+    }
+}
+
+MeshAsset::MeshAsset(const std::wstring& name, D3D11_PRIMITIVE_TOPOLOGY topology)
+:   m_Name(name),
+    m_References(1),
+    m_VertexBuffer(nullptr),
+    m_IndexBuffer(nullptr),
+    m_VertexStride(0),
+    m_VertexCount(0),
+    m_IndexCount(0),
+    m_IndexFormat(DXGI_FORMAT_R32_UINT),
+    m_Topology(topology)
+{
+    if (!m_Name.empty())
+        g_Meshes[m_Name] = this;
+}
+
+MeshAsset::~MeshAsset()
+{
+    if (!m_Name.empty())
+        g_Meshes.erase(m_Name);
+
+    ReleaseCOM(m_IndexBuffer);
+    ReleaseCOM(m_VertexBuffer);
+}
+
+MeshAsset* MeshAsset::Find(const std::wstring& name)
+{
+    auto it = g_Meshes.find(name);
+    if (it == g_Meshes.end())
+        return nullptr;
+
+    it->second->AddRef();
+    return it->second;
+}
+
+void MeshAsset::Release()
+{
+    if (--m_References == 0)
+        delete this;
+}
+
+void MeshAsset::Build(ID3D11Device* device, const void* vertices, UINT vertexStride,
+    std::vector<XMFLOAT3>& positions, const std::vector<UINT>& indices)
+{
+    m_VertexStride = vertexStride;
+    m_VertexCount = (UINT)positions.size();
+    m_IndexCount = (UINT)indices.size();
+    m_Positions.swap(positions);
+
+    XMVECTOR vMin = XMVectorReplicate(+MathHelper::Infinity);
+    XMVECTOR vMax = XMVectorReplicate(-MathHelper::Infinity);
+    for (UINT i = 0; i < m_VertexCount; ++i)
+    {
+        XMVECTOR P = XMLoadFloat3(&m_Positions[i]);
+        vMin = XMVectorMin(vMin, P);
+        vMax = XMVectorMax(vMax, P);
+    }
+    m_Bounds = BoxFromMinMax(vMin, vMax);
+
+    // Only triangles can be picked.
+    if (m_Topology == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST)
+    {
+        m_Indices = indices;
+
+        UINT triangleCount = m_IndexCount / 3;
+        for (UINT first = 0; first < triangleCount; first += ClusterSize)
+        {
+            Cluster cluster;
+            cluster.FirstTriangle = first;
+            cluster.TriangleCount = MathHelper::Min(ClusterSize, triangleCount - first);
+
+            vMin = XMVectorReplicate(+MathHelper::Infinity);
+            vMax = XMVectorReplicate(-MathHelper::Infinity);
+            for (UINT k = 3 * first; k < 3 * (first + cluster.TriangleCount); ++k)
+            {
+                XMVECTOR P = XMLoadFloat3(&m_Positions[m_Indices[k]]);
+                vMin = XMVectorMin(vMin, P);
+                vMax = XMVectorMax(vMax, P);
+            }
+            cluster.Box = BoxFromMinMax(vMin, vMax);
+            m_Clusters.push_back(cluster);
+        }
+    }
+
+    if (!device)
+        return;
+
+    D3D11_BUFFER_DESC vbd;
+    vbd.Usage = D3D11_USAGE_IMMUTABLE;
+    vbd.ByteWidth = m_VertexStride * m_VertexCount;
+    vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    vbd.CPUAccessFlags = 0;
+    vbd.MiscFlags = 0;
+    vbd.StructureByteStride = 0;
+    D3D11_SUBRESOURCE_DATA vinitData;
+    vinitData.pSysMem = vertices;
+    HR(device->CreateBuffer(&vbd, &vinitData, &m_VertexBuffer));
+
+    // Half the index memory whenever the vertex count allows it.
+    std::vector<USHORT> shortIndices;
+    D3D11_SUBRESOURCE_DATA iinitData;
+    iinitData.pSysMem = &indices[0];
+    UINT indexSize = sizeof(UINT);
+    if (m_VertexCount <= 0xffff)
+    {
+        shortIndices.assign(indices.begin(), indices.end());
+        iinitData.pSysMem = &shortIndices[0];
+        indexSize = sizeof(USHORT);
+        m_IndexFormat = DXGI_FORMAT_R16_UINT;
+    }
+
+    D3D11_BUFFER_DESC ibd;
+    ibd.Usage = D3D11_USAGE_IMMUTABLE;
+    ibd.ByteWidth = indexSize * m_IndexCount;
+    ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+    ibd.CPUAccessFlags = 0;
+    ibd.MiscFlags = 0;
+    ibd.StructureByteStride = 0;
+    HR(device->CreateBuffer(&ibd, &iinitData, &m_IndexBuffer));
+}
+
+void MeshAsset::Bind(ID3D11DeviceContext* context) const
+{
+    UINT offset = 0;
+    context->IASetVertexBuffers(0, 1, &m_VertexBuffer, &m_VertexStride, &offset);
+    context->IASetIndexBuffer(m_IndexBuffer, m_IndexFormat, 0);
+    context->IASetPrimitiveTopology(m_Topology);
+}
+
+bool MeshAsset::IntersectRay(FXMVECTOR origin, FXMVECTOR dir, float& tmin, UINT& triangle) const
+{
+    bool hit = false;
+    float t = 0.0f;
+    for (const Cluster& cluster : m_Clusters)
+    {
+        if (!XNA::IntersectRayAxisAlignedBox(origin, dir, &cluster.Box, &t) || t > tmin)
+            continue;
+
+        for (UINT i = cluster.FirstTriangle; i < cluster.FirstTriangle + cluster.TriangleCount; ++i)
+        {
+            XMVECTOR v0 = XMLoadFloat3(&m_Positions[m_Indices[i * 3 + 0]]);
+            XMVECTOR v1 = XMLoadFloat3(&m_Positions[m_Indices[i * 3 + 1]]);
+            XMVECTOR v2 = XMLoadFloat3(&m_Positions[m_Indices[i * 3 + 2]]);
+
+            if (XNA::IntersectRayTriangle(origin, dir, v0, v1, v2, &t) && t < tmin)
+            {
+                tmin = t;
+                triangle = i;
+                hit = true;
+            }
+        }
+    }
+    return hit;
+}
+
+MeshAsset::Stats MeshAsset::GetStats()
+{
+    Stats stats;
+    ZeroMemory(&stats, sizeof(stats));
+
+    for (auto& entry : g_Meshes)
+    {
+        const MeshAsset* mesh = entry.second;
+        UINT indexSize = mesh->m_IndexFormat == DXGI_FORMAT_R16_UINT ? sizeof(USHORT) : sizeof(UINT);
+        UINT gpuBytes = mesh->m_VertexStride * mesh->m_VertexCount + indexSize * mesh->m_IndexCount;
+        UINT cpuBytes = (UINT)(mesh->m_Positions.size() * sizeof(XMFLOAT3) +
+            mesh->m_Indices.size() * sizeof(UINT) + mesh->m_Clusters.size() * sizeof(Cluster));
+        UINT copyBytes = mesh->m_VertexStride * mesh->m_VertexCount + sizeof(UINT) * mesh->m_IndexCount;
+
+        ++stats.Meshes;
+        stats.References += mesh->m_References;
+        stats.GpuBytes += gpuBytes;
+        stats.CpuBytes += cpuBytes;
+        stats.UnsharedBytes += mesh->m_References * 2 * copyBytes;
+    }
+    return stats;
+}
+
+UINT MeshAsset::SelfTest()
+{
+    // A bumpy grid, to have clusters that overlap along the rays.
+    const UINT n = 33;
+    std::vector<XMFLOAT3> vertices(n * n);
+    for (UINT z = 0; z < n; ++z)
+    {
+        for (UINT x = 0; x < n; ++x)
+            vertices[z * n + x] = XMFLOAT3((float)x, 2.0f * sinf(0.7f * x) * cosf(0.5f * z), (float)z);
+    }
+
+    std::vector<UINT> indices;
+    for (UINT z = 0; z + 1 < n; ++z)
+    {
+        for (UINT x = 0; x + 1 < n; ++x)
+        {
+            UINT i = z * n + x;
+            UINT quad[6] = { i, i + n, i + 1, i + n, i + n + 1, i + 1 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+
+    struct PositionVertex
+    {
+        XMFLOAT3 Pos;
+    };
+    std::vector<PositionVertex> meshVertices(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i)
+        meshVertices[i].Pos = vertices[i];
+
+    MeshAsset* mesh = Create(nullptr, L"", meshVertices, indices);
+    UINT failures = 0;
+
+    for (UINT r = 0; r < 200; ++r)
+    {
+        XMVECTOR origin = XMVectorSet(-5.0f + 0.2f * (r % 17), 8.0f, -5.0f + 0.25f * (r % 23), 0.0f);
+        XMVECTOR target = XMVectorSet((float)(r * 7 % 32), 0.0f, (float)(r * 13 % 32), 0.0f);
+        XMVECTOR dir = XMVector3Normalize(target - origin);
+
+        float tmin = MathHelper::Infinity;
+        UINT triangle = 0;
+        bool hit = mesh->IntersectRay(origin, dir, tmin, triangle);
+
+        float expectedT = MathHelper::Infinity;
+        for (UINT i = 0; i < indices.size() / 3; ++i)
+        {
+            float t = 0.0f;
+            XMVECTOR v0 = XMLoadFloat3(&vertices[indices[i * 3 + 0]]);
+            XMVECTOR v1 = XMLoadFloat3(&vertices[indices[i * 3 + 1]]);
+            XMVECTOR v2 = XMLoadFloat3(&vertices[indices[i * 3 + 2]]);
+            if (XNA::IntersectRayTriangle(origin, dir, v0, v1, v2, &t) && t < expectedT)
+                expectedT = t;
+        }
+
+        if (hit != (expectedT < MathHelper::Infinity) || (hit && tmin != expectedT))
+            ++failures;
+    }
+
+    // A closer hit found elsewhere is kept.
+    float tmin = 0.001f;
+    UINT triangle = 0;
+    if (mesh->IntersectRay(XMVectorSet(16.0f, 8.0f, 16.0f, 0.0f), XMVectorSet(0.0f, -1.0f, 0.0f, 0.0f), tmin, triangle))
+        ++failures;
+
+    mesh->Release();
+    return failures;
+}
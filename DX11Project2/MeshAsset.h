@@ -0,0 +1,110 @@
+//***************************************************************************************
+// MeshAsset.h
+//
+// Vertex and index buffers shared by every Object that draws the same mesh,
+// with the CPU side picking needs: positions only, the triangle indices, the
+// bounds and clusters of consecutive triangles with their own boxes, so a ray
+// skips whole clusters.
+//
+// Meshes are registered by name and reference counted like COM objects: Find
+// and Create hand out a reference, Release drops it, ReleaseCOM works on them.
+// GetStats sums up the memory of all live meshes against what every reference
+// would hold with its own buffers and full vertex copies.
+//***************************************************************************************
+
+#ifndef MESHASSET_H
+#define MESHASSET_H
+
+#include "d3dUtil.h"
+
+class MeshAsset
+{
+public:
+    struct Stats
+    {
+        UINT    Meshes;
+        UINT    References;
+        UINT    GpuBytes;       // vertex and index buffers
+        UINT    CpuBytes;       // positions, indices and clusters for picking
+        UINT    UnsharedBytes;  // buffers plus full vertex and index copies per reference
+    };
+
+public:
+    // The mesh registered under 'name' with a new reference, or null.
+    static MeshAsset*   Find(const std::wstring& name);
+
+    // Builds a mesh with one reference and registers it under 'name' unless the
+    // name is empty.  VertexT starts with an XMFLOAT3 Pos, like the types in
+    // Vertex.h.  Without a device only the CPU side is built.
+    template <typename VertexT>
+    static MeshAsset*   Create(ID3D11Device* device, const std::wstring& name,
+                            const std::vector<VertexT>& vertices, const std::vector<UINT>& indices,
+                            D3D11_PRIMITIVE_TOPOLOGY topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST)
+    {
+        std::vector<XMFLOAT3> positions(vertices.size());
+        for (size_t i = 0; i < vertices.size(); ++i)
+            positions[i] = vertices[i].Pos;
+
+        MeshAsset* mesh = new MeshAsset(name, topology);
+        mesh->Build(device, &vertices[0], sizeof(VertexT), positions, indices);
+        return mesh;
+    }
+
+    void        AddRef()                    { ++m_References; }
+    void        Release();
+
+    // Sets the vertex and index buffers and the topology; the input layout is the caller's.
+    void        Bind(ID3D11DeviceContext* context) const;
+
+    UINT                        GetIndexCount() const   { return m_IndexCount; }
+    const XNA::AxisAlignedBox&  GetBounds() const       { return m_Bounds; }
+
+    // Nearest triangle the mesh space ray hits closer than 'tmin'; updates
+    // 'tmin' and 'triangle' and returns true when there is one.
+    bool        IntersectRay(FXMVECTOR origin, FXMVECTOR dir, float& tmin, UINT& triangle) const;
+
+    static Stats    GetStats();
+
+    // Compares the clustered ray test with testing every triangle.  Returns the
+    // number of mismatches.
+    static UINT     SelfTest();
+
+public:
+    MeshAsset(const MeshAsset& rhs)             = delete;
+    MeshAsset& operator=(const MeshAsset& rhs)  = delete;
+
+private:
+    static const UINT ClusterSize = 64;     // triangles
+
+    struct Cluster
+    {
+        XNA::AxisAlignedBox Box;
+        UINT                FirstTriangle;
+        UINT                TriangleCount;
+    };
+
+    MeshAsset(const std::wstring& name, D3D11_PRIMITIVE_TOPOLOGY topology);
+    ~MeshAsset();
+
+    void    Build(ID3D11Device* device, const void* vertices, UINT vertexStride,
+                std::vector<XMFLOAT3>& positions, const std::vector<UINT>& indices);
+
+private:
+    std::wstring                m_Name;
+    UINT                        m_References;
+
+    ID3D11Buffer*               m_VertexBuffer;
+    ID3D11Buffer*               m_IndexBuffer;
+    UINT                        m_VertexStride;
+    UINT                        m_VertexCount;
+    UINT                        m_IndexCount;
+    DXGI_FORMAT                 m_IndexFormat;      // 16 bit while the vertices fit
+    D3D11_PRIMITIVE_TOPOLOGY    m_Topology;
+
+    std::vector<XMFLOAT3>       m_Positions;
+    std::vector<UINT>           m_Indices;          // triangle lists only
+    std::vector<Cluster>        m_Clusters;
+    XNA::AxisAlignedBox         m_Bounds;
+};
+
+#endif // MESHASSET_H
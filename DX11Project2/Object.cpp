@@ -1,30 +1,24 @@
 #include "Object.h"
 #include "Effects.h"
 #include "RenderStates.h"
+#include "ViewContext.h"
+#include "TextureArrays.h"
 
 Object* Object::m_PickedObject = nullptr;
 
 Object::Object()
-:   m_VertexBuffer(nullptr),
-    m_IndexBuffer(nullptr),
-    m_VertexOffset(0),
-    m_IndexOffset(0),
-    m_IndexCount(0),
+:   m_Mesh(nullptr),
     m_PickedTriangle(-1),
-    m_DiffuseMapSRV(nullptr),
+    m_Handle(SceneStore::getInstance()->Create()),
+    m_DiffuseMap(TextureArrays::InvalidHandle),
     m_Effect(nullptr),
     m_Tech(nullptr)
 {
-    XMMATRIX I = XMMatrixIdentity();
-    XMStoreFloat4x4(&m_World, I);
-    XMStoreFloat4x4(&m_TexTransform, I);
-
-    m_MeshBox.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
-    m_MeshBox.Extents = XMFLOAT3(0.0f, 0.0f, 0.0f);
-    
-    m_Mat.Ambient = XMFLOAT4(0.5f, 0.5f, 0.5f, 1.0f);
-    m_Mat.Diffuse = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
-    m_Mat.Specular = XMFLOAT4(0.6f, 0.6f, 0.6f, 16.0f);
+    Material mat;
+    mat.Ambient = XMFLOAT4(0.5f, 0.5f, 0.5f, 1.0f);
+    mat.Diffuse = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+    mat.Specular = XMFLOAT4(0.6f, 0.6f, 0.6f, 16.0f);
+    SetMaterial(mat);
 
     m_PickedTriangleMat.Ambient = XMFLOAT4(0.0f, 0.8f, 0.4f, 1.0f);
     m_PickedTriangleMat.Diffuse = XMFLOAT4(0.0f, 0.8f, 0.4f, 1.0f);
@@ -35,13 +29,12 @@ Object::Object()
 Object::~Object()
 {
     Release();
+    SceneStore::getInstance()->Destroy(m_Handle);
 }
 
 void Object::Release()
 {
-    ReleaseCOM(m_DiffuseMapSRV);
-    ReleaseCOM(m_IndexBuffer);
-    ReleaseCOM(m_VertexBuffer);
+    ReleaseCOM(m_Mesh);
 }
 
 void Object::Update(float dt)
@@ -57,62 +50,132 @@ void Object::Render(ID3D11DeviceContext* context, CXMMATRIX viewProj)
     for (UINT p = 0; p < techDesc.Passes; ++p)
     {
         m_Tech->GetPassByIndex(p)->Apply(0, context);
-        context->DrawIndexed(m_IndexCount, m_IndexOffset, m_VertexOffset);
+        DrawMesh(context);
 
         if (this == m_PickedObject)
-        {
-            context->OMSetDepthStencilState(RenderStates::LessEqualDSS, 0);
-            Effects::BasicFX->SetMaterial(m_PickedTriangleMat);
-            m_Tech->GetPassByIndex(p)->Apply(0, context);
-            context->DrawIndexed(3, 3 * m_PickedTriangle, 0);
-            context->OMSetDepthStencilState(0, 0);
-        }
+            DrawPickedTriangle(context, viewProj, m_Tech->GetPassByIndex(p));
+    }
+}
+
+Object::BatchKey Object::GetBatchKey() const
+{
+    BatchKey key = { nullptr, 0, 0 };
+    return key;
+}
+
+void Object::RenderBatch(ID3D11DeviceContext* context, CXMMATRIX viewProj, Object* const* objects, UINT count, UINT offset)
+{
+    BatchKey key = objects[0]->GetBatchKey();
+    key.Mesh->Bind(context);
+    context->IASetInputLayout(InputLayouts::Basic32);
+
+    Effects::BasicFX->BindInstances(context, offset, objects[0]);
+    ID3DX11EffectTechnique* tech = Effects::BasicFX->SelectTech(key.Features);
+
+    D3DX11_TECHNIQUE_DESC techDesc;
+    tech->GetDesc(&techDesc);
+    for (UINT p = 0; p < techDesc.Passes; ++p)
+    {
+        tech->GetPassByIndex(p)->Apply(0, context);
+        context->DrawIndexedInstanced(key.Mesh->GetIndexCount(), count, 0, 0, 0);
+    }
+
+    // The highlight rebinds the ring at its own block, so it goes after every pass.
+    for (UINT i = 0; i < count; ++i)
+    {
+        if (objects[i] != m_PickedObject)
+            continue;
+        for (UINT p = 0; p < techDesc.Passes; ++p)
+            objects[i]->DrawPickedTriangle(context, viewProj, tech->GetPassByIndex(p));
     }
 }
 
-void Object::Pick(int sx, int sy, int cw, int ch, CXMMATRIX V, CXMMATRIX P, float& tmin)
+void Object::DrawPickedTriangle(ID3D11DeviceContext* context, CXMMATRIX viewProj, ID3DX11EffectPass* pass)
 {
-    float vx = (+2.0f*sx / cw - 1.0f) / P(0, 0);
-    float vy = (-2.0f*sy / ch + 1.0f) / P(1, 1);
+    // DrawMesh may have bound other buffers.
+    m_Mesh->Bind(context);
+    context->OMSetDepthStencilState(RenderStates::LessEqualDSS, 0);
+    Effects::BasicFX->UpdatePerObject(context, viewProj, this, m_PickedTriangleMat);
+    pass->Apply(0, context);
+    context->DrawIndexed(3, 3 * m_PickedTriangle, 0);
+    context->OMSetDepthStencilState(0, 0);
+}
 
-    XMVECTOR rayOrigin = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-    XMVECTOR rayDir = XMVectorSet(vx, vy, 1.0f, 0.0f);
+void Object::RenderDepth(ID3D11DeviceContext* context, CXMMATRIX lightViewProj)
+{
+    m_Effect->UpdateCb(context, lightViewProj, this);
+
+    D3DX11_TECHNIQUE_DESC techDesc;
+    m_Tech->GetDesc(&techDesc);
+    for (UINT p = 0; p < techDesc.Passes; ++p)
+    {
+        m_Tech->GetPassByIndex(p)->Apply(0, context);
+        DrawMesh(context);
+    }
+}
 
-    XMMATRIX W = XMLoadFloat4x4(&m_World);
-    XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(V), V);
-    XMMATRIX invWorld = XMMatrixInverse(&XMMatrixDeterminant(W), W);
-    XMMATRIX toLocal = XMMatrixMultiply(invView, invWorld);
+void Object::DrawMesh(ID3D11DeviceContext* context)
+{
+    context->DrawIndexed(m_Mesh->GetIndexCount(), 0, 0);
+}
 
-    rayOrigin = XMVector3TransformCoord(rayOrigin, toLocal);
-    rayDir = XMVector3TransformNormal(rayDir, toLocal);
+void Object::SetTransform(FXMVECTOR scale, FXMVECTOR rotation, FXMVECTOR translation)
+{
+    SceneStore::getInstance()->SetTransform(m_Handle, scale, rotation, translation);
+}
+
+void Object::SetParent(Object* parent)
+{
+    SceneStore::getInstance()->SetParent(m_Handle, parent ? parent->m_Handle : SceneStore::InvalidHandle);
+}
+
+void Object::SetDiffuseMap(const std::wstring& filename)
+{
+    m_DiffuseMap = TextureArrays::getInstance()->Add(filename);
+}
+
+void Object::SetMeshBox(const XNA::AxisAlignedBox& box)
+{
+    SceneStore::getInstance()->SetLocalBounds(m_Handle, box);
+}
+
+void Object::SetTexTransform(CXMMATRIX M)
+{
+    SceneStore::getInstance()->SetTexTransform(m_Handle, M);
+}
+
+void Object::SetMaterial(const Material& mat)
+{
+    SceneStore::getInstance()->SetMaterial(m_Handle, mat);
+}
+
+void Object::SetCastsShadow(bool castsShadow)
+{
+    SceneStore::getInstance()->SetFlag(m_Handle, SceneStore::CastsShadow, castsShadow);
+}
+
+void Object::SetOccluder(bool occluder)
+{
+    SceneStore::getInstance()->SetFlag(m_Handle, SceneStore::Occluder, occluder);
+}
+
+void Object::Pick(const ViewContext& view, float& tmin)
+{
+    XMMATRIX invWorld = SceneStore::getInstance()->GetInvWorld(m_Handle);
+
+    XMVECTOR rayOrigin = XMVector3TransformCoord(view.GetPickRayOrigin(), invWorld);
+    XMVECTOR rayDir = XMVector3TransformNormal(view.GetPickRayDir(), invWorld);
     rayDir = XMVector3Normalize(rayDir);
 
     m_PickedTriangle = -1;
     float t = 0.0f;
-    if (XNA::IntersectRayAxisAlignedBox(rayOrigin, rayDir, &m_MeshBox, &t))
+    if (!m_Mesh || !XNA::IntersectRayAxisAlignedBox(rayOrigin, rayDir, &GetMeshBox(), &t) || t > tmin)
+        return;
+
+    UINT triangle = 0;
+    if (m_Mesh->IntersectRay(rayOrigin, rayDir, tmin, triangle))
     {
-        if (t > tmin)
-            return;
-
-        for (UINT i = 0; i < m_MeshIndices.size() / 3; ++i)
-        {
-            UINT i0 = m_MeshIndices[i * 3 + 0];
-            UINT i1 = m_MeshIndices[i * 3 + 1];
-            UINT i2 = m_MeshIndices[i * 3 + 2];
-
-            XMVECTOR v0 = XMLoadFloat3(&m_MeshVertices[i0].Pos);
-            XMVECTOR v1 = XMLoadFloat3(&m_MeshVertices[i1].Pos);
-            XMVECTOR v2 = XMLoadFloat3(&m_MeshVertices[i2].Pos);
-
-            if (XNA::IntersectRayTriangle(rayOrigin, rayDir, v0, v1, v2, &t))
-            {
-                if (t < tmin)
-                {
-                    tmin = t;
-                    m_PickedTriangle = i;
-                    m_PickedObject = this;
-                }
-            }
-        }
+        m_PickedTriangle = triangle;
+        m_PickedObject = this;
     }
 }
@@ -1,25 +1,71 @@
 #pragma once
 #include "d3dUtil.h"
 #include "Vertex.h"
+#include "SceneStore.h"
+#include "MeshAsset.h"
 class Effect;
+class ViewContext;
 
 class Object
 {
+public:
+    // Objects drawn by BasicFX with the Basic32 layout can share one instanced
+    // draw when their keys are equal: same mesh, technique and diffuse array.
+    // The per-draw block carries the rest, the diffuse slice included.  A null
+    // mesh keeps the object out of batches.
+    struct BatchKey
+    {
+        const MeshAsset*    Mesh;
+        UINT                Features;   // BasicFeatures
+        UINT                Array;      // of the diffuse map, see TextureArrays
+
+        bool operator==(const BatchKey& rhs) const
+        {
+            return Mesh == rhs.Mesh && Features == rhs.Features && Array == rhs.Array;
+        }
+        // Keys without a mesh come first.
+        bool operator<(const BatchKey& rhs) const
+        {
+            if (!Mesh != !rhs.Mesh)
+                return !Mesh;
+            if (Mesh != rhs.Mesh)
+                return std::less<const MeshAsset*>()(Mesh, rhs.Mesh);
+            if (Features != rhs.Features)
+                return Features < rhs.Features;
+            return Array < rhs.Array;
+        }
+    };
+
+    // Objects per upload of per-draw blocks, to keep one upload a modest share
+    // of the ring; a batch never spans two uploads.
+    static const UINT MaxBatchSize = 1024;
+
 public:
     Object();
     virtual ~Object();
 
-    int                         GetVertexOffset() const { return m_VertexOffset; }
-    UINT                        GetIndexOffset() const  { return m_IndexOffset; }
-    UINT                        GetIndexCount() const   { return m_IndexCount; }
-    XMMATRIX                    GetWorldMatrix() const  { return XMLoadFloat4x4(&m_World); }
-    XMMATRIX                    GetTexTransform() const { return XMLoadFloat4x4(&m_TexTransform); }
-    ID3D11ShaderResourceView*   GetSRV() const          { return m_DiffuseMapSRV; }
-    Material                    GetMaterial() const     { return m_Mat; }
+    const MeshAsset*            GetMesh() const         { return m_Mesh; }
+    UINT                        GetDiffuseMap() const   { return m_DiffuseMap; }  // TextureArrays handle
+    SceneStore::Handle          GetHandle() const       { return m_Handle; }
+
+    // The rest lives in the scene store.
+    XMMATRIX                    GetWorldMatrix() const  { return SceneStore::getInstance()->GetWorld(m_Handle); }
+    XMMATRIX                    GetTexTransform() const { return SceneStore::getInstance()->GetTexTransform(m_Handle); }
+    Material                    GetMaterial() const     { return SceneStore::getInstance()->GetMaterial(m_Handle); }
+    bool                        CastsShadow() const     { return SceneStore::getInstance()->HasFlag(m_Handle, SceneStore::CastsShadow); }
+    bool                        IsOccluder() const      { return SceneStore::getInstance()->HasFlag(m_Handle, SceneStore::Occluder); }
+    const XNA::AxisAlignedBox&  GetMeshBox() const      { return SceneStore::getInstance()->GetLocalBounds(m_Handle); }
+
+    // Box around the mesh box after the world transform.
+    const XNA::AxisAlignedBox&  GetWorldBounds() const  { return SceneStore::getInstance()->GetWorldBounds(m_Handle); }
+
+    // Makes this object's transform relative to 'parent', or to the world for null.
+    void                        SetParent(Object* parent);
 
     static void InitPickedObject() { m_PickedObject = nullptr; }
 
-    void Pick(int sx, int sy, int cw, int ch, CXMMATRIX V, CXMMATRIX P, float& tmin);
+    // Tests the view's pick ray against the mesh; tmin is the nearest hit so far.
+    void Pick(const ViewContext& view, float& tmin);
     void ChangeEffectAndTech(Effect* effect, ID3DX11EffectTechnique* tech)
     {
         if (!effect || !tech) return;
@@ -32,26 +78,48 @@ public:
     virtual void    Update(float dt);
     virtual void    Render(ID3D11DeviceContext* context, CXMMATRIX viewProj);
 
+    // Draws depth only into the bound shadow map.  Objects that cast shadows override this.
+    virtual void    RenderShadow(ID3D11DeviceContext* context, CXMMATRIX lightViewProj) {}
+
+    virtual BatchKey    GetBatchKey() const;
+
+    // Draws 'count' objects with equal keys as one instanced draw per pass, their
+    // blocks uploaded by BasicEffect::UploadInstances at 'offset'.
+    static void     RenderBatch(ID3D11DeviceContext* context, CXMMATRIX viewProj, Object* const* objects, UINT count, UINT offset);
+
 protected:
     virtual void    CreateBuffer(ID3D11Device* device) = 0;
 
+    // Sets the transform of the current tick, relative to the parent; SceneStore::Interpolate
+    // makes the world matrix.
+    void            SetTransform(FXMVECTOR scale, FXMVECTOR rotation, FXMVECTOR translation);
+
+    // Registers the file with TextureArrays; the arrays are built after every Init.
+    void            SetDiffuseMap(const std::wstring& filename);
+
+    void            SetMeshBox(const XNA::AxisAlignedBox& box);
+    void            SetTexTransform(CXMMATRIX M);
+    void            SetMaterial(const Material& mat);
+    void            SetCastsShadow(bool castsShadow);
+    void            SetOccluder(bool occluder);
+
+    // Object::Render without the picked triangle highlight.
+    void            RenderDepth(ID3D11DeviceContext* context, CXMMATRIX lightViewProj);
+
+    // Issues the draws of one pass; the mesh is bound and the pass applied.
+    virtual void    DrawMesh(ID3D11DeviceContext* context);
+
+private:
+    // Draws the picked triangle over the object with 'pass' of its technique.
+    void            DrawPickedTriangle(ID3D11DeviceContext* context, CXMMATRIX viewProj, ID3DX11EffectPass* pass);
+
 protected:
-    ID3D11Buffer*                   m_VertexBuffer;
-    ID3D11Buffer*                   m_IndexBuffer;
-    int                             m_VertexOffset;
-    UINT                            m_IndexOffset;
-    UINT                            m_IndexCount;
+    MeshAsset*                      m_Mesh;
     UINT                            m_PickedTriangle;
     static Object*                  m_PickedObject;
 
-    std::vector<Vertex::Basic32>    m_MeshVertices;
-    std::vector<UINT>               m_MeshIndices;
-    XNA::AxisAlignedBox             m_MeshBox;
-
-    XMFLOAT4X4                      m_World;
-    XMFLOAT4X4                      m_TexTransform;
-    ID3D11ShaderResourceView*       m_DiffuseMapSRV;
-    Material                        m_Mat;
+    SceneStore::Handle              m_Handle;
+    UINT                            m_DiffuseMap;
     Material                        m_PickedTriangleMat;
 
     Effect*                         m_Effect;
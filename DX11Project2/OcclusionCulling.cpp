@@ -0,0 +1,640 @@
+//***************************************************************************************
+// OcclusionCulling.cpp
+//***************************************************************************************
+
+#include "OcclusionCulling.h"
+#include "Random.h"
+#include "GameTimer.h"
+#include <ppl.h>
+
+namespace
+{
+    // Corner k of a box, with bit 0/1/2 selecting +x/+y/+z.
+    XMVECTOR BoxCorner(FXMVECTOR center, FXMVECTOR extents, UINT k)
+    {
+        XMVECTOR sign = XMVectorSet((k & 1) ? 1.0f : -1.0f, (k & 2) ? 1.0f : -1.0f, (k & 4) ? 1.0f : -1.0f, 0.0f);
+        return XMVectorMultiplyAdd(sign, extents, center);
+    }
+}
+
+OcclusionCulling::OcclusionCulling()
+:   m_Corners(TilesY * (TileHeight + 1) * CornerPitch, MathHelper::Infinity),
+    m_Depth(Width * Height, MathHelper::Infinity)
+{
+    XMStoreFloat4x4(&m_ViewProj, XMMatrixIdentity());
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+    for (UINT i = 0; i < TilesX * TilesY; ++i)
+    {
+        m_TileMaxDepth[i] = MathHelper::Infinity;
+    }
+}
+
+OcclusionCulling::~OcclusionCulling()
+{
+}
+
+void OcclusionCulling::SetStaticOccluder(const std::vector<XMFLOAT3>& vertices, const std::vector<UINT>& indices)
+{
+    m_StaticVertices = vertices;
+    m_StaticIndices = indices;
+    m_ClipVertices.resize(vertices.size());
+}
+
+void OcclusionCulling::BeginFrame(CXMMATRIX viewProj)
+{
+    XMStoreFloat4x4(&m_ViewProj, viewProj);
+
+    m_Triangles.clear();
+    for (UINT row = 0; row < TilesY; ++row)
+    {
+        m_RowBins[row].clear();
+    }
+    std::fill(m_Depth.begin(), m_Depth.end(), MathHelper::Infinity);
+
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+void OcclusionCulling::AddOccluderBox(const XNA::AxisAlignedBox& localBox, CXMMATRIX world)
+{
+    // Corner indices of the 12 box triangles; winding does not matter.
+    static const UINT boxIndices[36] =
+    {
+        0, 2, 3,  0, 3, 1,     // -z
+        4, 5, 7,  4, 7, 6,     // +z
+        0, 4, 6,  0, 6, 2,     // -x
+        1, 3, 7,  1, 7, 5,     // +x
+        0, 1, 5,  0, 5, 4,     // -y
+        2, 6, 7,  2, 7, 3,     // +y
+    };
+
+    XMMATRIX worldViewProj = XMMatrixMultiply(world, XMLoadFloat4x4(&m_ViewProj));
+    XMVECTOR center = XMLoadFloat3(&localBox.Center);
+    XMVECTOR extents = XMLoadFloat3(&localBox.Extents);
+
+    XMVECTOR corners[8];
+    for (UINT k = 0; k < 8; ++k)
+    {
+        corners[k] = XMVector3Transform(BoxCorner(center, extents, k), worldViewProj);
+    }
+    for (UINT i = 0; i < 36; i += 3)
+    {
+        AddTriangle(corners[boxIndices[i]], corners[boxIndices[i + 1]], corners[boxIndices[i + 2]]);
+    }
+}
+
+#pragma region Setup
+void OcclusionCulling::AddTriangle(FXMVECTOR v0, FXMVECTOR v1, FXMVECTOR v2)
+{
+    XMFLOAT4 in[3];
+    XMStoreFloat4(&in[0], v0);
+    XMStoreFloat4(&in[1], v1);
+    XMStoreFloat4(&in[2], v2);
+
+    // Trivially reject triangles completely outside one side of the frustum.
+    if ((in[0].x > in[0].w && in[1].x > in[1].w && in[2].x > in[2].w) ||
+        (in[0].x < -in[0].w && in[1].x < -in[1].w && in[2].x < -in[2].w) ||
+        (in[0].y > in[0].w && in[1].y > in[1].w && in[2].y > in[2].w) ||
+        (in[0].y < -in[0].w && in[1].y < -in[1].w && in[2].y < -in[2].w) ||
+        (in[0].z < 0.0f && in[1].z < 0.0f && in[2].z < 0.0f))
+        return;
+
+    // Clip against the near plane (z >= 0); the other planes are handled by
+    // clamping the bounding rectangle to the screen.
+    XMFLOAT4 out[4];
+    UINT count = 0;
+    for (UINT i = 0; i < 3; ++i)
+    {
+        const XMFLOAT4& a = in[i];
+        const XMFLOAT4& b = in[(i + 1) % 3];
+        if (a.z >= 0.0f)
+            out[count++] = a;
+        if ((a.z >= 0.0f) != (b.z >= 0.0f))
+        {
+            float t = a.z / (a.z - b.z);
+            out[count++] = XMFLOAT4(a.x + t*(b.x - a.x), a.y + t*(b.y - a.y), 0.0f, a.w + t*(b.w - a.w));
+        }
+    }
+
+    for (UINT i = 1; i + 1 < count; ++i)
+    {
+        SetupTriangle(out[0], out[i], out[i + 1]);
+    }
+}
+
+void OcclusionCulling::SetupTriangle(const XMFLOAT4& v0, const XMFLOAT4& v1, const XMFLOAT4& v2)
+{
+    // To pixel coordinates, y down like the back buffer.
+    float x[3], y[3], z[3];
+    const XMFLOAT4* v[3] = { &v0, &v1, &v2 };
+    for (UINT i = 0; i < 3; ++i)
+    {
+        float invW = 1.0f / v[i]->w;
+        x[i] = (0.5f + 0.5f*v[i]->x*invW) * Width;
+        y[i] = (0.5f - 0.5f*v[i]->y*invW) * Height;
+        z[i] = v[i]->z*invW;
+    }
+
+    float area = (x[1] - x[0])*(y[2] - y[0]) - (x[2] - x[0])*(y[1] - y[0]);
+    if (fabsf(area) < 1e-6f)
+        return;
+
+    // No back face culling; flip clockwise triangles instead.
+    if (area < 0.0f)
+    {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(z[1], z[2]);
+        area = -area;
+    }
+
+    // Pixel corners sit on whole coordinates, from 0 to Width and Height.
+    float minX = MathHelper::Max(ceilf(MathHelper::Min(x[0], MathHelper::Min(x[1], x[2]))), 0.0f);
+    float maxX = MathHelper::Min(floorf(MathHelper::Max(x[0], MathHelper::Max(x[1], x[2]))), (float)Width);
+    float minY = MathHelper::Max(ceilf(MathHelper::Min(y[0], MathHelper::Min(y[1], y[2]))), 0.0f);
+    float maxY = MathHelper::Min(floorf(MathHelper::Max(y[0], MathHelper::Max(y[1], y[2]))), (float)Height);
+    if (minX > maxX || minY > maxY)
+        return;
+
+    Triangle tri;
+    for (UINT i = 0; i < 3; ++i)
+    {
+        UINT j = (i + 1) % 3;
+        tri.A[i] = y[i] - y[j];
+        tri.B[i] = x[j] - x[i];
+        tri.C[i] = x[i]*y[j] - y[i]*x[j];
+    }
+
+    // z/w is linear in screen space.
+    tri.ZA = ((z[1] - z[0])*(y[2] - y[0]) - (z[2] - z[0])*(y[1] - y[0])) / area;
+    tri.ZB = ((z[2] - z[0])*(x[1] - x[0]) - (z[1] - z[0])*(x[2] - x[0])) / area;
+    tri.ZC = z[0] - tri.ZA*x[0] - tri.ZB*y[0];
+
+    tri.MinX = (int)minX;
+    tri.MaxX = (int)maxX;
+    tri.MinY = (int)minY;
+    tri.MaxY = (int)maxY;
+
+    m_Triangles.push_back(tri);
+    ++m_Stats.OccluderTriangles;
+}
+#pragma endregion
+
+#pragma region Rasterization
+void OcclusionCulling::Rasterize()
+{
+    double start = GameTimer::NowMs();
+
+    XMMATRIX viewProj = XMLoadFloat4x4(&m_ViewProj);
+    for (UINT i = 0; i < m_StaticVertices.size(); ++i)
+    {
+        XMStoreFloat4(&m_ClipVertices[i], XMVector3Transform(XMLoadFloat3(&m_StaticVertices[i]), viewProj));
+    }
+    for (UINT i = 0; i + 2 < m_StaticIndices.size(); i += 3)
+    {
+        AddTriangle(
+            XMLoadFloat4(&m_ClipVertices[m_StaticIndices[i]]),
+            XMLoadFloat4(&m_ClipVertices[m_StaticIndices[i + 1]]),
+            XMLoadFloat4(&m_ClipVertices[m_StaticIndices[i + 2]]));
+    }
+
+    // A row rasterizes the corner lines along both of its edges, so a
+    // triangle touching the line between two rows goes to both.
+    for (UINT t = 0; t < m_Triangles.size(); ++t)
+    {
+        int first = m_Triangles[t].MinY > 0 ? (m_Triangles[t].MinY - 1) / (int)TileHeight : 0;
+        int last = MathHelper::Min(m_Triangles[t].MaxY / (int)TileHeight, (int)TilesY - 1);
+        for (int row = first; row <= last; ++row)
+        {
+            m_RowBins[row].push_back(t);
+        }
+    }
+
+    // Rows own disjoint pixels and tiles, so they need no synchronization.
+    concurrency::parallel_for(0u, TilesY, [this](UINT row) { RasterizeRow(row); });
+
+    m_Stats.RasterMs = GameTimer::NowMs() - start;
+}
+
+void OcclusionCulling::RasterizeRow(UINT row)
+{
+    const int rowMinY = row * TileHeight;
+    const int rowMaxY = rowMinY + TileHeight - 1;
+
+    const XMVECTOR zero = XMVectorZero();
+    const XMVECTOR laneOffsets = XMVectorSet(0.0f, 1.0f, 2.0f, 3.0f);
+
+    // The row's own copy of the TileHeight + 1 corner lines around its pixels;
+    // the last one is the next row's first, rasterized again.
+    float* corners = &m_Corners[row * (TileHeight + 1) * CornerPitch];
+    std::fill(corners, corners + (TileHeight + 1) * CornerPitch, MathHelper::Infinity);
+
+    for (auto t : m_RowBins[row])
+    {
+        const Triangle& tri = m_Triangles[t];
+        int y0 = MathHelper::Max(tri.MinY, rowMinY);
+        int y1 = MathHelper::Min(tri.MaxY, rowMaxY + 1);
+        int x0 = tri.MinX & ~3;
+
+        XMVECTOR a0 = XMVectorReplicate(tri.A[0]);
+        XMVECTOR a1 = XMVectorReplicate(tri.A[1]);
+        XMVECTOR a2 = XMVectorReplicate(tri.A[2]);
+        XMVECTOR za = XMVectorReplicate(tri.ZA);
+        XMVECTOR first = XMVectorReplicate((float)tri.MinX);
+        XMVECTOR last = XMVectorReplicate((float)tri.MaxX);
+
+        for (int y = y0; y <= y1; ++y)
+        {
+            float py = (float)y;
+            XMVECTOR c0 = XMVectorReplicate(tri.B[0]*py + tri.C[0]);
+            XMVECTOR c1 = XMVectorReplicate(tri.B[1]*py + tri.C[1]);
+            XMVECTOR c2 = XMVectorReplicate(tri.B[2]*py + tri.C[2]);
+            XMVECTOR zc = XMVectorReplicate(tri.ZB*py + tri.ZC);
+
+            float* line = &corners[(y - rowMinY) * CornerPitch];
+            for (int x = x0; x <= tri.MaxX; x += 4)
+            {
+                XMVECTOR px = XMVectorAdd(XMVectorReplicate((float)x), laneOffsets);
+
+                // Lanes outside the bounding rectangle are masked like the reference does.
+                XMVECTOR inside = XMVectorAndInt(
+                    XMVectorAndInt(XMVectorGreaterOrEqual(px, first), XMVectorLessOrEqual(px, last)),
+                    XMVectorAndInt(
+                        XMVectorGreaterOrEqual(XMVectorMultiplyAdd(a0, px, c0), zero),
+                        XMVectorGreaterOrEqual(XMVectorMultiplyAdd(a1, px, c1), zero)));
+                inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(XMVectorMultiplyAdd(a2, px, c2), zero));
+
+                XMVECTOR z = XMVectorMultiplyAdd(za, px, zc);
+                XMVECTOR depth = XMLoadFloat4(reinterpret_cast<XMFLOAT4*>(&line[x]));
+                XMVECTOR write = XMVectorAndInt(inside, XMVectorLess(z, depth));
+                XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&line[x]), XMVectorSelect(depth, z, write));
+            }
+        }
+    }
+
+    // A pixel takes the farthest of its four corners: it stays empty unless the
+    // occluders reach all of them, so no pixel claims coverage an occluder edge
+    // only crosses.
+    for (int y = rowMinY; y <= rowMaxY; ++y)
+    {
+        const float* top = &corners[(y - rowMinY) * CornerPitch];
+        const float* bottom = top + CornerPitch;
+        float* line = &m_Depth[y * Width];
+        for (UINT x = 0; x < Width; x += 4)
+        {
+            XMVECTOR left = XMVectorMax(
+                XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&top[x])),
+                XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&bottom[x])));
+            XMVECTOR right = XMVectorMax(
+                XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&top[x + 1])),
+                XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&bottom[x + 1])));
+            XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&line[x]), XMVectorMax(left, right));
+        }
+    }
+
+    // Farthest depth of every tile in the row, for whole tile acceptance.
+    for (UINT tx = 0; tx < TilesX; ++tx)
+    {
+        XMVECTOR vMax = XMVectorReplicate(-MathHelper::Infinity);
+        for (int y = rowMinY; y <= rowMaxY; ++y)
+        {
+            const float* line = &m_Depth[y * Width + tx * TileWidth];
+            for (UINT x = 0; x < TileWidth; x += 4)
+            {
+                vMax = XMVectorMax(vMax, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&line[x])));
+            }
+        }
+
+        XMFLOAT4 m;
+        XMStoreFloat4(&m, vMax);
+        m_TileMaxDepth[row * TilesX + tx] = MathHelper::Max(MathHelper::Max(m.x, m.y), MathHelper::Max(m.z, m.w));
+    }
+}
+#pragma endregion
+
+#pragma region Queries
+bool OcclusionCulling::GetScreenBounds(const XNA::AxisAlignedBox& worldBox, ScreenBounds& bounds) const
+{
+    XMMATRIX viewProj = XMLoadFloat4x4(&m_ViewProj);
+    XMVECTOR center = XMLoadFloat3(&worldBox.Center);
+    XMVECTOR extents = XMLoadFloat3(&worldBox.Extents);
+
+    XMVECTOR vMin = XMVectorReplicate(+MathHelper::Infinity);
+    XMVECTOR vMax = XMVectorReplicate(-MathHelper::Infinity);
+    for (UINT k = 0; k < 8; ++k)
+    {
+        XMVECTOR clip = XMVector3Transform(BoxCorner(center, extents, k), viewProj);
+
+        // Boxes reaching behind the near plane are always visible.
+        if (XMVectorGetZ(clip) < 0.0f)
+            return false;
+
+        XMVECTOR ndc = XMVectorDivide(clip, XMVectorSplatW(clip));
+        vMin = XMVectorMin(vMin, ndc);
+        vMax = XMVectorMax(vMax, ndc);
+    }
+
+    XMFLOAT3 ndcMin, ndcMax;
+    XMStoreFloat3(&ndcMin, vMin);
+    XMStoreFloat3(&ndcMax, vMax);
+
+    float minX = MathHelper::Max(floorf((0.5f + 0.5f*ndcMin.x) * Width), 0.0f);
+    float maxX = MathHelper::Min(floorf((0.5f + 0.5f*ndcMax.x) * Width), Width - 1.0f);
+    float minY = MathHelper::Max(floorf((0.5f - 0.5f*ndcMax.y) * Height), 0.0f);
+    float maxY = MathHelper::Min(floorf((0.5f - 0.5f*ndcMin.y) * Height), Height - 1.0f);
+    if (minX > maxX || minY > maxY)
+        return false;
+
+    bounds.MinX = (int)minX;
+    bounds.MaxX = (int)maxX;
+    bounds.MinY = (int)minY;
+    bounds.MaxY = (int)maxY;
+    bounds.MinZ = ndcMin.z;
+    return true;
+}
+
+bool OcclusionCulling::TestBounds(const ScreenBounds& bounds) const
+{
+    const XMVECTOR minZ = XMVectorReplicate(bounds.MinZ);
+    const XMVECTOR lanes = XMVectorSet(0.0f, 1.0f, 2.0f, 3.0f);
+    const XMVECTOR zero = XMVectorZero();
+
+    for (int ty = bounds.MinY / (int)TileHeight; ty <= bounds.MaxY / (int)TileHeight; ++ty)
+    {
+        for (int tx = bounds.MinX / (int)TileWidth; tx <= bounds.MaxX / (int)TileWidth; ++tx)
+        {
+            // Everything in the tile is in front of the box.
+            if (m_TileMaxDepth[ty * TilesX + tx] < bounds.MinZ)
+                continue;
+
+            int x0 = MathHelper::Max(bounds.MinX, tx * (int)TileWidth);
+            int x1 = MathHelper::Min(bounds.MaxX, (tx + 1) * (int)TileWidth - 1);
+            int y0 = MathHelper::Max(bounds.MinY, ty * (int)TileHeight);
+            int y1 = MathHelper::Min(bounds.MaxY, (ty + 1) * (int)TileHeight - 1);
+
+            XMVECTOR first = XMVectorReplicate((float)x0);
+            XMVECTOR last = XMVectorReplicate((float)x1);
+            for (int y = y0; y <= y1; ++y)
+            {
+                const float* line = &m_Depth[y * Width];
+                for (int x = x0 & ~3; x <= x1; x += 4)
+                {
+                    XMVECTOR px = XMVectorAdd(XMVectorReplicate((float)x), lanes);
+                    XMVECTOR inRect = XMVectorAndInt(XMVectorGreaterOrEqual(px, first), XMVectorLessOrEqual(px, last));
+                    XMVECTOR depth = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&line[x]));
+                    XMVECTOR visible = XMVectorAndInt(inRect, XMVectorGreaterOrEqual(depth, minZ));
+                    if (XMVector4NotEqualInt(visible, zero))
+                        return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool OcclusionCulling::IsOccluded(const XNA::AxisAlignedBox& worldBox)
+{
+    ++m_Stats.Tested;
+
+    ScreenBounds bounds;
+    if (!GetScreenBounds(worldBox, bounds) || !TestBounds(bounds))
+        return false;
+
+    ++m_Stats.Occluded;
+    return true;
+}
+#pragma endregion
+
+#pragma region Reference
+void OcclusionCulling::RasterizeReference(std::vector<float>& depth) const
+{
+    const UINT cornerPitch = Width + 1;
+    std::vector<float> corners(cornerPitch * (Height + 1), MathHelper::Infinity);
+
+    for (auto& tri : m_Triangles)
+    {
+        for (int y = tri.MinY; y <= tri.MaxY; ++y)
+        {
+            float py = (float)y;
+            for (int x = tri.MinX; x <= tri.MaxX; ++x)
+            {
+                float px = (float)x;
+
+                bool inside = true;
+                for (UINT i = 0; i < 3; ++i)
+                {
+                    inside = inside && (tri.A[i]*px + (tri.B[i]*py + tri.C[i]) >= 0.0f);
+                }
+
+                float z = tri.ZA*px + (tri.ZB*py + tri.ZC);
+                if (inside && z < corners[y * cornerPitch + x])
+                    corners[y * cornerPitch + x] = z;
+            }
+        }
+    }
+
+    depth.resize(Width * Height);
+    for (UINT y = 0; y < Height; ++y)
+    {
+        for (UINT x = 0; x < Width; ++x)
+        {
+            const float* c = &corners[y * cornerPitch + x];
+            depth[y * Width + x] = MathHelper::Max(
+                MathHelper::Max(c[0], c[1]),
+                MathHelper::Max(c[cornerPitch], c[cornerPitch + 1]));
+        }
+    }
+}
+
+bool OcclusionCulling::IsOccludedReference(const XNA::AxisAlignedBox& worldBox, const std::vector<float>& depth) const
+{
+    ScreenBounds bounds;
+    if (!GetScreenBounds(worldBox, bounds))
+        return false;
+
+    for (int y = bounds.MinY; y <= bounds.MaxY; ++y)
+    {
+        for (int x = bounds.MinX; x <= bounds.MaxX; ++x)
+        {
+            if (depth[y * Width + x] >= bounds.MinZ)
+                return false;
+        }
+    }
+    return true;
+}
+
+UINT OcclusionCulling::Validate(const std::vector<XNA::AxisAlignedBox>& boxes)
+{
+    UINT failures = 0;
+
+    std::vector<float> reference;
+    RasterizeReference(reference);
+    if (reference != m_Depth)
+        ++failures;
+
+    for (UINT ty = 0; ty < TilesY; ++ty)
+    {
+        for (UINT tx = 0; tx < TilesX; ++tx)
+        {
+            float maxDepth = -MathHelper::Infinity;
+            for (UINT y = ty * TileHeight; y < (ty + 1) * TileHeight; ++y)
+            {
+                for (UINT x = tx * TileWidth; x < (tx + 1) * TileWidth; ++x)
+                {
+                    maxDepth = MathHelper::Max(maxDepth, m_Depth[y * Width + x]);
+                }
+            }
+            if (maxDepth != m_TileMaxDepth[ty * TilesX + tx])
+                ++failures;
+        }
+    }
+
+    // The queries must not show up in the frame's stats.
+    Stats stats = m_Stats;
+    for (auto& box : boxes)
+    {
+        if (IsOccluded(box) != IsOccludedReference(box, reference))
+            ++failures;
+    }
+    m_Stats = stats;
+
+    return failures;
+}
+
+UINT OcclusionCulling::SelfTest()
+{
+    // Camera 10 units in front of a 4x4 wall at z = 0.
+    XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 0.0f, -10.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+    XMMATRIX proj = XMMatrixPerspectiveFovLH(0.25f*MathHelper::Pi, (float)Width / Height, 1.0f, 1000.0f);
+    XMMATRIX viewProj = XMMatrixMultiply(view, proj);
+
+    struct Case
+    {
+        XNA::AxisAlignedBox Box;
+        bool                Occluded;
+    };
+    Case cases[] =
+    {
+        { { XMFLOAT3(0.0f, 0.0f, 10.0f),  XMFLOAT3(0.5f, 0.5f, 0.5f) }, true  },    // right behind the wall
+        { { XMFLOAT3(0.0f, 0.0f, 10.0f),  XMFLOAT3(0.5f, 5.0f, 0.5f) }, false },    // sticks out above and below
+        { { XMFLOAT3(8.0f, 0.0f, 10.0f),  XMFLOAT3(0.5f, 0.5f, 0.5f) }, false },    // beside the wall
+        { { XMFLOAT3(0.0f, 0.0f, -5.0f),  XMFLOAT3(0.5f, 0.5f, 0.5f) }, false },    // in front of the wall
+        { { XMFLOAT3(0.0f, 0.0f, -10.0f), XMFLOAT3(0.5f, 0.5f, 0.5f) }, false },    // around the camera
+    };
+
+    std::vector<XNA::AxisAlignedBox> boxes;
+    for (auto& c : cases)
+    {
+        boxes.push_back(c.Box);
+    }
+
+    UINT failures = 0;
+
+    // Once with the wall as a static mesh and once as a per frame box.
+    for (UINT pass = 0; pass < 2; ++pass)
+    {
+        OcclusionCulling culling;
+        culling.BeginFrame(viewProj);
+        if (pass == 0)
+        {
+            std::vector<XMFLOAT3> vertices;
+            vertices.push_back(XMFLOAT3(-2.0f, -2.0f, 0.0f));
+            vertices.push_back(XMFLOAT3(-2.0f, +2.0f, 0.0f));
+            vertices.push_back(XMFLOAT3(+2.0f, +2.0f, 0.0f));
+            vertices.push_back(XMFLOAT3(+2.0f, -2.0f, 0.0f));
+
+            UINT quad[6] = { 0, 1, 2, 0, 2, 3 };
+            culling.SetStaticOccluder(vertices, std::vector<UINT>(quad, quad + 6));
+        }
+        else
+        {
+            XNA::AxisAlignedBox wall = { XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(2.0f, 2.0f, 0.1f) };
+            culling.AddOccluderBox(wall, XMMatrixIdentity());
+        }
+        culling.Rasterize();
+
+        for (auto& c : cases)
+        {
+            if (culling.IsOccluded(c.Box) != c.Occluded)
+                ++failures;
+        }
+        failures += culling.Validate(boxes);
+    }
+
+    // A wall whose right edge lies 0.8 of the way across pixel column 200, so
+    // the column's centre is covered but its right side is not.  A box behind
+    // it that reaches 0.15 pixels past the edge peeks through that sliver; one
+    // that stops in column 199 is hidden.
+    {
+        float sx = 1.0f / (tanf(0.125f*MathHelper::Pi) * Width / Height);
+        auto worldX = [sx](float pixelX, float distance) { return (2.0f*pixelX / Width - 1.0f) * distance / sx; };
+
+        float edge = worldX(200.8f, 10.0f);
+        std::vector<XMFLOAT3> vertices;
+        vertices.push_back(XMFLOAT3(-2.0f, -2.0f, 0.0f));
+        vertices.push_back(XMFLOAT3(-2.0f, +2.0f, 0.0f));
+        vertices.push_back(XMFLOAT3(edge, +2.0f, 0.0f));
+        vertices.push_back(XMFLOAT3(edge, -2.0f, 0.0f));
+        UINT quad[6] = { 0, 1, 2, 0, 2, 3 };
+
+        OcclusionCulling culling;
+        culling.SetStaticOccluder(vertices, std::vector<UINT>(quad, quad + 6));
+        culling.BeginFrame(viewProj);
+        culling.Rasterize();
+
+        // The near faces are 20 units from the camera and decide the screen bounds.
+        float peeking = worldX(200.95f, 20.0f);
+        float hidden = worldX(199.9f, 20.0f);
+        XNA::AxisAlignedBox peeker = { XMFLOAT3(0.5f*(peeking - 1.0f), 0.0f, 10.5f), XMFLOAT3(0.5f*(peeking + 1.0f), 1.0f, 0.5f) };
+        XNA::AxisAlignedBox hider = { XMFLOAT3(0.5f*(hidden - 1.0f), 0.0f, 10.5f), XMFLOAT3(0.5f*(hidden + 1.0f), 1.0f, 0.5f) };
+        if (culling.IsOccluded(peeker))
+            ++failures;
+        if (!culling.IsOccluded(hider))
+            ++failures;
+
+        std::vector<XNA::AxisAlignedBox> edgeBoxes;
+        edgeBoxes.push_back(peeker);
+        edgeBoxes.push_back(hider);
+        failures += culling.Validate(edgeBoxes);
+    }
+
+    // A bumpy grid like the terrain occluder, seen at a grazing angle, where
+    // many triangles share edges and corners.  The rasterizer and the queries
+    // have to agree with the reference everywhere.
+    {
+        const UINT n = 33;
+        Random random(31);
+        std::vector<XMFLOAT3> vertices(n * n);
+        for (UINT i = 0; i < n; ++i)
+        {
+            for (UINT j = 0; j < n; ++j)
+                vertices[i * n + j] = XMFLOAT3(4.0f*j - 64.0f, random.NextFloat(0.0f, 6.0f), 64.0f - 4.0f*i);
+        }
+        std::vector<UINT> indices;
+        for (UINT i = 0; i + 1 < n; ++i)
+        {
+            for (UINT j = 0; j + 1 < n; ++j)
+            {
+                UINT quad[6] = { i*n + j, i*n + j + 1, (i + 1)*n + j, (i + 1)*n + j, i*n + j + 1, (i + 1)*n + j + 1 };
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+        }
+
+        std::vector<XNA::AxisAlignedBox> scattered(200);
+        for (auto& box : scattered)
+        {
+            box.Center = XMFLOAT3(random.NextFloat(-64.0f, 64.0f), random.NextFloat(0.0f, 10.0f), random.NextFloat(-64.0f, 64.0f));
+            box.Extents = XMFLOAT3(random.NextFloat(0.2f, 3.0f), random.NextFloat(0.2f, 3.0f), random.NextFloat(0.2f, 3.0f));
+        }
+
+        XMMATRIX groundView = XMMatrixLookAtLH(XMVectorSet(-10.0f, 9.0f, -70.0f, 1.0f), XMVectorSet(10.0f, 2.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+        OcclusionCulling culling;
+        culling.SetStaticOccluder(vertices, indices);
+        culling.BeginFrame(XMMatrixMultiply(groundView, proj));
+        culling.AddOccluderBox(scattered[0], XMMatrixIdentity());
+        culling.Rasterize();
+        failures += culling.Validate(scattered);
+    }
+
+    return failures;
+}
+#pragma endregion
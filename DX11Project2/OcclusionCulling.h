@@ -0,0 +1,127 @@
+//***************************************************************************************
+// OcclusionCulling.h
+//
+// Software occlusion culling against a low resolution CPU depth buffer.
+//
+// Occluders are rasterized with the frame's view-projection into a Width x Height
+// depth buffer split into tiles.  Triangles are clipped against the near plane,
+// set up once and binned to tile rows; the rows are rasterized in parallel, four
+// samples at a time with XNA Math, and every tile keeps the farthest depth it
+// holds.  Occluders are sampled at the pixel corners and a pixel takes the
+// farthest of its four, so it only counts as covered when the occluders reach
+// every corner.  An occludee is tested with the nearest depth of its projected
+// bounds: it is occluded when every pixel under its screen rectangle is closer,
+// and whole tiles whose farthest depth is closer are accepted without looking
+// at their pixels.
+//
+// Occluders have to lie inside the objects they stand for (see
+// Terrain::BuildOccluder), otherwise the culling is not conservative.
+//***************************************************************************************
+
+#ifndef OCCLUSIONCULLING_H
+#define OCCLUSIONCULLING_H
+
+#include "d3dUtil.h"
+
+class OcclusionCulling
+{
+public:
+    static const UINT Width = 320;
+    static const UINT Height = 192;
+    static const UINT TileWidth = 32;
+    static const UINT TileHeight = 16;
+    static const UINT TilesX = Width / TileWidth;
+    static const UINT TilesY = Height / TileHeight;
+
+    // Corner samples per line: Width + 1, padded to whole groups of four.
+    static const UINT CornerPitch = Width + 4;
+
+    struct Stats
+    {
+        UINT    OccluderTriangles;  // after near plane clipping
+        UINT    Tested;
+        UINT    Occluded;
+        double  RasterMs;
+    };
+
+public:
+    OcclusionCulling();
+    ~OcclusionCulling();
+
+    // World space occluder drawn every frame, e.g. the terrain.
+    void    SetStaticOccluder(const std::vector<XMFLOAT3>& vertices, const std::vector<UINT>& indices);
+
+    // Clears the depth buffer and the per frame occluders.
+    void    BeginFrame(CXMMATRIX viewProj);
+
+    // Adds the solid box 'localBox' transformed by 'world' as an occluder for this frame.
+    void    AddOccluderBox(const XNA::AxisAlignedBox& localBox, CXMMATRIX world);
+
+    // Rasterizes the static and the per frame occluders.
+    void    Rasterize();
+
+    // True when 'worldBox' is completely hidden behind the rasterized occluders.
+    bool    IsOccluded(const XNA::AxisAlignedBox& worldBox);
+
+    // Scalar versions of Rasterize and IsOccluded: every triangle against every
+    // corner of its bounding rectangle, without tiles or threads.
+    void    RasterizeReference(std::vector<float>& depth) const;
+    bool    IsOccludedReference(const XNA::AxisAlignedBox& worldBox, const std::vector<float>& depth) const;
+
+    // Compares the rasterized buffer, the tile depths and the 'boxes' queries with
+    // the reference versions.  Returns the number of failed checks.
+    UINT    Validate(const std::vector<XNA::AxisAlignedBox>& boxes);
+
+    // Known answer checks on a small synthetic scene, including boxes peeking past
+    // an occluder edge by less than a pixel.  Returns the number of failed checks.
+    static UINT SelfTest();
+
+    const Stats&                GetStats() const    { return m_Stats; }
+    const std::vector<float>&   GetDepth() const    { return m_Depth; }
+
+public:
+    OcclusionCulling(const OcclusionCulling& rhs)               = delete;
+    OcclusionCulling& operator=(const OcclusionCulling& rhs)    = delete;
+
+private:
+    // Edge functions E(x, y) = A*x + B*y + C are >= 0 inside, depth is Z = ZA*x + ZB*y + ZC.
+    // The bounds are the range of pixel corners the triangle can cover.
+    struct Triangle
+    {
+        float   A[3], B[3], C[3];
+        float   ZA, ZB, ZC;
+        int     MinX, MaxX, MinY, MaxY;
+    };
+
+    // Screen rectangle and nearest depth of a box; false when the box reaches
+    // behind the near plane or lies off screen.
+    struct ScreenBounds
+    {
+        int     MinX, MaxX, MinY, MaxY;
+        float   MinZ;
+    };
+
+    void    AddTriangle(FXMVECTOR v0, FXMVECTOR v1, FXMVECTOR v2);
+    void    SetupTriangle(const XMFLOAT4& v0, const XMFLOAT4& v1, const XMFLOAT4& v2);
+    void    RasterizeRow(UINT row);
+    bool    GetScreenBounds(const XNA::AxisAlignedBox& worldBox, ScreenBounds& bounds) const;
+    bool    TestBounds(const ScreenBounds& bounds) const;
+
+private:
+    XMFLOAT4X4                      m_ViewProj;
+
+    std::vector<XMFLOAT3>           m_StaticVertices;
+    std::vector<UINT>               m_StaticIndices;
+    std::vector<XMFLOAT4>           m_ClipVertices;     // static occluder in clip space
+
+    std::vector<Triangle>           m_Triangles;
+    std::vector<UINT>               m_RowBins[TilesY];
+
+    std::vector<float>              m_Corners;          // TileHeight + 1 corner lines per tile row
+    std::vector<float>              m_Depth;
+    float                           m_TileMaxDepth[TilesX * TilesY];
+
+    Stats                           m_Stats;
+};
+
+#endif // OCCLUSIONCULLING_H
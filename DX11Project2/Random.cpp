@@ -0,0 +1,558 @@
+//***************************************************************************************
+// Random.cpp
+//***************************************************************************************
+
+#include "Random.h"
+#include "MathHelper.h"
+#include "GameTimer.h"
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <ppl.h>
+
+namespace
+{
+    const UINT64 DefaultSeed = 0x853c49e6748fea9bull;
+    const UINT64 Golden      = 0x9e3779b97f4a7c15ull;
+
+    // The splitmix64 finalizer: every bit of the input reaches every bit of the output.
+    UINT64 Mix64(UINT64 z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    float ToFloat(UINT x)
+    {
+        return (float)(x >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // The four lanes of a generator in registers for the length of a fill.
+#if defined(_XM_SSE_INTRINSICS_)
+    struct LaneState
+    {
+        explicit LaneState(const UINT (*state)[Random::Lanes])
+        {
+            for (UINT w = 0; w < 4; ++w)
+                S[w] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state[w]));
+        }
+
+        void Store(UINT (*state)[Random::Lanes]) const
+        {
+            for (UINT w = 0; w < 4; ++w)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(state[w]), S[w]);
+        }
+
+        // xoshiro128+ on every lane.
+        void Next(UINT* dest)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), _mm_add_epi32(S[0], S[3]));
+
+            __m128i t = _mm_slli_epi32(S[1], 9);
+            S[2] = _mm_xor_si128(S[2], S[0]);
+            S[3] = _mm_xor_si128(S[3], S[1]);
+            S[1] = _mm_xor_si128(S[1], S[2]);
+            S[0] = _mm_xor_si128(S[0], S[3]);
+            S[2] = _mm_xor_si128(S[2], t);
+            S[3] = _mm_or_si128(_mm_slli_epi32(S[3], 11), _mm_srli_epi32(S[3], 21));
+        }
+
+        __m128i S[4];
+    };
+#else
+    struct LaneState
+    {
+        explicit LaneState(const UINT (*state)[Random::Lanes])
+        {
+            memcpy(S, state, sizeof(S));
+        }
+
+        void Store(UINT (*state)[Random::Lanes]) const
+        {
+            memcpy(state, S, sizeof(S));
+        }
+
+        void Next(UINT* dest)
+        {
+            for (UINT l = 0; l < Random::Lanes; ++l)
+            {
+                dest[l] = S[0][l] + S[3][l];
+
+                UINT t = S[1][l] << 9;
+                S[2][l] ^= S[0][l];
+                S[3][l] ^= S[1][l];
+                S[1][l] ^= S[2][l];
+                S[0][l] ^= S[3][l];
+                S[2][l] ^= t;
+                S[3][l] = (S[3][l] << 11) | (S[3][l] >> 21);
+            }
+        }
+
+        UINT S[4][Random::Lanes];
+    };
+#endif
+
+    // Points on the unit sphere from u and v in [0, 1), four at a time: z even
+    // in [-1, 1) and the angle around z even make the points even over the
+    // sphere, with no draws thrown away as rejection sampling does.
+    void SphereFromUV(FXMVECTOR u, FXMVECTOR v, XMVECTOR& x, XMVECTOR& y, XMVECTOR& z)
+    {
+        const XMVECTOR one = XMVectorSplatOne();
+        z = XMVectorSubtract(XMVectorAdd(u, u), one);
+        XMVECTOR r = XMVectorSqrt(XMVectorMax(XMVectorNegativeMultiplySubtract(z, z, one), XMVectorZero()));
+
+        XMVECTOR s, c;
+        XMVectorSinCos(&s, &c, XMVectorMultiplyAdd(v, XMVectorReplicate(2.0f*XM_PI), XMVectorReplicate(-XM_PI)));
+        x = XMVectorMultiply(r, c);
+        y = XMVectorMultiply(r, s);
+    }
+
+    // Mirrors the points below the plane through the origin with normal 'n'.
+    void FlipToHemisphere(FXMVECTOR n, XMVECTOR& x, XMVECTOR& y, XMVECTOR& z)
+    {
+        XMVECTOR d = XMVectorMultiply(x, XMVectorSplatX(n));
+        d = XMVectorMultiplyAdd(y, XMVectorSplatY(n), d);
+        d = XMVectorMultiplyAdd(z, XMVectorSplatZ(n), d);
+
+        XMVECTOR below = XMVectorLess(d, XMVectorZero());
+        x = XMVectorSelect(x, XMVectorNegate(x), below);
+        y = XMVectorSelect(y, XMVectorNegate(y), below);
+        z = XMVectorSelect(z, XMVectorNegate(z), below);
+    }
+
+    XMVECTOR FirstLane(FXMVECTOR x, FXMVECTOR y, FXMVECTOR z)
+    {
+        return XMVectorSet(XMVectorGetX(x), XMVectorGetX(y), XMVectorGetX(z), 0.0f);
+    }
+
+    UINT64          g_Seed = DefaultSeed;
+    volatile LONG   g_NextStream = 0;
+
+    // __declspec(thread) takes no constructors, so each thread builds its
+    // generator in place on first use.  A Random needs no destructor.
+    __declspec(thread) BYTE     t_Storage[sizeof(Random)];
+    __declspec(thread) Random*  t_Random = nullptr;
+}
+
+#pragma region Generator
+Random::Random(UINT64 seed, UINT64 stream)
+{
+    Seed(seed, stream);
+}
+
+void Random::Seed(UINT64 seed, UINT64 stream)
+{
+    // Each lane's words come from splitmix64 started at a key of the seed and
+    // the stream.
+    UINT64 key = Mix64(seed + Golden) ^ Mix64(stream + 2 * Golden);
+    for (UINT l = 0; l < Lanes; ++l)
+    {
+        for (UINT w = 0; w < 4; w += 2)
+        {
+            key += Golden;
+            UINT64 bits = Mix64(key);
+            m_State[w][l] = (UINT)bits;
+            m_State[w + 1][l] = (UINT)(bits >> 32);
+        }
+
+        // xoshiro never leaves the all zero state.
+        if (!(m_State[0][l] | m_State[1][l] | m_State[2][l] | m_State[3][l]))
+            m_State[0][l] = 1;
+    }
+    m_Next = Lanes;
+}
+
+void Random::Step(UINT* dest)
+{
+    LaneState lanes(m_State);
+    lanes.Next(dest);
+    lanes.Store(m_State);
+}
+
+UINT Random::NextUInt()
+{
+    if (m_Next == Lanes)
+    {
+        Step(m_Buffer);
+        m_Next = 0;
+    }
+    return m_Buffer[m_Next++];
+}
+
+float Random::NextFloat()
+{
+    return ToFloat(NextUInt());
+}
+
+XMVECTOR Random::NextUnitVec3()
+{
+    float u = NextFloat();
+    float v = NextFloat();
+
+    XMVECTOR x, y, z;
+    SphereFromUV(XMVectorReplicate(u), XMVectorReplicate(v), x, y, z);
+    return FirstLane(x, y, z);
+}
+
+XMVECTOR Random::NextHemisphereUnitVec3(FXMVECTOR n)
+{
+    float u = NextFloat();
+    float v = NextFloat();
+
+    XMVECTOR x, y, z;
+    SphereFromUV(XMVectorReplicate(u), XMVectorReplicate(v), x, y, z);
+    FlipToHemisphere(n, x, y, z);
+    return FirstLane(x, y, z);
+}
+#pragma endregion
+
+#pragma region Fill
+void Random::FillUInts(UINT* dest, UINT count)
+{
+    // What is left of the last step, then whole steps straight into 'dest'.
+    for (; count > 0 && m_Next < Lanes; --count)
+        *dest++ = m_Buffer[m_Next++];
+
+    LaneState lanes(m_State);
+    for (; count >= Lanes; count -= Lanes, dest += Lanes)
+        lanes.Next(dest);
+
+    if (count > 0)
+    {
+        lanes.Next(m_Buffer);
+        m_Next = 0;
+        for (; count > 0; --count)
+            *dest++ = m_Buffer[m_Next++];
+    }
+    lanes.Store(m_State);
+}
+
+void Random::FillFloats(float* dest, UINT count, float a, float b)
+{
+    // The bits go into 'dest' and are converted where they are.
+    UINT* bits = reinterpret_cast<UINT*>(dest);
+    FillUInts(bits, count);
+
+    const float range = b - a;
+    UINT i = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+    const XMVECTOR scale = XMVectorReplicate(1.0f / 16777216.0f);
+    const XMVECTOR va = XMVectorReplicate(a);
+    const XMVECTOR vrange = XMVectorReplicate(range);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bits + i)), 8);
+        XMVECTOR f = _mm_mul_ps(_mm_cvtepi32_ps(v), scale);
+        _mm_storeu_ps(dest + i, _mm_add_ps(va, _mm_mul_ps(f, vrange)));
+    }
+#endif
+    for (; i < count; ++i)
+        dest[i] = a + ToFloat(bits[i])*range;
+}
+
+void Random::FillUnitVec3(XMFLOAT3* dest, UINT count)
+{
+    FillSpheres(dest, count, nullptr);
+}
+
+void Random::FillHemisphereUnitVec3(XMFLOAT3* dest, UINT count, FXMVECTOR n)
+{
+    XMVECTOR normal = n;
+    FillSpheres(dest, count, &normal);
+}
+
+void Random::FillSpheres(XMFLOAT3* dest, UINT count, const XMVECTOR* n)
+{
+    // u and v of point i are floats 2i and 2i + 1, as NextUnitVec3 draws them.
+    const UINT Chunk = 64;
+    XMFLOAT4A uv[Chunk / 2] = {};
+
+    for (UINT first = 0; first < count; first += Chunk)
+    {
+        UINT chunkCount = MathHelper::Min(Chunk, count - first);
+        FillFloats(&uv[0].x, 2 * chunkCount);
+
+        for (UINT i = 0; i < chunkCount; i += 4)
+        {
+            XMVECTOR a = XMLoadFloat4A(&uv[i / 2]);
+            XMVECTOR b = XMLoadFloat4A(&uv[i / 2 + 1]);
+            XMVECTOR u = XMVectorPermute(a, b, XMVectorPermuteControl(0, 2, 4, 6));
+            XMVECTOR v = XMVectorPermute(a, b, XMVectorPermuteControl(1, 3, 5, 7));
+
+            XMVECTOR x, y, z;
+            SphereFromUV(u, v, x, y, z);
+            if (n)
+                FlipToHemisphere(*n, x, y, z);
+
+            XMMATRIX M;
+            M.r[0] = x;
+            M.r[1] = y;
+            M.r[2] = z;
+            M.r[3] = XMVectorZero();
+            M = XMMatrixTranspose(M);
+
+            for (UINT k = 0; k < 4 && i + k < chunkCount; ++k)
+                XMStoreFloat3(&dest[first + i + k], M.r[k]);
+        }
+    }
+}
+#pragma endregion
+
+#pragma region Threads
+Random& Random::ForThread()
+{
+    if (!t_Random)
+        t_Random = new (t_Storage) Random(g_Seed, (UINT64)InterlockedIncrement(&g_NextStream));
+    return *t_Random;
+}
+
+void Random::SetGlobalSeed(UINT64 seed)
+{
+    g_Seed = seed;
+    g_NextStream = 0;
+    if (t_Random)
+        t_Random->Seed(g_Seed, (UINT64)InterlockedIncrement(&g_NextStream));
+}
+
+UINT64 Random::GetGlobalSeed()
+{
+    return g_Seed;
+}
+#pragma endregion
+
+#pragma region Tests
+namespace
+{
+    // xoshiro128+ one lane at a time, as written down by its authors.
+    UINT ReferenceNext(UINT* s)
+    {
+        const UINT result = s[0] + s[3];
+        const UINT t = s[1] << 9;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = (s[3] << 11) | (s[3] >> 21);
+        return result;
+    }
+
+    bool Near(const XMFLOAT3& a, FXMVECTOR b, float epsilon)
+    {
+        return XMVector3NearEqual(XMLoadFloat3(&a), b, XMVectorReplicate(epsilon)) != 0;
+    }
+}
+
+UINT Random::SelfTest()
+{
+    UINT failures = 0;
+
+    // The lanes against the reference, across a partial step and into NextUInt.
+    {
+        Random random(7, 3);
+        UINT lanes[Lanes][4];
+        for (UINT l = 0; l < Lanes; ++l)
+            for (UINT w = 0; w < 4; ++w)
+                lanes[l][w] = random.m_State[w][l];
+
+        std::vector<UINT> expected(112);
+        for (UINT k = 0; k < expected.size(); ++k)
+            expected[k] = ReferenceNext(lanes[k % Lanes]);
+
+        std::vector<UINT> values(103);
+        random.FillUInts(&values[0], (UINT)values.size());
+        for (UINT k = 0; k < expected.size(); ++k)
+        {
+            UINT value = k < values.size() ? values[k] : random.NextUInt();
+            if (value != expected[k])
+                ++failures;
+        }
+    }
+
+    // Fill gives what as many Next calls give, from any point in a step.
+    const XMVECTOR n = XMVector3Normalize(XMVectorSet(0.3f, 0.8f, -0.5f, 0.0f));
+    const UINT counts[] = { 0, 1, 3, 4, 5, 63, 64, 65, 130 };
+    for (UINT skip = 0; skip < 6; ++skip)
+    {
+        for (UINT count : counts)
+        {
+            Random fill(11, skip);
+            Random next(11, skip);
+            for (UINT i = 0; i < skip; ++i)
+            {
+                fill.NextUInt();
+                next.NextUInt();
+            }
+
+            std::vector<float> floats(count + 1, -7.0f);
+            fill.FillFloats(&floats[0], count, -2.0f, 3.0f);
+            for (UINT i = 0; i < count; ++i)
+                if (floats[i] != next.NextFloat(-2.0f, 3.0f) || floats[i] < -2.0f || floats[i] > 3.0f)
+                    ++failures;
+            if (floats[count] != -7.0f)
+                ++failures;
+
+            std::vector<XMFLOAT3> points(count + 1, XMFLOAT3(-7.0f, -7.0f, -7.0f));
+            fill.FillUnitVec3(&points[0], count);
+            for (UINT i = 0; i < count; ++i)
+                if (!Near(points[i], next.NextUnitVec3(), 1e-6f))
+                    ++failures;
+
+            fill.FillHemisphereUnitVec3(&points[0], count, n);
+            for (UINT i = 0; i < count; ++i)
+                if (!Near(points[i], next.NextHemisphereUnitVec3(n), 1e-6f))
+                    ++failures;
+            if (points[count].x != -7.0f)
+                ++failures;
+
+            if (fill.NextUInt() != next.NextUInt())
+                ++failures;
+        }
+    }
+
+    // Spread: even buckets, unit length, no bias on the sphere and a mean
+    // cosine of 1/2 on the hemisphere.
+    {
+        const UINT Count = 200000;
+        const UINT Buckets = 16;
+        Random random(42);
+
+        std::vector<float> floats(Count);
+        random.FillFloats(&floats[0], Count);
+        UINT buckets[Buckets] = {};
+        for (float f : floats)
+        {
+            if (f < 0.0f || f >= 1.0f)
+                ++failures;
+            else
+                ++buckets[(UINT)(f * Buckets)];
+        }
+        for (UINT b = 0; b < Buckets; ++b)
+            if (fabs((float)buckets[b] - (float)Count / Buckets) > 0.04f * Count / Buckets)
+                ++failures;
+
+        std::vector<XMFLOAT3> points(Count);
+        random.FillUnitVec3(&points[0], Count);
+        XMVECTOR sum = XMVectorZero();
+        UINT octants[8] = {};
+        for (auto& p : points)
+        {
+            XMVECTOR v = XMLoadFloat3(&p);
+            if (fabs(XMVectorGetX(XMVector3Length(v)) - 1.0f) > 1e-4f)
+                ++failures;
+            sum = XMVectorAdd(sum, v);
+            ++octants[(p.x < 0.0f ? 1 : 0) | (p.y < 0.0f ? 2 : 0) | (p.z < 0.0f ? 4 : 0)];
+        }
+        if (!XMVector3NearEqual(XMVectorScale(sum, 1.0f / Count), XMVectorZero(), XMVectorReplicate(0.01f)))
+            ++failures;
+        for (UINT o = 0; o < 8; ++o)
+            if (fabs((float)octants[o] - Count / 8.0f) > 0.04f * Count / 8.0f)
+                ++failures;
+
+        random.FillHemisphereUnitVec3(&points[0], Count, n);
+        float cosines = 0.0f;
+        for (auto& p : points)
+        {
+            float d = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&p), n));
+            if (d < -1e-6f)
+                ++failures;
+            cosines += d;
+        }
+        if (fabs(cosines / Count - 0.5f) > 0.01f)
+            ++failures;
+    }
+
+    // Seeds and streams: equal pairs repeat, other pairs have nothing in common.
+    {
+        Random a(1, 0), b(1, 0), c(1, 1), d(2, 0);
+        UINT same = 0, sameStream = 0, sameSeed = 0;
+        for (UINT i = 0; i < 1000; ++i)
+        {
+            UINT x = a.NextUInt();
+            same += x == b.NextUInt();
+            sameStream += x == c.NextUInt();
+            sameSeed += x == d.NextUInt();
+        }
+        if (same != 1000 || sameStream > 2 || sameSeed > 2)
+            ++failures;
+    }
+
+    // A stream per task comes out the same however the tasks are run.
+    {
+        const UINT Tasks = 16;
+        const UINT PerTask = 1000;
+        std::vector<XMFLOAT3> serial(Tasks * PerTask), parallel(Tasks * PerTask);
+        for (UINT t = 0; t < Tasks; ++t)
+            Random(99, t).FillUnitVec3(&serial[t * PerTask], PerTask);
+        concurrency::parallel_for(0u, Tasks, [&](UINT t)
+        {
+            Random(99, t).FillUnitVec3(&parallel[t * PerTask], PerTask);
+        });
+        if (memcmp(&serial[0], &parallel[0], serial.size() * sizeof(XMFLOAT3)) != 0)
+            ++failures;
+    }
+
+    if (&ForThread() != &ForThread())
+        ++failures;
+
+    return failures;
+}
+
+Random::BenchmarkResult Random::Benchmark(UINT count)
+{
+    BenchmarkResult result;
+    result.Count = count;
+
+    std::vector<float> floats(count);
+    std::vector<XMFLOAT3> points(count);
+    Random random(GetGlobalSeed());
+
+    double start = GameTimer::NowMs();
+    for (UINT i = 0; i < count; ++i)
+        floats[i] = (float)rand() / (float)RAND_MAX;
+    result.RandMs = GameTimer::NowMs() - start;
+
+    start = GameTimer::NowMs();
+    for (UINT i = 0; i < count; ++i)
+        floats[i] = random.NextFloat();
+    result.NextMs = GameTimer::NowMs() - start;
+
+    start = GameTimer::NowMs();
+    random.FillFloats(&floats[0], count);
+    result.FillMs = GameTimer::NowMs() - start;
+
+    // The rejection loop MathHelper::RandUnitVec3 had.
+    start = GameTimer::NowMs();
+    for (UINT i = 0; i < count; ++i)
+    {
+        XMVECTOR v;
+        do
+        {
+            v = XMVectorSet((float)rand() / RAND_MAX * 2.0f - 1.0f, (float)rand() / RAND_MAX * 2.0f - 1.0f,
+                (float)rand() / RAND_MAX * 2.0f - 1.0f, 0.0f);
+        } while (XMVector3Greater(XMVector3LengthSq(v), XMVectorSplatOne()));
+        XMStoreFloat3(&points[i], XMVector3Normalize(v));
+    }
+    result.RandUnitVec3Ms = GameTimer::NowMs() - start;
+
+    start = GameTimer::NowMs();
+    random.FillUnitVec3(&points[0], count);
+    result.FillUnitVec3Ms = GameTimer::NowMs() - start;
+
+    const UINT PerTask = 16384;
+    start = GameTimer::NowMs();
+    concurrency::parallel_for(0u, (count + PerTask - 1) / PerTask, [&](UINT t)
+    {
+        UINT first = t * PerTask;
+        Random(GetGlobalSeed(), t).FillUnitVec3(&points[first], MathHelper::Min(PerTask, count - first));
+    });
+    result.ParallelFillMs = GameTimer::NowMs() - start;
+
+    return result;
+}
+#pragma endregion
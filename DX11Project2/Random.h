@@ -0,0 +1,94 @@
+//***************************************************************************************
+// Random.h
+//
+// A small, fast random number generator in place of the C rand(): xoshiro128+
+// run as four interleaved streams, so one SSE2 step gives four values.  The
+// values come out lane by lane, step by step, whether they are drawn one at a
+// time or filled in bulk; a Fill call gives exactly what the same number of
+// Next calls would have.
+//
+// A generator is seeded with a seed and a stream number through splitmix64,
+// so equal pairs give equal sequences and the streams of one seed are
+// unrelated.  A generator is not shared between threads: parallel work that has
+// to come out the same on every run gives each task a generator of its own,
+// Random(seed, taskIndex), which does not depend on the thread it runs on.
+// ForThread hands every thread a generator of its own for the rest, the
+// MathHelper helpers among them.
+//***************************************************************************************
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <Windows.h>
+#include <xnamath.h>
+
+class Random
+{
+public:
+    static const UINT Lanes = 4;
+
+    struct BenchmarkResult
+    {
+        UINT    Count;
+        double  RandMs;             // rand() floats
+        double  NextMs;             // NextFloat one at a time
+        double  FillMs;             // FillFloats
+        double  RandUnitVec3Ms;     // rejection sampling over rand(), as MathHelper did
+        double  FillUnitVec3Ms;     // FillUnitVec3
+        double  ParallelFillMs;     // FillUnitVec3 split over tasks with a stream each
+    };
+
+public:
+    explicit Random(UINT64 seed, UINT64 stream = 0);
+
+    void        Seed(UINT64 seed, UINT64 stream = 0);
+
+    UINT        NextUInt();
+    // In [0, 1), with 24 bits.
+    float       NextFloat();
+    // In [a, b).
+    float       NextFloat(float a, float b)     { return a + NextFloat()*(b - a); }
+    // Uniform on the unit sphere; w is 0.
+    XMVECTOR    NextUnitVec3();
+    // Uniform on the half of the unit sphere around 'n'.
+    XMVECTOR    NextHemisphereUnitVec3(FXMVECTOR n);
+
+    void        FillUInts(UINT* dest, UINT count);
+    void        FillFloats(float* dest, UINT count, float a = 0.0f, float b = 1.0f);
+    void        FillUnitVec3(XMFLOAT3* dest, UINT count);
+    void        FillHemisphereUnitVec3(XMFLOAT3* dest, UINT count, FXMVECTOR n);
+
+    // The generator of the calling thread.  Threads get streams of the global
+    // seed in the order they first ask, so only the main thread's is the same
+    // from run to run.
+    static Random&  ForThread();
+
+    // The seed of the ForThread generators.  Restarts the stream numbers and
+    // reseeds the calling thread's generator, so call it on the main thread
+    // before other threads draw.
+    static void     SetGlobalSeed(UINT64 seed);
+    static UINT64   GetGlobalSeed();
+
+    // Checks the vector steps against a scalar xoshiro128+, Fill against Next,
+    // the ranges and spread of the values and that parallel fills with a stream
+    // per task repeat.  Returns the number of failures.
+    static UINT             SelfTest();
+
+    static BenchmarkResult  Benchmark(UINT count);
+
+private:
+    // Steps every lane once and writes the four results.
+    void        Step(UINT* dest);
+
+    void        FillSpheres(XMFLOAT3* dest, UINT count, const XMVECTOR* n);
+
+private:
+    // State word w of lane l is m_State[w][l], so a step works on whole rows.
+    UINT        m_State[4][Lanes];
+
+    // The values of the last step not handed out yet, from m_Next on.
+    UINT        m_Buffer[Lanes];
+    UINT        m_Next;
+};
+
+#endif // RANDOM_H
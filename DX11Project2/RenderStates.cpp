@@ -6,6 +6,7 @@
 
 ID3D11RasterizerState*      RenderStates::WireframeRS       = nullptr;
 ID3D11RasterizerState*      RenderStates::NoCullRS          = nullptr;
+ID3D11RasterizerState*      RenderStates::ShadowDepthRS     = nullptr;
 
 ID3D11BlendState*           RenderStates::AlphaToCoverageBS = nullptr;
 ID3D11BlendState*           RenderStates::TransparentBS     = nullptr;
@@ -40,6 +41,23 @@ void RenderStates::InitAll(ID3D11Device* device)
 
 	HR(device->CreateRasterizerState(&noCullDesc, &NoCullRS));
 
+	//
+	// ShadowDepthRS
+	//
+	// Depth bias against shadow acne; the slope term covers surfaces
+	// seen edge on by the light.
+	D3D11_RASTERIZER_DESC shadowDepthDesc;
+	ZeroMemory(&shadowDepthDesc, sizeof(D3D11_RASTERIZER_DESC));
+	shadowDepthDesc.FillMode = D3D11_FILL_SOLID;
+	shadowDepthDesc.CullMode = D3D11_CULL_BACK;
+	shadowDepthDesc.FrontCounterClockwise = false;
+	shadowDepthDesc.DepthBias = 10000;
+	shadowDepthDesc.DepthBiasClamp = 0.0f;
+	shadowDepthDesc.SlopeScaledDepthBias = 1.0f;
+	shadowDepthDesc.DepthClipEnable = true;
+
+	HR(device->CreateRasterizerState(&shadowDepthDesc, &ShadowDepthRS));
+
 	//
 	// AlphaToCoverageBS
 	//
@@ -88,6 +106,7 @@ void RenderStates::DestroyAll()
 {
 	ReleaseCOM(WireframeRS);
 	ReleaseCOM(NoCullRS);
+	ReleaseCOM(ShadowDepthRS);
 	ReleaseCOM(AlphaToCoverageBS);
 	ReleaseCOM(TransparentBS);
     ReleaseCOM(LessEqualDSS);
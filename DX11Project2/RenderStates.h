@@ -14,6 +14,8 @@ enum RenderOptions
     Lighting,
     Textures,
     TexturesAndFog,
+    ClusteredLights,    // TexturesAndFog plus the clustered point and spot lights
+    Shadows,            // TexturesAndFog plus cascaded shadows from the first directional light
 };
 
 class RenderStates
@@ -24,6 +26,7 @@ public:
 
 	static ID3D11RasterizerState* WireframeRS;
 	static ID3D11RasterizerState* NoCullRS;
+	static ID3D11RasterizerState* ShadowDepthRS;
 	 
 	static ID3D11BlendState* AlphaToCoverageBS;
 	static ID3D11BlendState* TransparentBS;
@@ -0,0 +1,1057 @@
+//***************************************************************************************
+// SceneStore.cpp
+//***************************************************************************************
+
+#include "SceneStore.h"
+#include "Allocators.h"
+#include "GameTimer.h"
+#include <cassert>
+#include <cmath>
+#include <ppl.h>
+
+namespace
+{
+    // Fills the hole at 'i' with the last element.
+    template <typename T>
+    void RemoveSwap(std::vector<T>& v, UINT i)
+    {
+        v[i] = v.back();
+        v.pop_back();
+    }
+
+    // Element k becomes the old element order[k].
+    template <typename T, typename Order>
+    void Permute(std::vector<T>& v, const Order& order)
+    {
+        std::vector<T> permuted(v.size());
+        for (UINT k = 0; k < order.size(); ++k)
+            permuted[k] = v[order[k]];
+        v.swap(permuted);
+    }
+
+    XNA::AxisAlignedBox TransformBox(const XNA::AxisAlignedBox& local, CXMMATRIX W)
+    {
+        XMVECTOR extents = XMLoadFloat3(&local.Extents);
+
+        // Each world axis gets the extents projected onto it by the absolute matrix rows.
+        XMVECTOR worldExtents =
+            XMVectorSplatX(extents) * XMVectorAbs(W.r[0]) +
+            XMVectorSplatY(extents) * XMVectorAbs(W.r[1]) +
+            XMVectorSplatZ(extents) * XMVectorAbs(W.r[2]);
+
+        XNA::AxisAlignedBox box;
+        XMStoreFloat3(&box.Center, XMVector3TransformCoord(XMLoadFloat3(&local.Center), W));
+        XMStoreFloat3(&box.Extents, worldExtents);
+        return box;
+    }
+
+    // Row 'row' of the four matrices, in structure of arrays form: soa[c]
+    // holds element (row, c) of every lane.
+    void GatherRow(const std::vector<XMFLOAT4X4>& matrices, const UINT lanes[4], UINT row, XMVECTOR soa[4])
+    {
+        XMMATRIX M;
+        for (UINT l = 0; l < 4; ++l)
+            M.r[l] = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(matrices[lanes[l]].m[row]));
+        M = XMMatrixTranspose(M);
+        for (UINT c = 0; c < 4; ++c)
+            soa[c] = M.r[c];
+    }
+
+    // The other way round: aos.r[l] is row 'row' of lane l.
+    XMMATRIX ScatterRow(FXMVECTOR c0, FXMVECTOR c1, FXMVECTOR c2, CXMVECTOR c3)
+    {
+        XMMATRIX M;
+        M.r[0] = c0;
+        M.r[1] = c1;
+        M.r[2] = c2;
+        M.r[3] = c3;
+        return XMMatrixTranspose(M);
+    }
+
+    void StoreRow(BYTE* record, UINT offset, UINT row, FXMVECTOR v)
+    {
+        XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(record + offset + row * sizeof(XMFLOAT4)), v);
+    }
+
+    // What every Object kept for itself before the store: one heap allocation per
+    // object, next to its mesh data, reached through a virtual call.
+    class ObjectBaseline
+    {
+    public:
+        struct Transform
+        {
+            XMFLOAT3    Scale;
+            XMFLOAT4    Rotation;
+            XMFLOAT3    Translation;
+        };
+
+        explicit ObjectBaseline(UINT meshBytes)
+        :   m_Mesh(meshBytes), m_AtRest(false)
+        {
+            XMStoreFloat4x4(&m_World, XMMatrixIdentity());
+            XMStoreFloat4x4(&m_InvWorld, XMMatrixIdentity());
+            m_Curr.Scale = XMFLOAT3(1.0f, 1.0f, 1.0f);
+            m_Curr.Rotation = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+            m_Curr.Translation = XMFLOAT3(0.0f, 0.0f, 0.0f);
+            m_Prev = m_Curr;
+            m_LocalBounds.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+            m_LocalBounds.Extents = XMFLOAT3(0.5f, 0.5f, 0.5f);
+        }
+        virtual ~ObjectBaseline() {}
+
+        void BeginTick() { m_Prev = m_Curr; }
+
+        virtual void Update(float t)
+        {
+            XMStoreFloat4(&m_Curr.Rotation, XMQuaternionRotationRollPitchYaw(0.0f, t, 0.0f));
+            m_AtRest = false;
+        }
+
+        void Interpolate(float alpha)
+        {
+            if (m_AtRest)
+                return;
+
+            XMVECTOR scale = XMVectorLerp(XMLoadFloat3(&m_Prev.Scale), XMLoadFloat3(&m_Curr.Scale), alpha);
+            XMVECTOR rotation = XMQuaternionSlerp(XMLoadFloat4(&m_Prev.Rotation), XMLoadFloat4(&m_Curr.Rotation), alpha);
+            XMVECTOR translation = XMVectorLerp(XMLoadFloat3(&m_Prev.Translation), XMLoadFloat3(&m_Curr.Translation), alpha);
+
+            XMMATRIX W = XMMatrixScalingFromVector(scale) * XMMatrixRotationQuaternion(rotation) * XMMatrixTranslationFromVector(translation);
+            XMVECTOR det;
+            XMStoreFloat4x4(&m_World, W);
+            XMStoreFloat4x4(&m_InvWorld, XMMatrixInverse(&det, W));
+            m_WorldBounds = TransformBox(m_LocalBounds, W);
+
+            m_AtRest = memcmp(&m_Prev, &m_Curr, sizeof(Transform)) == 0;
+        }
+
+    private:
+        std::vector<char>       m_Mesh;
+        XMFLOAT4X4              m_World;
+        XMFLOAT4X4              m_InvWorld;
+        Transform               m_Prev;
+        Transform               m_Curr;
+        bool                    m_AtRest;
+        XNA::AxisAlignedBox     m_LocalBounds;
+        XNA::AxisAlignedBox     m_WorldBounds;
+    };
+}
+
+#pragma region Entries
+const UINT SceneStore::NoParent;
+
+SceneStore::SceneStore()
+:   m_OrderDirty(false)
+{
+    // Material 0, the zeroed one, is every new entry's.
+    m_Materials.push_back(Material());
+    m_DrawMaterials = m_Materials;
+}
+
+SceneStore::~SceneStore()
+{
+}
+
+SceneStore::Handle SceneStore::Create()
+{
+    UINT slot;
+    if (!m_FreeSlots.empty())
+    {
+        slot = m_FreeSlots.back();
+        m_FreeSlots.pop_back();
+    }
+    else
+    {
+        // Generations start at 1 so a zeroed handle is never valid.
+        slot = (UINT)m_SlotDense.size();
+        assert(slot < SlotMask);
+        m_SlotDense.push_back(0);
+        m_SlotGeneration.push_back(1);
+    }
+
+    UINT i = GetCount();
+    m_SlotDense[slot] = i;
+
+    XMFLOAT4X4 I;
+    XMStoreFloat4x4(&I, XMMatrixIdentity());
+
+    XNA::AxisAlignedBox empty;
+    empty.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    empty.Extents = XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+    m_DenseSlot.push_back(slot);
+    m_PrevScale.push_back(XMFLOAT3(1.0f, 1.0f, 1.0f));
+    m_PrevRotation.push_back(XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+    m_PrevTranslation.push_back(XMFLOAT3(0.0f, 0.0f, 0.0f));
+    m_CurrScale.push_back(m_PrevScale.back());
+    m_CurrRotation.push_back(m_PrevRotation.back());
+    m_CurrTranslation.push_back(m_PrevTranslation.back());
+    m_Parent.push_back(NoParent);
+    m_Local.push_back(I);
+    m_InvLocal.push_back(I);
+    m_World.push_back(I);
+    m_InvWorld.push_back(I);
+    m_TexTransform.push_back(I);
+    m_LocalBounds.push_back(empty);
+    m_WorldBounds.push_back(empty);
+    m_Flags.push_back(AtRest | UniformScale | Rigid);
+    m_MaterialIndex.push_back(0);
+    m_DrawFlags.push_back(m_Flags.back());
+    m_DrawTexTransform.push_back(I);
+    m_DrawMaterialIndex.push_back(0);
+
+    // A new root after everything else keeps the order depth-first.
+    m_RootStarts.push_back(i);
+
+    return (m_SlotGeneration[slot] << SlotBits) | slot;
+}
+
+void SceneStore::Destroy(Handle h)
+{
+    if (!IsValid(h))
+        return;
+
+    UINT slot = h & SlotMask;
+    UINT i = m_SlotDense[slot];
+    UINT last = GetCount() - 1;
+
+    // Children move up to the parent, keeping their local transforms.
+    for (UINT k = 0; k < last + 1; ++k)
+    {
+        if (m_Parent[k] == i)
+        {
+            m_Parent[k] = m_Parent[i];
+            m_Flags[k] &= ~AtRest;
+        }
+    }
+
+    // The last entry moves into the hole; its handle and its children now lead there.
+    m_SlotDense[m_DenseSlot[last]] = i;
+    for (UINT k = 0; k < last; ++k)
+    {
+        if (m_Parent[k] == last)
+            m_Parent[k] = i;
+    }
+
+    RemoveSwap(m_DenseSlot, i);
+    RemoveSwap(m_PrevScale, i);
+    RemoveSwap(m_PrevRotation, i);
+    RemoveSwap(m_PrevTranslation, i);
+    RemoveSwap(m_CurrScale, i);
+    RemoveSwap(m_CurrRotation, i);
+    RemoveSwap(m_CurrTranslation, i);
+    RemoveSwap(m_Parent, i);
+    RemoveSwap(m_Local, i);
+    RemoveSwap(m_InvLocal, i);
+    RemoveSwap(m_World, i);
+    RemoveSwap(m_InvWorld, i);
+    RemoveSwap(m_TexTransform, i);
+    RemoveSwap(m_LocalBounds, i);
+    RemoveSwap(m_WorldBounds, i);
+    RemoveSwap(m_Flags, i);
+    RemoveSwap(m_MaterialIndex, i);
+    RemoveSwap(m_DrawFlags, i);
+    RemoveSwap(m_DrawTexTransform, i);
+    RemoveSwap(m_DrawMaterialIndex, i);
+    m_OrderDirty = true;
+
+    // Skip the generation that would make the invalid handle.
+    UINT generation = (m_SlotGeneration[slot] + 1) & (0xffffffff >> SlotBits);
+    m_SlotGeneration[slot] = generation == 0 ? 1 : generation;
+    m_FreeSlots.push_back(slot);
+}
+
+bool SceneStore::IsValid(Handle h) const
+{
+    UINT slot = h & SlotMask;
+    return slot < m_SlotGeneration.size() && m_SlotGeneration[slot] == h >> SlotBits;
+}
+
+UINT SceneStore::Dense(Handle h) const
+{
+    assert(IsValid(h));
+    return m_SlotDense[h & SlotMask];
+}
+#pragma endregion
+
+#pragma region Properties
+void SceneStore::SetTransform(Handle h, FXMVECTOR scale, FXMVECTOR rotation, FXMVECTOR translation)
+{
+    UINT i = Dense(h);
+    XMStoreFloat3(&m_CurrScale[i], scale);
+    XMStoreFloat4(&m_CurrRotation[i], rotation);
+    XMStoreFloat3(&m_CurrTranslation[i], translation);
+    m_Flags[i] &= ~AtRest;
+}
+
+void SceneStore::SetParent(Handle h, Handle parent)
+{
+    UINT i = Dense(h);
+    UINT p = parent == InvalidHandle ? NoParent : Dense(parent);
+
+    // No cycles: the new parent must not sit below 'h'.
+    for (UINT k = p; k != NoParent; k = m_Parent[k])
+    {
+        assert(k != i);
+        if (k == i)
+            return;
+    }
+
+    m_Parent[i] = p;
+    m_Flags[i] &= ~AtRest;
+    m_OrderDirty = true;
+}
+
+SceneStore::Handle SceneStore::GetParent(Handle h) const
+{
+    UINT p = m_Parent[Dense(h)];
+    return p == NoParent ? InvalidHandle : (m_SlotGeneration[m_DenseSlot[p]] << SlotBits) | m_DenseSlot[p];
+}
+
+void SceneStore::SetLocalBounds(Handle h, const XNA::AxisAlignedBox& box)
+{
+    UINT i = Dense(h);
+    m_LocalBounds[i] = box;
+    m_WorldBounds[i] = TransformBox(box, XMLoadFloat4x4(&m_World[i]));
+}
+
+void SceneStore::SetTexTransform(Handle h, CXMMATRIX M)
+{
+    UINT i = Dense(h);
+    XMStoreFloat4x4(&m_TexTransform[i], M);
+    m_Flags[i] |= DrawDataChanged;
+}
+
+void SceneStore::SetMaterial(Handle h, const Material& mat)
+{
+    UINT i = Dense(h);
+    m_MaterialIndex[i] = FindMaterial(mat);
+    m_Flags[i] |= DrawDataChanged;
+}
+
+void SceneStore::SetFlag(Handle h, UINT flag, bool enable)
+{
+    UINT i = Dense(h);
+    m_Flags[i] = enable ? (m_Flags[i] | flag) : (m_Flags[i] & ~flag);
+}
+
+XMMATRIX SceneStore::GetLocal(Handle h) const
+{
+    return XMLoadFloat4x4(&m_Local[Dense(h)]);
+}
+
+XMMATRIX SceneStore::GetWorld(Handle h) const
+{
+    return XMLoadFloat4x4(&m_World[Dense(h)]);
+}
+
+XMMATRIX SceneStore::GetInvWorld(Handle h) const
+{
+    return XMLoadFloat4x4(&m_InvWorld[Dense(h)]);
+}
+
+XMMATRIX SceneStore::GetTexTransform(Handle h) const
+{
+    return XMLoadFloat4x4(&m_DrawTexTransform[Dense(h)]);
+}
+
+const Material& SceneStore::GetMaterial(Handle h) const
+{
+    return m_DrawMaterials[m_DrawMaterialIndex[Dense(h)]];
+}
+
+const XNA::AxisAlignedBox& SceneStore::GetLocalBounds(Handle h) const
+{
+    return m_LocalBounds[Dense(h)];
+}
+
+const XNA::AxisAlignedBox& SceneStore::GetWorldBounds(Handle h) const
+{
+    return m_WorldBounds[Dense(h)];
+}
+
+bool SceneStore::HasFlag(Handle h, UINT flag) const
+{
+    return (m_DrawFlags[Dense(h)] & flag) != 0;
+}
+
+UINT SceneStore::FindMaterial(const Material& mat)
+{
+    // A scene uses a handful of materials; objects sharing one share the index.
+    for (UINT m = 0; m < m_Materials.size(); ++m)
+    {
+        if (memcmp(&m_Materials[m], &mat, sizeof(Material)) == 0)
+            return m;
+    }
+
+    m_Materials.push_back(mat);
+    return (UINT)m_Materials.size() - 1;
+}
+#pragma endregion
+
+#pragma region Batch
+void SceneStore::BeginTick()
+{
+    // Whole arrays at a time; an entry at rest copies onto itself.
+    m_PrevScale = m_CurrScale;
+    m_PrevRotation = m_CurrRotation;
+    m_PrevTranslation = m_CurrTranslation;
+}
+
+void SceneStore::Interpolate(float alpha)
+{
+    if (m_OrderDirty)
+        SortDepthFirst();
+
+    // Materials are only ever added.
+    if (m_DrawMaterials.size() != m_Materials.size())
+        m_DrawMaterials.insert(m_DrawMaterials.end(), m_Materials.begin() + m_DrawMaterials.size(), m_Materials.end());
+
+    const UINT count = GetCount();
+    if (count < ParallelThreshold)
+    {
+        InterpolateLocal(0, count, alpha);
+        PropagateWorld(0, count);
+        return;
+    }
+
+    // Local transforms are independent per entry, world transforms per root subtree.
+    const UINT chunk = 1024;
+    concurrency::parallel_for(0u, (count + chunk - 1) / chunk, [&](UINT c)
+    {
+        InterpolateLocal(c * chunk, MathHelper::Min(count, (c + 1) * chunk), alpha);
+    });
+
+    const UINT roots = (UINT)m_RootStarts.size();
+    concurrency::parallel_for(0u, roots, [&](UINT r)
+    {
+        PropagateWorld(m_RootStarts[r], r + 1 < roots ? m_RootStarts[r + 1] : count);
+    });
+}
+
+void SceneStore::InterpolateLocal(UINT begin, UINT end, float alpha)
+{
+    for (UINT i = begin; i < end; ++i)
+    {
+        if (m_Flags[i] & DrawDataChanged)
+        {
+            m_DrawTexTransform[i] = m_TexTransform[i];
+            m_DrawMaterialIndex[i] = m_MaterialIndex[i];
+        }
+
+        m_Flags[i] &= ~(WorldChanged | DrawDataChanged);
+        if (m_Flags[i] & AtRest)
+            continue;
+
+        XMVECTOR prevScale = XMLoadFloat3(&m_PrevScale[i]);
+        XMVECTOR prevRotation = XMLoadFloat4(&m_PrevRotation[i]);
+        XMVECTOR prevTranslation = XMLoadFloat3(&m_PrevTranslation[i]);
+        XMVECTOR currScale = XMLoadFloat3(&m_CurrScale[i]);
+        XMVECTOR currRotation = XMLoadFloat4(&m_CurrRotation[i]);
+        XMVECTOR currTranslation = XMLoadFloat3(&m_CurrTranslation[i]);
+
+        XMVECTOR scale = XMVectorLerp(prevScale, currScale, alpha);
+        XMVECTOR rotation = XMQuaternionSlerp(prevRotation, currRotation, alpha);
+        XMVECTOR translation = XMVectorLerp(prevTranslation, currTranslation, alpha);
+
+        XMMATRIX S = XMMatrixScalingFromVector(scale);
+        XMMATRIX R = XMMatrixRotationQuaternion(rotation);
+        XMMATRIX L = S * R;
+        L.r[3] = XMVectorSetW(translation, 1.0f);
+
+        // The inverse follows from the parts: T^-1 * R^T * S^-1, no general inverse.
+        XMMATRIX invSR = XMMatrixTranspose(R) * XMMatrixScalingFromVector(XMVectorReciprocal(scale));
+        XMMATRIX invL = invSR;
+        invL.r[3] = XMVectorSetW(XMVector3TransformNormal(-translation, invSR), 1.0f);
+
+        XMStoreFloat4x4(&m_Local[i], L);
+        XMStoreFloat4x4(&m_InvLocal[i], invL);
+        m_Flags[i] |= WorldChanged;
+
+        // Nothing moves until the next SetTransform.
+        if (XMVector3Equal(prevScale, currScale) &&
+            XMVector4Equal(prevRotation, currRotation) &&
+            XMVector3Equal(prevTranslation, currTranslation))
+        {
+            m_Flags[i] |= AtRest;
+        }
+    }
+}
+
+void SceneStore::PropagateWorld(UINT begin, UINT end)
+{
+    // Parents come first, so their flags and matrices are final when a child is reached.
+    for (UINT i = begin; i < end; ++i)
+    {
+        UINT p = m_Parent[i];
+        if (p != NoParent && (m_Flags[p] & WorldChanged))
+            m_Flags[i] |= WorldChanged;
+
+        if (!(m_Flags[i] & WorldChanged))
+        {
+            m_DrawFlags[i] = m_Flags[i];
+            continue;
+        }
+
+        // A blend of two uniform scales is uniform, so the tick scales decide.
+        const XMFLOAT3& prev = m_PrevScale[i];
+        const XMFLOAT3& curr = m_CurrScale[i];
+        UINT scaleFlags = 0;
+        if (prev.x == prev.y && prev.x == prev.z && curr.x == curr.y && curr.x == curr.z)
+            scaleFlags = (prev.x == 1.0f && curr.x == 1.0f) ? (UniformScale | Rigid) : UniformScale;
+        if (p != NoParent)
+            scaleFlags &= m_Flags[p];
+        m_Flags[i] = (m_Flags[i] & ~(UniformScale | Rigid)) | scaleFlags;
+
+        XMMATRIX W = XMLoadFloat4x4(&m_Local[i]);
+        XMMATRIX invW = XMLoadFloat4x4(&m_InvLocal[i]);
+        if (p != NoParent)
+        {
+            W = W * XMLoadFloat4x4(&m_World[p]);
+            invW = XMLoadFloat4x4(&m_InvWorld[p]) * invW;
+        }
+
+        XMStoreFloat4x4(&m_World[i], W);
+        XMStoreFloat4x4(&m_InvWorld[i], invW);
+        m_WorldBounds[i] = TransformBox(m_LocalBounds[i], W);
+        m_DrawFlags[i] = m_Flags[i];
+    }
+}
+
+void SceneStore::GetDrawTransforms(const Handle* handles, UINT count, CXMMATRIX viewProj,
+                                   const DrawLayout& layout, void* dest) const
+{
+    // Element (k, c) of viewProj in every lane.
+    XMVECTOR vp[4][4];
+    for (UINT k = 0; k < 4; ++k)
+    {
+        vp[k][0] = XMVectorSplatX(viewProj.r[k]);
+        vp[k][1] = XMVectorSplatY(viewProj.r[k]);
+        vp[k][2] = XMVectorSplatZ(viewProj.r[k]);
+        vp[k][3] = XMVectorSplatW(viewProj.r[k]);
+    }
+    const XMVECTOR zero = XMVectorZero();
+    const XMVECTOR lastRow = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+
+    BYTE* records = static_cast<BYTE*>(dest);
+    for (UINT first = 0; first < count; first += 4)
+    {
+        // A short last group repeats its last entry in the spare lanes.
+        UINT laneCount = MathHelper::Min(4u, count - first);
+        UINT lanes[4];
+        UINT shared = UniformScale | Rigid;
+        for (UINT l = 0; l < 4; ++l)
+        {
+            lanes[l] = Dense(handles[first + MathHelper::Min(l, laneCount - 1)]);
+            shared &= m_DrawFlags[lanes[l]];
+        }
+
+        // w[r][c] is element (r, c) of the four world matrices.
+        XMVECTOR w[4][4];
+        for (UINT r = 0; r < 4; ++r)
+            GatherRow(m_World, lanes, r, w[r]);
+
+        // World-view-projection.  The world's last column is (0, 0, 0, 1), so
+        // row r takes three products and, for the translation row, vp's last row.
+        XMVECTOR wvp[4][4];
+        for (UINT r = 0; r < 4; ++r)
+        {
+            for (UINT c = 0; c < 4; ++c)
+            {
+                XMVECTOR v = XMVectorMultiplyAdd(w[r][2], vp[2][c],
+                             XMVectorMultiplyAdd(w[r][1], vp[1][c], XMVectorMultiply(w[r][0], vp[0][c])));
+                wvp[r][c] = (r == 3) ? XMVectorAdd(v, vp[3][c]) : v;
+            }
+        }
+
+        // Inverse transpose of the upper 3x3.  For s times a rotation it is the
+        // rotation over s, i.e. the matrix over s squared.
+        XMVECTOR n[3][3];
+        if (shared & Rigid)
+        {
+            for (UINT r = 0; r < 3; ++r)
+                for (UINT c = 0; c < 3; ++c)
+                    n[r][c] = w[r][c];
+        }
+        else
+        {
+            XMVECTOR scale2 = XMVectorMultiplyAdd(w[0][2], w[0][2],
+                              XMVectorMultiplyAdd(w[0][1], w[0][1], XMVectorMultiply(w[0][0], w[0][0])));
+            XMVECTOR invScale2 = XMVectorReciprocal(scale2);
+            for (UINT r = 0; r < 3; ++r)
+                for (UINT c = 0; c < 3; ++c)
+                    n[r][c] = XMVectorMultiply(w[r][c], invScale2);
+
+            if (!(shared & UniformScale))
+            {
+                // The other lanes transpose the inverse the store keeps anyway.
+                XMVECTOR inv[3][4];
+                for (UINT r = 0; r < 3; ++r)
+                    GatherRow(m_InvWorld, lanes, r, inv[r]);
+
+                XMVECTOR general = XMVectorSelectControl(
+                    (m_DrawFlags[lanes[0]] & UniformScale) ? 0 : 1, (m_DrawFlags[lanes[1]] & UniformScale) ? 0 : 1,
+                    (m_DrawFlags[lanes[2]] & UniformScale) ? 0 : 1, (m_DrawFlags[lanes[3]] & UniformScale) ? 0 : 1);
+                for (UINT r = 0; r < 3; ++r)
+                    for (UINT c = 0; c < 3; ++c)
+                        n[r][c] = XMVectorSelect(n[r][c], inv[c][r], general);
+            }
+        }
+
+        // Back to one matrix per lane, each record written front to back.
+        XMMATRIX wvpRows[4];
+        XMMATRIX nRows[3];
+        for (UINT r = 0; r < 4; ++r)
+            wvpRows[r] = ScatterRow(wvp[r][0], wvp[r][1], wvp[r][2], wvp[r][3]);
+        for (UINT r = 0; r < 3; ++r)
+            nRows[r] = ScatterRow(n[r][0], n[r][1], n[r][2], zero);
+
+        for (UINT l = 0; l < laneCount; ++l)
+        {
+            BYTE* record = records + (first + l) * layout.Stride;
+            memcpy(record + layout.World, &m_World[lanes[l]], sizeof(XMFLOAT4X4));
+            for (UINT r = 0; r < 3; ++r)
+                StoreRow(record, layout.WorldInvTranspose, r, nRows[r].r[l]);
+            StoreRow(record, layout.WorldInvTranspose, 3, lastRow);
+            for (UINT r = 0; r < 4; ++r)
+                StoreRow(record, layout.WorldViewProj, r, wvpRows[r].r[l]);
+            memcpy(record + layout.TexTransform, &m_DrawTexTransform[lanes[l]], sizeof(XMFLOAT4X4));
+        }
+    }
+}
+
+void SceneStore::SortDepthFirst()
+{
+    const UINT count = GetCount();
+
+    // Scratch lists live on the frame arena.
+    typedef std::vector<UINT, ArenaAllocator<UINT>> Scratch;
+
+    Scratch firstChild(count, NoParent);
+    Scratch nextSibling(count, NoParent);
+    for (UINT i = count; i-- > 0;)
+    {
+        if (m_Parent[i] != NoParent)
+        {
+            nextSibling[i] = firstChild[m_Parent[i]];
+            firstChild[m_Parent[i]] = i;
+        }
+    }
+
+    // order[k] is the entry that goes to k.
+    Scratch order;
+    Scratch stack;
+    order.reserve(count);
+    m_RootStarts.clear();
+    for (UINT root = 0; root < count; ++root)
+    {
+        if (m_Parent[root] != NoParent)
+            continue;
+
+        m_RootStarts.push_back((UINT)order.size());
+        stack.push_back(root);
+        while (!stack.empty())
+        {
+            UINT i = stack.back();
+            stack.pop_back();
+            order.push_back(i);
+            for (UINT c = firstChild[i]; c != NoParent; c = nextSibling[c])
+                stack.push_back(c);
+        }
+    }
+    assert(order.size() == count);
+
+    Scratch newIndex(count);
+    for (UINT k = 0; k < count; ++k)
+        newIndex[order[k]] = k;
+    for (UINT i = 0; i < count; ++i)
+    {
+        if (m_Parent[i] != NoParent)
+            m_Parent[i] = newIndex[m_Parent[i]];
+    }
+
+    Permute(m_DenseSlot, order);
+    Permute(m_PrevScale, order);
+    Permute(m_PrevRotation, order);
+    Permute(m_PrevTranslation, order);
+    Permute(m_CurrScale, order);
+    Permute(m_CurrRotation, order);
+    Permute(m_CurrTranslation, order);
+    Permute(m_Parent, order);
+    Permute(m_Local, order);
+    Permute(m_InvLocal, order);
+    Permute(m_World, order);
+    Permute(m_InvWorld, order);
+    Permute(m_TexTransform, order);
+    Permute(m_LocalBounds, order);
+    Permute(m_WorldBounds, order);
+    Permute(m_Flags, order);
+    Permute(m_MaterialIndex, order);
+    Permute(m_DrawFlags, order);
+    Permute(m_DrawTexTransform, order);
+    Permute(m_DrawMaterialIndex, order);
+
+    for (UINT k = 0; k < count; ++k)
+        m_SlotDense[m_DenseSlot[k]] = k;
+
+    m_OrderDirty = false;
+}
+#pragma endregion
+
+#pragma region Tests
+UINT SceneStore::SelfTest()
+{
+    UINT failures = 0;
+    const float epsilon = 0.001f;
+
+    struct Check
+    {
+        static bool Near(CXMMATRIX A, CXMMATRIX B, float epsilon)
+        {
+            for (int r = 0; r < 4; ++r)
+            {
+                if (!XMVector4NearEqual(A.r[r], B.r[r], XMVectorReplicate(epsilon)))
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    SceneStore store;
+
+    // Handles survive the compaction of other entries.
+    Handle a = store.Create();
+    Handle b = store.Create();
+    Handle c = store.Create();
+    store.SetTransform(c, XMVectorReplicate(1.0f), XMQuaternionIdentity(), XMVectorSet(3.0f, 0.0f, 0.0f, 0.0f));
+    store.Destroy(a);
+
+    if (store.IsValid(a) || !store.IsValid(b) || !store.IsValid(c) || store.GetCount() != 2)
+        ++failures;
+
+    store.Interpolate(1.0f);
+    if (XMVectorGetX(store.GetWorld(c).r[3]) != 3.0f)
+        ++failures;
+
+    // A reused slot gets a new generation; the old handle stays dead.
+    Handle d = store.Create();
+    if ((d & SlotMask) != (a & SlotMask) || d == a || store.IsValid(a) || !store.IsValid(d))
+        ++failures;
+
+    // Batch results against per entry math.
+    XNA::AxisAlignedBox local;
+    local.Center = XMFLOAT3(1.0f, -2.0f, 0.5f);
+    local.Extents = XMFLOAT3(0.5f, 1.0f, 2.0f);
+    store.SetLocalBounds(b, local);
+
+    XMVECTOR scale = XMVectorSet(2.0f, 0.5f, 3.0f, 0.0f);
+    XMVECTOR rotation = XMQuaternionRotationRollPitchYaw(0.3f, -1.1f, 0.7f);
+    XMVECTOR translation = XMVectorSet(10.0f, -4.0f, 7.0f, 0.0f);
+    store.SetTransform(b, scale, rotation, translation);
+    store.Interpolate(1.0f);
+
+    XMMATRIX expected = XMMatrixScalingFromVector(scale) * XMMatrixRotationQuaternion(rotation) * XMMatrixTranslationFromVector(translation);
+    XMVECTOR det;
+    if (!Check::Near(store.GetWorld(b), expected, epsilon) ||
+        !Check::Near(store.GetInvWorld(b), XMMatrixInverse(&det, expected), epsilon))
+    {
+        ++failures;
+    }
+
+    // The world box holds every corner of the transformed local box, tightly.
+    const XNA::AxisAlignedBox& bounds = store.GetWorldBounds(b);
+    XMVECTOR boundsMin = XMLoadFloat3(&bounds.Center) - XMLoadFloat3(&bounds.Extents);
+    XMVECTOR boundsMax = XMLoadFloat3(&bounds.Center) + XMLoadFloat3(&bounds.Extents);
+    XMVECTOR cornerMin = XMVectorReplicate(+MathHelper::Infinity);
+    XMVECTOR cornerMax = XMVectorReplicate(-MathHelper::Infinity);
+    for (int k = 0; k < 8; ++k)
+    {
+        XMVECTOR sign = XMVectorSet(k & 1 ? 1.0f : -1.0f, k & 2 ? 1.0f : -1.0f, k & 4 ? 1.0f : -1.0f, 0.0f);
+        XMVECTOR corner = XMLoadFloat3(&local.Center) + sign * XMLoadFloat3(&local.Extents);
+        corner = XMVector3TransformCoord(corner, expected);
+        cornerMin = XMVectorMin(cornerMin, corner);
+        cornerMax = XMVectorMax(cornerMax, corner);
+    }
+    if (!XMVector3NearEqual(boundsMin, cornerMin, XMVectorReplicate(epsilon)) ||
+        !XMVector3NearEqual(boundsMax, cornerMax, XMVectorReplicate(epsilon)))
+    {
+        ++failures;
+    }
+
+    // Halfway between ticks, then at rest once both ticks agree.
+    store.BeginTick();
+    store.SetTransform(b, scale, rotation, translation + XMVectorSet(2.0f, 0.0f, 0.0f, 0.0f));
+    store.Interpolate(0.5f);
+    if (fabsf(XMVectorGetX(store.GetWorld(b).r[3]) - 11.0f) > epsilon || store.HasFlag(b, AtRest))
+        ++failures;
+
+    store.BeginTick();
+    store.Interpolate(0.5f);
+    if (fabsf(XMVectorGetX(store.GetWorld(b).r[3]) - 12.0f) > epsilon || !store.HasFlag(b, AtRest))
+        ++failures;
+
+    // Equal materials share an entry.
+    Material mat;
+    mat.Diffuse = XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f);
+    store.SetMaterial(c, mat);
+    store.SetMaterial(d, mat);
+    if (store.m_MaterialIndex[store.Dense(c)] != store.m_MaterialIndex[store.Dense(d)] || store.m_Materials.size() != 2)
+        ++failures;
+
+    // What a tick sets stays out of the getters until the next Interpolate,
+    // at rest or not.
+    XMMATRIX texTransform = XMMatrixTranslation(0.25f, 0.5f, 0.0f);
+    store.SetTexTransform(c, texTransform);
+    if (store.GetMaterial(c).Diffuse.x != 0.0f || !Check::Near(store.GetTexTransform(c), XMMatrixIdentity(), epsilon))
+        ++failures;
+
+    store.Interpolate(1.0f);
+    if (store.GetMaterial(c).Diffuse.x != 1.0f || !Check::Near(store.GetTexTransform(c), texTransform, epsilon) ||
+        !store.HasFlag(c, AtRest))
+    {
+        ++failures;
+    }
+
+    // A chain root -> child -> grandchild composes down, after reordering.
+    {
+        SceneStore tree;
+        Handle grandchild = tree.Create();
+        Handle other = tree.Create();
+        Handle child = tree.Create();
+        Handle root = tree.Create();
+        tree.SetParent(grandchild, child);
+        tree.SetParent(child, root);
+
+        XMVECTOR rootRotation = XMQuaternionRotationRollPitchYaw(0.0f, 0.5f, 0.0f);
+        tree.SetTransform(root, XMVectorReplicate(1.0f), rootRotation, XMVectorSet(10.0f, 0.0f, 0.0f, 0.0f));
+        tree.SetTransform(child, XMVectorReplicate(2.0f), XMQuaternionIdentity(), XMVectorSet(0.0f, 5.0f, 0.0f, 0.0f));
+        tree.SetTransform(grandchild, XMVectorReplicate(1.0f), XMQuaternionIdentity(), XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f));
+        tree.Interpolate(1.0f);
+
+        XMMATRIX rootWorld = XMMatrixRotationQuaternion(rootRotation) * XMMatrixTranslation(10.0f, 0.0f, 0.0f);
+        XMMATRIX childWorld = XMMatrixScaling(2.0f, 2.0f, 2.0f) * XMMatrixTranslation(0.0f, 5.0f, 0.0f) * rootWorld;
+        XMMATRIX grandchildWorld = XMMatrixTranslation(1.0f, 0.0f, 0.0f) * childWorld;
+        if (!Check::Near(tree.GetWorld(grandchild), grandchildWorld, epsilon) ||
+            !Check::Near(tree.GetInvWorld(grandchild), XMMatrixInverse(&det, grandchildWorld), epsilon) ||
+            tree.GetParent(grandchild) != child || tree.GetParent(root) != InvalidHandle)
+        {
+            ++failures;
+        }
+
+        for (UINT i = 0; i < tree.GetCount(); ++i)
+        {
+            if (tree.m_Parent[i] != NoParent && tree.m_Parent[i] >= i)
+                ++failures;
+        }
+
+        // Moving the root alone recomputes its subtree and nothing else.
+        tree.BeginTick();
+        tree.Interpolate(1.0f);
+        tree.SetTransform(root, XMVectorReplicate(1.0f), rootRotation, XMVectorSet(20.0f, 0.0f, 0.0f, 0.0f));
+        tree.Interpolate(1.0f);
+        if (!tree.HasFlag(grandchild, WorldChanged) || tree.HasFlag(other, WorldChanged) ||
+            !tree.HasFlag(child, AtRest) ||
+            !Check::Near(tree.GetWorld(grandchild), grandchildWorld * XMMatrixTranslation(10.0f, 0.0f, 0.0f), epsilon))
+        {
+            ++failures;
+        }
+
+        // Destroying the middle attaches the grandchild to the root.
+        tree.Destroy(child);
+        tree.Interpolate(1.0f);
+        XMMATRIX expectedWorld = XMMatrixTranslation(1.0f, 0.0f, 0.0f) * rootWorld * XMMatrixTranslation(10.0f, 0.0f, 0.0f);
+        if (tree.GetParent(grandchild) != root || !Check::Near(tree.GetWorld(grandchild), expectedWorld, epsilon))
+            ++failures;
+    }
+
+    // Draw transforms against world * viewProj and a general inverse, for
+    // rigid, uniformly and unevenly scaled entries, some under parents, in
+    // groups of every length.
+    {
+        SceneStore draw;
+        std::vector<Handle> handles;
+        const UINT expectedFlags[] = { UniformScale | Rigid, UniformScale, 0, UniformScale, UniformScale, 0, UniformScale | Rigid };
+        const XMVECTOR scales[] =
+        {
+            XMVectorReplicate(1.0f), XMVectorReplicate(2.5f), XMVectorSet(0.5f, 2.0f, 1.5f, 0.0f)
+        };
+        for (UINT i = 0; i < 7; ++i)
+        {
+            handles.push_back(draw.Create());
+            XMVECTOR rotation = XMQuaternionRotationRollPitchYaw(0.4f * i, -0.3f * i, 0.2f + 0.1f * i);
+            draw.SetTransform(handles[i], scales[i % 3], rotation, XMVectorSet(1.0f * i, -2.0f, 0.5f * i, 0.0f));
+            draw.SetTexTransform(handles[i], XMMatrixScaling(1.0f + i, 2.0f, 1.0f));
+        }
+        // Rigid under uniform is uniform, anything under uneven is uneven, rigid under rigid stays rigid.
+        draw.SetParent(handles[3], handles[1]);
+        draw.SetParent(handles[5], handles[2]);
+        draw.SetParent(handles[6], handles[0]);
+        draw.Interpolate(1.0f);
+
+        XMMATRIX viewProj = XMMatrixLookAtLH(XMVectorSet(3.0f, 4.0f, -10.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) *
+            XMMatrixPerspectiveFovLH(0.25f * MathHelper::Pi, 1.5f, 1.0f, 1000.0f);
+
+        struct Record
+        {
+            XMFLOAT4X4  WorldViewProj;
+            XMFLOAT4X4  World;
+            XMFLOAT4X4  TexTransform;
+            XMFLOAT4X4  WorldInvTranspose;
+        };
+        DrawLayout layout = { sizeof(Record), offsetof(Record, World), offsetof(Record, WorldInvTranspose),
+                              offsetof(Record, WorldViewProj), offsetof(Record, TexTransform) };
+
+        for (UINT i = 0; i < handles.size(); ++i)
+        {
+            if ((draw.m_Flags[draw.Dense(handles[i])] & (UniformScale | Rigid)) != expectedFlags[i])
+                ++failures;
+        }
+
+        // Back to front, so the lanes do not follow the dense order, then
+        // groups that are all uniform and all rigid.
+        std::vector<std::vector<Handle> > orders;
+        for (UINT count = 0; count <= handles.size(); ++count)
+            orders.push_back(std::vector<Handle>(handles.rbegin(), handles.rbegin() + count));
+        const Handle uniform[] = { handles[1], handles[3], handles[4], handles[0] };
+        const Handle rigid[] = { handles[6], handles[0], handles[6], handles[0], handles[0] };
+        orders.push_back(std::vector<Handle>(uniform, uniform + ARRAYSIZE(uniform)));
+        orders.push_back(std::vector<Handle>(rigid, rigid + ARRAYSIZE(rigid)));
+
+        for (auto& order : orders)
+        {
+            UINT count = (UINT)order.size();
+            // One record more than asked for, which must stay untouched.
+            std::vector<Record> records(count + 1);
+            memset(&records[0], 0xcd, records.size() * sizeof(Record));
+            draw.GetDrawTransforms(order.empty() ? nullptr : &order[0], count, viewProj, layout, &records[0]);
+
+            for (UINT i = 0; i < count; ++i)
+            {
+                XMMATRIX world = draw.GetWorld(order[i]);
+                if (!Check::Near(XMLoadFloat4x4(&records[i].World), world, epsilon) ||
+                    !Check::Near(XMLoadFloat4x4(&records[i].WorldViewProj), world * viewProj, epsilon) ||
+                    !Check::Near(XMLoadFloat4x4(&records[i].WorldInvTranspose), MathHelper::InverseTranspose(world), epsilon) ||
+                    !Check::Near(XMLoadFloat4x4(&records[i].TexTransform), draw.GetTexTransform(order[i]), epsilon))
+                {
+                    ++failures;
+                }
+            }
+            const BYTE* spare = reinterpret_cast<const BYTE*>(&records[count]);
+            if (std::count(spare, spare + sizeof(Record), 0xcd) != sizeof(Record))
+                ++failures;
+        }
+    }
+
+    return failures;
+}
+
+SceneStore::BenchmarkResult SceneStore::Benchmark(UINT count, UINT frames)
+{
+    BenchmarkResult result;
+    result.Count = count;
+    result.Frames = frames;
+
+    XNA::AxisAlignedBox local;
+    local.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    local.Extents = XMFLOAT3(0.5f, 0.5f, 0.5f);
+
+    // Store: a tick and an interpolation per frame, every entry moving.
+    {
+        SceneStore store;
+        std::vector<Handle> handles(count);
+        for (UINT i = 0; i < count; ++i)
+        {
+            handles[i] = store.Create();
+            store.SetLocalBounds(handles[i], local);
+        }
+
+        double start = GameTimer::NowMs();
+        for (UINT f = 0; f < frames; ++f)
+        {
+            store.BeginTick();
+            for (UINT i = 0; i < count; ++i)
+            {
+                store.SetTransform(handles[i], XMVectorReplicate(1.0f),
+                    XMQuaternionRotationRollPitchYaw(0.0f, 0.01f*(f + i), 0.0f), XMVectorZero());
+            }
+            store.Interpolate(0.5f);
+        }
+        result.StoreMs = (GameTimer::NowMs() - start) / frames;
+    }
+
+    // Objects: the same work through one heap object each, mesh data in between.
+    {
+        std::vector<ObjectBaseline*> objects(count);
+        for (UINT i = 0; i < count; ++i)
+            objects[i] = new ObjectBaseline(256 + 64 * (i % 7));
+
+        double start = GameTimer::NowMs();
+        for (UINT f = 0; f < frames; ++f)
+        {
+            for (UINT i = 0; i < count; ++i)
+                objects[i]->BeginTick();
+            for (UINT i = 0; i < count; ++i)
+                objects[i]->Update(0.01f*(f + i));
+            for (UINT i = 0; i < count; ++i)
+                objects[i]->Interpolate(0.5f);
+        }
+        result.ObjectsMs = (GameTimer::NowMs() - start) / frames;
+
+        for (UINT i = 0; i < count; ++i)
+            SafeDelete(objects[i]);
+    }
+
+    // Draw transforms: a third each rigid, uniformly and unevenly scaled, into
+    // records laid out like the per-draw blocks, against the per entry math
+    // BasicEffect used before.
+    {
+        SceneStore store;
+        std::vector<Handle> handles(count);
+        const XMVECTOR scales[] =
+        {
+            XMVectorReplicate(1.0f), XMVectorReplicate(2.0f), XMVectorSet(1.0f, 2.0f, 0.5f, 0.0f)
+        };
+        for (UINT i = 0; i < count; ++i)
+        {
+            handles[i] = store.Create();
+            store.SetTransform(handles[i], scales[i % 3],
+                XMQuaternionRotationRollPitchYaw(0.0f, 0.01f*i, 0.0f), XMVectorSet(0.0f, 0.0f, 0.01f*i, 0.0f));
+        }
+        store.Interpolate(1.0f);
+
+        struct Record
+        {
+            XMFLOAT4X4  World;
+            XMFLOAT4X4  WorldInvTranspose;
+            XMFLOAT4X4  WorldViewProj;
+            XMFLOAT4X4  TexTransform;
+            XMFLOAT4    Pad[5];
+        };
+        DrawLayout layout = { sizeof(Record), offsetof(Record, World), offsetof(Record, WorldInvTranspose),
+                              offsetof(Record, WorldViewProj), offsetof(Record, TexTransform) };
+        std::vector<Record> records(count);
+        XMMATRIX viewProj = XMMatrixPerspectiveFovLH(0.25f * MathHelper::Pi, 1.5f, 1.0f, 1000.0f);
+
+        double start = GameTimer::NowMs();
+        for (UINT f = 0; f < frames; ++f)
+            store.GetDrawTransforms(&handles[0], count, viewProj, layout, &records[0]);
+        result.DrawTransformsMs = (GameTimer::NowMs() - start) / frames;
+
+        start = GameTimer::NowMs();
+        for (UINT f = 0; f < frames; ++f)
+        {
+            for (UINT i = 0; i < count; ++i)
+            {
+                XMMATRIX world = store.GetWorld(handles[i]);
+                XMStoreFloat4x4(&records[i].World, world);
+                XMStoreFloat4x4(&records[i].WorldInvTranspose, MathHelper::InverseTranspose(world));
+                XMStoreFloat4x4(&records[i].WorldViewProj, world * viewProj);
+                XMStoreFloat4x4(&records[i].TexTransform, store.GetTexTransform(handles[i]));
+            }
+        }
+        result.PerEntryDrawMs = (GameTimer::NowMs() - start) / frames;
+    }
+
+    return result;
+}
+#pragma endregion
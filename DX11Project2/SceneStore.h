@@ -0,0 +1,201 @@
+//***************************************************************************************
+// SceneStore.h
+//
+// Structure of arrays storage for the per object data the frame touches: tick
+// transforms, world matrices and their inverses, texture transforms, local and
+// world bounds, flags and material indices.
+//
+// Entries are addressed by handles that stay valid until the entry is destroyed;
+// a handle picks a slot, and the slot maps to the entry's index in the dense
+// arrays, which are compacted by moving the last entry into the hole.  The
+// generation in the handle catches use after Destroy.
+//
+// An entry may have a parent; its transform is then relative to the parent's
+// world.  The dense arrays are kept in depth-first order, every parent before
+// its children and every subtree contiguous, so one forward pass composes the
+// world matrices and independent root subtrees can run in parallel.
+//
+// BeginTick and Interpolate update every entry in one pass over contiguous
+// arrays.  Entries that did not move since their last Interpolate are skipped;
+// an entry whose local transform or parent moved is flagged WorldChanged and
+// only those entries get a new world matrix, inverse and bounds.
+//
+// GetDrawTransforms turns the world matrices of the entries drawn this frame
+// into the matrices the shaders take, four entries per pass in structure of
+// arrays form, and writes them where the caller says, e.g. straight into the
+// mapped per-draw buffer.
+//
+// With a threaded simulation the setters run on the tick thread, under the
+// simulation's state mutex that Interpolate is called under as well.  The
+// getters, HasFlag and GetDrawTransforms only read arrays that Interpolate
+// writes: it copies the texture transforms, material indices and flags that
+// ticks set into render side arrays, and the material list as it grows.  So
+// the frame reads the store without the lock once Interpolate returned.
+// Create, Destroy, SetParent and SetLocalBounds are for setup, while no tick
+// runs.
+//***************************************************************************************
+
+#ifndef SCENESTORE_H
+#define SCENESTORE_H
+
+#include "d3dUtil.h"
+
+class SceneStore
+{
+public:
+    typedef UINT Handle;
+    static const Handle InvalidHandle = 0xffffffff;
+
+    enum Flags : UINT
+    {
+        CastsShadow     = 1 << 0,
+        Occluder        = 1 << 1,   // opaque and filling its local bounds
+        AtRest          = 1 << 2,   // local transform matches both tick transforms
+        WorldChanged    = 1 << 3,   // world data was recomputed by the last Interpolate
+        UniformScale    = 1 << 4,   // the world matrix scales every axis alike, parents included
+        Rigid           = 1 << 5,   // and by exactly 1
+        DrawDataChanged = 1 << 6,   // texture transform or material set since the last Interpolate
+    };
+
+    // Where GetDrawTransforms writes an entry's matrices: byte offsets into
+    // records of Stride bytes, one record per entry.
+    struct DrawLayout
+    {
+        UINT    Stride;
+        UINT    World;
+        UINT    WorldInvTranspose;
+        UINT    WorldViewProj;
+        UINT    TexTransform;
+    };
+
+    struct BenchmarkResult
+    {
+        UINT    Count;
+        UINT    Frames;
+        double  StoreMs;        // per frame, the store's batch passes
+        double  ObjectsMs;      // per frame, the same work on separately allocated objects
+        double  DrawTransformsMs;   // per frame, GetDrawTransforms for every entry
+        double  PerEntryDrawMs;     // per frame, world * viewProj and a general inverse per entry
+    };
+
+public:
+    static SceneStore* getInstance()
+    {
+        static SceneStore sceneStore;
+        return &sceneStore;
+    }
+
+    SceneStore();
+    ~SceneStore();
+
+    Handle  Create();
+    void    Destroy(Handle h);
+    bool    IsValid(Handle h) const;
+    UINT    GetCount() const            { return (UINT)m_DenseSlot.size(); }
+
+    // Simulation side: the transform of the current tick, relative to the parent.
+    void    SetTransform(Handle h, FXMVECTOR scale, FXMVECTOR rotation, FXMVECTOR translation);
+
+    // Attaches 'h' under 'parent', or makes it a root for InvalidHandle.  The
+    // children of a destroyed entry move up to its parent.
+    void    SetParent(Handle h, Handle parent);
+    Handle  GetParent(Handle h) const;
+
+    void    SetLocalBounds(Handle h, const XNA::AxisAlignedBox& box);
+    void    SetTexTransform(Handle h, CXMMATRIX M);
+    void    SetMaterial(Handle h, const Material& mat);
+    void    SetFlag(Handle h, UINT flag, bool enable);
+
+    // The state as of the last Interpolate.
+    XMMATRIX                    GetLocal(Handle h) const;
+    XMMATRIX                    GetWorld(Handle h) const;
+    XMMATRIX                    GetInvWorld(Handle h) const;
+    XMMATRIX                    GetTexTransform(Handle h) const;
+    const Material&             GetMaterial(Handle h) const;
+    const XNA::AxisAlignedBox&  GetLocalBounds(Handle h) const;
+    const XNA::AxisAlignedBox&  GetWorldBounds(Handle h) const;
+    bool                        HasFlag(Handle h, UINT flag) const;
+
+    // The current tick transforms become the previous ones.
+    void    BeginTick();
+
+    // Blends the previous and current tick transforms by 'alpha' into the local
+    // matrices, then composes the world matrices, their inverses and the world
+    // bounds down the hierarchy, and copies what the ticks set for the frame.
+    void    Interpolate(float alpha);
+
+    // Writes the world, inverse transpose (for normals), world-view-projection
+    // and texture matrices of 'count' entries into the records at 'dest'.  The
+    // inverse transpose is the world matrix itself for rigid entries, divided
+    // by the squared scale for uniformly scaled ones and the transposed stored
+    // inverse for the rest; no entry needs a general inverse.
+    void    GetDrawTransforms(const Handle* handles, UINT count, CXMMATRIX viewProj,
+                              const DrawLayout& layout, void* dest) const;
+
+    // Checks handle reuse, compaction and the hierarchy and compares the batch
+    // results with per entry math.  Returns the number of failed checks.
+    static UINT             SelfTest();
+
+    // Moves 'count' entries for 'frames' frames.
+    static BenchmarkResult  Benchmark(UINT count, UINT frames);
+
+public:
+    SceneStore(const SceneStore& rhs)               = delete;
+    SceneStore& operator=(const SceneStore& rhs)    = delete;
+
+private:
+    static const UINT SlotBits = 20;
+    static const UINT SlotMask = (1 << SlotBits) - 1;
+    static const UINT NoParent = 0xffffffff;
+
+    // Below this many entries the passes stay on the calling thread.
+    static const UINT ParallelThreshold = 4096;
+
+    UINT    Dense(Handle h) const;
+    UINT    FindMaterial(const Material& mat);
+
+    // Permutes the dense arrays into depth-first order.
+    void    SortDepthFirst();
+
+    void    InterpolateLocal(UINT begin, UINT end, float alpha);
+    void    PropagateWorld(UINT begin, UINT end);
+
+private:
+    // Per slot.
+    std::vector<UINT>                   m_SlotDense;
+    std::vector<UINT>                   m_SlotGeneration;
+    std::vector<UINT>                   m_FreeSlots;
+
+    // Per entry, dense.
+    std::vector<UINT>                   m_DenseSlot;
+    std::vector<XMFLOAT3>               m_PrevScale;
+    std::vector<XMFLOAT4>               m_PrevRotation;
+    std::vector<XMFLOAT3>               m_PrevTranslation;
+    std::vector<XMFLOAT3>               m_CurrScale;
+    std::vector<XMFLOAT4>               m_CurrRotation;
+    std::vector<XMFLOAT3>               m_CurrTranslation;
+    std::vector<UINT>                   m_Parent;           // dense index or NoParent
+    std::vector<XMFLOAT4X4>             m_Local;
+    std::vector<XMFLOAT4X4>             m_InvLocal;
+    std::vector<XMFLOAT4X4>             m_World;
+    std::vector<XMFLOAT4X4>             m_InvWorld;
+    std::vector<XMFLOAT4X4>             m_TexTransform;
+    std::vector<XNA::AxisAlignedBox>    m_LocalBounds;
+    std::vector<XNA::AxisAlignedBox>    m_WorldBounds;
+    std::vector<UINT>                   m_Flags;
+    std::vector<UINT>                   m_MaterialIndex;
+
+    std::vector<Material>               m_Materials;
+
+    // Render side copies, written by Interpolate only.
+    std::vector<UINT>                   m_DrawFlags;
+    std::vector<XMFLOAT4X4>             m_DrawTexTransform;
+    std::vector<UINT>                   m_DrawMaterialIndex;
+    std::vector<Material>               m_DrawMaterials;
+
+    // Where each root's subtree starts in the dense arrays.
+    std::vector<UINT>                   m_RootStarts;
+    bool                                m_OrderDirty;
+};
+
+#endif // SCENESTORE_H
@@ -0,0 +1,126 @@
+//***************************************************************************************
+// Simulation.cpp
+//***************************************************************************************
+
+#include "Simulation.h"
+#include <cmath>
+
+Simulation::Simulation()
+:   m_TickTime(1.0f / 60.0f),
+    m_MaxCatchUpSteps(5),
+    m_SecondsPerCount(0.0),
+    m_Accumulator(0.0f),
+    m_TickCount(0),
+    m_DroppedTicks(0),
+    m_StopThread(false),
+    m_LastTickCounts(0)
+{
+    __int64 countsPerSec;
+    QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
+    m_SecondsPerCount = 1.0 / (double)countsPerSec;
+}
+
+Simulation::~Simulation()
+{
+    StopThread();
+}
+
+void Simulation::SetTickRate(float ticksPerSecond)
+{
+    m_TickTime = 1.0f / ticksPerSecond;
+}
+
+UINT Simulation::Advance(float dt, const TickFunction& tick)
+{
+    // GameTimer reports a negative step while it is stopped.
+    m_Accumulator += dt > 0.0f ? dt : 0.0f;
+
+    UINT steps = 0;
+    while (m_Accumulator >= m_TickTime && steps < m_MaxCatchUpSteps)
+    {
+        tick(m_TickTime);
+        m_Accumulator -= m_TickTime;
+        ++steps;
+    }
+
+    if (m_Accumulator >= m_TickTime)
+    {
+        m_DroppedTicks += (UINT)(m_Accumulator / m_TickTime);
+        m_Accumulator = fmodf(m_Accumulator, m_TickTime);
+    }
+
+    m_TickCount += steps;
+    return steps;
+}
+
+void Simulation::StartThread(const TickFunction& tick)
+{
+    if (IsThreaded())
+        return;
+
+    m_StopThread = false;
+    m_LastTickCounts = Now();
+    m_Thread = std::thread(&Simulation::ThreadMain, this, tick);
+}
+
+void Simulation::StopThread()
+{
+    if (!IsThreaded())
+        return;
+
+    m_StopThread = true;
+    m_Thread.join();
+    m_Accumulator = 0.0f;
+}
+
+float Simulation::GetAlpha() const
+{
+    float alpha = m_Accumulator / m_TickTime;
+    if (IsThreaded())
+        alpha = (float)((Now() - m_LastTickCounts) * m_SecondsPerCount) / m_TickTime;
+
+    return alpha < 0.0f ? 0.0f : (alpha > 1.0f ? 1.0f : alpha);
+}
+
+void Simulation::ThreadMain(TickFunction tick)
+{
+    const __int64 tickCounts = (__int64)(m_TickTime / m_SecondsPerCount);
+    __int64 last = m_LastTickCounts;
+
+    while (!m_StopThread)
+    {
+        __int64 now = Now();
+
+        UINT steps = 0;
+        while (now - last >= tickCounts && steps < m_MaxCatchUpSteps)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_StateMutex);
+                tick(m_TickTime);
+            }
+            last += tickCounts;
+            m_LastTickCounts = last;
+            ++steps;
+        }
+        m_TickCount += steps;
+
+        if (now - last >= tickCounts)
+        {
+            __int64 behind = (now - last) / tickCounts;
+            m_DroppedTicks += (UINT)behind;
+            last += behind * tickCounts;
+            m_LastTickCounts = last;
+        }
+
+        // Sleep is coarse, so wake up early and let the loop spin for the rest.
+        double remainingMs = 1000.0 * (last + tickCounts - Now()) * m_SecondsPerCount;
+        Sleep(remainingMs > 2.0 ? (DWORD)(remainingMs - 1.0) : 0);
+    }
+}
+
+__int64 Simulation::Now()
+{
+    __int64 counts;
+    QueryPerformanceCounter((LARGE_INTEGER*)&counts);
+    return counts;
+}
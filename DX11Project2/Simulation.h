@@ -0,0 +1,81 @@
+//***************************************************************************************
+// Simulation.h
+//
+// Runs the simulation in fixed steps, independently of the frame rate.
+//
+// Advance adds the frame time to an accumulator and runs as many whole ticks as
+// fit, at most MaxCatchUpSteps; time beyond that is dropped so a slow frame
+// makes the simulation lag instead of spiralling.  The remainder, as a fraction
+// of a tick, is the alpha the renderer interpolates the last two states with.
+//
+// With StartThread the ticks run on their own thread instead, paced by the
+// wall clock.  Each tick holds GetStateMutex; the render thread holds it while
+// it reads the simulation state.
+//***************************************************************************************
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <windows.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class Simulation
+{
+public:
+    typedef std::function<void(float)> TickFunction;
+
+public:
+    Simulation();
+    ~Simulation();
+
+    void    SetTickRate(float ticksPerSecond);
+    void    SetMaxCatchUpSteps(UINT steps)      { m_MaxCatchUpSteps = steps; }
+
+    float   GetTickTime() const                 { return m_TickTime; }
+    UINT    GetMaxCatchUpSteps() const          { return m_MaxCatchUpSteps; }
+    bool    IsThreaded() const                  { return m_Thread.joinable(); }
+
+    // Runs the ticks due after 'dt' seconds on the calling thread and returns how many ran.
+    UINT    Advance(float dt, const TickFunction& tick);
+
+    // Moves the ticks to a thread of their own until StopThread.
+    void    StartThread(const TickFunction& tick);
+    void    StopThread();
+
+    // Fraction of a tick elapsed since the last one, in [0, 1].
+    float   GetAlpha() const;
+
+    // Ticks run so far and ticks whose time was dropped.
+    UINT    GetTickCount() const                { return m_TickCount; }
+    UINT    GetDroppedTicks() const             { return m_DroppedTicks; }
+
+    std::mutex& GetStateMutex()                 { return m_StateMutex; }
+
+public:
+    Simulation(const Simulation& rhs)               = delete;
+    Simulation& operator=(const Simulation& rhs)    = delete;
+
+private:
+    void    ThreadMain(TickFunction tick);
+
+    static __int64  Now();
+
+private:
+    float               m_TickTime;
+    UINT                m_MaxCatchUpSteps;
+    double              m_SecondsPerCount;
+
+    float               m_Accumulator;
+    std::atomic<UINT>   m_TickCount;
+    std::atomic<UINT>   m_DroppedTicks;
+
+    std::thread         m_Thread;
+    std::atomic<bool>   m_StopThread;
+    std::atomic<__int64> m_LastTickCounts;      // when the threaded simulation last ticked
+    std::mutex          m_StateMutex;
+};
+
+#endif // SIMULATION_H
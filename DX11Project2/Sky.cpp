@@ -4,24 +4,22 @@
 
 #include "Sky.h"
 #include "GeometryGenerator.h"
-#include "Camera.h"
+#include "ViewContext.h"
 #include "Vertex.h"
 #include "Effects.h"
+#include "AssetArchive.h"
 
 Sky::Sky(ID3D11Device* device, const std::wstring& cubemapFilename, float skySphereRadius)
 {
-	HR(D3DX11CreateShaderResourceViewFromFile(device, cubemapFilename.c_str(), 0, 0, &m_CubeMapSRV, 0));
+	AssetArchive::Asset cubemap;
+	AssetArchive::getInstance()->Load(cubemapFilename, cubemap);
+	HR(D3DX11CreateShaderResourceViewFromMemory(device, cubemap.Data, cubemap.Size, 0, 0, &m_CubeMapSRV, 0));
 
-	GeometryGenerator::MeshData sphere;
-	GeometryGenerator geoGen;
-	geoGen.CreateSphere(skySphereRadius, 30, 30, sphere);
-
-	std::vector<XMFLOAT3> vertices(sphere.Vertices.size());
-
-	for(size_t i = 0; i < sphere.Vertices.size(); ++i)
-	{
-		vertices[i] = sphere.Vertices[i].Position;
-	}
+	// Only positions are needed, in 16-bit indices.
+	GeometryGenerator::Counts counts = GeometryGenerator::SphereCounts(30, 30);
+	std::vector<XMFLOAT3> vertices(counts.Vertices);
+	std::vector<USHORT> indices16(counts.Indices);
+	GeometryGenerator::CreateSphere(skySphereRadius, 30, 30, &vertices[0], &indices16[0]);
 
     D3D11_BUFFER_DESC vbd;
     vbd.Usage = D3D11_USAGE_IMMUTABLE;
@@ -37,7 +35,7 @@ Sky::Sky(ID3D11Device* device, const std::wstring& cubemapFilename, float skySph
     HR(device->CreateBuffer(&vbd, &vinitData, &m_VB));
 	
 
-	m_IndexCount = sphere.Indices.size();
+	m_IndexCount = indices16.size();
 
 	D3D11_BUFFER_DESC ibd;
     ibd.Usage = D3D11_USAGE_IMMUTABLE;
@@ -47,9 +45,6 @@ Sky::Sky(ID3D11Device* device, const std::wstring& cubemapFilename, float skySph
 	ibd.StructureByteStride = 0;
     ibd.MiscFlags = 0;
 
-	std::vector<USHORT> indices16;
-	indices16.assign(sphere.Indices.begin(), sphere.Indices.end());
-
     D3D11_SUBRESOURCE_DATA iinitData;
     iinitData.pSysMem = &indices16[0];
 
@@ -68,11 +63,11 @@ ID3D11ShaderResourceView* Sky::CubeMapSRV()
 	return m_CubeMapSRV;
 }
 
-void Sky::Draw(ID3D11DeviceContext* dc, const Camera& camera)
+void Sky::Draw(ID3D11DeviceContext* dc, const ViewContext& view)
 {
-	XMFLOAT3 eyePos = camera.GetPosition();
+	XMFLOAT3 eyePos = view.GetEyePosW();
 	XMMATRIX T = XMMatrixTranslation(eyePos.x, eyePos.y, eyePos.z);
-	XMMATRIX WVP = XMMatrixMultiply(T, camera.ViewProj());
+	XMMATRIX WVP = XMMatrixMultiply(T, view.ViewProj());
 
 	Effects::SkyFX->SetWorldViewProj(WVP);
 	Effects::SkyFX->SetCubeMap(m_CubeMapSRV);
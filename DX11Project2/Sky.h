@@ -9,7 +9,7 @@
 
 #include "d3dUtil.h"
 
-class Camera;
+class ViewContext;
 
 class Sky
 {
@@ -19,7 +19,7 @@ public:
 
 	ID3D11ShaderResourceView* CubeMapSRV();
 
-	void Draw(ID3D11DeviceContext* dc, const Camera& camera);
+	void Draw(ID3D11DeviceContext* dc, const ViewContext& view);
 
 public:
     Sky(const Sky& rhs)             = delete;
@@ -3,13 +3,15 @@
 //***************************************************************************************
 
 #include "Terrain.h"
-#include "Camera.h"
+#include "ViewContext.h"
 #include "LightHelper.h"
 #include "Effects.h"
 #include "Vertex.h"
 #include "RenderStates.h"
+#include "AssetArchive.h"
 #include <fstream>
 #include <sstream>
+#include <ppl.h>
 
 Terrain::Terrain() : 
 	m_QuadPatchVB(0), 
@@ -17,6 +19,11 @@ Terrain::Terrain() :
 	m_LayerMapArraySRV(0), 
 	m_BlendMapSRV(0), 
 	m_HeightMapSRV(0),
+	m_VirtualTexture(0),
+	m_PageCache(0),
+	m_PageCacheSRV(0),
+	m_PageTable(0),
+	m_PageTableSRV(0),
 	m_NumPatchVertices(0),
 	m_NumPatchQuadFaces(0),
 	m_NumPatchVertRows(0),
@@ -37,6 +44,11 @@ Terrain::~Terrain()
 	ReleaseCOM(m_LayerMapArraySRV);
 	ReleaseCOM(m_BlendMapSRV);
 	ReleaseCOM(m_HeightMapSRV);
+	ReleaseCOM(m_PageCacheSRV);
+	ReleaseCOM(m_PageCache);
+	ReleaseCOM(m_PageTableSRV);
+	ReleaseCOM(m_PageTable);
+	SafeDelete(m_VirtualTexture);
 }
 
 float Terrain::GetWidth()const
@@ -118,19 +130,18 @@ void Terrain::Init(ID3D11Device* device, ID3D11DeviceContext* dc, const InitInfo
 	BuildQuadPatchIB(device);
 	BuildHeightmapSRV(device);
 
-// 	std::vector<std::wstring> layerFilenames;
-// 	layerFilenames.push_back(m_Info.LayerMapFilename0);
-// 	layerFilenames.push_back(m_Info.LayerMapFilename1);
-// 	layerFilenames.push_back(m_Info.LayerMapFilename2);
-// 	layerFilenames.push_back(m_Info.LayerMapFilename3);
-// 	layerFilenames.push_back(m_Info.LayerMapFilename4);
-// 	m_LayerMapArraySRV = d3dHelper::CreateTexture2DArraySRV(device, dc, layerFilenames);
+	AssetArchive::Asset blendMap;
+	AssetArchive::getInstance()->Load(m_Info.BlendMapFilename, blendMap);
+	HR(D3DX11CreateShaderResourceViewFromMemory(device, 
+		blendMap.Data, blendMap.Size, 0, 0, &m_BlendMapSRV, 0));
 
-	HR(D3DX11CreateShaderResourceViewFromFile(device, 
-		m_Info.BlendMapFilename.c_str(), 0, 0, &m_BlendMapSRV, 0));
+	// Instead of sampling five layers per pixel, the layers are blended on the
+	// CPU into virtual texture pages as the camera comes close to them.
+	if( !m_Info.LayerMapFilename0.empty() )
+		BuildVirtualTexture(device, dc);
 }
 
-void Terrain::Draw(ID3D11DeviceContext* dc, const Camera& cam, DirectionalLight lights[3])
+void Terrain::Draw(ID3D11DeviceContext* dc, const ViewContext& view, DirectionalLight lights[3])
 {
 	dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_4_CONTROL_POINT_PATCHLIST);
 	dc->IASetInputLayout(InputLayouts::Terrain);
@@ -140,47 +151,35 @@ void Terrain::Draw(ID3D11DeviceContext* dc, const Camera& cam, DirectionalLight
     dc->IASetVertexBuffers(0, 1, &m_QuadPatchVB, &stride, &offset);
 	dc->IASetIndexBuffer(m_QuadPatchIB, DXGI_FORMAT_R16_UINT, 0);
 
-	XMMATRIX viewProj = cam.ViewProj();
-	XMMATRIX world  = XMLoadFloat4x4(&m_World);
-	XMMATRIX worldInvTranspose = MathHelper::InverseTranspose(world);
-	XMMATRIX worldViewProj = world*viewProj;
-
-	XMFLOAT4 worldPlanes[6];
-	ExtractFrustumPlanes(worldPlanes, viewProj);
-
-	// Set per frame constants.
-	Effects::TerrainFX->SetViewProj(viewProj);
-	Effects::TerrainFX->SetEyePosW(cam.GetPosition());
+	// Set per frame constants.  The effect skips values that did not change,
+	// so everything but the camera dependent data only uploads once.
+	Effects::TerrainFX->SetViewProj(view.ViewProj());
+	Effects::TerrainFX->SetEyePosW(view.GetEyePosW());
 	Effects::TerrainFX->SetDirLights(lights);
-	Effects::TerrainFX->SetFogColor(Colors::Silver);
-	Effects::TerrainFX->SetFogStart(15.0f);
-	Effects::TerrainFX->SetFogRange(175.0f);
-	Effects::TerrainFX->SetMinDist(20.0f);
-	Effects::TerrainFX->SetMaxDist(500.0f);
-	Effects::TerrainFX->SetMinTess(1.0f);
-	Effects::TerrainFX->SetMaxTess(6.0f);
-	Effects::TerrainFX->SetTexelCellSpaceU(1.0f / m_Info.HeightmapWidth);
-	Effects::TerrainFX->SetTexelCellSpaceV(1.0f / m_Info.HeightmapHeight);
-	Effects::TerrainFX->SetWorldCellSpace(m_Info.CellSpacing);
-	Effects::TerrainFX->SetWorldFrustumPlanes(worldPlanes);
-	
-	//Effects::TerrainFX->SetLayerMapArray(m_LayerMapArraySRV);
-	Effects::TerrainFX->SetBlendMap(m_BlendMapSRV);
-	Effects::TerrainFX->SetHeightMap(m_HeightMapSRV);
+	Effects::TerrainFX->SetWorldFrustumPlanes(view.GetPlanes());
+	SetSceneConstants();
 
-	Effects::TerrainFX->SetMaterial(m_Mat);
+	if( m_VirtualTexture )
+		UpdateVirtualTexture(dc, view);
+	UINT texturing = m_VirtualTexture ? TerrainVirtualTexture : 0;
 
     ID3DX11EffectTechnique* tech = 0;
     switch (RenderStates::m_RenderOptions)
     {
     case RenderOptions::Lighting:
-        tech = Effects::TerrainFX->m_Light1Tech;
+        tech = Effects::TerrainFX->SelectTech(1);
         break;
     case RenderOptions::Textures:
-        tech = Effects::TerrainFX->m_Light3Tech;
+        tech = Effects::TerrainFX->SelectTech(3 | texturing);
         break;
     case RenderOptions::TexturesAndFog:
-        tech = Effects::TerrainFX->m_Light3FogTech;
+        tech = Effects::TerrainFX->SelectTech(3 | TerrainFog | texturing);
+        break;
+    case RenderOptions::ClusteredLights:
+        tech = Effects::TerrainFX->SelectTech(3 | TerrainFog | TerrainClustered | texturing);
+        break;
+    case RenderOptions::Shadows:
+        tech = Effects::TerrainFX->SelectTech(3 | TerrainFog | TerrainShadowReceive | texturing);
         break;
     }
     D3DX11_TECHNIQUE_DESC techDesc;
@@ -200,23 +199,300 @@ void Terrain::Draw(ID3D11DeviceContext* dc, const Camera& cam, DirectionalLight
 	dc->DSSetShader(0, 0, 0);
 }
 
-void Terrain::LoadHeightmap()
+void Terrain::DrawShadow(ID3D11DeviceContext* dc, const ViewContext& view, CXMMATRIX lightViewProj,
+	const std::vector<UINT>& patches)
+{
+	if( patches.empty() )
+		return;
+
+	dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_4_CONTROL_POINT_PATCHLIST);
+	dc->IASetInputLayout(InputLayouts::Terrain);
+
+	UINT stride = sizeof(Vertex::Terrain);
+	UINT offset = 0;
+	dc->IASetVertexBuffers(0, 1, &m_QuadPatchVB, &stride, &offset);
+	dc->IASetIndexBuffer(m_QuadPatchIB, DXGI_FORMAT_R16_UINT, 0);
+
+	// The hull shader culls against the cascade volume instead of the camera frustum.
+	XMFLOAT4 worldPlanes[6];
+	ExtractFrustumPlanes(worldPlanes, lightViewProj);
+
+	Effects::TerrainFX->SetViewProj(lightViewProj);
+	Effects::TerrainFX->SetEyePosW(view.GetEyePosW());
+	Effects::TerrainFX->SetWorldFrustumPlanes(worldPlanes);
+	SetSceneConstants();
+
+	ID3DX11EffectTechnique* tech = Effects::TerrainFX->SelectTech(TerrainShadowCaster);
+	D3DX11_TECHNIQUE_DESC techDesc;
+	tech->GetDesc( &techDesc );
+
+	for(UINT p = 0; p < techDesc.Passes; ++p)
+	{
+		tech->GetPassByIndex(p)->Apply(0, dc);
+
+		// Every patch is 4 indices at 4*patchID; draw runs of consecutive patches at once.
+		for(UINT i = 0; i < patches.size(); )
+		{
+			UINT first = patches[i];
+			UINT count = 1;
+			while( i + count < patches.size() && patches[i + count] == first + count )
+				++count;
+
+			dc->DrawIndexed(count*4, first*4, 0);
+			i += count;
+		}
+	}
+
+	dc->HSSetShader(0, 0, 0);
+	dc->DSSetShader(0, 0, 0);
+}
+
+void Terrain::SetSceneConstants()
 {
-	std::vector<unsigned char> in( m_Info.HeightmapWidth * m_Info.HeightmapHeight );
+	Effects::TerrainFX->SetFogColor(Colors::Silver);
+	Effects::TerrainFX->SetFogStart(15.0f);
+	Effects::TerrainFX->SetFogRange(175.0f);
+	Effects::TerrainFX->SetMinDist(20.0f);
+	Effects::TerrainFX->SetMaxDist(500.0f);
+	Effects::TerrainFX->SetMinTess(1.0f);
+	Effects::TerrainFX->SetMaxTess(6.0f);
+	Effects::TerrainFX->SetTexelCellSpaceU(1.0f / m_Info.HeightmapWidth);
+	Effects::TerrainFX->SetTexelCellSpaceV(1.0f / m_Info.HeightmapHeight);
+	Effects::TerrainFX->SetWorldCellSpace(m_Info.CellSpacing);
 
-	std::ifstream inFile;
-	inFile.open(m_Info.HeightMapFilename.c_str(), std::ios_base::binary);
+	//Effects::TerrainFX->SetLayerMapArray(m_LayerMapArraySRV);
+	Effects::TerrainFX->SetBlendMap(m_BlendMapSRV);
+	Effects::TerrainFX->SetHeightMap(m_HeightMapSRV);
 
-	if(inFile)
+	Effects::TerrainFX->SetVirtualTextureLayout(XMFLOAT4((float)VirtualPages, (float)PageSize,
+		(float)PageBorder, (float)(CacheSlotsPerSide*PageSize)));
+	Effects::TerrainFX->SetPageTable(m_PageTableSRV);
+	Effects::TerrainFX->SetPageCache(m_PageCacheSRV);
+
+	Effects::TerrainFX->SetMaterial(m_Mat);
+}
+
+VirtualTexture::Stats Terrain::GetVirtualTextureStats()const
+{
+	VirtualTexture::Stats stats;
+	ZeroMemory(&stats, sizeof(stats));
+	if( m_VirtualTexture )
+		stats = m_VirtualTexture->GetStats();
+	return stats;
+}
+
+XMVECTOR Terrain::SampleImage(const TextureCompressor::Image& level, float u, float v, bool wrap)
+{
+	// Bilinear, with texel centers at half integers like the GPU.
+	float x = u*level.Width - 0.5f;
+	float y = v*level.Height - 0.5f;
+	float x0 = floorf(x);
+	float y0 = floorf(y);
+
+	int w = (int)level.Width;
+	int h = (int)level.Height;
+	int xs[2] = { (int)x0, (int)x0 + 1 };
+	int ys[2] = { (int)y0, (int)y0 + 1 };
+	for(int k = 0; k < 2; ++k)
 	{
-		inFile.read((char*)&in[0], (std::streamsize)in.size());
-		inFile.close();
+		xs[k] = wrap ? ((xs[k] % w) + w) % w : MathHelper::Clamp(xs[k], 0, w-1);
+		ys[k] = wrap ? ((ys[k] % h) + h) % h : MathHelper::Clamp(ys[k], 0, h-1);
 	}
 
+	const XMUBYTEN4* texels = reinterpret_cast<const XMUBYTEN4*>(&level.Texels[0]);
+	XMVECTOR c00 = XMLoadUByteN4(&texels[ys[0]*w + xs[0]]);
+	XMVECTOR c10 = XMLoadUByteN4(&texels[ys[0]*w + xs[1]]);
+	XMVECTOR c01 = XMLoadUByteN4(&texels[ys[1]*w + xs[0]]);
+	XMVECTOR c11 = XMLoadUByteN4(&texels[ys[1]*w + xs[1]]);
+
+	return XMVectorLerp(XMVectorLerp(c00, c10, x - x0), XMVectorLerp(c01, c11, x - x0), y - y0);
+}
+
+void Terrain::BuildVirtualTexture(ID3D11Device* device, ID3D11DeviceContext* dc)
+{
+	const std::wstring* layerFilenames[5] = 
+	{
+		&m_Info.LayerMapFilename0,
+		&m_Info.LayerMapFilename1,
+		&m_Info.LayerMapFilename2,
+		&m_Info.LayerMapFilename3,
+		&m_Info.LayerMapFilename4,
+	};
+	for(UINT i = 0; i < 5; ++i)
+	{
+		TextureCompressor::ReadImage(device, dc, *layerFilenames[i], m_LayerImages[i]);
+	}
+	TextureCompressor::ReadImage(device, dc, m_Info.BlendMapFilename, m_BlendImage);
+
+	VirtualTexture::Desc desc = { VirtualPages, CacheSlotsPerSide, MaxPageUploads };
+	m_VirtualTexture = new VirtualTexture(desc);
+
+	// The physical cache, filled a page at a time by UpdateVirtualTexture.
+	D3D11_TEXTURE2D_DESC texDesc;
+	texDesc.Width = CacheSlotsPerSide*PageSize;
+	texDesc.Height = CacheSlotsPerSide*PageSize;
+	texDesc.MipLevels = 1;
+	texDesc.ArraySize = 1;
+	texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	texDesc.SampleDesc.Count   = 1;
+	texDesc.SampleDesc.Quality = 0;
+	texDesc.Usage = D3D11_USAGE_DEFAULT;
+	texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	texDesc.CPUAccessFlags = 0;
+	texDesc.MiscFlags = 0;
+	HR(device->CreateTexture2D(&texDesc, 0, &m_PageCache));
+	HR(device->CreateShaderResourceView(m_PageCache, 0, &m_PageCacheSRV));
+
+	// The page table, one texel per mip 0 page; the packed entries read back
+	// as slot x, slot y and mip in the first three channels.
+	texDesc.Width = VirtualPages;
+	texDesc.Height = VirtualPages;
+	texDesc.Format = DXGI_FORMAT_R8G8B8A8_UINT;
+
+	D3D11_SUBRESOURCE_DATA data;
+	data.pSysMem = &m_VirtualTexture->GetTable()[0];
+	data.SysMemPitch = VirtualPages*sizeof(UINT);
+	data.SysMemSlicePitch = 0;
+	HR(device->CreateTexture2D(&texDesc, &data, &m_PageTable));
+	HR(device->CreateShaderResourceView(m_PageTable, 0, &m_PageTableSRV));
+}
+
+void Terrain::UpdateVirtualTexture(ID3D11DeviceContext* dc, const ViewContext& view)
+{
+	// Each cell of a grid over the terrain asks for the pages under it at the mip
+	// whose texels come closest to a pixel at the nearest point of the cell.
+	// Cells take their heights from the patch around them.
+	float texelsPerUnit = (float)(VirtualPages*(PageSize - 2*PageBorder)) / GetWidth();
+	float cellWidth = GetWidth() / LodCells;
+	float cellDepth = GetDepth() / LodCells;
+	UINT patchCols = m_NumPatchVertCols-1;
+	UINT patchRows = m_NumPatchVertRows-1;
+
+	XMVECTOR eye = XMLoadFloat3(&view.GetEyePosW());
+	const XMFLOAT4* planes = view.GetPlanes();
+
+	m_VirtualTexture->BeginFrame();
+	for(UINT i = 0; i < LodCells; ++i)
+	{
+		for(UINT j = 0; j < LodCells; ++j)
+		{
+			XMFLOAT2 boundsY = m_PatchBoundsY[(i*patchRows/LodCells)*patchCols + j*patchCols/LodCells];
+			XMVECTOR center = XMVectorSet(-0.5f*GetWidth() + (j + 0.5f)*cellWidth, 0.5f*(boundsY.x + boundsY.y),
+				0.5f*GetDepth() - (i + 0.5f)*cellDepth, 0.0f);
+			XMVECTOR extents = XMVectorSet(0.5f*cellWidth, 0.5f*(boundsY.y - boundsY.x), 0.5f*cellDepth, 0.0f);
+
+			// Same test as AabbBehindPlaneTest in Terrain.fx.
+			bool outside = false;
+			for(UINT p = 0; p < 6 && !outside; ++p)
+			{
+				XMVECTOR plane = XMLoadFloat4(&planes[p]);
+				float r = XMVectorGetX(XMVector3Dot(extents, XMVectorAbs(plane)));
+				float s = XMVectorGetX(XMVector3Dot(center, plane)) + planes[p].w;
+				outside = s + r < 0.0f;
+			}
+			if( outside )
+				continue;
+
+			XMVECTOR nearest = XMVectorClamp(eye, XMVectorSubtract(center, extents), XMVectorAdd(center, extents));
+			float dist = XMVectorGetX(XMVector3Length(XMVectorSubtract(eye, nearest)));
+
+			// Round log2 of the texels per pixel.
+			float texelsPerPixel = texelsPerUnit*dist / view.GetPixelScale();
+			UINT mip = 0;
+			while( texelsPerPixel >= 1.5f && mip + 1 < m_VirtualTexture->GetMipCount() )
+			{
+				texelsPerPixel *= 0.5f;
+				++mip;
+			}
+
+			// Pulled in a little so a cell does not ask for its neighbours' pages.
+			m_VirtualTexture->RequestRect((j + 0.01f) / LodCells, (i + 0.01f) / LodCells,
+				(j + 0.99f) / LodCells, (i + 0.99f) / LodCells, mip);
+		}
+	}
+	m_VirtualTexture->EndFrame();
+
+	const std::vector<VirtualTexture::Upload>& uploads = m_VirtualTexture->GetUploads();
+	if( uploads.empty() )
+		return;
+
+	// Bake in parallel, upload from this thread.
+	UINT pageTexels = PageSize*PageSize;
+	m_PageTexels.resize(uploads.size()*pageTexels);
+	concurrency::parallel_for(0u, (UINT)uploads.size(), [&](UINT k)
+	{
+		BakePage(uploads[k].Source, &m_PageTexels[k*pageTexels]);
+	});
+
+	for(UINT k = 0; k < uploads.size(); ++k)
+	{
+		D3D11_BOX box;
+		box.left   = (uploads[k].Slot % CacheSlotsPerSide)*PageSize;
+		box.top    = (uploads[k].Slot / CacheSlotsPerSide)*PageSize;
+		box.right  = box.left + PageSize;
+		box.bottom = box.top + PageSize;
+		box.front  = 0;
+		box.back   = 1;
+		dc->UpdateSubresource(m_PageCache, 0, &box, &m_PageTexels[k*pageTexels], PageSize*sizeof(UINT), 0);
+	}
+
+	if( m_VirtualTexture->TableChanged() )
+	{
+		dc->UpdateSubresource(m_PageTable, 0, 0, &m_VirtualTexture->GetTable()[0], VirtualPages*sizeof(UINT), 0);
+	}
+}
+
+void Terrain::BakePage(const VirtualTexture::Page& page, UINT* texels)const
+{
+	// Virtual texels across the terrain at the page's mip, and for every layer
+	// the level whose texels come closest to them once tiled.
+	UINT inner = PageSize - 2*PageBorder;
+	float virtualTexels = (float)((VirtualPages >> page.Mip)*inner);
+
+	const TextureCompressor::Image* layers[5];
+	for(UINT i = 0; i < 5; ++i)
+	{
+		UINT level = 0;
+		float ratio = LayerTiling*m_LayerImages[i][0].Width / virtualTexels;
+		while( ratio >= 1.5f && level + 1 < m_LayerImages[i].size() )
+		{
+			ratio *= 0.5f;
+			++level;
+		}
+		layers[i] = &m_LayerImages[i][level];
+	}
+
+	// The blend of Terrain.fx: layer 0, then layers 1 to 4 by the blend map's channels.
+	for(UINT y = 0; y < PageSize; ++y)
+	{
+		float v = ((float)(page.Y*inner + y) - PageBorder + 0.5f) / virtualTexels;
+		for(UINT x = 0; x < PageSize; ++x)
+		{
+			float u = ((float)(page.X*inner + x) - PageBorder + 0.5f) / virtualTexels;
+
+			XMVECTOR t = SampleImage(m_BlendImage[0], u, v, false);
+			XMVECTOR c = SampleImage(*layers[0], u*LayerTiling, v*LayerTiling, true);
+			c = XMVectorLerpV(c, SampleImage(*layers[1], u*LayerTiling, v*LayerTiling, true), XMVectorSplatX(t));
+			c = XMVectorLerpV(c, SampleImage(*layers[2], u*LayerTiling, v*LayerTiling, true), XMVectorSplatY(t));
+			c = XMVectorLerpV(c, SampleImage(*layers[3], u*LayerTiling, v*LayerTiling, true), XMVectorSplatZ(t));
+			c = XMVectorLerpV(c, SampleImage(*layers[4], u*LayerTiling, v*LayerTiling, true), XMVectorSplatW(t));
+
+			XMStoreUByteN4(reinterpret_cast<XMUBYTEN4*>(&texels[y*PageSize + x]), c);
+		}
+	}
+}
+
+void Terrain::LoadHeightmap()
+{
+	AssetArchive::Asset in;
+	AssetArchive::getInstance()->Load(m_Info.HeightMapFilename, in);
+
+	// A short or missing file leaves the rest flat, as before.
 	m_Heightmap.resize(m_Info.HeightmapHeight * m_Info.HeightmapWidth, 0);
-	for(UINT i = 0; i < m_Info.HeightmapHeight * m_Info.HeightmapWidth; ++i)
+	UINT count = MathHelper::Min(in.Size, m_Info.HeightmapHeight * m_Info.HeightmapWidth);
+	for(UINT i = 0; i < count; ++i)
 	{
-		m_Heightmap[i] = (in[i] / 255.0f)*m_Info.HeightScale;
+		m_Heightmap[i] = (in.Data[i] / 255.0f)*m_Info.HeightScale;
 	}
 }
 
@@ -270,6 +546,7 @@ float Terrain::Average(int i, int j)
 void Terrain::CalcAllPatchBoundsY()
 {
 	m_PatchBoundsY.resize(m_NumPatchQuadFaces);
+	m_PatchBounds.resize(m_NumPatchQuadFaces);
 
 	for(UINT i = 0; i < m_NumPatchVertRows-1; ++i)
 	{
@@ -302,6 +579,68 @@ void Terrain::CalcPatchBoundsY(UINT i, UINT j)
 
 	UINT patchID = i*(m_NumPatchVertCols-1)+j;
 	m_PatchBoundsY[patchID] = XMFLOAT2(minY, maxY);
+
+	// Same layout as BuildQuadPatchVB: rows run from +z to -z.
+	float patchWidth = GetWidth() / (m_NumPatchVertCols-1);
+	float patchDepth = GetDepth() / (m_NumPatchVertRows-1);
+	float centerX = -0.5f*GetWidth() + (j + 0.5f)*patchWidth;
+	float centerZ = 0.5f*GetDepth() - (i + 0.5f)*patchDepth;
+
+	m_PatchBounds[patchID].Center  = XMFLOAT3(centerX, 0.5f*(minY + maxY), centerZ);
+	m_PatchBounds[patchID].Extents = XMFLOAT3(0.5f*patchWidth, 0.5f*(maxY - minY), 0.5f*patchDepth);
+}
+
+void Terrain::BuildOccluder(std::vector<XMFLOAT3>& vertices, std::vector<UINT>& indices, UINT step)const
+{
+	UINT numCols = (m_Info.HeightmapWidth-1) / step + 1;
+	UINT numRows = (m_Info.HeightmapHeight-1) / step + 1;
+
+	float halfWidth = 0.5f*GetWidth();
+	float halfDepth = 0.5f*GetDepth();
+
+	XMMATRIX world = XMLoadFloat4x4(&m_World);
+
+	// Same layout as BuildQuadPatchVB: rows run from +z to -z.
+	vertices.resize(numRows*numCols);
+	for(UINT i = 0; i < numRows; ++i)
+	{
+		for(UINT j = 0; j < numCols; ++j)
+		{
+			// Lowest height of the cells touching this vertex.
+			int y0 = MathHelper::Max((int)(i*step) - (int)step, 0);
+			int y1 = MathHelper::Min((int)(i*step) + (int)step, (int)m_Info.HeightmapHeight-1);
+			int x0 = MathHelper::Max((int)(j*step) - (int)step, 0);
+			int x1 = MathHelper::Min((int)(j*step) + (int)step, (int)m_Info.HeightmapWidth-1);
+
+			float minY = +MathHelper::Infinity;
+			for(int y = y0; y <= y1; ++y)
+			{
+				for(int x = x0; x <= x1; ++x)
+				{
+					minY = MathHelper::Min(minY, m_Heightmap[y*m_Info.HeightmapWidth + x]);
+				}
+			}
+
+			XMVECTOR p = XMVectorSet(-halfWidth + j*step*m_Info.CellSpacing, minY, halfDepth - i*step*m_Info.CellSpacing, 1.0f);
+			XMStoreFloat3(&vertices[i*numCols+j], XMVector3TransformCoord(p, world));
+		}
+	}
+
+	indices.clear();
+	indices.reserve((numRows-1)*(numCols-1)*6);
+	for(UINT i = 0; i < numRows-1; ++i)
+	{
+		for(UINT j = 0; j < numCols-1; ++j)
+		{
+			indices.push_back(i*numCols+j);
+			indices.push_back(i*numCols+j+1);
+			indices.push_back((i+1)*numCols+j);
+
+			indices.push_back((i+1)*numCols+j);
+			indices.push_back(i*numCols+j+1);
+			indices.push_back((i+1)*numCols+j+1);
+		}
+	}
 }
 
 void Terrain::BuildQuadPatchVB(ID3D11Device* device)
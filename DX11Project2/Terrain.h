@@ -8,8 +8,10 @@
 #define TERRAIN_H
 
 #include "d3dUtil.h"
+#include "VirtualTexture.h"
+#include "TextureCompressor.h"
 
-class Camera;
+class ViewContext;
 struct DirectionalLight;
 
 class Terrain
@@ -43,9 +45,26 @@ public:
 
 	void Init(ID3D11Device* device, ID3D11DeviceContext* dc, const InitInfo& initInfo);
 
-	void Draw(ID3D11DeviceContext* dc, const Camera& cam, DirectionalLight lights[3]);
+	void Draw(ID3D11DeviceContext* dc, const ViewContext& view, DirectionalLight lights[3]);
+
+	// World bounds of every patch, in patch ID order.
+	const std::vector<XNA::AxisAlignedBox>& GetPatchBounds()const { return m_PatchBounds; }
+
+	// Coarse occluder mesh with a vertex every 'step' heightmap cells, in world space.
+	// Each vertex takes the lowest height around it, so the mesh stays under the
+	// real surface.
+	void BuildOccluder(std::vector<XMFLOAT3>& vertices, std::vector<UINT>& indices, UINT step)const;
+
+	// Draws the given patches depth only with 'lightViewProj'.  The camera still
+	// drives the tessellation so the shadow matches the terrain that is seen.
+	void DrawShadow(ID3D11DeviceContext* dc, const ViewContext& view, CXMMATRIX lightViewProj,
+		const std::vector<UINT>& patches);
+
+	// Page cache activity of the last Draw; all zero without layer maps.
+	VirtualTexture::Stats GetVirtualTextureStats()const;
 
 private:
+	void SetSceneConstants();
 	void LoadHeightmap();
 	void Smooth();
 	bool InBounds(int i, int j);
@@ -56,6 +75,16 @@ private:
 	void BuildQuadPatchIB(ID3D11Device* device);
 	void BuildHeightmapSRV(ID3D11Device* device);
 
+	// CPU copies of the layer and blend images and their mip chains, read by
+	// TextureCompressor::ReadImage and used to bake pages.
+	typedef std::vector<TextureCompressor::Image> MipChain;
+
+	static XMVECTOR SampleImage(const TextureCompressor::Image& level, float u, float v, bool wrap);
+
+	void BuildVirtualTexture(ID3D11Device* device, ID3D11DeviceContext* dc);
+	void UpdateVirtualTexture(ID3D11DeviceContext* dc, const ViewContext& view);
+	void BakePage(const VirtualTexture::Page& page, UINT* texels)const;
+
 private:
 
 	// Divide heightmap into patches such that each patch has CellsPerPatch cells
@@ -63,6 +92,19 @@ private:
 	// to 64, we use all the data from the heightmap.  
 	static const int CellsPerPatch = 64;
 
+	// The blended layers form one virtual texture of VirtualPages x VirtualPages
+	// pages over the whole terrain.  Every page is PageSize texels across, with
+	// PageBorder texels of its neighbours around it for bilinear filtering.
+	static const UINT VirtualPages = 64;
+	static const UINT PageSize = 128;
+	static const UINT PageBorder = 1;
+	static const UINT CacheSlotsPerSide = 20;
+	static const UINT MaxPageUploads = 8;
+	static const UINT LayerTiling = 50; // gTexScale in Terrain.fx
+
+	// The camera estimate picks one mip per cell of a LodCells x LodCells grid.
+	static const UINT LodCells = 32;
+
 	ID3D11Buffer* m_QuadPatchVB;
 	ID3D11Buffer* m_QuadPatchIB;
 
@@ -70,6 +112,15 @@ private:
 	ID3D11ShaderResourceView* m_BlendMapSRV;
 	ID3D11ShaderResourceView* m_HeightMapSRV;
 
+	VirtualTexture* m_VirtualTexture;
+	MipChain m_LayerImages[5];
+	MipChain m_BlendImage;
+	ID3D11Texture2D* m_PageCache;
+	ID3D11ShaderResourceView* m_PageCacheSRV;
+	ID3D11Texture2D* m_PageTable;
+	ID3D11ShaderResourceView* m_PageTableSRV;
+	std::vector<UINT> m_PageTexels; // staging for this frame's uploads
+
 	InitInfo m_Info;
 
 	UINT m_NumPatchVertices;
@@ -83,6 +134,7 @@ private:
 	Material m_Mat;
 
 	std::vector<XMFLOAT2> m_PatchBoundsY;
+	std::vector<XNA::AxisAlignedBox> m_PatchBounds;
 	std::vector<float> m_Heightmap;
 };
 
@@ -0,0 +1,293 @@
+//***************************************************************************************
+// TestMain.cpp
+//
+// Console runner for the engine's self tests.  Everything it checks runs on the
+// CPU, without a window or a device, so it runs anywhere the engine builds.
+//
+//   Tests                  runs every suite
+//   Tests <suite>...       runs the named suites
+//   Tests -replay <file> [-tickrate <hz>]
+//                          plays a session recorded with -record back without
+//                          a window and reports the frame times
+//   Tests -bench <name>    runs a benchmark and prints its results: scene, tree,
+//                          collision, bc, io, random or waves
+//
+// Prints one line per suite and exits with 1 when any check failed.  Run it
+// from the DX11Project2 directory, where the engine finds its assets.
+//***************************************************************************************
+
+#include "ClusteredLighting.h"
+#include "CascadedShadows.h"
+#include "OcclusionCulling.h"
+#include "FramePacer.h"
+#include "SceneStore.h"
+#include "MeshAsset.h"
+#include "DynamicAabbTree.h"
+#include "CollisionWorld.h"
+#include "Land.h"
+#include "VirtualTexture.h"
+#include "TextureCompressor.h"
+#include "TextureArrays.h"
+#include "AssetArchive.h"
+#include "Random.h"
+#include "WaveSimulation.h"
+#include "D3DManager.h"
+#include "InputRecorder.h"
+#include "GameTimer.h"
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+    // A self test returns the number of checks that failed.
+    struct Suite
+    {
+        const wchar_t*  Name;
+        UINT            (*Run)();
+    };
+
+    const Suite Suites[] =
+    {
+        { L"ClusteredLighting",     ClusteredLighting::SelfTest },
+        { L"CascadedShadows",       CascadedShadows::SelfTest },
+        { L"OcclusionCulling",      OcclusionCulling::SelfTest },
+        { L"FramePacer",            FramePacer::SelfTest },
+        { L"SceneStore",            SceneStore::SelfTest },
+        { L"MeshAsset",             MeshAsset::SelfTest },
+        { L"DynamicAabbTree",       DynamicAabbTree::SelfTest },
+        { L"CollisionWorld",        CollisionWorld::SelfTest },
+        { L"Land",                  Land::SelfTest },
+        { L"VirtualTexture",        VirtualTexture::SelfTest },
+        { L"TextureCompressor",     TextureCompressor::SelfTest },
+        { L"TextureArrays",         TextureArrays::SelfTest },
+        { L"AssetArchive",          AssetArchive::SelfTest },
+        { L"Random",                Random::SelfTest },
+        { L"WaveSimulation",        WaveSimulation::SelfTest },
+    };
+
+    // A benchmark prints its own results.
+    struct Bench
+    {
+        const wchar_t*  Name;
+        void            (*Run)();
+    };
+
+    // The scene store and its draw transforms against per object math.
+    void BenchScene()
+    {
+        SceneStore::BenchmarkResult bench = SceneStore::Benchmark(100000, 60);
+        wprintf(L"%u transforms, %u frames\n", bench.Count, bench.Frames);
+        wprintf(L"Scene store: %.3f ms per frame\n", bench.StoreMs);
+        wprintf(L"Objects: %.3f ms per frame\n", bench.ObjectsMs);
+        wprintf(L"Draw transforms: %.3f ms per frame\n", bench.DrawTransformsMs);
+        wprintf(L"Per object draw transforms: %.3f ms per frame\n", bench.PerEntryDrawMs);
+    }
+
+    // The scene tree's queries against testing every box.
+    void BenchTree()
+    {
+        UINT counts[] = { 10000, 100000 };
+        for (UINT count : counts)
+        {
+            DynamicAabbTree::BenchmarkResult bench = DynamicAabbTree::Benchmark(count, 60);
+            wprintf(L"%u moving boxes, %u frames, height %u\n", bench.Count, bench.Frames, bench.Height);
+            wprintf(L"Update: %.3f ms per frame\n", bench.UpdateMs);
+            wprintf(L"Tree queries: %.3f ms per frame\n", bench.TreeQueryMs);
+            wprintf(L"Brute force: %.3f ms per frame\n\n", bench.BruteQueryMs);
+        }
+    }
+
+    // The collision pipeline at 1k, 10k and 50k bodies.
+    void BenchCollision()
+    {
+        UINT counts[] = { 1000, 10000, 50000 };
+        for (UINT count : counts)
+        {
+            CollisionWorld::BenchmarkResult bench = CollisionWorld::Benchmark(count, 60);
+            wprintf(L"%u bodies, %u frames: %u pairs, %u touching\n", bench.Count, bench.Frames, bench.Candidates, bench.Touching);
+            wprintf(L"Broadphase: %.3f ms per frame\n", bench.BroadphaseMs);
+            wprintf(L"Narrowphase: %.3f ms per frame\n", bench.NarrowphaseMs);
+            wprintf(L"All pairs of bounds: %.3f ms\n\n", bench.BruteForceMs);
+        }
+    }
+
+    // The block compressor on a 1024 x 1024 image and its mips in every format.
+    void BenchBlockCompression()
+    {
+        TextureCompressor::BenchmarkResult bench = TextureCompressor::Benchmark(1024);
+        wprintf(L"%u x %u and mips\n", bench.Size, bench.Size);
+        for (UINT f = 0; f < TextureCompressor::FormatCount; ++f)
+        {
+            wprintf(L"%s: %.3f ms, RMSE %.3f\n", TextureCompressor::GetName((TextureCompressor::Format)f),
+                bench.Ms[f], bench.Rmse[f]);
+        }
+    }
+
+    // Loading the files of Assets.pak loose against through the pack.
+    void BenchAssetPack()
+    {
+        AssetArchive::BenchmarkResult bench = AssetArchive::Benchmark(L"Assets.pak");
+        if (bench.Files == 0)
+        {
+            wprintf(L"Assets.pak could not be mounted.\n");
+            return;
+        }
+        wprintf(L"%u files, %llu KB, packed in %llu KB\n", bench.Files, bench.Bytes / 1024, bench.PackBytes / 1024);
+        wprintf(L"Loose: %u opens, %u reads, %.3f ms\n", bench.Loose.Opens, bench.Loose.Reads, bench.Loose.Ms);
+        wprintf(L"Pack: %u opens, %u reads, %.3f ms\n", bench.Packed.Opens, bench.Packed.Reads, bench.Packed.Ms);
+    }
+
+    // The random number generator against rand().
+    void BenchRandom()
+    {
+        Random::BenchmarkResult bench = Random::Benchmark(1 << 22);
+        wprintf(L"%u values\n", bench.Count);
+        wprintf(L"rand(): %.3f ms\n", bench.RandMs);
+        wprintf(L"NextFloat: %.3f ms\n", bench.NextMs);
+        wprintf(L"FillFloats: %.3f ms\n", bench.FillMs);
+        wprintf(L"Unit vectors, rand() and rejection: %.3f ms\n", bench.RandUnitVec3Ms);
+        wprintf(L"FillUnitVec3: %.3f ms\n", bench.FillUnitVec3Ms);
+        wprintf(L"FillUnitVec3 over tasks: %.3f ms\n", bench.ParallelFillMs);
+    }
+
+    // The water solver on 256, 512 and 1024 square grids.
+    void BenchWaves()
+    {
+        UINT sizes[] = { 256, 512, 1024 };
+        for (UINT size : sizes)
+        {
+            WaveSimulation::BenchmarkResult bench = WaveSimulation::Benchmark(size, 200);
+            wprintf(L"%u x %u, %u steps\n", bench.Size, bench.Size, bench.Steps);
+            wprintf(L"Scalar: %.3f ms per step\n", bench.ScalarMs);
+            wprintf(L"SIMD: %.3f ms per step\n", bench.SimdMs);
+            wprintf(L"SIMD over tasks: %.3f ms per step\n\n", bench.ParallelMs);
+        }
+    }
+
+    const Bench Benches[] =
+    {
+        { L"scene",         BenchScene },
+        { L"tree",          BenchTree },
+        { L"collision",     BenchCollision },
+        { L"bc",            BenchBlockCompression },
+        { L"io",            BenchAssetPack },
+        { L"random",        BenchRandom },
+        { L"waves",         BenchWaves },
+    };
+
+    int RunBench(const wchar_t* name)
+    {
+        for (auto& bench : Benches)
+        {
+            if (_wcsicmp(bench.Name, name) == 0)
+            {
+                bench.Run();
+                return 0;
+            }
+        }
+
+        wprintf(L"No benchmark is called %s.  There are:", name);
+        for (auto& bench : Benches)
+            wprintf(L" %s", bench.Name);
+        wprintf(L"\n");
+        return 1;
+    }
+
+    // Every frame's recorded events and step go through D3DManager::Update and
+    // PrepareFrame, the CPU half of Render, as in the windowed replay.  Nothing
+    // is drawn.  The frame times go to <file>.csv like the windowed replay's.
+    int Replay(const std::wstring& filename, float tickRate)
+    {
+        InputRecorder recorder;
+        if (!recorder.BeginReplay(filename))
+        {
+            wprintf(L"%s could not be loaded.\n", filename.c_str());
+            return 1;
+        }
+
+        // The windowed replay never threads the simulation either.
+        auto d3d = D3DManager::getInstance();
+        d3d->SetSimulation(tickRate, 5, false);
+        if (!d3d->InitHeadless(800, 600))
+        {
+            d3d->CleanupDevice();
+            return 1;
+        }
+
+        auto input = InputManager::getInstance();
+        double totalMs = 0.0;
+        double worstMs = 0.0;
+        float dt = 0.0f;
+        while (recorder.ReplayFrame(*input, dt))
+        {
+            input->ProcessEvents();
+            FrameArena::getInstance()->Reset();
+
+            double start = GameTimer::NowMs();
+            d3d->Update(dt);
+            d3d->PrepareFrame();
+            double ms = GameTimer::NowMs() - start;
+
+            recorder.AddFrameTime(ms);
+            totalMs += ms;
+            worstMs = MathHelper::Max(worstMs, ms);
+        }
+        recorder.WriteProfile(filename + L".csv");
+        recorder.EndReplay();
+        d3d->CleanupDevice();
+
+        UINT frames = recorder.GetFrameCount();
+        wprintf(L"%u frames replayed, %.3f ms per frame, %.3f ms at worst\n",
+            frames, frames ? totalMs / frames : 0.0, worstMs);
+        return 0;
+    }
+
+    bool IsSelected(const wchar_t* name, int argc, wchar_t* argv[])
+    {
+        if (argc < 2)
+            return true;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (_wcsicmp(argv[i], name) == 0)
+                return true;
+        }
+        return false;
+    }
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+    if (argc >= 3 && _wcsicmp(argv[1], L"-replay") == 0)
+    {
+        float tickRate = 60.0f;
+        if (argc >= 5 && _wcsicmp(argv[3], L"-tickrate") == 0 && _wtof(argv[4]) > 0.0)
+            tickRate = (float)_wtof(argv[4]);
+        return Replay(argv[2], tickRate);
+    }
+    if (argc >= 3 && _wcsicmp(argv[1], L"-bench") == 0)
+        return RunBench(argv[2]);
+
+    UINT failedSuites = 0;
+    UINT ran = 0;
+    for (auto& suite : Suites)
+    {
+        if (!IsSelected(suite.Name, argc, argv))
+            continue;
+
+        double start = GameTimer::NowMs();
+        UINT failures = suite.Run();
+        double elapsed = GameTimer::NowMs() - start;
+
+        wprintf(L"%-20s %s  %u failed checks, %.1f ms\n", suite.Name, failures ? L"FAIL" : L"ok  ", failures, elapsed);
+        failedSuites += failures ? 1 : 0;
+        ++ran;
+    }
+
+    if (ran == 0)
+    {
+        wprintf(L"No suite matches the arguments.\n");
+        return 1;
+    }
+    wprintf(L"%u of %u suites passed\n", ran - failedSuites, ran);
+    return failedSuites ? 1 : 0;
+}
@@ -0,0 +1,214 @@
+//***************************************************************************************
+// TextureArrays.cpp
+//***************************************************************************************
+
+#include "TextureArrays.h"
+#include "AssetArchive.h"
+
+namespace
+{
+    struct TestRandom
+    {
+        explicit TestRandom(UINT seed) : State(seed) {}
+
+        UINT Next(UINT n)
+        {
+            State = State * 1664525u + 1013904223u;
+            return (State >> 8) % n;
+        }
+
+        UINT State;
+    };
+
+    bool IsBlockCompressed(DXGI_FORMAT format)
+    {
+        return (format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM) ||
+            (format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB);
+    }
+
+    struct DescLess
+    {
+        bool operator()(const TextureArrays::TextureDesc& a, const TextureArrays::TextureDesc& b) const
+        {
+            if (a.Width != b.Width)
+                return a.Width < b.Width;
+            if (a.Height != b.Height)
+                return a.Height < b.Height;
+            if (a.MipLevels != b.MipLevels)
+                return a.MipLevels < b.MipLevels;
+            return a.Format < b.Format;
+        }
+    };
+
+    bool SameDesc(const TextureArrays::TextureDesc& a, const TextureArrays::TextureDesc& b)
+    {
+        return !DescLess()(a, b) && !DescLess()(b, a);
+    }
+}
+
+const UINT TextureArrays::InvalidHandle;
+
+UINT TextureArrays::Add(const std::wstring& filename)
+{
+    auto it = m_Handles.find(filename);
+    if (it != m_Handles.end())
+        return it->second;
+
+    AssetArchive::Asset file;
+    AssetArchive::getInstance()->Load(filename, file);
+
+    D3DX11_IMAGE_INFO info;
+    HR(D3DX11GetImageInfoFromMemory(file.Data, file.Size, 0, &info, 0));
+
+    TextureDesc desc;
+    desc.Width = info.Width;
+    desc.Height = info.Height;
+    desc.Format = info.Format;
+    desc.MipLevels = info.MipLevels;
+    if (desc.MipLevels <= 1 && !IsBlockCompressed(desc.Format))
+    {
+        desc.MipLevels = 1;
+        for (UINT size = MathHelper::Max(desc.Width, desc.Height); size > 1; size >>= 1)
+            ++desc.MipLevels;
+    }
+
+    Slice unbuilt = { InvalidHandle, 0 };
+    UINT handle = (UINT)m_Filenames.size();
+    m_Handles[filename] = handle;
+    m_Filenames.push_back(filename);
+    m_Descs.push_back(desc);
+    m_Slices.push_back(unbuilt);
+    return handle;
+}
+
+void TextureArrays::Build(ID3D11Device* device, ID3D11DeviceContext* dc)
+{
+    for (auto srv : m_SRVs)
+        ReleaseCOM(srv);
+
+    UINT arrayCount = Group(m_Descs, D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION, m_Slices);
+    m_SRVs.assign(arrayCount, nullptr);
+
+    std::vector<std::wstring> filenames;
+    for (UINT array = 0; array < arrayCount; ++array)
+    {
+        // Group hands out slices in order, so the files come out slice by slice.
+        filenames.clear();
+        UINT first = 0;
+        for (UINT handle = 0; handle < m_Filenames.size(); ++handle)
+        {
+            if (m_Slices[handle].Array != array)
+                continue;
+            if (filenames.empty())
+                first = handle;
+            filenames.push_back(m_Filenames[handle]);
+        }
+
+        m_SRVs[array] = d3dHelper::CreateTexture2DArraySRV(device, dc, filenames,
+            DXGI_FORMAT_FROM_FILE, D3DX11_FILTER_NONE, D3DX11_FILTER_LINEAR, m_Descs[first].MipLevels);
+    }
+}
+
+void TextureArrays::Release()
+{
+    for (auto srv : m_SRVs)
+        ReleaseCOM(srv);
+
+    m_SRVs.clear();
+    m_Handles.clear();
+    m_Filenames.clear();
+    m_Descs.clear();
+    m_Slices.clear();
+}
+
+TextureArrays::Stats TextureArrays::GetStats() const
+{
+    Stats stats;
+    stats.Textures = (UINT)m_Filenames.size();
+    stats.Arrays = (UINT)m_SRVs.size();
+    return stats;
+}
+
+UINT TextureArrays::Group(const std::vector<TextureDesc>& descs, UINT maxSlices, std::vector<Slice>& slices)
+{
+    // The array that still takes textures of each desc.
+    std::map<TextureDesc, UINT, DescLess> open;
+    std::vector<UINT> sizes;
+
+    slices.resize(descs.size());
+    for (UINT i = 0; i < descs.size(); ++i)
+    {
+        auto it = open.find(descs[i]);
+        if (it == open.end() || sizes[it->second] == maxSlices)
+        {
+            open[descs[i]] = (UINT)sizes.size();
+            sizes.push_back(0);
+            it = open.find(descs[i]);
+        }
+
+        slices[i].Array = it->second;
+        slices[i].Index = sizes[it->second]++;
+    }
+    return (UINT)sizes.size();
+}
+
+UINT TextureArrays::SelfTest()
+{
+    UINT failures = 0;
+    TestRandom random(2024);
+
+    const DXGI_FORMAT formats[] = { DXGI_FORMAT_BC1_UNORM, DXGI_FORMAT_BC3_UNORM, DXGI_FORMAT_R8G8B8A8_UNORM };
+    for (UINT trial = 0; trial < 50; ++trial)
+    {
+        UINT maxSlices = 1 + random.Next(8);
+        std::vector<TextureDesc> descs(random.Next(60));
+        for (auto& desc : descs)
+        {
+            desc.Width = 256 << random.Next(2);
+            desc.Height = 256 << random.Next(2);
+            desc.MipLevels = 1 + random.Next(2);
+            desc.Format = formats[random.Next(ARRAYSIZE(formats))];
+        }
+
+        std::vector<Slice> slices;
+        UINT arrayCount = Group(descs, maxSlices, slices);
+        if (slices.size() != descs.size())
+        {
+            ++failures;
+            continue;
+        }
+
+        // Every array holds one desc in slices 0..n-1, at most maxSlices of them.
+        std::vector<UINT> sizes(arrayCount, 0);
+        std::vector<UINT> owners(arrayCount, InvalidHandle);
+        for (UINT i = 0; i < descs.size(); ++i)
+        {
+            const Slice& slice = slices[i];
+            if (slice.Array >= arrayCount || slice.Index != sizes[slice.Array]++)
+            {
+                ++failures;
+                continue;
+            }
+            if (owners[slice.Array] == InvalidHandle)
+                owners[slice.Array] = i;
+            else if (!SameDesc(descs[owners[slice.Array]], descs[i]))
+                ++failures;
+        }
+
+        // No more arrays than each desc needs.
+        std::map<TextureDesc, UINT, DescLess> counts;
+        for (auto& desc : descs)
+            ++counts[desc];
+        UINT needed = 0;
+        for (auto& count : counts)
+            needed += (count.second + maxSlices - 1) / maxSlices;
+        if (arrayCount != needed)
+            ++failures;
+
+        for (UINT size : sizes)
+            if (size == 0 || size > maxSlices)
+                ++failures;
+    }
+
+    return failures;
+}
@@ -0,0 +1,97 @@
+//***************************************************************************************
+// TextureArrays.h
+//
+// Packs the diffuse maps of the scene into Texture2DArrays, so objects with
+// different textures bind the same shader resource and can share an instanced
+// draw; each draw picks its texture by slice from the per-draw block.
+//
+// Textures are registered by file name, then Build groups every file with the
+// same width, height, mip count and format into one array, a slice each, and
+// loads them with d3dHelper::CreateTexture2DArraySRV.  Block compressed DDS
+// files are copied as they are.  Files without mips of their own and not block
+// compressed get a full chain from D3DX, as D3DX11CreateShaderResourceViewFromFile
+// would give them.
+//
+// Add returns a handle that stays valid until Release; the array and slice
+// behind it are known once Build has run.
+//***************************************************************************************
+
+#ifndef TEXTUREARRAYS_H
+#define TEXTUREARRAYS_H
+
+#include "d3dUtil.h"
+#include <map>
+
+class TextureArrays
+{
+public:
+    static const UINT InvalidHandle = 0xffffffff;
+
+    // What has to match for two textures to share an array.
+    struct TextureDesc
+    {
+        UINT        Width;
+        UINT        Height;
+        UINT        MipLevels;
+        DXGI_FORMAT Format;
+    };
+
+    struct Slice
+    {
+        UINT    Array;
+        UINT    Index;
+    };
+
+    struct Stats
+    {
+        UINT    Textures;
+        UINT    Arrays;
+    };
+
+public:
+    static TextureArrays* getInstance()
+    {
+        static TextureArrays textureArrays;
+        return &textureArrays;
+    }
+
+    // Registers 'filename', once however often it is added.  Only reads the
+    // file's header; call before Build.
+    UINT    Add(const std::wstring& filename);
+
+    // Creates the arrays of every texture added so far.
+    void    Build(ID3D11Device* device, ID3D11DeviceContext* dc);
+
+    // Drops the arrays and every handle.
+    void    Release();
+
+    Slice                       GetSlice(UINT handle) const     { return m_Slices[handle]; }
+    ID3D11ShaderResourceView*   GetSRV(UINT array) const        { return m_SRVs[array]; }
+    Stats                       GetStats() const;
+
+    // Puts equal descs into the same array, in the order they come, starting a
+    // new array when one is full.  Fills 'slices' for every desc and returns
+    // the number of arrays.
+    static UINT Group(const std::vector<TextureDesc>& descs, UINT maxSlices, std::vector<Slice>& slices);
+
+    // Checks Group on random descs: equal descs share arrays, slices are dense
+    // and no array is over the limit.  Returns the number of failures.
+    static UINT SelfTest();
+
+public:
+    TextureArrays(const TextureArrays& rhs)             = delete;
+    TextureArrays& operator=(const TextureArrays& rhs)  = delete;
+
+private:
+    TextureArrays() {}
+    ~TextureArrays() { Release(); }
+
+private:
+    std::map<std::wstring, UINT>            m_Handles;
+    std::vector<std::wstring>               m_Filenames;    // per handle
+    std::vector<TextureDesc>                m_Descs;
+    std::vector<Slice>                      m_Slices;
+    std::vector<ID3D11ShaderResourceView*>  m_SRVs;         // per array
+};
+
+#endif // TEXTUREARRAYS_H
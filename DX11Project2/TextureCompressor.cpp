@@ -0,0 +1,1111 @@
+//***************************************************************************************
+// TextureCompressor.cpp
+//***************************************************************************************
+
+#include "TextureCompressor.h"
+#include "AssetArchive.h"
+#include "GameTimer.h"
+#include <ppl.h>
+#include <fstream>
+
+namespace
+{
+    // Below this many blocks an image is compressed on the calling thread.
+    const UINT ParallelBlocks = 1024;
+
+    // Interpolation weights of BC7's 4 bit indices, out of 64.
+    const UINT BC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    struct TestRandom
+    {
+        explicit TestRandom(UINT seed) : State(seed) {}
+
+        float Next(float a, float b)
+        {
+            State = State * 1664525u + 1013904223u;
+            return a + (b - a) * (float)(State >> 8) / (float)(1 << 24);
+        }
+
+        UINT State;
+    };
+
+    UINT FourCC(char a, char b, char c, char d)
+    {
+        return (UINT)(BYTE)a | ((UINT)(BYTE)b << 8) | ((UINT)(BYTE)c << 16) | ((UINT)(BYTE)d << 24);
+    }
+
+    UINT PackRGBA(UINT r, UINT g, UINT b, UINT a)
+    {
+        return r | (g << 8) | (b << 16) | (a << 24);
+    }
+
+    UINT Channel(UINT texel, UINT channel)
+    {
+        return (texel >> (8 * channel)) & 0xff;
+    }
+
+    // Bits are packed from the lowest bit of the first byte up, as in every BC format.
+    struct BitWriter
+    {
+        explicit BitWriter(BYTE* data) : Data(data), Position(0) {}
+
+        void Write(UINT value, UINT bits)
+        {
+            for (UINT i = 0; i < bits; ++i, ++Position)
+                if ((value >> i) & 1)
+                    Data[Position >> 3] |= (BYTE)(1 << (Position & 7));
+        }
+
+        BYTE*   Data;
+        UINT    Position;
+    };
+
+    struct BitReader
+    {
+        explicit BitReader(const BYTE* data) : Data(data), Position(0) {}
+
+        UINT Read(UINT bits)
+        {
+            UINT value = 0;
+            for (UINT i = 0; i < bits; ++i, ++Position)
+                value |= (UINT)((Data[Position >> 3] >> (Position & 7)) & 1) << i;
+            return value;
+        }
+
+        const BYTE* Data;
+        UINT        Position;
+    };
+
+    // The 16 texels of block (bx, by), the last row and column repeated past the edges.
+    void LoadBlock(const TextureCompressor::Image& image, UINT bx, UINT by, XMVECTOR texels[16])
+    {
+        const XMUBYTEN4* source = reinterpret_cast<const XMUBYTEN4*>(&image.Texels[0]);
+        for (UINT y = 0; y < 4; ++y)
+        {
+            UINT row = MathHelper::Min(by * 4 + y, image.Height - 1);
+            for (UINT x = 0; x < 4; ++x)
+            {
+                UINT column = MathHelper::Min(bx * 4 + x, image.Width - 1);
+                texels[y * 4 + x] = XMLoadUByteN4(&source[row * image.Width + column]);
+            }
+        }
+    }
+
+    void StoreBlock(const UINT texels[16], UINT bx, UINT by, TextureCompressor::Image& image)
+    {
+        for (UINT y = 0; y < 4 && by * 4 + y < image.Height; ++y)
+            for (UINT x = 0; x < 4 && bx * 4 + x < image.Width; ++x)
+                image.Texels[(by * 4 + y) * image.Width + bx * 4 + x] = texels[y * 4 + x];
+    }
+
+#pragma region Fitting
+    // Endpoints of the segment along the principal axis of 'points' that covers them
+    // all.  The axis comes from power iteration on the covariance.
+    void FitLine(const XMVECTOR* points, UINT count, XMVECTOR& e0, XMVECTOR& e1)
+    {
+        XMVECTOR mean = XMVectorZero();
+        XMVECTOR lo = points[0];
+        XMVECTOR hi = points[0];
+        for (UINT i = 0; i < count; ++i)
+        {
+            mean = XMVectorAdd(mean, points[i]);
+            lo = XMVectorMin(lo, points[i]);
+            hi = XMVectorMax(hi, points[i]);
+        }
+        mean = XMVectorScale(mean, 1.0f / count);
+
+        XMVECTOR c0 = XMVectorZero();
+        XMVECTOR c1 = XMVectorZero();
+        XMVECTOR c2 = XMVectorZero();
+        XMVECTOR c3 = XMVectorZero();
+        for (UINT i = 0; i < count; ++i)
+        {
+            XMVECTOR d = XMVectorSubtract(points[i], mean);
+            c0 = XMVectorMultiplyAdd(d, XMVectorSplatX(d), c0);
+            c1 = XMVectorMultiplyAdd(d, XMVectorSplatY(d), c1);
+            c2 = XMVectorMultiplyAdd(d, XMVectorSplatZ(d), c2);
+            c3 = XMVectorMultiplyAdd(d, XMVectorSplatW(d), c3);
+        }
+
+        // The diagonal of the bounds is a good first guess.
+        XMVECTOR axis = XMVectorSubtract(hi, lo);
+        for (UINT k = 0; k < 8; ++k)
+        {
+            XMVECTOR next = XMVectorMultiply(c0, XMVectorSplatX(axis));
+            next = XMVectorMultiplyAdd(c1, XMVectorSplatY(axis), next);
+            next = XMVectorMultiplyAdd(c2, XMVectorSplatZ(axis), next);
+            next = XMVectorMultiplyAdd(c3, XMVectorSplatW(axis), next);
+
+            float length = XMVectorGetX(XMVector4Length(next));
+            if (length < 1e-12f)
+                break;
+            axis = XMVectorScale(next, 1.0f / length);
+        }
+
+        float length = XMVectorGetX(XMVector4Length(axis));
+        if (length < 1e-12f)
+        {
+            e0 = mean;
+            e1 = mean;
+            return;
+        }
+        axis = XMVectorScale(axis, 1.0f / length);
+
+        float tMin = +MathHelper::Infinity;
+        float tMax = -MathHelper::Infinity;
+        for (UINT i = 0; i < count; ++i)
+        {
+            float t = XMVectorGetX(XMVector4Dot(XMVectorSubtract(points[i], mean), axis));
+            tMin = MathHelper::Min(tMin, t);
+            tMax = MathHelper::Max(tMax, t);
+        }
+        e0 = XMVectorSaturate(XMVectorMultiplyAdd(axis, XMVectorReplicate(tMin), mean));
+        e1 = XMVectorSaturate(XMVectorMultiplyAdd(axis, XMVectorReplicate(tMax), mean));
+    }
+
+    // The endpoints that fit 'points' best in the least squares sense, when point i
+    // sits at weights[i] between them.  False when the weights do not span a line.
+    bool RefitLine(const XMVECTOR* points, const float* weights, UINT count, XMVECTOR& e0, XMVECTOR& e1)
+    {
+        float aa = 0.0f;
+        float bb = 0.0f;
+        float ab = 0.0f;
+        XMVECTOR ax = XMVectorZero();
+        XMVECTOR bx = XMVectorZero();
+        for (UINT i = 0; i < count; ++i)
+        {
+            float b = weights[i];
+            float a = 1.0f - b;
+            aa += a * a;
+            bb += b * b;
+            ab += a * b;
+            ax = XMVectorMultiplyAdd(points[i], XMVectorReplicate(a), ax);
+            bx = XMVectorMultiplyAdd(points[i], XMVectorReplicate(b), bx);
+        }
+
+        float det = aa * bb - ab * ab;
+        if (fabsf(det) < 1e-6f)
+            return false;
+
+        float invDet = 1.0f / det;
+        e0 = XMVectorSaturate(XMVectorScale(XMVectorSubtract(XMVectorScale(ax, bb), XMVectorScale(bx, ab)), invDet));
+        e1 = XMVectorSaturate(XMVectorScale(XMVectorSubtract(XMVectorScale(bx, aa), XMVectorScale(ax, ab)), invDet));
+        return true;
+    }
+
+    // Nearest palette entry for every point, weighing channels by 'mask'.  Returns
+    // the summed squared error.
+    float AssignIndices(const XMVECTOR* points, UINT count, const XMVECTOR* palette, UINT paletteSize,
+                        FXMVECTOR mask, UINT* indices)
+    {
+        float total = 0.0f;
+        for (UINT i = 0; i < count; ++i)
+        {
+            float best = MathHelper::Infinity;
+            for (UINT k = 0; k < paletteSize; ++k)
+            {
+                XMVECTOR d = XMVectorMultiply(XMVectorSubtract(points[i], palette[k]), mask);
+                float error = XMVectorGetX(XMVector4LengthSq(d));
+                if (error < best)
+                {
+                    best = error;
+                    indices[i] = k;
+                }
+            }
+            total += best;
+        }
+        return total;
+    }
+#pragma endregion
+
+#pragma region BC1
+    USHORT To565(FXMVECTOR color)
+    {
+        XMVECTOR q = XMVectorRound(XMVectorMultiply(XMVectorSaturate(color), XMVectorSet(31.0f, 63.0f, 31.0f, 0.0f)));
+        return (USHORT)(((UINT)XMVectorGetX(q) << 11) | ((UINT)XMVectorGetY(q) << 5) | (UINT)XMVectorGetZ(q));
+    }
+
+    void Expand565(USHORT c, UINT rgb[3])
+    {
+        UINT r = (c >> 11) & 31;
+        UINT g = (c >> 5) & 63;
+        UINT b = c & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    XMVECTOR From565(USHORT c)
+    {
+        UINT rgb[3];
+        Expand565(c, rgb);
+        return XMVectorSet(rgb[0] / 255.0f, rgb[1] / 255.0f, rgb[2] / 255.0f, 0.0f);
+    }
+
+    // Quantizes the endpoints, orders them for the wanted mode and assigns the
+    // indices.  Returns the error.  Equal endpoints always decode as three colors.
+    float BuildBC1(const XMVECTOR* points, UINT count, FXMVECTOR e0, FXMVECTOR e1, bool threeColor,
+                   USHORT& c0, USHORT& c1, UINT* indices)
+    {
+        c0 = To565(e0);
+        c1 = To565(e1);
+        if (threeColor ? c0 > c1 : c0 < c1)
+            std::swap(c0, c1);
+        if (c0 == c1)
+            threeColor = true;
+
+        XMVECTOR palette[4];
+        palette[0] = From565(c0);
+        palette[1] = From565(c1);
+        if (threeColor)
+        {
+            palette[2] = XMVectorLerp(palette[0], palette[1], 0.5f);
+        }
+        else
+        {
+            palette[2] = XMVectorLerp(palette[0], palette[1], 1.0f / 3.0f);
+            palette[3] = XMVectorLerp(palette[0], palette[1], 2.0f / 3.0f);
+        }
+
+        static const XMVECTORF32 rgb = { 1.0f, 1.0f, 1.0f, 0.0f };
+        return AssignIndices(points, count, palette, threeColor ? 3 : 4, rgb, indices);
+    }
+
+    // With 'allowTransparent', texels under half alpha take the transparent entry
+    // of the three color mode.  BC3's color half always decodes as four colors.
+    void EncodeBC1(const XMVECTOR texels[16], bool allowTransparent, BYTE* block)
+    {
+        static const XMVECTORF32 rgb = { 1.0f, 1.0f, 1.0f, 0.0f };
+
+        XMVECTOR opaque[16];
+        UINT positions[16];
+        UINT count = 0;
+        for (UINT i = 0; i < 16; ++i)
+        {
+            if (!allowTransparent || XMVectorGetW(texels[i]) >= 0.5f)
+            {
+                opaque[count] = XMVectorMultiply(texels[i], rgb);
+                positions[count++] = i;
+            }
+        }
+        bool threeColor = count < 16;
+
+        USHORT c0 = 0;
+        USHORT c1 = 0;
+        UINT indices[16];
+        if (count > 0)
+        {
+            XMVECTOR e0, e1;
+            FitLine(opaque, count, e0, e1);
+            float error = BuildBC1(opaque, count, e0, e1, threeColor, c0, c1, indices);
+
+            // Where each index sits between the endpoints; c0 <= c1 is the three color mode.
+            static const float fourColorWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+            static const float threeColorWeights[3] = { 0.0f, 1.0f, 0.5f };
+            float weights[16];
+            for (UINT i = 0; i < count; ++i)
+                weights[i] = c0 <= c1 ? threeColorWeights[indices[i]] : fourColorWeights[indices[i]];
+
+            USHORT r0, r1;
+            UINT refit[16];
+            if (RefitLine(opaque, weights, count, e0, e1) &&
+                BuildBC1(opaque, count, e0, e1, threeColor, r0, r1, refit) < error)
+            {
+                c0 = r0;
+                c1 = r1;
+                memcpy(indices, refit, count * sizeof(UINT));
+            }
+        }
+
+        UINT bits = threeColor && allowTransparent ? 0xffffffff : 0;
+        for (UINT i = 0; i < count; ++i)
+        {
+            bits &= ~(3u << (2 * positions[i]));
+            bits |= indices[i] << (2 * positions[i]);
+        }
+
+        block[0] = (BYTE)c0;
+        block[1] = (BYTE)(c0 >> 8);
+        block[2] = (BYTE)c1;
+        block[3] = (BYTE)(c1 >> 8);
+        block[4] = (BYTE)bits;
+        block[5] = (BYTE)(bits >> 8);
+        block[6] = (BYTE)(bits >> 16);
+        block[7] = (BYTE)(bits >> 24);
+    }
+
+    void DecodeBC1(const BYTE* block, bool fourColor, UINT texels[16])
+    {
+        USHORT c0 = (USHORT)(block[0] | (block[1] << 8));
+        USHORT c1 = (USHORT)(block[2] | (block[3] << 8));
+        UINT bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((UINT)block[7] << 24);
+
+        UINT a[3], b[3];
+        Expand565(c0, a);
+        Expand565(c1, b);
+
+        UINT palette[4];
+        palette[0] = PackRGBA(a[0], a[1], a[2], 255);
+        palette[1] = PackRGBA(b[0], b[1], b[2], 255);
+        if (fourColor || c0 > c1)
+        {
+            palette[2] = PackRGBA((2 * a[0] + b[0]) / 3, (2 * a[1] + b[1]) / 3, (2 * a[2] + b[2]) / 3, 255);
+            palette[3] = PackRGBA((a[0] + 2 * b[0]) / 3, (a[1] + 2 * b[1]) / 3, (a[2] + 2 * b[2]) / 3, 255);
+        }
+        else
+        {
+            palette[2] = PackRGBA((a[0] + b[0]) / 2, (a[1] + b[1]) / 2, (a[2] + b[2]) / 2, 255);
+            palette[3] = 0;
+        }
+
+        for (UINT i = 0; i < 16; ++i)
+            texels[i] = palette[(bits >> (2 * i)) & 3];
+    }
+#pragma endregion
+
+#pragma region BC4
+    // One channel, 0..1.  Always the eight value mode; a flat block uses index 0.
+    void EncodeBC4(const float values[16], BYTE* block)
+    {
+        float lo = values[0];
+        float hi = values[0];
+        for (UINT i = 1; i < 16; ++i)
+        {
+            lo = MathHelper::Min(lo, values[i]);
+            hi = MathHelper::Max(hi, values[i]);
+        }
+
+        UINT a0 = (UINT)(hi * 255.0f + 0.5f);
+        UINT a1 = (UINT)(lo * 255.0f + 0.5f);
+
+        float palette[8];
+        palette[0] = (float)a0;
+        palette[1] = (float)a1;
+        for (UINT k = 2; k < 8; ++k)
+            palette[k] = (float)(((8 - k) * a0 + (k - 1) * a1) / 7);
+
+        UINT64 bits = 0;
+        if (a0 != a1)
+        {
+            for (UINT i = 0; i < 16; ++i)
+            {
+                float v = values[i] * 255.0f;
+                UINT index = 0;
+                float best = fabsf(v - palette[0]);
+                for (UINT k = 1; k < 8; ++k)
+                {
+                    float error = fabsf(v - palette[k]);
+                    if (error < best)
+                    {
+                        best = error;
+                        index = k;
+                    }
+                }
+                bits |= (UINT64)index << (3 * i);
+            }
+        }
+
+        block[0] = (BYTE)a0;
+        block[1] = (BYTE)a1;
+        for (UINT j = 0; j < 6; ++j)
+            block[2 + j] = (BYTE)(bits >> (8 * j));
+    }
+
+    void DecodeBC4(const BYTE* block, BYTE values[16])
+    {
+        UINT a0 = block[0];
+        UINT a1 = block[1];
+
+        UINT palette[8];
+        palette[0] = a0;
+        palette[1] = a1;
+        if (a0 > a1)
+        {
+            for (UINT k = 2; k < 8; ++k)
+                palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+        }
+        else
+        {
+            for (UINT k = 2; k < 6; ++k)
+                palette[k] = ((6 - k) * a0 + (k - 1) * a1) / 5;
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+
+        UINT64 bits = 0;
+        for (UINT j = 0; j < 6; ++j)
+            bits |= (UINT64)block[2 + j] << (8 * j);
+
+        for (UINT i = 0; i < 16; ++i)
+            values[i] = (BYTE)palette[(bits >> (3 * i)) & 7];
+    }
+#pragma endregion
+
+#pragma region BC7
+    // The 7 bit endpoint and shared low bit that rebuild 'e' best.
+    void QuantizeBC7(FXMVECTOR e, UINT q[4], UINT& p)
+    {
+        XMFLOAT4 v;
+        XMStoreFloat4(&v, XMVectorScale(e, 255.0f));
+        const float* c = &v.x;
+
+        float bestError = MathHelper::Infinity;
+        for (UINT bit = 0; bit < 2; ++bit)
+        {
+            UINT candidate[4];
+            float error = 0.0f;
+            for (UINT k = 0; k < 4; ++k)
+            {
+                int value = (int)floorf((c[k] - bit) * 0.5f + 0.5f);
+                candidate[k] = (UINT)MathHelper::Clamp(value, 0, 127);
+                float d = (float)((candidate[k] << 1) | bit) - c[k];
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                p = bit;
+                memcpy(q, candidate, sizeof(candidate));
+            }
+        }
+    }
+
+    void BC7Palette(const UINT q0[4], UINT p0, const UINT q1[4], UINT p1, UINT palette[16][4])
+    {
+        for (UINT k = 0; k < 16; ++k)
+        {
+            for (UINT c = 0; c < 4; ++c)
+            {
+                UINT e0 = (q0[c] << 1) | p0;
+                UINT e1 = (q1[c] << 1) | p1;
+                palette[k][c] = ((64 - BC7Weights[k]) * e0 + BC7Weights[k] * e1 + 32) >> 6;
+            }
+        }
+    }
+
+    float BuildBC7(const XMVECTOR texels[16], FXMVECTOR e0, FXMVECTOR e1,
+                   UINT q0[4], UINT& p0, UINT q1[4], UINT& p1, UINT indices[16])
+    {
+        QuantizeBC7(e0, q0, p0);
+        QuantizeBC7(e1, q1, p1);
+
+        UINT entries[16][4];
+        BC7Palette(q0, p0, q1, p1, entries);
+
+        XMVECTOR palette[16];
+        for (UINT k = 0; k < 16; ++k)
+            palette[k] = XMVectorScale(XMVectorSet((float)entries[k][0], (float)entries[k][1], (float)entries[k][2], (float)entries[k][3]), 1.0f / 255.0f);
+
+        return AssignIndices(texels, 16, palette, 16, XMVectorSplatOne(), indices);
+    }
+
+    // Mode 6: one RGBA line, 7 bit endpoints with a low bit each, 4 bit indices.
+    void EncodeBC7(const XMVECTOR texels[16], BYTE* block)
+    {
+        XMVECTOR e0, e1;
+        FitLine(texels, 16, e0, e1);
+
+        UINT q0[4], q1[4], p0, p1, indices[16];
+        float error = BuildBC7(texels, e0, e1, q0, p0, q1, p1, indices);
+
+        float weights[16];
+        for (UINT i = 0; i < 16; ++i)
+            weights[i] = BC7Weights[indices[i]] / 64.0f;
+
+        UINT r0[4], r1[4], rp0, rp1, refit[16];
+        if (RefitLine(texels, weights, 16, e0, e1) &&
+            BuildBC7(texels, e0, e1, r0, rp0, r1, rp1, refit) < error)
+        {
+            memcpy(q0, r0, sizeof(q0));
+            memcpy(q1, r1, sizeof(q1));
+            p0 = rp0;
+            p1 = rp1;
+            memcpy(indices, refit, sizeof(indices));
+        }
+
+        // The first texel's index is stored without its top bit, so it has to be
+        // under 8; swapping the endpoints mirrors every index.
+        if (indices[0] >= 8)
+        {
+            for (UINT c = 0; c < 4; ++c)
+                std::swap(q0[c], q1[c]);
+            std::swap(p0, p1);
+            for (UINT i = 0; i < 16; ++i)
+                indices[i] = 15 - indices[i];
+        }
+
+        memset(block, 0, 16);
+        BitWriter writer(block);
+        writer.Write(1 << 6, 7);
+        for (UINT c = 0; c < 4; ++c)
+        {
+            writer.Write(q0[c], 7);
+            writer.Write(q1[c], 7);
+        }
+        writer.Write(p0, 1);
+        writer.Write(p1, 1);
+        for (UINT i = 0; i < 16; ++i)
+            writer.Write(indices[i], i == 0 ? 3 : 4);
+    }
+
+    // Mode 6 blocks only; any other mode decodes as transparent black.
+    void DecodeBC7(const BYTE* block, UINT texels[16])
+    {
+        BitReader reader(block);
+        if (reader.Read(7) != (1 << 6))
+        {
+            memset(texels, 0, 16 * sizeof(UINT));
+            return;
+        }
+
+        UINT q0[4], q1[4];
+        for (UINT c = 0; c < 4; ++c)
+        {
+            q0[c] = reader.Read(7);
+            q1[c] = reader.Read(7);
+        }
+        UINT p0 = reader.Read(1);
+        UINT p1 = reader.Read(1);
+
+        UINT palette[16][4];
+        BC7Palette(q0, p0, q1, p1, palette);
+
+        for (UINT i = 0; i < 16; ++i)
+        {
+            UINT k = reader.Read(i == 0 ? 3 : 4);
+            texels[i] = PackRGBA(palette[k][0], palette[k][1], palette[k][2], palette[k][3]);
+        }
+    }
+#pragma endregion
+
+    void EncodeBlock(TextureCompressor::Format format, const XMVECTOR texels[16], BYTE* block)
+    {
+        float values[16];
+        switch (format)
+        {
+        case TextureCompressor::BC1:
+            EncodeBC1(texels, true, block);
+            break;
+        case TextureCompressor::BC3:
+            for (UINT i = 0; i < 16; ++i)
+                values[i] = XMVectorGetW(texels[i]);
+            EncodeBC4(values, block);
+            EncodeBC1(texels, false, block + 8);
+            break;
+        case TextureCompressor::BC4:
+            for (UINT i = 0; i < 16; ++i)
+                values[i] = XMVectorGetX(texels[i]);
+            EncodeBC4(values, block);
+            break;
+        case TextureCompressor::BC5:
+            for (UINT i = 0; i < 16; ++i)
+                values[i] = XMVectorGetX(texels[i]);
+            EncodeBC4(values, block);
+            for (UINT i = 0; i < 16; ++i)
+                values[i] = XMVectorGetY(texels[i]);
+            EncodeBC4(values, block + 8);
+            break;
+        case TextureCompressor::BC7:
+            EncodeBC7(texels, block);
+            break;
+        }
+    }
+
+    void DecodeBlock(TextureCompressor::Format format, const BYTE* block, UINT texels[16])
+    {
+        BYTE red[16], green[16];
+        switch (format)
+        {
+        case TextureCompressor::BC1:
+            DecodeBC1(block, false, texels);
+            break;
+        case TextureCompressor::BC3:
+            DecodeBC4(block, red);
+            DecodeBC1(block + 8, true, texels);
+            for (UINT i = 0; i < 16; ++i)
+                texels[i] = (texels[i] & 0x00ffffff) | ((UINT)red[i] << 24);
+            break;
+        case TextureCompressor::BC4:
+            DecodeBC4(block, red);
+            for (UINT i = 0; i < 16; ++i)
+                texels[i] = PackRGBA(red[i], 0, 0, 255);
+            break;
+        case TextureCompressor::BC5:
+            DecodeBC4(block, red);
+            DecodeBC4(block + 8, green);
+            for (UINT i = 0; i < 16; ++i)
+                texels[i] = PackRGBA(red[i], green[i], 0, 255);
+            break;
+        case TextureCompressor::BC7:
+            DecodeBC7(block, texels);
+            break;
+        }
+    }
+
+    // Which of r, g, b, a the format keeps, as bits 0..3.
+    UINT ChannelMask(TextureCompressor::Format format)
+    {
+        static const UINT masks[TextureCompressor::FormatCount] = { 0x7, 0xf, 0x1, 0x3, 0xf };
+        return masks[format];
+    }
+
+    double Rmse(const TextureCompressor::Image& a, const TextureCompressor::Image& b, UINT channels)
+    {
+        double sum = 0.0;
+        UINT count = 0;
+        for (UINT i = 0; i < a.Texels.size(); ++i)
+        {
+            for (UINT c = 0; c < 4; ++c)
+            {
+                if ((channels >> c) & 1)
+                {
+                    double d = (double)Channel(a.Texels[i], c) - (double)Channel(b.Texels[i], c);
+                    sum += d * d;
+                    ++count;
+                }
+            }
+        }
+        return count ? sqrt(sum / count) : 0.0;
+    }
+
+    // Smooth ramps with a little noise, like most color maps.  Alpha ramps too but
+    // stays over half, so BC1 keeps every texel opaque.
+    void MakeTestImage(UINT width, UINT height, TestRandom& random, TextureCompressor::Image& image)
+    {
+        image.Width = width;
+        image.Height = height;
+        image.Texels.resize(width * height);
+        for (UINT y = 0; y < height; ++y)
+        {
+            for (UINT x = 0; x < width; ++x)
+            {
+                float u = (float)x / width;
+                float v = (float)y / height;
+                float rgba[4] = { 255.0f * u, 255.0f * v, 255.0f * (1.0f - 0.5f * (u + v)), 128.0f + 127.0f * u * v };
+
+                UINT c[4];
+                for (UINT k = 0; k < 4; ++k)
+                    c[k] = (UINT)MathHelper::Clamp(rgba[k] + random.Next(-6.0f, 6.0f), k == 3 ? 128.0f : 0.0f, 255.0f);
+                image.Texels[y * width + x] = PackRGBA(c[0], c[1], c[2], c[3]);
+            }
+        }
+    }
+
+    // 2x2 box filter; odd edges average what is there.
+    void Downsample(const TextureCompressor::Image& source, TextureCompressor::Image& dest)
+    {
+        dest.Width = MathHelper::Max(source.Width / 2, 1u);
+        dest.Height = MathHelper::Max(source.Height / 2, 1u);
+        dest.Texels.resize(dest.Width * dest.Height);
+        for (UINT y = 0; y < dest.Height; ++y)
+        {
+            for (UINT x = 0; x < dest.Width; ++x)
+            {
+                UINT sum[4] = { 0, 0, 0, 0 };
+                UINT n = 0;
+                for (UINT sy = 2 * y; sy < MathHelper::Min(2 * y + 2, source.Height); ++sy)
+                {
+                    for (UINT sx = 2 * x; sx < MathHelper::Min(2 * x + 2, source.Width); ++sx)
+                    {
+                        for (UINT c = 0; c < 4; ++c)
+                            sum[c] += Channel(source.Texels[sy * source.Width + sx], c);
+                        ++n;
+                    }
+                }
+                dest.Texels[y * dest.Width + x] = PackRGBA((sum[0] + n / 2) / n, (sum[1] + n / 2) / n, (sum[2] + n / 2) / n, (sum[3] + n / 2) / n);
+            }
+        }
+    }
+}
+
+#pragma region Formats
+UINT TextureCompressor::GetBlockBytes(Format format)
+{
+    return format == BC1 || format == BC4 ? 8 : 16;
+}
+
+DXGI_FORMAT TextureCompressor::GetDxgiFormat(Format format)
+{
+    static const DXGI_FORMAT formats[FormatCount] =
+    {
+        DXGI_FORMAT_BC1_UNORM,
+        DXGI_FORMAT_BC3_UNORM,
+        DXGI_FORMAT_BC4_UNORM,
+        DXGI_FORMAT_BC5_UNORM,
+        DXGI_FORMAT_BC7_UNORM,
+    };
+    return formats[format];
+}
+
+const wchar_t* TextureCompressor::GetName(Format format)
+{
+    static const wchar_t* names[FormatCount] = { L"bc1", L"bc3", L"bc4", L"bc5", L"bc7" };
+    return names[format];
+}
+
+bool TextureCompressor::ParseFormat(const std::wstring& name, Format& format)
+{
+    for (UINT f = 0; f < FormatCount; ++f)
+    {
+        if (_wcsicmp(name.c_str(), GetName((Format)f)) == 0)
+        {
+            format = (Format)f;
+            return true;
+        }
+    }
+    return false;
+}
+#pragma endregion
+
+#pragma region Compression
+void TextureCompressor::Compress(const Image& image, Format format, Surface& surface)
+{
+    UINT blocksX = (image.Width + 3) / 4;
+    UINT blocksY = (image.Height + 3) / 4;
+    UINT blockBytes = GetBlockBytes(format);
+
+    surface.Width = image.Width;
+    surface.Height = image.Height;
+    surface.Blocks.assign(blocksX * blocksY * blockBytes, 0);
+
+    auto encodeRow = [&](UINT by)
+    {
+        XMVECTOR texels[16];
+        for (UINT bx = 0; bx < blocksX; ++bx)
+        {
+            LoadBlock(image, bx, by, texels);
+            EncodeBlock(format, texels, &surface.Blocks[(by * blocksX + bx) * blockBytes]);
+        }
+    };
+
+    // Blocks are independent; rows of them go to the worker threads.
+    if (blocksX * blocksY >= ParallelBlocks)
+    {
+        concurrency::parallel_for(0u, blocksY, encodeRow);
+    }
+    else
+    {
+        for (UINT by = 0; by < blocksY; ++by)
+            encodeRow(by);
+    }
+}
+
+void TextureCompressor::Decompress(const Surface& surface, Format format, Image& image)
+{
+    UINT blocksX = (surface.Width + 3) / 4;
+    UINT blocksY = (surface.Height + 3) / 4;
+    UINT blockBytes = GetBlockBytes(format);
+
+    image.Width = surface.Width;
+    image.Height = surface.Height;
+    image.Texels.resize(surface.Width * surface.Height);
+
+    for (UINT by = 0; by < blocksY; ++by)
+    {
+        for (UINT bx = 0; bx < blocksX; ++bx)
+        {
+            UINT texels[16];
+            DecodeBlock(format, &surface.Blocks[(by * blocksX + bx) * blockBytes], texels);
+            StoreBlock(texels, bx, by, image);
+        }
+    }
+}
+#pragma endregion
+
+#pragma region Files
+void TextureCompressor::ReadImage(ID3D11Device* device, ID3D11DeviceContext* dc,
+                                  const std::wstring& filename, std::vector<Image>& levels)
+{
+    // Same staging load as d3dHelper::CreateTexture2DArraySRV, with D3DX building
+    // the whole mip chain.
+    D3DX11_IMAGE_LOAD_INFO loadInfo;
+    loadInfo.Width  = D3DX11_FROM_FILE;
+    loadInfo.Height = D3DX11_FROM_FILE;
+    loadInfo.Depth  = D3DX11_FROM_FILE;
+    loadInfo.FirstMipLevel = 0;
+    loadInfo.MipLevels = D3DX11_DEFAULT;
+    loadInfo.Usage = D3D11_USAGE_STAGING;
+    loadInfo.BindFlags = 0;
+    loadInfo.CpuAccessFlags = D3D11_CPU_ACCESS_READ;
+    loadInfo.MiscFlags = 0;
+    loadInfo.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    loadInfo.Filter = D3DX11_FILTER_NONE;
+    loadInfo.MipFilter = D3DX11_FILTER_LINEAR;
+    loadInfo.pSrcInfo  = 0;
+
+    AssetArchive::Asset file;
+    AssetArchive::getInstance()->Load(filename, file);
+
+    ID3D11Texture2D* tex = 0;
+    HR(D3DX11CreateTextureFromMemory(device, file.Data, file.Size,
+        &loadInfo, 0, (ID3D11Resource**)&tex, 0));
+
+    D3D11_TEXTURE2D_DESC texDesc;
+    tex->GetDesc(&texDesc);
+
+    levels.resize(texDesc.MipLevels);
+    for (UINT mip = 0; mip < texDesc.MipLevels; ++mip)
+    {
+        Image& level = levels[mip];
+        level.Width  = MathHelper::Max(texDesc.Width >> mip, 1u);
+        level.Height = MathHelper::Max(texDesc.Height >> mip, 1u);
+        level.Texels.resize(level.Width * level.Height);
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        HR(dc->Map(tex, mip, D3D11_MAP_READ, 0, &mapped));
+        for (UINT y = 0; y < level.Height; ++y)
+            memcpy(&level.Texels[y * level.Width], (BYTE*)mapped.pData + y * mapped.RowPitch, level.Width * sizeof(UINT));
+        dc->Unmap(tex, mip);
+    }
+
+    ReleaseCOM(tex);
+}
+
+void TextureCompressor::BuildDds(Format format, const std::vector<Surface>& levels, std::vector<BYTE>& file)
+{
+    // DDS_HEADER after the magic number, see the DDS reference.  BC1 and BC3 keep
+    // their old FourCC codes; the others need the DX10 extension header.
+    const UINT DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PIXELFORMAT = 0x1000;
+    const UINT DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000;
+    const UINT DDPF_FOURCC = 0x4;
+    const UINT DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+
+    bool dx10 = format != BC1 && format != BC3;
+
+    UINT header[32];
+    ZeroMemory(header, sizeof(header));
+    header[0] = FourCC('D', 'D', 'S', ' ');
+    header[1] = 124;
+    header[2] = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header[3] = levels[0].Height;
+    header[4] = levels[0].Width;
+    header[5] = (UINT)levels[0].Blocks.size();
+    header[7] = (UINT)levels.size();
+    header[19] = 32;
+    header[20] = DDPF_FOURCC;
+    header[21] = format == BC1 ? FourCC('D', 'X', 'T', '1') : format == BC3 ? FourCC('D', 'X', 'T', '5') : FourCC('D', 'X', '1', '0');
+    header[27] = DDSCAPS_TEXTURE | (levels.size() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+    // DDS_HEADER_DXT10: format, 2D resource dimension, no flags, one element.
+    UINT extension[5] = { (UINT)GetDxgiFormat(format), 3, 0, 1, 0 };
+
+    size_t size = sizeof(header) + (dx10 ? sizeof(extension) : 0);
+    for (const Surface& level : levels)
+        size += level.Blocks.size();
+
+    file.resize(size);
+    BYTE* out = &file[0];
+    memcpy(out, header, sizeof(header));
+    out += sizeof(header);
+    if (dx10)
+    {
+        memcpy(out, extension, sizeof(extension));
+        out += sizeof(extension);
+    }
+    for (const Surface& level : levels)
+    {
+        memcpy(out, &level.Blocks[0], level.Blocks.size());
+        out += level.Blocks.size();
+    }
+}
+
+bool TextureCompressor::CompressFile(ID3D11Device* device, ID3D11DeviceContext* dc,
+                                     const std::wstring& source, const std::wstring& dest, Format format)
+{
+    std::vector<Image> levels;
+    ReadImage(device, dc, source, levels);
+
+    std::vector<Surface> surfaces(levels.size());
+    for (UINT i = 0; i < levels.size(); ++i)
+        Compress(levels[i], format, surfaces[i]);
+
+    std::vector<BYTE> file;
+    BuildDds(format, surfaces, file);
+
+    std::ofstream fout(dest.c_str(), std::ios::binary);
+    if (!fout)
+        return false;
+    fout.write((const char*)&file[0], file.size());
+    return fout.good();
+}
+#pragma endregion
+
+#pragma region Testing
+UINT TextureCompressor::SelfTest()
+{
+    UINT failures = 0;
+    TestRandom random(1234);
+
+    // 37 x 22 leaves partial blocks on the right and at the bottom, 128 x 128 is
+    // enough blocks to go parallel.
+    const double maxRmse[FormatCount] = { 6.0, 6.0, 4.0, 4.0, 5.0 };
+    const UINT sizes[2][2] = { { 37, 22 }, { 128, 128 } };
+    for (UINT s = 0; s < 2; ++s)
+    {
+        Image image;
+        MakeTestImage(sizes[s][0], sizes[s][1], random, image);
+        for (UINT f = 0; f < FormatCount; ++f)
+        {
+            Surface surface;
+            Compress(image, (Format)f, surface);
+            if (surface.Blocks.size() != ((image.Width + 3) / 4) * ((image.Height + 3) / 4) * GetBlockBytes((Format)f))
+                ++failures;
+
+            Image decoded;
+            Decompress(surface, (Format)f, decoded);
+            if (Rmse(image, decoded, ChannelMask((Format)f)) > maxRmse[f])
+                ++failures;
+        }
+    }
+
+    // BC7 blocks of texels scattered along one line between random colors, the
+    // first texel anywhere on it so the encoder has to swap endpoints for its
+    // anchor index.  Every texel is within half a palette step, give or take
+    // the endpoint rounding.
+    for (UINT trial = 0; trial < 64; ++trial)
+    {
+        float a[4], b[4];
+        for (UINT c = 0; c < 4; ++c)
+        {
+            a[c] = random.Next(0.0f, 255.0f);
+            b[c] = random.Next(0.0f, 255.0f);
+        }
+
+        Image image;
+        image.Width = 4;
+        image.Height = 4;
+        image.Texels.resize(16);
+        for (UINT i = 0; i < 16; ++i)
+        {
+            float t = random.Next(0.0f, 1.0f);
+            UINT c[4];
+            for (UINT k = 0; k < 4; ++k)
+                c[k] = (UINT)(a[k] + t * (b[k] - a[k]) + 0.5f);
+            image.Texels[i] = PackRGBA(c[0], c[1], c[2], c[3]);
+        }
+
+        Surface surface;
+        Image decoded;
+        Compress(image, BC7, surface);
+        Decompress(surface, BC7, decoded);
+        for (UINT i = 0; i < 16; ++i)
+            for (UINT c = 0; c < 4; ++c)
+                if (fabsf((float)Channel(decoded.Texels[i], c) - (float)Channel(image.Texels[i], c)) > fabsf(b[c] - a[c]) / 30.0f + 3.0f)
+                    ++failures;
+    }
+
+    // A flat block is exact but for BC1's 5:6:5 and BC7's 7 bit rounding.
+    const UINT maxFlatError[FormatCount] = { 4, 4, 0, 0, 1 };
+    for (UINT trial = 0; trial < 64; ++trial)
+    {
+        Image image;
+        image.Width = 4;
+        image.Height = 4;
+        UINT color = PackRGBA((UINT)random.Next(0.0f, 255.9f), (UINT)random.Next(0.0f, 255.9f),
+                              (UINT)random.Next(0.0f, 255.9f), (UINT)random.Next(128.0f, 255.9f));
+        image.Texels.assign(16, color);
+
+        for (UINT f = 0; f < FormatCount; ++f)
+        {
+            Surface surface;
+            Image decoded;
+            Compress(image, (Format)f, surface);
+            Decompress(surface, (Format)f, decoded);
+
+            UINT channels = ChannelMask((Format)f) & (f == BC1 ? 0x7u : 0xfu);
+            for (UINT i = 0; i < 16; ++i)
+                for (UINT c = 0; c < 4; ++c)
+                    if ((channels >> c) & 1 && (UINT)abs((int)Channel(decoded.Texels[i], c) - (int)Channel(color, c)) > maxFlatError[f])
+                        ++failures;
+        }
+    }
+
+    // BC1 keeps 1 bit alpha: texels under half alpha come back transparent.
+    {
+        Image image;
+        MakeTestImage(8, 8, random, image);
+        for (UINT i = 0; i < image.Texels.size(); ++i)
+            if ((i * 7) % 3 == 0)
+                image.Texels[i] &= 0x00ffffff;
+
+        Surface surface;
+        Image decoded;
+        Compress(image, BC1, surface);
+        Decompress(surface, BC1, decoded);
+        for (UINT i = 0; i < image.Texels.size(); ++i)
+            if ((Channel(image.Texels[i], 3) >= 128) != (Channel(decoded.Texels[i], 3) == 255))
+                ++failures;
+    }
+
+    // The DDS file of a mip chain: headers, then every level in order.
+    {
+        std::vector<Image> levels(1);
+        MakeTestImage(37, 22, random, levels[0]);
+        while (levels.back().Width > 1 || levels.back().Height > 1)
+        {
+            Image next;
+            Downsample(levels.back(), next);
+            levels.push_back(next);
+        }
+
+        for (UINT f = 0; f < FormatCount; ++f)
+        {
+            std::vector<Surface> surfaces(levels.size());
+            size_t blockBytes = 0;
+            for (UINT i = 0; i < levels.size(); ++i)
+            {
+                Compress(levels[i], (Format)f, surfaces[i]);
+                blockBytes += surfaces[i].Blocks.size();
+            }
+
+            std::vector<BYTE> file;
+            BuildDds((Format)f, surfaces, file);
+
+            const UINT* header = reinterpret_cast<const UINT*>(&file[0]);
+            bool dx10 = header[21] == FourCC('D', 'X', '1', '0');
+            size_t headerBytes = 128 + (dx10 ? 20 : 0);
+            if (header[0] != FourCC('D', 'D', 'S', ' ') || header[1] != 124 || header[3] != 22 || header[4] != 37 ||
+                header[7] != levels.size() || file.size() != headerBytes + blockBytes)
+                ++failures;
+            if (dx10 != (f != BC1 && f != BC3) || (dx10 && header[32] != (UINT)GetDxgiFormat((Format)f)))
+                ++failures;
+            if (memcmp(&file[headerBytes], &surfaces[0].Blocks[0], surfaces[0].Blocks.size()) != 0 ||
+                memcmp(&file[file.size() - surfaces.back().Blocks.size()], &surfaces.back().Blocks[0], surfaces.back().Blocks.size()) != 0)
+                ++failures;
+        }
+    }
+
+    return failures;
+}
+
+TextureCompressor::BenchmarkResult TextureCompressor::Benchmark(UINT size)
+{
+    BenchmarkResult result;
+    result.Size = size;
+
+    TestRandom random(99);
+    std::vector<Image> levels(1);
+    MakeTestImage(size, size, random, levels[0]);
+    while (levels.back().Width > 1 || levels.back().Height > 1)
+    {
+        Image next;
+        Downsample(levels.back(), next);
+        levels.push_back(next);
+    }
+
+    for (UINT f = 0; f < FormatCount; ++f)
+    {
+        std::vector<Surface> surfaces(levels.size());
+        double start = GameTimer::NowMs();
+        for (UINT i = 0; i < levels.size(); ++i)
+            Compress(levels[i], (Format)f, surfaces[i]);
+        result.Ms[f] = GameTimer::NowMs() - start;
+
+        Image decoded;
+        Decompress(surfaces[0], (Format)f, decoded);
+        result.Rmse[f] = Rmse(levels[0], decoded, ChannelMask((Format)f));
+    }
+
+    return result;
+}
+#pragma endregion
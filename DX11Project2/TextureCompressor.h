@@ -0,0 +1,95 @@
+//***************************************************************************************
+// TextureCompressor.h
+//
+// Compresses RGBA8 images into the block formats Direct3D 11 samples directly
+// and writes them, with every mip level, to DDS files that D3DX loads as is.
+// A BC texture takes a quarter (BC3, BC5, BC7) or an eighth (BC1, BC4) of the
+// memory and load bandwidth of the RGBA8 one.
+//
+// Each 4x4 block is fitted on its own.  The endpoints start on the principal
+// axis of the block's texels, every texel takes the nearest palette entry, and
+// one least squares pass refits the endpoints to those indices; the refit is
+// kept when it lowers the error.  Texels go through XMVECTOR math a whole texel
+// at a time, and the rows of blocks are spread over the worker threads.
+//
+// BC7 blocks are all written in mode 6, a single RGBA line with 4 bit indices.
+// It skips the partition search of a full BC7 encoder and still fits smooth
+// color and alpha better than BC3.
+//***************************************************************************************
+
+#ifndef TEXTURECOMPRESSOR_H
+#define TEXTURECOMPRESSOR_H
+
+#include "d3dUtil.h"
+
+class TextureCompressor
+{
+public:
+    enum Format
+    {
+        BC1,        // RGB, 1 bit alpha
+        BC3,        // RGB, smooth alpha
+        BC4,        // R
+        BC5,        // RG, for normal maps
+        BC7,        // RGBA
+        FormatCount
+    };
+
+    // R8G8B8A8 texels, row by row.
+    struct Image
+    {
+        UINT                Width;
+        UINT                Height;
+        std::vector<UINT>   Texels;
+    };
+
+    // Blocks row by row; partial blocks at the right and bottom edges repeat
+    // the last row and column of texels.
+    struct Surface
+    {
+        UINT                Width;
+        UINT                Height;
+        std::vector<BYTE>   Blocks;
+    };
+
+    struct BenchmarkResult
+    {
+        UINT    Size;
+        double  Ms[FormatCount];        // to compress the image and its mips
+        double  Rmse[FormatCount];      // on the channels the format keeps, 0..255
+    };
+
+public:
+    static UINT         GetBlockBytes(Format format);
+    static DXGI_FORMAT  GetDxgiFormat(Format format);
+    static const wchar_t* GetName(Format format);
+
+    // "bc1" .. "bc7", any case.
+    static bool         ParseFormat(const std::wstring& name, Format& format);
+
+    static void     Compress(const Image& image, Format format, Surface& surface);
+
+    // Channels the format does not store come back as 0, alpha as 255.
+    static void     Decompress(const Surface& surface, Format format, Image& image);
+
+    // Reads any image D3DX can load, converted to RGBA8, with a full mip chain.
+    static void     ReadImage(ID3D11Device* device, ID3D11DeviceContext* dc,
+                              const std::wstring& filename, std::vector<Image>& levels);
+
+    // The DDS file for 'levels', mip 0 first.
+    static void     BuildDds(Format format, const std::vector<Surface>& levels, std::vector<BYTE>& file);
+
+    // Reads 'source', compresses every mip level and writes 'dest'.
+    static bool     CompressFile(ID3D11Device* device, ID3D11DeviceContext* dc,
+                                 const std::wstring& source, const std::wstring& dest, Format format);
+
+    // Round trips generated images through every format and checks the error,
+    // flat blocks, 1 bit alpha, partial blocks and the DDS layout.  Returns the
+    // number of failures.
+    static UINT             SelfTest();
+
+    // Compresses a generated 'size' x 'size' image and its mips in every format.
+    static BenchmarkResult  Benchmark(UINT size);
+};
+
+#endif // TEXTURECOMPRESSOR_H
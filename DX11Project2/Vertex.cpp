@@ -11,11 +11,34 @@ const D3D11_INPUT_ELEMENT_DESC InputLayoutDesc::Color[2] =
     { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
     { "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 }
 };
-const D3D11_INPUT_ELEMENT_DESC InputLayoutDesc::Basic32[3] =
+const D3D11_INPUT_ELEMENT_DESC InputLayoutDesc::Basic32[24] =
 {
     { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
     { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-    { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+    { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+
+    // PerObjectConstants, fetched from ConstantBuffers::PerDraw.
+    { "WORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLD", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLDINVTRANSPOSE", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 64, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLDINVTRANSPOSE", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 80, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLDINVTRANSPOSE", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 96, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLDINVTRANSPOSE", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 112, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLDVIEWPROJ", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 128, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLDVIEWPROJ", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 144, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLDVIEWPROJ", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 160, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "WORLDVIEWPROJ", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 176, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "TEXTRANSFORM", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 192, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "TEXTRANSFORM", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 208, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "TEXTRANSFORM", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 224, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "TEXTRANSFORM", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 240, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "MATERIAL", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 256, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "MATERIAL", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 272, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "MATERIAL", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 288, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "MATERIAL", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 304, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "TEXSLICE", 0, DXGI_FORMAT_R32_UINT, 1, 320, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
 };
 const D3D11_INPUT_ELEMENT_DESC InputLayoutDesc::Terrain[3] =
 {
@@ -53,14 +76,14 @@ void InputLayouts::InitAll(ID3D11Device* device)
     //
     // Basic32
     //
-    Effects::BasicFX->m_Light1Tech->GetPassByIndex(0)->GetDesc(&passDesc);
-    HR(device->CreateInputLayout(InputLayoutDesc::Basic32, 3, passDesc.pIAInputSignature,
+    Effects::BasicFX->m_DefaultTech->GetPassByIndex(0)->GetDesc(&passDesc);
+    HR(device->CreateInputLayout(InputLayoutDesc::Basic32, ARRAYSIZE(InputLayoutDesc::Basic32), passDesc.pIAInputSignature,
         passDesc.IAInputSignatureSize, &Basic32));
 
     //
     // Terrain
     //
-    Effects::TerrainFX->m_Light1Tech->GetPassByIndex(0)->GetDesc(&passDesc);
+    Effects::TerrainFX->m_DefaultTech->GetPassByIndex(0)->GetDesc(&passDesc);
     HR(device->CreateInputLayout(InputLayoutDesc::Terrain, 3, passDesc.pIAInputSignature,
         passDesc.IAInputSignatureSize, &Terrain));
 }
@@ -38,7 +38,7 @@ public:
 	// Init like const int A::a[4] = {0, 1, 2, 3}; in .cpp file.
     static const D3D11_INPUT_ELEMENT_DESC Pos[1];
     static const D3D11_INPUT_ELEMENT_DESC Color[2];
-    static const D3D11_INPUT_ELEMENT_DESC Basic32[3];
+    static const D3D11_INPUT_ELEMENT_DESC Basic32[24];
     static const D3D11_INPUT_ELEMENT_DESC Terrain[3];
 };
 
@@ -0,0 +1,73 @@
+//***************************************************************************************
+// ViewContext.cpp
+//***************************************************************************************
+
+#include "ViewContext.h"
+#include "Camera.h"
+
+ViewContext::ViewContext()
+:   m_EyePosW(0.0f, 0.0f, 0.0f),
+    m_NearZ(1.0f),
+    m_FarZ(1000.0f),
+    m_PixelScale(1.0f),
+    m_PickRayOrigin(0.0f, 0.0f, 0.0f),
+    m_PickRayDir(0.0f, 0.0f, 1.0f)
+{
+    XMMATRIX I = XMMatrixIdentity();
+    XMStoreFloat4x4(&m_View, I);
+    XMStoreFloat4x4(&m_Proj, I);
+    XMStoreFloat4x4(&m_ViewProj, I);
+    XMStoreFloat4x4(&m_InvView, I);
+    XMStoreFloat4x4(&m_InvProj, I);
+    XMStoreFloat4x4(&m_InvViewProj, I);
+}
+
+void ViewContext::Build(const Camera& cam, int sx, int sy, int clientWidth, int clientHeight)
+{
+    XMMATRIX view = cam.View();
+    XMMATRIX proj = cam.Proj();
+    XMMATRIX viewProj = XMMatrixMultiply(view, proj);
+
+    // The view matrix is a rigid transform, its inverse is the camera basis itself.
+    XMVECTOR pos = cam.GetPositionXM();
+    XMMATRIX invView(
+        cam.GetRightXM(),
+        cam.GetUpXM(),
+        cam.GetLookXM(),
+        XMVectorSetW(pos, 1.0f));
+    invView.r[0] = XMVectorSetW(invView.r[0], 0.0f);
+    invView.r[1] = XMVectorSetW(invView.r[1], 0.0f);
+    invView.r[2] = XMVectorSetW(invView.r[2], 0.0f);
+
+    XMVECTOR det;
+    XMMATRIX invProj = XMMatrixInverse(&det, proj);
+    XMMATRIX invViewProj = XMMatrixMultiply(invProj, invView);
+
+    XMStoreFloat4x4(&m_View, view);
+    XMStoreFloat4x4(&m_Proj, proj);
+    XMStoreFloat4x4(&m_ViewProj, viewProj);
+    XMStoreFloat4x4(&m_InvView, invView);
+    XMStoreFloat4x4(&m_InvProj, invProj);
+    XMStoreFloat4x4(&m_InvViewProj, invViewProj);
+
+    m_EyePosW = cam.GetPosition();
+    m_NearZ = cam.GetNearZ();
+    m_FarZ = cam.GetFarZ();
+    m_PixelScale = 0.5f * clientHeight * m_Proj(1, 1);
+
+    ExtractFrustumPlanes(m_Planes, viewProj);
+
+    for (UINT k = 0; k < 8; ++k)
+    {
+        XMVECTOR ndc = XMVectorSet((k & 1) ? 1.0f : -1.0f, (k & 2) ? 1.0f : -1.0f, (k & 4) ? 1.0f : 0.0f, 1.0f);
+        XMStoreFloat3(&m_Corners[k], XMVector3TransformCoord(ndc, invViewProj));
+    }
+
+    // Ray from the eye through the pixel, built in view space.
+    float vx = (+2.0f*sx / clientWidth - 1.0f) / proj(0, 0);
+    float vy = (-2.0f*sy / clientHeight + 1.0f) / proj(1, 1);
+    XMVECTOR rayDir = XMVector3TransformNormal(XMVectorSet(vx, vy, 1.0f, 0.0f), invView);
+
+    m_PickRayOrigin = m_EyePosW;
+    XMStoreFloat3(&m_PickRayDir, XMVector3Normalize(rayDir));
+}
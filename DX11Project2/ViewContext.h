@@ -0,0 +1,72 @@
+//***************************************************************************************
+// ViewContext.h
+//
+// Everything derived from the camera that more than one system needs in a frame.
+//
+// Build is called once after the camera moved; the matrices, their inverses, the
+// world space frustum planes and corners and the world space pick ray under the
+// mouse are computed there and only read afterwards, so no consumer multiplies
+// or inverts the camera matrices again.
+//***************************************************************************************
+
+#ifndef VIEWCONTEXT_H
+#define VIEWCONTEXT_H
+
+#include "d3dUtil.h"
+
+class Camera;
+
+class ViewContext
+{
+public:
+    ViewContext();
+
+    // Caches the camera state and the pick ray through client pixel (sx, sy).
+    void    Build(const Camera& cam, int sx, int sy, int clientWidth, int clientHeight);
+
+    XMMATRIX        View() const            { return XMLoadFloat4x4(&m_View); }
+    XMMATRIX        Proj() const            { return XMLoadFloat4x4(&m_Proj); }
+    XMMATRIX        ViewProj() const        { return XMLoadFloat4x4(&m_ViewProj); }
+    XMMATRIX        InvView() const         { return XMLoadFloat4x4(&m_InvView); }
+    XMMATRIX        InvProj() const         { return XMLoadFloat4x4(&m_InvProj); }
+    XMMATRIX        InvViewProj() const     { return XMLoadFloat4x4(&m_InvViewProj); }
+
+    const XMFLOAT3& GetEyePosW() const      { return m_EyePosW; }
+    float           GetNearZ() const        { return m_NearZ; }
+    float           GetFarZ() const         { return m_FarZ; }
+
+    // Pixels covered by one world unit facing the camera at distance 1.
+    float           GetPixelScale() const   { return m_PixelScale; }
+
+    // Left, right, bottom, top, near, far; normals point inside.
+    const XMFLOAT4* GetPlanes() const       { return m_Planes; }
+
+    // Near plane corners followed by far plane corners, in the order
+    // (-x,-y), (+x,-y), (-x,+y), (+x,+y) of normalized device coordinates.
+    const XMFLOAT3* GetCorners() const      { return m_Corners; }
+
+    // Unit length.
+    XMVECTOR        GetPickRayOrigin() const    { return XMLoadFloat3(&m_PickRayOrigin); }
+    XMVECTOR        GetPickRayDir() const       { return XMLoadFloat3(&m_PickRayDir); }
+
+private:
+    XMFLOAT4X4  m_View;
+    XMFLOAT4X4  m_Proj;
+    XMFLOAT4X4  m_ViewProj;
+    XMFLOAT4X4  m_InvView;
+    XMFLOAT4X4  m_InvProj;
+    XMFLOAT4X4  m_InvViewProj;
+
+    XMFLOAT3    m_EyePosW;
+    float       m_NearZ;
+    float       m_FarZ;
+    float       m_PixelScale;
+
+    XMFLOAT4    m_Planes[6];
+    XMFLOAT3    m_Corners[8];
+
+    XMFLOAT3    m_PickRayOrigin;
+    XMFLOAT3    m_PickRayDir;
+};
+
+#endif // VIEWCONTEXT_H
@@ -0,0 +1,360 @@
+//***************************************************************************************
+// VirtualTexture.cpp
+//***************************************************************************************
+
+#include "VirtualTexture.h"
+
+namespace
+{
+    struct TestRandom
+    {
+        explicit TestRandom(UINT seed) : State(seed) {}
+
+        float Next(float a, float b)
+        {
+            State = State * 1664525u + 1013904223u;
+            return a + (b - a) * (float)(State >> 8) / (float)(1 << 24);
+        }
+
+        UINT State;
+    };
+}
+
+const UINT VirtualTexture::InvalidSlot;
+
+VirtualTexture::VirtualTexture(const Desc& desc)
+:   m_Desc(desc),
+    m_Head(InvalidSlot),
+    m_Tail(InvalidSlot),
+    m_Frame(0),
+    m_TableChanged(true)
+{
+    assert(desc.PagesPerSide > 0 && desc.PagesPerSide <= 256 && (desc.PagesPerSide & (desc.PagesPerSide - 1)) == 0);
+    assert(desc.CacheSlotsPerSide > 0 && desc.CacheSlotsPerSide <= 256);
+
+    UINT pages = 0;
+    for (UINT side = desc.PagesPerSide; side > 0; side >>= 1)
+    {
+        m_MipOffsets.push_back(pages);
+        pages += side * side;
+    }
+    m_PageSlots.assign(pages, InvalidSlot);
+    m_PageRequested.assign(pages, 0);
+
+    // Free slots are handed out from the back, lowest first.
+    UINT slotCount = desc.CacheSlotsPerSide * desc.CacheSlotsPerSide;
+    m_Slots.resize(slotCount);
+    for (UINT i = 0; i < slotCount; ++i)
+    {
+        m_Slots[i].PageIndex = InvalidSlot;
+        m_Slots[i].LastRequested = 0;
+        m_Slots[i].Prev = InvalidSlot;
+        m_Slots[i].Next = InvalidSlot;
+        m_FreeSlots.push_back(slotCount - 1 - i);
+    }
+
+    m_Table.assign(desc.PagesPerSide * desc.PagesPerSide, 0);
+    BuildTable();
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+#pragma region Requests
+void VirtualTexture::BeginFrame()
+{
+    // Frame 0 marks pages that were never requested.
+    ++m_Frame;
+    m_Misses.clear();
+    m_Uploads.clear();
+    m_TableChanged = false;
+
+    UINT resident = m_Stats.Resident;
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+    m_Stats.Resident = resident;
+
+    Request(GetMipCount() - 1, 0, 0);
+}
+
+void VirtualTexture::Request(UINT mip, UINT x, UINT y)
+{
+    assert(mip < GetMipCount() && x < GetPagesPerSide(mip) && y < GetPagesPerSide(mip));
+
+    UINT index = IndexOf(mip, x, y);
+    if (m_PageRequested[index] == m_Frame)
+        return;
+    m_PageRequested[index] = m_Frame;
+    ++m_Stats.Requested;
+
+    UINT slot = m_PageSlots[index];
+    if (slot != InvalidSlot)
+    {
+        ++m_Stats.Hits;
+        m_Slots[slot].LastRequested = m_Frame;
+        Unlink(slot);
+        PushBack(slot);
+        return;
+    }
+
+    ++m_Stats.Misses;
+    Miss miss = { { mip, x, y }, index };
+    m_Misses.push_back(miss);
+}
+
+void VirtualTexture::RequestRect(float u0, float v0, float u1, float v1, UINT mip)
+{
+    float pages = (float)GetPagesPerSide(mip);
+    int last = (int)GetPagesPerSide(mip) - 1;
+
+    int x0 = MathHelper::Clamp((int)floorf(u0 * pages), 0, last);
+    int x1 = MathHelper::Clamp((int)floorf(u1 * pages), 0, last);
+    int y0 = MathHelper::Clamp((int)floorf(v0 * pages), 0, last);
+    int y1 = MathHelper::Clamp((int)floorf(v1 * pages), 0, last);
+
+    for (int y = y0; y <= y1; ++y)
+        for (int x = x0; x <= x1; ++x)
+            Request(mip, (UINT)x, (UINT)y);
+}
+
+void VirtualTexture::EndFrame()
+{
+    // Coarse pages first: each one stands in for many fine ones until they arrive.
+    std::sort(m_Misses.begin(), m_Misses.end(), [](const Miss& a, const Miss& b)
+    {
+        return a.Source.Mip != b.Source.Mip ? a.Source.Mip > b.Source.Mip : a.PageIndex < b.PageIndex;
+    });
+
+    for (UINT i = 0; i < m_Misses.size(); ++i)
+    {
+        if (m_Uploads.size() == m_Desc.MaxUploadsPerFrame)
+        {
+            m_Stats.Deferred += (UINT)m_Misses.size() - i;
+            break;
+        }
+
+        UINT slot = InvalidSlot;
+        if (!m_FreeSlots.empty())
+        {
+            slot = m_FreeSlots.back();
+            m_FreeSlots.pop_back();
+            ++m_Stats.Resident;
+        }
+        else
+        {
+            // Everything requested this frame sits behind the older pages, so
+            // once the head was requested this frame every slot is needed.
+            if (m_Head == InvalidSlot || m_Slots[m_Head].LastRequested == m_Frame)
+            {
+                m_Stats.Deferred += (UINT)m_Misses.size() - i;
+                break;
+            }
+
+            slot = m_Head;
+            Unlink(slot);
+            m_PageSlots[m_Slots[slot].PageIndex] = InvalidSlot;
+            ++m_Stats.Evictions;
+        }
+
+        const Miss& miss = m_Misses[i];
+        m_PageSlots[miss.PageIndex] = slot;
+        m_Slots[slot].PageIndex = miss.PageIndex;
+        m_Slots[slot].LastRequested = m_Frame;
+        PushBack(slot);
+
+        Upload upload = { miss.Source, slot };
+        m_Uploads.push_back(upload);
+    }
+
+    m_Stats.Uploads = (UINT)m_Uploads.size();
+    if (!m_Uploads.empty())
+    {
+        BuildTable();
+        m_TableChanged = true;
+    }
+}
+
+UINT VirtualTexture::GetSlot(UINT mip, UINT x, UINT y) const
+{
+    return m_PageSlots[IndexOf(mip, x, y)];
+}
+#pragma endregion
+
+#pragma region Cache
+void VirtualTexture::Unlink(UINT slot)
+{
+    Slot& s = m_Slots[slot];
+    if (s.Prev != InvalidSlot)
+        m_Slots[s.Prev].Next = s.Next;
+    else if (m_Head == slot)
+        m_Head = s.Next;
+
+    if (s.Next != InvalidSlot)
+        m_Slots[s.Next].Prev = s.Prev;
+    else if (m_Tail == slot)
+        m_Tail = s.Prev;
+
+    s.Prev = InvalidSlot;
+    s.Next = InvalidSlot;
+}
+
+void VirtualTexture::PushBack(UINT slot)
+{
+    Slot& s = m_Slots[slot];
+    s.Prev = m_Tail;
+    s.Next = InvalidSlot;
+    if (m_Tail != InvalidSlot)
+        m_Slots[m_Tail].Next = slot;
+    else
+        m_Head = slot;
+    m_Tail = slot;
+}
+
+void VirtualTexture::BuildTable()
+{
+    // Coarse to fine, each mip 0 page keeps the finest resident page above it.
+    // Before the first upload nothing is resident and slot 0 stands in.
+    UINT side = m_Desc.PagesPerSide;
+    UINT coarsest = GetMipCount() - 1;
+    for (UINT mip = coarsest + 1; mip-- > 0;)
+    {
+        for (UINT y = 0; y < side; ++y)
+        {
+            for (UINT x = 0; x < side; ++x)
+            {
+                UINT slot = m_PageSlots[IndexOf(mip, x >> mip, y >> mip)];
+                if (slot == InvalidSlot && mip != coarsest)
+                    continue;
+
+                UINT s = slot != InvalidSlot ? slot : 0;
+                m_Table[y * side + x] = (s % m_Desc.CacheSlotsPerSide) | ((s / m_Desc.CacheSlotsPerSide) << 8) | (mip << 16);
+            }
+        }
+    }
+}
+#pragma endregion
+
+#pragma region Validation
+UINT VirtualTexture::Validate() const
+{
+    UINT broken = 0;
+
+    // Every resident page and its slot point at each other.
+    UINT resident = 0;
+    for (UINT i = 0; i < m_PageSlots.size(); ++i)
+    {
+        UINT slot = m_PageSlots[i];
+        if (slot == InvalidSlot)
+            continue;
+        ++resident;
+        if (slot >= m_Slots.size() || m_Slots[slot].PageIndex != i)
+            ++broken;
+    }
+
+    // The LRU list holds exactly the used slots, oldest request first.
+    UINT linked = 0;
+    UINT prev = InvalidSlot;
+    for (UINT s = m_Head; s != InvalidSlot && linked <= m_Slots.size(); s = m_Slots[s].Next)
+    {
+        const Slot& slot = m_Slots[s];
+        if (slot.Prev != prev || slot.PageIndex == InvalidSlot || m_PageSlots[slot.PageIndex] != s)
+            ++broken;
+        if (prev != InvalidSlot && m_Slots[prev].LastRequested > slot.LastRequested)
+            ++broken;
+        prev = s;
+        ++linked;
+    }
+    if (prev != m_Tail || linked != resident || resident != m_Stats.Resident ||
+        resident + m_FreeSlots.size() != m_Slots.size())
+        ++broken;
+
+    // The table names the finest resident page over every mip 0 page.
+    UINT side = m_Desc.PagesPerSide;
+    for (UINT y = 0; y < side; ++y)
+    {
+        for (UINT x = 0; x < side; ++x)
+        {
+            UINT mip = 0;
+            while (mip + 1 < GetMipCount() && m_PageSlots[IndexOf(mip, x >> mip, y >> mip)] == InvalidSlot)
+                ++mip;
+
+            UINT slot = m_PageSlots[IndexOf(mip, x >> mip, y >> mip)];
+            UINT s = slot != InvalidSlot ? slot : 0;
+            UINT expected = (s % m_Desc.CacheSlotsPerSide) | ((s / m_Desc.CacheSlotsPerSide) << 8) | (mip << 16);
+            if (m_Table[y * side + x] != expected)
+                ++broken;
+        }
+    }
+
+    return broken;
+}
+
+UINT VirtualTexture::SelfTest()
+{
+    UINT failures = 0;
+    TestRandom random(4321);
+
+    // A camera wanders over a 32 x 32 page texture with a cache of 36 pages.  It
+    // needs fine pages near it and coarser ones further out.
+    Desc desc = { 32, 6, 4 };
+    VirtualTexture vt(desc);
+
+    std::vector<UINT> lastRequested(vt.m_PageSlots.size(), 0);
+    float u = 0.5f;
+    float v = 0.5f;
+    for (UINT frame = 0; frame < 400; ++frame)
+    {
+        u = MathHelper::Clamp(u + random.Next(-0.03f, 0.03f), 0.0f, 1.0f);
+        v = MathHelper::Clamp(v + random.Next(-0.03f, 0.03f), 0.0f, 1.0f);
+        float reach = frame % 50 == 49 ? 0.5f : 0.05f;  // now and then more than fits
+
+        std::vector<UINT> residentBefore;
+        for (UINT i = 0; i < vt.m_PageSlots.size(); ++i)
+            if (vt.m_PageSlots[i] != InvalidSlot)
+                residentBefore.push_back(i);
+
+        vt.BeginFrame();
+        vt.RequestRect(u - reach, v - reach, u + reach, v + reach, 0);
+        vt.RequestRect(u - 2.0f*reach, v - 2.0f*reach, u + 2.0f*reach, v + 2.0f*reach, 1);
+        vt.RequestRect(u - 4.0f*reach, v - 4.0f*reach, u + 4.0f*reach, v + 4.0f*reach, 3);
+        vt.EndFrame();
+
+        const Stats& stats = vt.GetStats();
+        if (stats.Hits + stats.Misses != stats.Requested || stats.Uploads + stats.Deferred != stats.Misses ||
+            stats.Uploads > desc.MaxUploadsPerFrame)
+            ++failures;
+
+        // Nothing requested this frame was evicted, and no page that stayed is
+        // older than one that left.
+        UINT newestEvicted = 0;
+        UINT oldestKept = 0xffffffff;
+        for (UINT i : residentBefore)
+        {
+            if (vt.m_PageSlots[i] == InvalidSlot)
+            {
+                if (vt.m_PageRequested[i] == vt.m_Frame)
+                    ++failures;
+                newestEvicted = MathHelper::Max(newestEvicted, lastRequested[i]);
+            }
+            else if (vt.m_PageRequested[i] != vt.m_Frame)
+            {
+                oldestKept = MathHelper::Min(oldestKept, lastRequested[i]);
+            }
+        }
+        if (newestEvicted > oldestKept)
+            ++failures;
+
+        for (UINT i = 0; i < vt.m_PageRequested.size(); ++i)
+            if (vt.m_PageRequested[i] == vt.m_Frame)
+                lastRequested[i] = vt.m_Frame;
+
+        // Uploads went to the pages they name, and the coarsest page stays.
+        for (const Upload& upload : vt.GetUploads())
+            if (vt.GetSlot(upload.Source.Mip, upload.Source.X, upload.Source.Y) != upload.Slot)
+                ++failures;
+        if (vt.GetSlot(vt.GetMipCount() - 1, 0, 0) == InvalidSlot)
+            ++failures;
+
+        failures += vt.Validate();
+    }
+
+    return failures;
+}
+#pragma endregion
@@ -0,0 +1,147 @@
+//***************************************************************************************
+// VirtualTexture.h
+//
+// Page management for a texture too large to keep in video memory.  The virtual
+// texture is a mip pyramid of square pages, PagesPerSide pages across at mip 0
+// and one page at the coarsest mip.  A cache of fixed size holds some of them,
+// and the page table says which cache slot holds each resident page.
+//
+// Every frame the renderer requests the pages it is about to sample between
+// BeginFrame and EndFrame.  Resident pages are hits and become the most recently
+// used; the others are misses.  EndFrame gives up to MaxUploadsPerFrame misses,
+// coarsest first, a slot: a free one, or the one of the least recently used page
+// that was not requested this frame.  The caller then fills the slots listed by
+// GetUploads.  Misses that get no slot are requested again next frame.
+//
+// The page table resolves every mip 0 page to the finest resident page over it,
+// so a page that is not resident yet shows its blurrier ancestor.  The coarsest
+// page is requested every frame and never leaves.
+//
+// Nothing here touches Direct3D; Terrain owns the textures.
+//***************************************************************************************
+
+#ifndef VIRTUALTEXTURE_H
+#define VIRTUALTEXTURE_H
+
+#include "d3dUtil.h"
+
+class VirtualTexture
+{
+public:
+    static const UINT InvalidSlot = 0xffffffff;
+
+    struct Desc
+    {
+        UINT    PagesPerSide;           // at mip 0, a power of two up to 256
+        UINT    CacheSlotsPerSide;      // up to 256
+        UINT    MaxUploadsPerFrame;
+    };
+
+    struct Page
+    {
+        UINT    Mip;
+        UINT    X;
+        UINT    Y;
+    };
+
+    struct Upload
+    {
+        Page    Source;
+        UINT    Slot;
+    };
+
+    struct Stats
+    {
+        UINT    Requested;      // distinct pages in the last frame
+        UINT    Hits;
+        UINT    Misses;
+        UINT    Uploads;
+        UINT    Evictions;
+        UINT    Deferred;       // misses left for later by the upload budget or a cache full of needed pages
+        UINT    Resident;
+    };
+
+public:
+    explicit VirtualTexture(const Desc& desc);
+
+    const Desc& GetDesc() const                 { return m_Desc; }
+    UINT        GetMipCount() const             { return (UINT)m_MipOffsets.size(); }
+    UINT        GetPagesPerSide(UINT mip) const { return m_Desc.PagesPerSide >> mip; }
+    UINT        GetSlotCount() const            { return (UINT)m_Slots.size(); }
+
+    void        BeginFrame();
+    void        Request(UINT mip, UINT x, UINT y);
+
+    // Every page of 'mip' under [u0, u1] x [v0, v1] of the virtual texture.
+    void        RequestRect(float u0, float v0, float u1, float v1, UINT mip);
+
+    void        EndFrame();
+
+    // The slots EndFrame handed out, to be filled before the table is used.
+    const std::vector<Upload>&  GetUploads() const  { return m_Uploads; }
+
+    // InvalidSlot when the page is not resident.
+    UINT        GetSlot(UINT mip, UINT x, UINT y) const;
+
+    // One entry per mip 0 page, row by row: the slot of the finest resident
+    // page over it, packed as slot x | slot y << 8 | mip << 16.
+    const std::vector<UINT>&    GetTable() const    { return m_Table; }
+
+    // Whether the last EndFrame changed the table.
+    bool        TableChanged() const            { return m_TableChanged; }
+
+    const Stats&    GetStats() const            { return m_Stats; }
+
+    // Checks the page table against the slots and the LRU list.  Returns the
+    // number of broken entries.
+    UINT        Validate() const;
+
+    // Drives a cache through a moving camera's requests and checks residency,
+    // eviction order and the table every frame.  Returns the number of failures.
+    static UINT SelfTest();
+
+public:
+    VirtualTexture(const VirtualTexture& rhs)               = delete;
+    VirtualTexture& operator=(const VirtualTexture& rhs)    = delete;
+
+private:
+    struct Slot
+    {
+        UINT    PageIndex;      // InvalidSlot while free
+        UINT    LastRequested;  // frame number
+        UINT    Prev;           // LRU list, least recently used first
+        UINT    Next;
+    };
+
+    struct Miss
+    {
+        Page    Source;
+        UINT    PageIndex;
+    };
+
+    UINT    IndexOf(UINT mip, UINT x, UINT y) const     { return m_MipOffsets[mip] + y * GetPagesPerSide(mip) + x; }
+    void    Unlink(UINT slot);
+    void    PushBack(UINT slot);
+    void    BuildTable();
+
+private:
+    Desc                    m_Desc;
+    std::vector<UINT>       m_MipOffsets;
+    std::vector<UINT>       m_PageSlots;        // per page of every mip
+    std::vector<UINT>       m_PageRequested;    // frame number of the last request
+
+    std::vector<Slot>       m_Slots;
+    std::vector<UINT>       m_FreeSlots;
+    UINT                    m_Head;
+    UINT                    m_Tail;
+
+    UINT                    m_Frame;
+    std::vector<Miss>       m_Misses;
+    std::vector<Upload>     m_Uploads;
+    std::vector<UINT>       m_Table;
+    bool                    m_TableChanged;
+
+    Stats                   m_Stats;
+};
+
+#endif // VIRTUALTEXTURE_H
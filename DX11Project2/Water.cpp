@@ -0,0 +1,172 @@
+#include "Water.h"
+#include "Effects.h"
+#include "RenderStates.h"
+
+
+Water::Water()
+:   m_Random(0),
+    m_StepTime(0.0f),
+    m_DropTime(0.0f),
+    m_TexOffset(0.0f, 0.0f),
+    m_Back(0),
+    m_Fresh(false),
+    m_VB(nullptr),
+    m_IB(nullptr),
+    m_IndexCount(0),
+    m_Center(0.0f, 0.0f, 0.0f),
+    m_Size(128.0f),
+    m_DiffuseMapFile(L"Textures/water2.dds")
+{
+    Material mat;
+    mat.Ambient = XMFLOAT4(0.5f, 0.5f, 0.5f, 1.0f);
+    mat.Diffuse = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.5f);
+    mat.Specular = XMFLOAT4(0.8f, 0.8f, 0.8f, 32.0f);
+    SetMaterial(mat);
+}
+
+
+Water::~Water()
+{
+    Release();
+}
+
+void Water::Place(const XMFLOAT3& center, float size, const std::wstring& diffuseMap)
+{
+    m_Center = center;
+    m_Size = size;
+    m_DiffuseMapFile = diffuseMap;
+}
+
+void Water::Init(ID3D11Device* device)
+{
+    // The constants of Luna's Waves demo; a step is 0.03 s whatever the grid spacing.
+    m_Waves.Init(GridVertices, GridVertices, m_Size / (GridVertices - 1), 0.03f, 3.25f, 0.4f);
+
+    // ForThread hands out streams from 1 on, so stream 0 is the drops' own.
+    m_Random.Seed(Random::GetGlobalSeed(), 0);
+
+    CreateBuffer(device);
+    m_Effect = Effects::BasicFX;
+    m_Tech = Effects::BasicFX->m_DefaultTech;
+    SetDiffuseMap(m_DiffuseMapFile);
+    SetTransform(XMVectorReplicate(1.0f), XMQuaternionIdentity(), XMLoadFloat3(&m_Center));
+}
+
+void Water::Release()
+{
+    ReleaseCOM(m_VB);
+    ReleaseCOM(m_IB);
+    Object::Release();
+}
+
+void Water::Update(float dt)
+{
+    // A drop somewhere away from the shore every quarter second.
+    m_DropTime += dt;
+    if (m_DropTime >= 0.25f)
+    {
+        m_DropTime -= 0.25f;
+        UINT row = 5 + m_Random.NextUInt() % (m_Waves.GetRows() - 10);
+        UINT col = 5 + m_Random.NextUInt() % (m_Waves.GetCols() - 10);
+        m_Waves.Disturb(row, col, m_Random.NextFloat(0.5f, 1.0f));
+    }
+
+    // Only the last step of the tick writes the vertices.
+    m_StepTime += dt;
+    UINT steps = MathHelper::Min((UINT)(m_StepTime / m_Waves.GetTimeStep()), MaxStepsPerTick);
+    m_StepTime = steps < MaxStepsPerTick ? m_StepTime - steps * m_Waves.GetTimeStep() : 0.0f;
+    for (UINT s = 0; s < steps; ++s)
+        m_Waves.Step(s + 1 == steps ? &m_Vertices[m_Back][0] : nullptr);
+
+    if (steps)
+    {
+        std::lock_guard<std::mutex> lock(m_VertexMutex);
+        m_Back ^= 1;
+        m_Fresh = true;
+    }
+
+    // The water texture tiles five times over the surface and drifts.
+    m_TexOffset.x += 0.05f*dt;
+    m_TexOffset.y += 0.1f*dt;
+    m_TexOffset.x -= floorf(m_TexOffset.x);
+    m_TexOffset.y -= floorf(m_TexOffset.y);
+    XMMATRIX waterScale = XMMatrixScaling(5.0f, 5.0f, 0.0f);
+    XMMATRIX waterOffset = XMMatrixTranslation(m_TexOffset.x, m_TexOffset.y, 0.0f);
+    SetTexTransform(waterScale * waterOffset);
+
+    Object::Update(dt);
+}
+
+void Water::Render(ID3D11DeviceContext* context, CXMMATRIX viewProj)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_VertexMutex);
+        if (m_Fresh)
+        {
+            const std::vector<Vertex::Basic32>& vertices = m_Vertices[m_Back ^ 1];
+            D3D11_MAPPED_SUBRESOURCE mapped;
+            HR(context->Map(m_VB, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+            memcpy(mapped.pData, &vertices[0], vertices.size() * sizeof(Vertex::Basic32));
+            context->Unmap(m_VB, 0);
+            m_Fresh = false;
+        }
+    }
+
+    UINT stride = sizeof(Vertex::Basic32);
+    UINT offset = 0;
+    context->IASetVertexBuffers(0, 1, &m_VB, &stride, &offset);
+    context->IASetIndexBuffer(m_IB, DXGI_FORMAT_R32_UINT, 0);
+    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    context->IASetInputLayout(InputLayouts::Basic32);
+
+    m_Tech = Effects::BasicFX->SelectTech(BasicEffect::FeaturesFor(RenderStates::m_RenderOptions));
+
+    Object::Render(context, viewProj);
+}
+
+void Water::DrawMesh(ID3D11DeviceContext* context)
+{
+    context->DrawIndexed(m_IndexCount, 0, 0);
+}
+
+void Water::CreateBuffer(ID3D11Device* device)
+{
+    // Both copies start as the flat surface.
+    m_Vertices[0].resize(m_Waves.GetVertexCount());
+    m_Waves.Step(&m_Vertices[0][0]);
+    m_Vertices[1] = m_Vertices[0];
+
+    D3D11_BUFFER_DESC vbd;
+    vbd.Usage = D3D11_USAGE_DYNAMIC;
+    vbd.ByteWidth = sizeof(Vertex::Basic32) * m_Waves.GetVertexCount();
+    vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    vbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    vbd.MiscFlags = 0;
+    vbd.StructureByteStride = 0;
+
+    D3D11_SUBRESOURCE_DATA vinitData;
+    vinitData.pSysMem = &m_Vertices[0][0];
+    HR(device->CreateBuffer(&vbd, &vinitData, &m_VB));
+
+    std::vector<UINT> indices;
+    m_Waves.BuildIndices(indices);
+    m_IndexCount = (UINT)indices.size();
+
+    D3D11_BUFFER_DESC ibd;
+    ibd.Usage = D3D11_USAGE_IMMUTABLE;
+    ibd.ByteWidth = sizeof(UINT) * m_IndexCount;
+    ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+    ibd.CPUAccessFlags = 0;
+    ibd.MiscFlags = 0;
+    ibd.StructureByteStride = 0;
+
+    D3D11_SUBRESOURCE_DATA iinitData;
+    iinitData.pSysMem = &indices[0];
+    HR(device->CreateBuffer(&ibd, &iinitData, &m_IB));
+
+    // The crests of a few drops stay within a few units of the rest level.
+    XNA::AxisAlignedBox box;
+    box.Center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    box.Extents = XMFLOAT3(0.5f*m_Waves.GetWidth(), 4.0f, 0.5f*m_Waves.GetDepth());
+    SetMeshBox(box);
+}
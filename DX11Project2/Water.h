@@ -0,0 +1,52 @@
+#pragma once
+#include <mutex>
+#include "Object.h"
+#include "Random.h"
+#include "WaveSimulation.h"
+class Water : public Object
+{
+public:
+    Water();
+    virtual ~Water();
+
+    // Where the surface lies, its side and the texture it wears; call before Init.
+    void Place(const XMFLOAT3& center, float size, const std::wstring& diffuseMap);
+
+    virtual void Init(ID3D11Device* device);
+    virtual void Release();
+    virtual void Update(float dt);
+    virtual void Render(ID3D11DeviceContext* context, CXMMATRIX viewProj);
+    virtual void CreateBuffer(ID3D11Device* device);
+
+protected:
+    virtual void DrawMesh(ID3D11DeviceContext* context);
+
+private:
+    // Vertices along each side of the grid.
+    static const UINT GridVertices = 161;
+
+    // At most this many wave steps per tick; time beyond them is dropped.
+    static const UINT MaxStepsPerTick = 4;
+
+    WaveSimulation  m_Waves;
+    Random          m_Random;
+    float           m_StepTime;         // not yet stepped
+    float           m_DropTime;         // since the last drop
+    XMFLOAT2        m_TexOffset;
+
+    // Update writes the surface into m_Vertices[m_Back] and then flips m_Back,
+    // so a tick on the simulation thread never writes what Render copies.
+    // m_Fresh is set when m_Vertices[m_Back ^ 1] has not been uploaded yet.
+    std::vector<Vertex::Basic32>    m_Vertices[2];
+    UINT                            m_Back;
+    bool                            m_Fresh;
+    std::mutex                      m_VertexMutex;
+
+    ID3D11Buffer*   m_VB;               // dynamic, rewritten whenever the surface changed
+    ID3D11Buffer*   m_IB;
+    UINT            m_IndexCount;
+
+    XMFLOAT3        m_Center;
+    float           m_Size;
+    std::wstring    m_DiffuseMapFile;
+};
@@ -0,0 +1,468 @@
+//***************************************************************************************
+// WaveSimulation.cpp
+//***************************************************************************************
+
+#include "WaveSimulation.h"
+#include "Random.h"
+#include "GameTimer.h"
+#include <cassert>
+#include <cmath>
+#include <ppl.h>
+
+namespace
+{
+    void WriteVertex(Vertex::Basic32& vertex, float x, float y, float z, float nx, float ny, float nz, float u, float v)
+    {
+        vertex.Pos = XMFLOAT3(x, y, z);
+        vertex.Normal = XMFLOAT3(nx, ny, nz);
+        vertex.Tex = XMFLOAT2(u, v);
+    }
+}
+
+WaveSimulation::WaveSimulation()
+:   m_Rows(0),
+    m_Cols(0),
+    m_Spacing(0.0f),
+    m_TimeStep(0.0f),
+    m_K1(0.0f),
+    m_K2(0.0f),
+    m_K3(0.0f),
+    m_Current(0)
+{
+}
+
+void WaveSimulation::Init(UINT rows, UINT cols, float spacing, float timeStep, float speed, float damping)
+{
+    assert(rows >= 5 && cols >= 5);
+
+    m_Rows = rows;
+    m_Cols = cols;
+    m_Spacing = spacing;
+    m_TimeStep = timeStep;
+
+    // The explicit scheme only stays bounded while a wave crosses less than
+    // about 0.7 cells per step.
+    float d = damping*timeStep + 2.0f;
+    float e = (speed*speed)*(timeStep*timeStep) / (spacing*spacing);
+    assert(e <= 0.5f);
+
+    m_K1 = (damping*timeStep - 2.0f) / d;
+    m_K2 = (4.0f - 8.0f*e) / d;
+    m_K3 = (2.0f*e) / d;
+
+    m_Heights[0].assign(rows * cols, 0.0f);
+    m_Heights[1].assign(rows * cols, 0.0f);
+    m_Current = 0;
+}
+
+void WaveSimulation::Disturb(UINT row, UINT col, float magnitude)
+{
+    assert(row > 1 && row < m_Rows - 2);
+    assert(col > 1 && col < m_Cols - 2);
+
+    float* h = &m_Heights[m_Current][row * m_Cols + col];
+    float halfMagnitude = 0.5f*magnitude;
+
+    h[0] += magnitude;
+    h[1] += halfMagnitude;
+    h[-1] += halfMagnitude;
+    h[m_Cols] += halfMagnitude;
+    h[-(int)m_Cols] += halfMagnitude;
+}
+
+void WaveSimulation::Step(Vertex::Basic32* vertices, bool parallel)
+{
+    if (parallel)
+    {
+        concurrency::parallel_for(0u, (m_Rows + RowsPerTask - 1) / RowsPerTask, [&](UINT t)
+        {
+            StepRows(t * RowsPerTask, MathHelper::Min(m_Rows, (t + 1) * RowsPerTask), vertices);
+        });
+    }
+    else
+    {
+        StepRows(0, m_Rows, vertices);
+    }
+
+    // The previous heights were overwritten with the next ones.
+    m_Current ^= 1;
+}
+
+void WaveSimulation::StepRows(UINT first, UINT last, Vertex::Basic32* vertices)
+{
+    const UINT cols = m_Cols;
+    const float* current = &m_Heights[m_Current][0];
+    float* next = &m_Heights[m_Current ^ 1][0];
+
+    const float halfWidth = 0.5f*GetWidth();
+    const float halfDepth = 0.5f*GetDepth();
+    const float du = 1.0f / (m_Cols - 1);
+    const float dv = 1.0f / (m_Rows - 1);
+    const float twoSpacing = 2.0f*m_Spacing;
+
+    const XMVECTOR k1 = XMVectorReplicate(m_K1);
+    const XMVECTOR k2 = XMVectorReplicate(m_K2);
+    const XMVECTOR k3 = XMVectorReplicate(m_K3);
+    const XMVECTOR ny = XMVectorReplicate(twoSpacing);
+
+    for (UINT i = first; i < last; ++i)
+    {
+        const float* c = current + i * cols;
+        float* n = next + i * cols;
+        Vertex::Basic32* row = vertices ? vertices + i * cols : nullptr;
+        const float z = halfDepth - i*m_Spacing;
+        const float v = i*dv;
+
+        // The boundary stays still, its normals straight up.
+        if (i == 0 || i == m_Rows - 1)
+        {
+            for (UINT j = 0; j < cols; ++j)
+            {
+                n[j] = 0.0f;
+                if (row)
+                    WriteVertex(row[j], -halfWidth + j*m_Spacing, c[j], z, 0.0f, 1.0f, 0.0f, j*du, v);
+            }
+            continue;
+        }
+
+        n[0] = 0.0f;
+        n[cols - 1] = 0.0f;
+        if (row)
+        {
+            WriteVertex(row[0], -halfWidth, c[0], z, 0.0f, 1.0f, 0.0f, 0.0f, v);
+            WriteVertex(row[cols - 1], halfWidth, c[cols - 1], z, 0.0f, 1.0f, 0.0f, 1.0f, v);
+        }
+
+        // The normal is the cross product of the tangents along the row and
+        // down the column, (2h, r - l, 0) and (0, d - u, -2h), scaled by 2h.
+        const float* up = c - cols;
+        const float* down = c + cols;
+        UINT j = 1;
+        for (; j + 4 <= cols - 1; j += 4)
+        {
+            XMVECTOR C = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(c + j));
+            XMVECTOR L = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(c + j - 1));
+            XMVECTOR R = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(c + j + 1));
+            XMVECTOR U = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(up + j));
+            XMVECTOR D = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(down + j));
+            XMVECTOR P = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(n + j));
+
+            XMVECTOR sum = XMVectorAdd(XMVectorAdd(L, R), XMVectorAdd(U, D));
+            XMVECTOR N = XMVectorAdd(XMVectorAdd(XMVectorMultiply(k1, P), XMVectorMultiply(k2, C)), XMVectorMultiply(k3, sum));
+            XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(n + j), N);
+
+            if (!row)
+                continue;
+
+            XMVECTOR nx = XMVectorSubtract(L, R);
+            XMVECTOR nz = XMVectorSubtract(D, U);
+            XMVECTOR lengthSq = XMVectorAdd(XMVectorAdd(XMVectorMultiply(nx, nx), XMVectorMultiply(ny, ny)), XMVectorMultiply(nz, nz));
+            XMVECTOR invLength = XMVectorReciprocalSqrt(lengthSq);
+
+            XMFLOAT4 heights, normalX, normalY, normalZ;
+            XMStoreFloat4(&heights, C);
+            XMStoreFloat4(&normalX, XMVectorMultiply(nx, invLength));
+            XMStoreFloat4(&normalY, XMVectorMultiply(ny, invLength));
+            XMStoreFloat4(&normalZ, XMVectorMultiply(nz, invLength));
+
+            const float* h = &heights.x;
+            const float* nxs = &normalX.x;
+            const float* nys = &normalY.x;
+            const float* nzs = &normalZ.x;
+            for (UINT k = 0; k < 4; ++k)
+            {
+                UINT col = j + k;
+                WriteVertex(row[col], -halfWidth + col*m_Spacing, h[k], z, nxs[k], nys[k], nzs[k], col*du, v);
+            }
+        }
+
+        for (; j < cols - 1; ++j)
+        {
+            float sum = (c[j - 1] + c[j + 1]) + (up[j] + down[j]);
+            n[j] = (m_K1*n[j] + m_K2*c[j]) + m_K3*sum;
+
+            if (!row)
+                continue;
+
+            float nx = c[j - 1] - c[j + 1];
+            float nz = down[j] - up[j];
+            float invLength = 1.0f / sqrtf((nx*nx + twoSpacing*twoSpacing) + nz*nz);
+            WriteVertex(row[j], -halfWidth + j*m_Spacing, c[j], z, nx*invLength, twoSpacing*invLength, nz*invLength, j*du, v);
+        }
+    }
+}
+
+void WaveSimulation::BuildIndices(std::vector<UINT>& indices) const
+{
+    indices.clear();
+    indices.reserve(6 * (m_Rows - 1) * (m_Cols - 1));
+    for (UINT i = 0; i + 1 < m_Rows; ++i)
+    {
+        for (UINT j = 0; j + 1 < m_Cols; ++j)
+        {
+            indices.push_back(i * m_Cols + j);
+            indices.push_back(i * m_Cols + j + 1);
+            indices.push_back((i + 1) * m_Cols + j);
+
+            indices.push_back((i + 1) * m_Cols + j);
+            indices.push_back(i * m_Cols + j + 1);
+            indices.push_back((i + 1) * m_Cols + j + 1);
+        }
+    }
+}
+
+#pragma region Tests
+namespace
+{
+    // Luna's solver: one vertex at a time, the normals in a pass of their own
+    // over the surface before the step.
+    struct ReferenceWaves
+    {
+        ReferenceWaves(UINT rows, UINT cols, float spacing, float k1, float k2, float k3)
+            : Rows(rows), Cols(cols), Spacing(spacing), K1(k1), K2(k2), K3(k3),
+            Previous(rows * cols, 0.0f), Current(rows * cols, 0.0f)
+        {
+        }
+
+        void Disturb(UINT row, UINT col, float magnitude)
+        {
+            Current[row * Cols + col] += magnitude;
+            Current[row * Cols + col + 1] += 0.5f*magnitude;
+            Current[row * Cols + col - 1] += 0.5f*magnitude;
+            Current[(row + 1) * Cols + col] += 0.5f*magnitude;
+            Current[(row - 1) * Cols + col] += 0.5f*magnitude;
+        }
+
+        void Step(Vertex::Basic32* vertices)
+        {
+            float halfWidth = 0.5f*(Cols - 1)*Spacing;
+            float halfDepth = 0.5f*(Rows - 1)*Spacing;
+            for (UINT i = 0; i < Rows; ++i)
+            {
+                for (UINT j = 0; j < Cols; ++j)
+                {
+                    Vertex::Basic32& vertex = vertices[i * Cols + j];
+                    vertex.Pos = XMFLOAT3(-halfWidth + j*Spacing, Current[i * Cols + j], halfDepth - i*Spacing);
+                    vertex.Normal = XMFLOAT3(0.0f, 1.0f, 0.0f);
+                    vertex.Tex = XMFLOAT2((float)j / (Cols - 1), (float)i / (Rows - 1));
+                }
+            }
+            for (UINT i = 1; i < Rows - 1; ++i)
+            {
+                for (UINT j = 1; j < Cols - 1; ++j)
+                {
+                    float l = Current[i * Cols + j - 1];
+                    float r = Current[i * Cols + j + 1];
+                    float t = Current[(i - 1) * Cols + j];
+                    float b = Current[(i + 1) * Cols + j];
+                    XMVECTOR n = XMVector3Normalize(XMVectorSet(l - r, 2.0f*Spacing, b - t, 0.0f));
+                    XMStoreFloat3(&vertices[i * Cols + j].Normal, n);
+                }
+            }
+
+            for (UINT i = 1; i < Rows - 1; ++i)
+            {
+                for (UINT j = 1; j < Cols - 1; ++j)
+                {
+                    Previous[i * Cols + j] = K1*Previous[i * Cols + j] + K2*Current[i * Cols + j] +
+                        K3*(Current[(i + 1) * Cols + j] + Current[(i - 1) * Cols + j] +
+                            Current[i * Cols + j + 1] + Current[i * Cols + j - 1]);
+                }
+            }
+            Previous.swap(Current);
+        }
+
+        UINT                Rows;
+        UINT                Cols;
+        float               Spacing;
+        float               K1;
+        float               K2;
+        float               K3;
+        std::vector<float>  Previous;
+        std::vector<float>  Current;
+    };
+
+    bool Near(float a, float b, float epsilon)
+    {
+        return fabs(a - b) <= epsilon * (1.0f + fabs(b));
+    }
+
+    bool NearVertex(const Vertex::Basic32& a, const Vertex::Basic32& b)
+    {
+        return Near(a.Pos.x, b.Pos.x, 1e-5f) && Near(a.Pos.y, b.Pos.y, 1e-5f) && Near(a.Pos.z, b.Pos.z, 1e-5f) &&
+            Near(a.Normal.x, b.Normal.x, 1e-4f) && Near(a.Normal.y, b.Normal.y, 1e-4f) && Near(a.Normal.z, b.Normal.z, 1e-4f) &&
+            Near(a.Tex.x, b.Tex.x, 1e-6f) && Near(a.Tex.y, b.Tex.y, 1e-6f);
+    }
+}
+
+UINT WaveSimulation::SelfTest()
+{
+    UINT failures = 0;
+    Random random(50);
+
+    // Against the reference on grids whose interiors are no multiple of four
+    // wide, serial and parallel steps taking turns.
+    const UINT sizes[][2] = { { 5, 5 }, { 37, 29 }, { 64, 64 }, { 9, 70 } };
+    for (auto& size : sizes)
+    {
+        UINT rows = size[0], cols = size[1];
+        WaveSimulation waves;
+        waves.Init(rows, cols, 0.8f, 0.03f, 3.25f, 0.4f);
+        ReferenceWaves reference(rows, cols, 0.8f, waves.m_K1, waves.m_K2, waves.m_K3);
+
+        // One vertex more than the grid, which must stay untouched.
+        Vertex::Basic32 guard;
+        WriteVertex(guard, -7.0f, -7.0f, -7.0f, -7.0f, -7.0f, -7.0f, -7.0f, -7.0f);
+        std::vector<Vertex::Basic32> vertices(rows * cols + 1, guard);
+        std::vector<Vertex::Basic32> expected(rows * cols);
+
+        for (UINT s = 0; s < 40; ++s)
+        {
+            if (s % 5 == 0)
+            {
+                UINT row = 2 + random.NextUInt() % (rows - 4);
+                UINT col = 2 + random.NextUInt() % (cols - 4);
+                float magnitude = random.NextFloat(0.5f, 1.0f);
+                waves.Disturb(row, col, magnitude);
+                reference.Disturb(row, col, magnitude);
+            }
+
+            waves.Step(&vertices[0], s % 2 == 0);
+            reference.Step(&expected[0]);
+
+            for (UINT k = 0; k < rows * cols; ++k)
+            {
+                if (!Near(waves.m_Heights[waves.m_Current][k], reference.Current[k], 1e-5f) || !NearVertex(vertices[k], expected[k]))
+                    ++failures;
+            }
+            if (memcmp(&vertices[rows * cols], &guard, sizeof(guard)) != 0)
+                ++failures;
+
+            for (UINT j = 0; j < cols; ++j)
+                if (waves.GetHeight(0, j) != 0.0f || waves.GetHeight(rows - 1, j) != 0.0f)
+                    ++failures;
+            for (UINT i = 0; i < rows; ++i)
+                if (waves.GetHeight(i, 0) != 0.0f || waves.GetHeight(i, cols - 1) != 0.0f)
+                    ++failures;
+        }
+    }
+
+    // Serial and parallel steps are the same arithmetic, bit for bit.
+    {
+        WaveSimulation serial, parallel;
+        serial.Init(100, 67, 0.5f, 0.03f, 3.0f, 0.2f);
+        parallel.Init(100, 67, 0.5f, 0.03f, 3.0f, 0.2f);
+        std::vector<Vertex::Basic32> serialVertices(serial.GetVertexCount()), parallelVertices(parallel.GetVertexCount());
+        for (UINT s = 0; s < 30; ++s)
+        {
+            if (s % 3 == 0)
+            {
+                UINT row = 2 + random.NextUInt() % 96;
+                UINT col = 2 + random.NextUInt() % 63;
+                serial.Disturb(row, col, 1.0f);
+                parallel.Disturb(row, col, 1.0f);
+            }
+            serial.Step(&serialVertices[0], false);
+            parallel.Step(&parallelVertices[0], true);
+        }
+        if (serial.m_Heights[serial.m_Current] != parallel.m_Heights[parallel.m_Current] ||
+            memcmp(&serialVertices[0], &parallelVertices[0], serialVertices.size() * sizeof(Vertex::Basic32)) != 0)
+            ++failures;
+    }
+
+    // Damped waves stay bounded and die down.  A drop starts the surface
+    // moving as well as raising it, so the first crests rise well above it.
+    {
+        WaveSimulation waves;
+        waves.Init(48, 48, 0.8f, 0.03f, 3.25f, 0.4f);
+        waves.Disturb(24, 24, 1.0f);
+        float highest = 0.0f;
+        for (UINT s = 0; s < 2000; ++s)
+        {
+            waves.Step(nullptr, false);
+            if (s == 1500)
+                highest = 0.0f;
+            for (float h : waves.m_Heights[waves.m_Current])
+                highest = MathHelper::Max(highest, fabsf(h));
+            if (!(highest < 8.0f))
+                break;
+        }
+        if (!(highest < 0.01f))
+            ++failures;
+    }
+
+    // Every cell is two triangles facing up.
+    {
+        WaveSimulation waves;
+        waves.Init(6, 9, 1.0f, 0.03f, 3.25f, 0.4f);
+        std::vector<Vertex::Basic32> vertices(waves.GetVertexCount());
+        waves.Step(&vertices[0], false);
+
+        std::vector<UINT> indices;
+        waves.BuildIndices(indices);
+        if (indices.size() != 6 * 5 * 8)
+            ++failures;
+        for (UINT t = 0; t + 2 < indices.size(); t += 3)
+        {
+            if (indices[t] >= vertices.size() || indices[t + 1] >= vertices.size() || indices[t + 2] >= vertices.size())
+            {
+                ++failures;
+                continue;
+            }
+            XMVECTOR p0 = XMLoadFloat3(&vertices[indices[t]].Pos);
+            XMVECTOR p1 = XMLoadFloat3(&vertices[indices[t + 1]].Pos);
+            XMVECTOR p2 = XMLoadFloat3(&vertices[indices[t + 2]].Pos);
+            if (XMVectorGetY(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0))) <= 0.0f)
+                ++failures;
+        }
+    }
+
+    return failures;
+}
+
+WaveSimulation::BenchmarkResult WaveSimulation::Benchmark(UINT size, UINT steps)
+{
+    BenchmarkResult result;
+    result.Size = size;
+    result.Steps = steps;
+
+    // The same spacing and drops as the lake, so the waves cover the grid alike at every size.
+    const float spacing = 0.8f;
+    std::vector<Vertex::Basic32> vertices(size * size);
+
+    WaveSimulation waves;
+    waves.Init(size, size, spacing, 0.03f, 3.25f, 0.4f);
+    ReferenceWaves reference(size, size, spacing, waves.m_K1, waves.m_K2, waves.m_K3);
+
+    Random random(size);
+    std::vector<UINT> drops(2 * steps);
+    for (auto& drop : drops)
+        drop = 2 + random.NextUInt() % (size - 4);
+
+    double start = GameTimer::NowMs();
+    for (UINT s = 0; s < steps; ++s)
+    {
+        if (s % 4 == 0)
+            reference.Disturb(drops[2 * s], drops[2 * s + 1], 1.0f);
+        reference.Step(&vertices[0]);
+    }
+    result.ScalarMs = (GameTimer::NowMs() - start) / steps;
+
+    const bool parallel[] = { false, true };
+    double* times[] = { &result.SimdMs, &result.ParallelMs };
+    for (UINT p = 0; p < 2; ++p)
+    {
+        waves.Init(size, size, spacing, 0.03f, 3.25f, 0.4f);
+        start = GameTimer::NowMs();
+        for (UINT s = 0; s < steps; ++s)
+        {
+            if (s % 4 == 0)
+                waves.Disturb(drops[2 * s], drops[2 * s + 1], 1.0f);
+            waves.Step(&vertices[0], parallel[p]);
+        }
+        *times[p] = (GameTimer::NowMs() - start) / steps;
+    }
+
+    return result;
+}
+#pragma endregion
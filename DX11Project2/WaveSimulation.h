@@ -0,0 +1,96 @@
+//***************************************************************************************
+// WaveSimulation.h
+//
+// Water waves on the CPU: the damped wave equation on a grid of heights,
+// solved with finite differences as in Luna's Waves demo.  The heights are
+// kept as two plain float arrays, the current and the previous step; a step
+// writes the next heights over the previous ones and the two swap.
+//
+// A step works four columns at a time with XNA Math and splits the rows over
+// tasks; every row reads only the current heights, so rows never wait on each
+// other.  While the current heights around a vertex are at hand, the same pass
+// writes the vertex of the surface as it stood before the step: position,
+// normal from the central differences and texture coordinates.  The vertices
+// thus lag the heights by one step, which no one can see.
+//
+// The boundary vertices stay at height 0.  The grid is centred on the origin
+// of the xz plane, rows running towards -z and columns towards +x.
+//***************************************************************************************
+
+#ifndef WAVESIMULATION_H
+#define WAVESIMULATION_H
+
+#include "Vertex.h"
+
+class WaveSimulation
+{
+public:
+    struct BenchmarkResult
+    {
+        UINT    Size;           // vertices along each side
+        UINT    Steps;
+        double  ScalarMs;       // per step: one vertex at a time, normals in a pass of their own
+        double  SimdMs;         // per step: Step on the calling thread only
+        double  ParallelMs;     // per step: Step with the rows split over tasks
+    };
+
+public:
+    WaveSimulation();
+
+    // A grid of 'rows' x 'cols' vertices 'spacing' apart, advanced 'timeStep'
+    // seconds per step.  Waves travel at 'speed' and die out faster the higher
+    // 'damping' is.  Starts flat.
+    void    Init(UINT rows, UINT cols, float spacing, float timeStep, float speed, float damping);
+
+    UINT    GetRows() const                 { return m_Rows; }
+    UINT    GetCols() const                 { return m_Cols; }
+    UINT    GetVertexCount() const          { return m_Rows * m_Cols; }
+    float   GetWidth() const                { return (m_Cols - 1) * m_Spacing; }
+    float   GetDepth() const                { return (m_Rows - 1) * m_Spacing; }
+    float   GetTimeStep() const             { return m_TimeStep; }
+    float   GetHeight(UINT row, UINT col) const { return m_Heights[m_Current][row * m_Cols + col]; }
+
+    // Raises the vertex at 'row', 'col' by 'magnitude' and its four neighbours
+    // by half of it.  The vertex has to be two or more rows and columns inside
+    // the boundary.
+    void    Disturb(UINT row, UINT col, float magnitude);
+
+    // Advances the heights one step.  With 'vertices', GetVertexCount of them,
+    // also writes the surface as it was before the step.  'parallel' splits the
+    // rows over tasks.
+    void    Step(Vertex::Basic32* vertices, bool parallel = true);
+
+    // The two triangles of every cell, for a triangle list over the vertices Step writes.
+    void    BuildIndices(std::vector<UINT>& indices) const;
+
+    // Checks Step against the scalar solver, serial against parallel, that the
+    // boundary stays still and that damped waves die down.  Returns the number
+    // of failures.
+    static UINT             SelfTest();
+
+    // Times 'steps' steps of a 'size' x 'size' grid with a drop every few steps.
+    static BenchmarkResult  Benchmark(UINT size, UINT steps);
+
+private:
+    // Rows are handed to tasks in blocks of this many.
+    static const UINT RowsPerTask = 16;
+
+    // Steps the rows 'first' to 'last' - 1.
+    void    StepRows(UINT first, UINT last, Vertex::Basic32* vertices);
+
+private:
+    UINT                m_Rows;
+    UINT                m_Cols;
+    float               m_Spacing;
+    float               m_TimeStep;
+
+    // next = K1*previous + K2*current + K3*(sum of the four neighbours)
+    float               m_K1;
+    float               m_K2;
+    float               m_K3;
+
+    std::vector<float>  m_Heights[2];       // row major
+    UINT                m_Current;          // index of the current heights
+};
+
+#endif // WAVESIMULATION_H
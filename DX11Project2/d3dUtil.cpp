@@ -3,13 +3,15 @@
 //***************************************************************************************
 
 #include "d3dUtil.h"
+#include "AssetArchive.h"
 
 ID3D11ShaderResourceView* d3dHelper::CreateTexture2DArraySRV(
 		ID3D11Device* device, ID3D11DeviceContext* context,
 		std::vector<std::wstring>& filenames,
 		DXGI_FORMAT format,
 		UINT filter, 
-		UINT mipFilter)
+		UINT mipFilter,
+		UINT mipLevels)
 {
 	//
 	// Load the texture elements individually from file.  These textures
@@ -29,7 +31,7 @@ ID3D11ShaderResourceView* d3dHelper::CreateTexture2DArraySRV(
         loadInfo.Height = D3DX11_FROM_FILE;
         loadInfo.Depth  = D3DX11_FROM_FILE;
         loadInfo.FirstMipLevel = 0;
-        loadInfo.MipLevels = D3DX11_FROM_FILE;
+        loadInfo.MipLevels = mipLevels;
         loadInfo.Usage = D3D11_USAGE_STAGING;
         loadInfo.BindFlags = 0;
         loadInfo.CpuAccessFlags = D3D11_CPU_ACCESS_WRITE | D3D11_CPU_ACCESS_READ;
@@ -39,7 +41,9 @@ ID3D11ShaderResourceView* d3dHelper::CreateTexture2DArraySRV(
         loadInfo.MipFilter = mipFilter;
 		loadInfo.pSrcInfo  = 0;
 
-        HR(D3DX11CreateTextureFromFile(device, filenames[i].c_str(), 
+		AssetArchive::Asset file;
+		AssetArchive::getInstance()->Load(filenames[i], file);
+        HR(D3DX11CreateTextureFromMemory(device, file.Data, file.Size, 
 			&loadInfo, 0, (ID3D11Resource**)&srcTex[i], 0));
 	}
 
@@ -68,23 +72,25 @@ ID3D11ShaderResourceView* d3dHelper::CreateTexture2DArraySRV(
 	HR(device->CreateTexture2D( &texArrayDesc, 0, &texArray));
 
 	//
-	// Copy individual texture elements into texture array.
+	// Copy individual texture elements into texture array.  A GPU copy
+	// moves whole blocks, so layers already compressed to a BC format
+	// (see TextureCompressor) go in as they are.
 	//
 
 	// for each texture element...
 	for(UINT texElement = 0; texElement < size; ++texElement)
 	{
+		D3D11_TEXTURE2D_DESC elementDesc;
+		srcTex[texElement]->GetDesc(&elementDesc);
+		assert(elementDesc.Width == texElementDesc.Width && elementDesc.Height == texElementDesc.Height &&
+			elementDesc.MipLevels == texElementDesc.MipLevels && elementDesc.Format == texElementDesc.Format);
+
 		// for each mipmap level...
 		for(UINT mipLevel = 0; mipLevel < texElementDesc.MipLevels; ++mipLevel)
 		{
-			D3D11_MAPPED_SUBRESOURCE mappedTex2D;
-			HR(context->Map(srcTex[texElement], mipLevel, D3D11_MAP_READ, 0, &mappedTex2D));
-
-			context->UpdateSubresource(texArray, 
+			context->CopySubresourceRegion(texArray, 
 				D3D11CalcSubresource(mipLevel, texElement, texElementDesc.MipLevels),
-				0, mappedTex2D.pData, mappedTex2D.RowPitch, mappedTex2D.DepthPitch);
-
-			context->Unmap(srcTex[texElement], mipLevel);
+				0, 0, 0, srcTex[texElement], mipLevel, 0);
 		}
 	}	
 
@@ -122,13 +128,7 @@ ID3D11ShaderResourceView* d3dHelper::CreateRandomTexture1DSRV(ID3D11Device* devi
 	//
 	XMFLOAT4 randomValues[1024];
 
-	for(int i = 0; i < 1024; ++i)
-	{
-		randomValues[i].x = MathHelper::RandF(-1.0f, 1.0f);
-		randomValues[i].y = MathHelper::RandF(-1.0f, 1.0f);
-		randomValues[i].z = MathHelper::RandF(-1.0f, 1.0f);
-		randomValues[i].w = MathHelper::RandF(-1.0f, 1.0f);
-	}
+	Random::ForThread().FillFloats(&randomValues[0].x, 4*1024, -1.0f, 1.0f);
 
     D3D11_SUBRESOURCE_DATA initData;
     initData.pSysMem = randomValues;
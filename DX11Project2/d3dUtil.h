@@ -27,10 +27,14 @@
 #pragma comment( lib, "dxerr.lib" )
 #pragma comment( lib, "dxgi.lib" )
 #pragma comment( lib, "d3d11.lib" )
-#pragma comment( lib, "d3dx11d.lib" )
 #pragma comment( lib, "d3dcompiler.lib" )
+#if defined(DEBUG) | defined(_DEBUG)
+#pragma comment( lib, "d3dx11d.lib" )
 #pragma comment( lib, "Effects11d.lib" )
-//#pragma comment( lib, "Effects11.lib" )
+#else
+#pragma comment( lib, "d3dx11.lib" )
+#pragma comment( lib, "Effects11.lib" )
+#endif
 
 //---------------------------------------------------------------------------------------
 // Simple d3d error checker for book demos.
@@ -76,14 +80,17 @@ class d3dHelper
 public:
 	///<summary>
 	/// 
-	/// Does not work with compressed formats.
+	/// Every file must have the same size, mip count and format.  Block
+	/// compressed DDS files work when loaded with DXGI_FORMAT_FROM_FILE.
+	/// mipLevels other than D3DX11_FROM_FILE has D3DX build that many levels.
 	///</summary>
 	static ID3D11ShaderResourceView* CreateTexture2DArraySRV(
 		ID3D11Device* device, ID3D11DeviceContext* context,
 		std::vector<std::wstring>& filenames,
 		DXGI_FORMAT format = DXGI_FORMAT_FROM_FILE,
 		UINT filter = D3DX11_FILTER_NONE, 
-		UINT mipFilter = D3DX11_FILTER_LINEAR);
+		UINT mipFilter = D3DX11_FILTER_LINEAR,
+		UINT mipLevels = D3DX11_FROM_FILE);
 
 	static ID3D11ShaderResourceView* CreateRandomTexture1DSRV(ID3D11Device* device);
 };